@@ -27,6 +27,7 @@ int cmd_disable_region(int argc, const char **argv, struct cxl_ctx *ctx);
 int cmd_destroy_region(int argc, const char **argv, struct cxl_ctx *ctx);
 #ifdef ENABLE_LIBTRACEFS
 int cmd_monitor(int argc, const char **argv, struct cxl_ctx *ctx);
+int cmd_decode_log(int argc, const char **argv, struct cxl_ctx *ctx);
 #else
 static inline int cmd_monitor(int argc, const char **argv, struct cxl_ctx *ctx)
 {
@@ -34,5 +35,13 @@ static inline int cmd_monitor(int argc, const char **argv, struct cxl_ctx *ctx)
 		"cxl monitor: unavailable, rebuild with '-Dlibtracefs=enabled'\n");
 	return EXIT_FAILURE;
 }
+
+static inline int cmd_decode_log(int argc, const char **argv,
+				 struct cxl_ctx *ctx)
+{
+	fprintf(stderr,
+		"cxl decode-log: unavailable, rebuild with '-Dlibtracefs=enabled'\n");
+	return EXIT_FAILURE;
+}
 #endif
 #endif /* _CXL_BUILTIN_H_ */
@@ -855,6 +855,42 @@ walk_children:
 	}
 }
 
+static bool walk_endpoint_selected(struct cxl_endpoint *endpoint,
+				   struct cxl_filter_params *p)
+{
+	struct cxl_port *ep_port = cxl_endpoint_get_port(endpoint);
+
+	if (!util_cxl_endpoint_filter(endpoint, p->endpoint_filter))
+		return false;
+	if (!util_cxl_port_filter_by_bus(ep_port, p->bus_filter))
+		return false;
+	if (!util_cxl_endpoint_filter_by_port(endpoint, p->port_filter,
+					      pf_mode(p)))
+		return false;
+	if (!util_cxl_endpoint_filter_by_memdev(endpoint, p->memdev_filter,
+						p->serial_filter))
+		return false;
+	if (!p->idle && !cxl_endpoint_is_enabled(endpoint))
+		return false;
+	return true;
+}
+
+static bool walk_endpoint_memdev_selected(struct cxl_memdev *memdev,
+					  struct cxl_filter_params *p)
+{
+	if (!util_cxl_memdev_filter(memdev, p->memdev_filter,
+				    p->serial_filter))
+		return false;
+	if (!util_cxl_memdev_filter_by_decoder(memdev, p->decoder_filter))
+		return false;
+	if (!util_cxl_memdev_filter_by_port(memdev, p->bus_filter,
+					    p->port_filter))
+		return false;
+	if (!p->idle && !cxl_memdev_is_enabled(memdev))
+		return false;
+	return true;
+}
+
 static void walk_endpoints(struct cxl_port *port, struct cxl_filter_params *p,
 			   struct json_object *jeps, struct json_object *jdevs,
 			   struct json_object *jdecoders, unsigned long flags)
@@ -862,23 +898,12 @@ static void walk_endpoints(struct cxl_port *port, struct cxl_filter_params *p,
 	struct cxl_endpoint *endpoint;
 
 	cxl_endpoint_foreach(port, endpoint) {
-		struct cxl_port *ep_port = cxl_endpoint_get_port(endpoint);
 		const char *devname = cxl_endpoint_get_devname(endpoint);
 		struct json_object *jchilddecoders = NULL;
 		struct json_object *jendpoint = NULL;
 		struct cxl_memdev *memdev;
 
-		if (!util_cxl_endpoint_filter(endpoint, p->endpoint_filter))
-			continue;
-		if (!util_cxl_port_filter_by_bus(ep_port, p->bus_filter))
-			continue;
-		if (!util_cxl_endpoint_filter_by_port(endpoint, p->port_filter,
-						      pf_mode(p)))
-			continue;
-		if (!util_cxl_endpoint_filter_by_memdev(
-			    endpoint, p->memdev_filter, p->serial_filter))
-			continue;
-		if (!p->idle && !cxl_endpoint_is_enabled(endpoint))
+		if (!walk_endpoint_selected(endpoint, p))
 			continue;
 		if (p->endpoints) {
 			jendpoint = util_cxl_endpoint_to_json(endpoint, flags);
@@ -894,16 +919,7 @@ static void walk_endpoints(struct cxl_port *port, struct cxl_filter_params *p,
 			memdev = cxl_endpoint_get_memdev(endpoint);
 			if (!memdev)
 				continue;
-			if (!util_cxl_memdev_filter(memdev, p->memdev_filter,
-						    p->serial_filter))
-				continue;
-			if (!util_cxl_memdev_filter_by_decoder(
-				    memdev, p->decoder_filter))
-				continue;
-			if (!util_cxl_memdev_filter_by_port(
-				    memdev, p->bus_filter, p->port_filter))
-				continue;
-			if (!p->idle && !cxl_memdev_is_enabled(memdev))
+			if (!walk_endpoint_memdev_selected(memdev, p))
 				continue;
 			jobj = util_cxl_memdev_to_json(memdev, flags);
 			if (!jobj) {
@@ -1035,6 +1051,69 @@ walk_children:
 	}
 }
 
+static bool walk_anon_memdev_selected(struct cxl_memdev *memdev,
+				      struct cxl_filter_params *p)
+{
+	if (!util_cxl_memdev_filter(memdev, p->memdev_filter,
+				    p->serial_filter))
+		return false;
+	if (cxl_memdev_is_enabled(memdev))
+		return false;
+	return p->idle;
+}
+
+/* would the walk below list @memdev, anonymous or under its endpoint? */
+static bool walk_memdev_selected(struct cxl_memdev *memdev,
+				 struct cxl_filter_params *p)
+{
+	struct cxl_endpoint *endpoint;
+
+	if (!cxl_memdev_is_enabled(memdev))
+		return walk_anon_memdev_selected(memdev, p);
+
+	endpoint = cxl_memdev_get_endpoint(memdev);
+	if (!endpoint || !walk_endpoint_selected(endpoint, p))
+		return false;
+	return walk_endpoint_memdev_selected(memdev, p);
+}
+
+/*
+ * Issue the mailbox commands for every memdev the walk below is going
+ * to list up front, @p->jobs memdevs at a time, so that the walk only
+ * formats results.
+ */
+static void walk_prefetch(struct cxl_ctx *ctx, struct cxl_filter_params *p,
+			  unsigned long flags)
+{
+	struct cxl_memdev *memdev, **memdevs = NULL;
+	int count = 0, alloc = 0;
+
+	if (!p->memdevs || p->jobs <= 1)
+		return;
+
+	cxl_memdev_foreach(ctx, memdev) {
+		if (!walk_memdev_selected(memdev, p))
+			continue;
+
+		if (count == alloc) {
+			struct cxl_memdev **tmp;
+
+			alloc = alloc ? alloc * 2 : 16;
+			tmp = realloc(memdevs, alloc * sizeof(*memdevs));
+			if (!tmp) {
+				free(memdevs);
+				return;
+			}
+			memdevs = tmp;
+		}
+		memdevs[count++] = memdev;
+	}
+
+	dbg(p, "prefetch %d memdevs, %d jobs\n", count, p->jobs);
+	util_cxl_memdevs_prefetch(memdevs, count, flags, p->jobs);
+	free(memdevs);
+}
+
 struct json_object *cxl_filter_walk(struct cxl_ctx *ctx,
 				    struct cxl_filter_params *p)
 {
@@ -1092,16 +1171,13 @@ struct json_object *cxl_filter_walk(struct cxl_ctx *ctx,
 	if (!jregions)
 		goto err;
 
+	walk_prefetch(ctx, p, flags);
+
 	dbg(p, "walk memdevs\n");
 	cxl_memdev_foreach(ctx, memdev) {
 		struct json_object *janondev;
 
-		if (!util_cxl_memdev_filter(memdev, p->memdev_filter,
-					    p->serial_filter))
-			continue;
-		if (cxl_memdev_is_enabled(memdev))
-			continue;
-		if (!p->idle)
+		if (!walk_anon_memdev_selected(memdev, p))
 			continue;
 		if (p->memdevs) {
 			janondev = util_cxl_memdev_to_json(memdev, flags);
@@ -1249,8 +1325,10 @@ walk_children:
 		     top_level_objs > 1);
 	splice_array(p, jregions, jplatform, "regions", top_level_objs > 1);
 
+	util_cxl_mbox_cache_free();
 	return jplatform;
 err:
+	util_cxl_mbox_cache_free();
 	json_object_put(janondevs);
 	json_object_put(jbuses);
 	json_object_put(jports);
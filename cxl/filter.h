@@ -32,6 +32,7 @@ struct cxl_filter_params {
 	bool dax;
 	bool media_errors;
 	int verbose;
+	int jobs;
 	struct log_ctx ctx;
 };
 
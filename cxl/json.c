@@ -2,6 +2,9 @@
 // Copyright (C) 2015-2021 Intel Corporation. All rights reserved.
 #include <limits.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
 #include <util/json.h>
 #include <util/bitmap.h>
 #include <uuid/uuid.h>
@@ -19,6 +22,184 @@
 #define CXL_FW_VERSION_STR_LEN	16
 #define CXL_FW_MAX_SLOTS	4
 
+enum cxl_mbox_kind {
+	CXL_MBOX_FW,
+	CXL_MBOX_HEALTH,
+	CXL_MBOX_ALERT_CONFIG,
+	CXL_MBOX_IDENTIFY,
+	CXL_MBOX_PARTITION,
+	CXL_MBOX_MAX,
+};
+
+/*
+ * Mailbox results gathered ahead of the JSON walk by
+ * util_cxl_memdevs_prefetch(). Each command is handed out once, a
+ * memdev that was not prefetched (or whose prefetch failed) has its
+ * command submitted on demand.
+ */
+struct cxl_mbox_ent {
+	struct cxl_memdev *memdev;
+	struct cxl_cmd *cmd[CXL_MBOX_MAX];
+};
+
+static struct cxl_mbox_cache {
+	struct cxl_mbox_ent *ent;
+	int count;
+	unsigned long flags;
+	int next;
+} mbox_cache;
+
+static struct cxl_cmd *cxl_mbox_submit(struct cxl_memdev *memdev,
+		enum cxl_mbox_kind kind)
+{
+	struct cxl_cmd *cmd;
+
+	switch (kind) {
+	case CXL_MBOX_FW:
+		cmd = cxl_cmd_new_get_fw_info(memdev);
+		break;
+	case CXL_MBOX_HEALTH:
+		cmd = cxl_cmd_new_get_health_info(memdev);
+		break;
+	case CXL_MBOX_ALERT_CONFIG:
+		cmd = cxl_cmd_new_get_alert_config(memdev);
+		break;
+	case CXL_MBOX_IDENTIFY:
+		cmd = cxl_cmd_new_identify(memdev);
+		break;
+	case CXL_MBOX_PARTITION:
+		cmd = cxl_cmd_new_get_partition(memdev);
+		break;
+	default:
+		return NULL;
+	}
+	if (!cmd)
+		return NULL;
+
+	if (cxl_cmd_submit(cmd) < 0 || cxl_cmd_get_mbox_status(cmd) != 0) {
+		cxl_cmd_unref(cmd);
+		return NULL;
+	}
+	return cmd;
+}
+
+/* return a successfully completed @kind command for @memdev, or NULL */
+static struct cxl_cmd *util_cxl_memdev_mbox(struct cxl_memdev *memdev,
+		enum cxl_mbox_kind kind)
+{
+	struct cxl_cmd *cmd;
+	int i;
+
+	for (i = 0; i < mbox_cache.count; i++) {
+		struct cxl_mbox_ent *ent = &mbox_cache.ent[i];
+
+		if (ent->memdev != memdev)
+			continue;
+		cmd = ent->cmd[kind];
+		ent->cmd[kind] = NULL;
+		if (cmd)
+			return cmd;
+		break;
+	}
+
+	return cxl_mbox_submit(memdev, kind);
+}
+
+static void cxl_mbox_prefetch_one(struct cxl_mbox_ent *ent,
+		unsigned long flags)
+{
+	struct cxl_memdev *memdev = ent->memdev;
+
+	if (flags & UTIL_JSON_HEALTH)
+		ent->cmd[CXL_MBOX_HEALTH] =
+			cxl_mbox_submit(memdev, CXL_MBOX_HEALTH);
+	if (flags & UTIL_JSON_ALERT_CONFIG)
+		ent->cmd[CXL_MBOX_ALERT_CONFIG] =
+			cxl_mbox_submit(memdev, CXL_MBOX_ALERT_CONFIG);
+	if (flags & UTIL_JSON_PARTITION) {
+		struct cxl_cmd *cmd = cxl_mbox_submit(memdev,
+						      CXL_MBOX_IDENTIFY);
+
+		ent->cmd[CXL_MBOX_IDENTIFY] = cmd;
+		/* same condition as util_cxl_memdev_partition_to_json() */
+		if (cmd && cxl_cmd_identify_get_partition_align(cmd))
+			ent->cmd[CXL_MBOX_PARTITION] =
+				cxl_mbox_submit(memdev, CXL_MBOX_PARTITION);
+	}
+	if (flags & UTIL_JSON_FIRMWARE)
+		ent->cmd[CXL_MBOX_FW] = cxl_mbox_submit(memdev, CXL_MBOX_FW);
+}
+
+static void *cxl_mbox_prefetch_worker(void *arg)
+{
+	struct cxl_mbox_cache *cache = arg;
+	int i;
+
+	/*
+	 * Each memdev is claimed by exactly one worker, so the commands
+	 * and cached fd of a memdev are only used by one thread. The
+	 * state shared between memdevs, the context's log function and
+	 * the lock that guards opening the memdev fds, is safe to use
+	 * concurrently.
+	 */
+	for (;;) {
+		i = __atomic_fetch_add(&cache->next, 1, __ATOMIC_RELAXED);
+		if (i >= cache->count)
+			break;
+		cxl_mbox_prefetch_one(&cache->ent[i], cache->flags);
+	}
+	return NULL;
+}
+
+void util_cxl_memdevs_prefetch(struct cxl_memdev **memdevs, int count,
+		unsigned long flags, int jobs)
+{
+	pthread_t *threads;
+	int i, started = 0;
+
+	if (!(flags & (UTIL_JSON_HEALTH | UTIL_JSON_ALERT_CONFIG
+			| UTIL_JSON_PARTITION | UTIL_JSON_FIRMWARE)))
+		return;
+	if (jobs > count)
+		jobs = count;
+	if (jobs <= 1)
+		return;
+
+	util_cxl_mbox_cache_free();
+	mbox_cache.ent = calloc(count, sizeof(*mbox_cache.ent));
+	if (!mbox_cache.ent)
+		return;
+	for (i = 0; i < count; i++)
+		mbox_cache.ent[i].memdev = memdevs[i];
+	mbox_cache.count = count;
+	mbox_cache.flags = flags;
+	mbox_cache.next = 0;
+
+	/* the calling thread is one of the workers */
+	threads = calloc(jobs - 1, sizeof(*threads));
+	if (threads)
+		for (; started < jobs - 1; started++)
+			if (pthread_create(&threads[started], NULL,
+					   cxl_mbox_prefetch_worker,
+					   &mbox_cache) != 0)
+				break;
+	cxl_mbox_prefetch_worker(&mbox_cache);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+}
+
+void util_cxl_mbox_cache_free(void)
+{
+	int i, j;
+
+	for (i = 0; i < mbox_cache.count; i++)
+		for (j = 0; j < CXL_MBOX_MAX; j++)
+			cxl_cmd_unref(mbox_cache.ent[i].cmd[j]);
+	free(mbox_cache.ent);
+	memset(&mbox_cache, 0, sizeof(mbox_cache));
+}
+
 static struct json_object *util_cxl_memdev_fw_to_json(
 		struct cxl_memdev *memdev, unsigned long flags)
 {
@@ -35,17 +216,10 @@ static struct json_object *util_cxl_memdev_fw_to_json(
 	if (!memdev)
 		goto err_jobj;
 
-	cmd = cxl_cmd_new_get_fw_info(memdev);
+	cmd = util_cxl_memdev_mbox(memdev, CXL_MBOX_FW);
 	if (!cmd)
 		goto err_jobj;
 
-	rc = cxl_cmd_submit(cmd);
-	if (rc < 0)
-		goto err_cmd;
-	rc = cxl_cmd_get_mbox_status(cmd);
-	if (rc != 0)
-		goto err_cmd;
-
 	/* fw_info fields */
 	num_slots = cxl_cmd_fw_info_get_num_slots(cmd);
 	jobj = json_object_new_int(num_slots);
@@ -99,8 +273,6 @@ static struct json_object *util_cxl_memdev_fw_to_json(
 	cxl_cmd_unref(cmd);
 	return jfw;
 
-err_cmd:
-	cxl_cmd_unref(cmd);
 err_jobj:
 	json_object_put(jfw);
 	return NULL;
@@ -122,17 +294,10 @@ static struct json_object *util_cxl_memdev_health_to_json(
 	if (!memdev)
 		goto err_jobj;
 
-	cmd = cxl_cmd_new_get_health_info(memdev);
+	cmd = util_cxl_memdev_mbox(memdev, CXL_MBOX_HEALTH);
 	if (!cmd)
 		goto err_jobj;
 
-	rc = cxl_cmd_submit(cmd);
-	if (rc < 0)
-		goto err_cmd;
-	rc = cxl_cmd_get_mbox_status(cmd);
-	if (rc != 0)
-		goto err_cmd;
-
 	/* health_status fields */
 	rc = cxl_cmd_health_info_get_maintenance_needed(cmd);
 	jobj = json_object_new_boolean(rc);
@@ -274,8 +439,6 @@ static struct json_object *util_cxl_memdev_health_to_json(
 	cxl_cmd_unref(cmd);
 	return jhealth;
 
-err_cmd:
-	cxl_cmd_unref(cmd);
 err_jobj:
 	json_object_put(jhealth);
 	return NULL;
@@ -296,17 +459,10 @@ util_cxl_memdev_alert_config_to_json(struct cxl_memdev *memdev,
 	if (!memdev)
 		goto err_jobj;
 
-	cmd = cxl_cmd_new_get_alert_config(memdev);
+	cmd = util_cxl_memdev_mbox(memdev, CXL_MBOX_ALERT_CONFIG);
 	if (!cmd)
 		goto err_jobj;
 
-	rc = cxl_cmd_submit(cmd);
-	if (rc < 0)
-		goto err_cmd;
-	rc = cxl_cmd_get_mbox_status(cmd);
-	if (rc != 0)
-		goto err_cmd;
-
 	rc = cxl_cmd_alert_config_life_used_prog_warn_threshold_valid(cmd);
 	jobj = json_object_new_boolean(rc);
 	if (jobj)
@@ -453,8 +609,6 @@ util_cxl_memdev_alert_config_to_json(struct cxl_memdev *memdev,
 	cxl_cmd_unref(cmd);
 	return jalert_config;
 
-err_cmd:
-	cxl_cmd_unref(cmd);
 err_jobj:
 	json_object_put(jalert_config);
 	return NULL;
@@ -471,7 +625,6 @@ static struct json_object *util_cxl_memdev_partition_to_json(struct cxl_memdev *
 	struct json_object *jpart;
 	unsigned long long cap;
 	struct cxl_cmd *cmd;
-	int rc;
 
 	jpart = json_object_new_object();
 	if (!jpart)
@@ -480,17 +633,10 @@ static struct json_object *util_cxl_memdev_partition_to_json(struct cxl_memdev *
 		goto err_jobj;
 
 	/* Retrieve partition info in the IDENTIFY mbox cmd */
-	cmd = cxl_cmd_new_identify(memdev);
+	cmd = util_cxl_memdev_mbox(memdev, CXL_MBOX_IDENTIFY);
 	if (!cmd)
 		goto err_jobj;
 
-	rc = cxl_cmd_submit(cmd);
-	if (rc < 0)
-		goto err_identify;
-	rc = cxl_cmd_get_mbox_status(cmd);
-	if (rc != 0)
-		goto err_identify;
-
 	cap = cxl_cmd_identify_get_total_size(cmd);
 	if (cap != ULLONG_MAX) {
 		jobj = util_json_object_size(cap, flags);
@@ -523,17 +669,10 @@ static struct json_object *util_cxl_memdev_partition_to_json(struct cxl_memdev *
 		return jpart;
 
 	/* Retrieve partition info in GET_PARTITION_INFO mbox cmd */
-	cmd = cxl_cmd_new_get_partition(memdev);
+	cmd = util_cxl_memdev_mbox(memdev, CXL_MBOX_PARTITION);
 	if (!cmd)
 		return jpart;
 
-	rc = cxl_cmd_submit(cmd);
-	if (rc < 0)
-		goto err_get;
-	rc = cxl_cmd_get_mbox_status(cmd);
-	if (rc != 0)
-		goto err_get;
-
 	cap = cxl_cmd_partition_get_active_volatile_size(cmd);
 	if (cap != ULLONG_MAX) {
 		jobj = util_json_object_size(cap, flags);
@@ -563,13 +702,9 @@ static struct json_object *util_cxl_memdev_partition_to_json(struct cxl_memdev *
 					"next_persistent_size", jobj);
 	}
 
-err_get:
 	cxl_cmd_unref(cmd);
 	return jpart;
 
-err_identify:
-	cxl_cmd_unref(cmd);
-
 err_jobj:
 	json_object_put(jpart);
 	return NULL;
@@ -5,6 +5,9 @@
 struct cxl_memdev;
 struct json_object *util_cxl_memdev_to_json(struct cxl_memdev *memdev,
 		unsigned long flags);
+void util_cxl_memdevs_prefetch(struct cxl_memdev **memdevs, int count,
+		unsigned long flags, int jobs);
+void util_cxl_mbox_cache_free(void);
 struct cxl_bus;
 struct json_object *util_cxl_bus_to_json(struct cxl_bus *bus,
 					 unsigned long flags);
@@ -5,6 +5,8 @@
 #include <errno.h>
 #include <limits.h>
 #include <libgen.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <dirent.h>
 #include <unistd.h>
@@ -38,6 +40,9 @@
  * the context by dropping the reference count to zero with
  * cxl_unref(), or take additional references with cxl_ref()
  * @timeout: default library timeout in milliseconds
+ * @enum_jobs: threads used to enumerate sibling ports, see cxl_set_enum_jobs()
+ * @probe_settled: set while sibling ports are enumerated in parallel, see
+ *		   cxl_port_enum_siblings()
  */
 struct cxl_ctx {
 	/* log_ctx must be first member for cxl_set_log_fn compat */
@@ -47,6 +52,10 @@ struct cxl_ctx {
 	int memdevs_init;
 	int buses_init;
 	unsigned long timeout;
+	int enum_jobs;
+	int probe_settled;
+	/* guards opening and closing the cached memdev ctl_fd */
+	pthread_mutex_t ctl_lock;
 	struct udev *udev;
 	struct udev_queue *udev_queue;
 	struct list_head memdevs;
@@ -77,6 +86,29 @@ static void free_fwl(struct cxl_fw_loader *fwl)
 	}
 }
 
+static void free_cmd(struct cxl_cmd *cmd)
+{
+	free(cmd->query_cmd);
+	free(cmd->send_cmd);
+	free(cmd->input_payload);
+	free(cmd->output_payload);
+	free(cmd);
+}
+
+static void free_cmd_pool(struct cxl_memdev *memdev)
+{
+	struct cxl_ctx *ctx = memdev->ctx;
+	struct cxl_cmd *cmd, *_c;
+
+	pthread_mutex_lock(&ctx->ctl_lock);
+	list_for_each_safe(&memdev->cmd_pool, cmd, _c, list) {
+		list_del_from(&memdev->cmd_pool, &cmd->list);
+		free_cmd(cmd);
+	}
+	memdev->cmd_pool_len = 0;
+	pthread_mutex_unlock(&ctx->ctl_lock);
+}
+
 static void free_memdev(struct cxl_memdev *memdev, struct list_head *head)
 {
 	if (head)
@@ -84,6 +116,10 @@ static void free_memdev(struct cxl_memdev *memdev, struct list_head *head)
 	kmod_module_unref(memdev->module);
 	free_pmem(memdev->pmem);
 	free_fwl(memdev->fwl);
+	free_cmd_pool(memdev);
+	if (memdev->ctl_fd > -1)
+		close(memdev->ctl_fd);
+	free(memdev->query_cmd);
 	free(memdev->firmware_version);
 	free(memdev->dev_buf);
 	free(memdev->dev_path);
@@ -239,6 +275,30 @@ CXL_EXPORT void *cxl_get_private_data(struct cxl_ctx *ctx)
 	return ctx->private_data;
 }
 
+/**
+ * cxl_set_enum_jobs - set the number of threads used to enumerate ports
+ * @ctx: cxl library context
+ * @jobs: thread count, 1 (the default) enumerates sequentially
+ *
+ * With @jobs > 1, the first lookup of the child ports or decoders of a
+ * port populates those of all its sibling ports in parallel. Object
+ * lists keep the same order as with sequential enumeration. The log
+ * function set with cxl_set_log_fn() is then also called from the
+ * enumeration threads, and must be safe to call concurrently.
+ */
+CXL_EXPORT int cxl_set_enum_jobs(struct cxl_ctx *ctx, int jobs)
+{
+	if (jobs < 1)
+		return -EINVAL;
+	ctx->enum_jobs = jobs;
+	return 0;
+}
+
+CXL_EXPORT int cxl_get_enum_jobs(struct cxl_ctx *ctx)
+{
+	return ctx->enum_jobs;
+}
+
 /**
  * cxl_new - instantiate a new library context
  * @ctx: context to establish
@@ -294,6 +354,8 @@ CXL_EXPORT int cxl_new(struct cxl_ctx **ctx)
 	c->udev = udev;
 	c->udev_queue = udev_queue;
 	c->timeout = 5000;
+	c->enum_jobs = 1;
+	pthread_mutex_init(&c->ctl_lock, NULL);
 
 	return 0;
 
@@ -338,6 +400,8 @@ CXL_EXPORT void cxl_unref(struct cxl_ctx *ctx)
 	if (ctx->refcount > 0)
 		return;
 
+	sysfs_cache_flush(ctx);
+
 	list_for_each_safe(&ctx->memdevs, memdev, _d, list)
 		free_memdev(memdev, &ctx->memdevs);
 
@@ -349,6 +413,7 @@ CXL_EXPORT void cxl_unref(struct cxl_ctx *ctx)
 	kmod_unref(ctx->kmod_ctx);
 	daxctl_unref(ctx->daxctl_ctx);
 	info(ctx, "context %p released\n", ctx);
+	pthread_mutex_destroy(&ctx->ctl_lock);
 	free(ctx);
 }
 
@@ -548,21 +613,20 @@ static int region_start_cmp(struct cxl_region *r1, struct cxl_region *r2)
 static void *add_cxl_region(void *parent, int id, const char *cxlregion_base)
 {
 	const char *devname = devpath_to_devname(cxlregion_base);
-	char *path = calloc(1, strlen(cxlregion_base) + 100);
 	struct cxl_region *region, *region_dup, *_r;
 	struct cxl_decoder *decoder = parent;
 	struct cxl_ctx *ctx = cxl_decoder_get_ctx(decoder);
 	char buf[SYSFS_ATTR_SIZE];
+	struct sysfs_dir dir;
 	u64 resource = ULLONG_MAX;
 
 	dbg(ctx, "%s: base: \'%s\'\n", devname, cxlregion_base);
 
-	if (!path)
-		return NULL;
+	sysfs_dir_open(ctx, &dir, cxlregion_base);
 
 	region = calloc(1, sizeof(*region));
 	if (!region)
-		goto err_path;
+		goto err_dir;
 
 	region->id = id;
 	region->ctx = ctx;
@@ -578,53 +642,45 @@ static void *add_cxl_region(void *parent, int id, const char *cxlregion_base)
 		goto err;
 	region->buf_len = strlen(cxlregion_base) + 50;
 
-	sprintf(path, "%s/size", cxlregion_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "size", buf) < 0)
 		region->size = ULLONG_MAX;
 	else
 		region->size = strtoull(buf, NULL, 0);
 
-	sprintf(path, "%s/resource", cxlregion_base);
-	if (sysfs_read_attr(ctx, path, buf) == 0)
+	if (sysfs_dir_read_attr(&dir, "resource", buf) == 0)
 		resource = strtoull(buf, NULL, 0);
 
 	if (resource < ULLONG_MAX)
 		region->start = resource;
 
-	sprintf(path, "%s/uuid", cxlregion_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "uuid", buf) < 0)
 		goto err;
 	if (strlen(buf) && uuid_parse(buf, region->uuid) < 0) {
-		dbg(ctx, "%s:%s\n", path, buf);
+		dbg(ctx, "%s/uuid:%s\n", cxlregion_base, buf);
 		goto err;
 	}
 
-	sprintf(path, "%s/interleave_granularity", cxlregion_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "interleave_granularity", buf) < 0)
 		region->interleave_granularity = UINT_MAX;
 	else
 		region->interleave_granularity = strtoul(buf, NULL, 0);
 
-	sprintf(path, "%s/interleave_ways", cxlregion_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "interleave_ways", buf) < 0)
 		region->interleave_ways = UINT_MAX;
 	else
 		region->interleave_ways = strtoul(buf, NULL, 0);
 
-	sprintf(path, "%s/commit", cxlregion_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "commit", buf) < 0)
 		region->decode_state = CXL_DECODE_UNKNOWN;
 	else
 		region->decode_state = strtoul(buf, NULL, 0);
 
-	sprintf(path, "%s/mode", cxlregion_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "mode", buf) < 0)
 		region->mode = CXL_DECODER_MODE_NONE;
 	else
 		region->mode = cxl_decoder_mode_from_ident(buf);
 
-	sprintf(path, "%s/modalias", cxlregion_base);
-	if (sysfs_read_attr(ctx, path, buf) == 0)
+	if (sysfs_dir_read_attr(&dir, "modalias", buf) == 0)
 		region->module = util_modalias_to_module(ctx, buf);
 
 	cxl_region_foreach_safe(decoder, region_dup, _r)
@@ -637,14 +693,14 @@ static void *add_cxl_region(void *parent, int id, const char *cxlregion_base)
 
 	list_add_sorted(&decoder->regions, region, list, region_start_cmp);
 
-	free(path);
+	sysfs_dir_close(&dir);
 	return region;
 err:
 	free(region->dev_path);
 	free(region->dev_buf);
 	free(region);
-err_path:
-	free(path);
+err_dir:
+	sysfs_dir_close(&dir);
 	return NULL;
 }
 
@@ -678,7 +734,8 @@ static int cxl_wait_probe(struct cxl_ctx *ctx)
 static int device_parse(struct cxl_ctx *ctx, const char *base_path,
 			const char *dev_name, void *parent, add_dev_fn add_dev)
 {
-	cxl_wait_probe(ctx);
+	if (!ctx->probe_settled)
+		cxl_wait_probe(ctx);
 	return sysfs_device_parse(ctx, base_path, dev_name, parent, add_dev);
 }
 
@@ -1260,11 +1317,14 @@ static void *add_cxl_memdev(void *parent, int id, const char *cxlmem_base)
 	struct cxl_ctx *ctx = parent;
 	struct cxl_memdev *memdev, *memdev_dup;
 	char buf[SYSFS_ATTR_SIZE];
+	struct sysfs_dir dir;
 	struct stat st;
 	char *host;
 
 	if (!path)
 		return NULL;
+
+	sysfs_dir_open(ctx, &dir, cxlmem_base);
 	dbg(ctx, "%s: base: \'%s\'\n", devname, cxlmem_base);
 
 	memdev = calloc(1, sizeof(*memdev));
@@ -1272,6 +1332,8 @@ static void *add_cxl_memdev(void *parent, int id, const char *cxlmem_base)
 		goto err_dev;
 	memdev->id = id;
 	memdev->ctx = ctx;
+	memdev->ctl_fd = -1;
+	list_head_init(&memdev->cmd_pool);
 
 	sprintf(path, "/dev/cxl/%s", devname);
 	if (stat(path, &st) < 0)
@@ -1279,28 +1341,23 @@ static void *add_cxl_memdev(void *parent, int id, const char *cxlmem_base)
 	memdev->major = major(st.st_rdev);
 	memdev->minor = minor(st.st_rdev);
 
-	sprintf(path, "%s/pmem/size", cxlmem_base);
-	if (sysfs_read_attr(ctx, path, buf) == 0)
+	if (sysfs_dir_read_attr(&dir, "pmem/size", buf) == 0)
 		memdev->pmem_size = strtoull(buf, NULL, 0);
 
-	sprintf(path, "%s/ram/size", cxlmem_base);
-	if (sysfs_read_attr(ctx, path, buf) == 0)
+	if (sysfs_dir_read_attr(&dir, "ram/size", buf) == 0)
 		memdev->ram_size = strtoull(buf, NULL, 0);
 
-	sprintf(path, "%s/pmem/qos_class", cxlmem_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "pmem/qos_class", buf) < 0)
 		memdev->pmem_qos_class = CXL_QOS_CLASS_NONE;
 	else
 		memdev->pmem_qos_class = atoi(buf);
 
-	sprintf(path, "%s/ram/qos_class", cxlmem_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "ram/qos_class", buf) < 0)
 		memdev->ram_qos_class = CXL_QOS_CLASS_NONE;
 	else
 		memdev->ram_qos_class = atoi(buf);
 
-	sprintf(path, "%s/payload_max", cxlmem_base);
-	if (sysfs_read_attr(ctx, path, buf) == 0) {
+	if (sysfs_dir_read_attr(&dir, "payload_max", buf) == 0) {
 		memdev->payload_max = strtoull(buf, NULL, 0);
 		if (memdev->payload_max < 0)
 			goto err_read;
@@ -1308,8 +1365,7 @@ static void *add_cxl_memdev(void *parent, int id, const char *cxlmem_base)
 		memdev->payload_max = -1;
 	}
 
-	sprintf(path, "%s/label_storage_size", cxlmem_base);
-	if (sysfs_read_attr(ctx, path, buf) == 0) {
+	if (sysfs_dir_read_attr(&dir, "label_storage_size", buf) == 0) {
 		memdev->lsa_size = strtoull(buf, NULL, 0);
 		if (memdev->lsa_size == ULLONG_MAX)
 			goto err_read;
@@ -1317,14 +1373,12 @@ static void *add_cxl_memdev(void *parent, int id, const char *cxlmem_base)
 		memdev->lsa_size = SIZE_MAX;
 	}
 
-	sprintf(path, "%s/serial", cxlmem_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "serial", buf) < 0)
 		memdev->serial = ULLONG_MAX;
 	else
 		memdev->serial = strtoull(buf, NULL, 0);
 
-	sprintf(path, "%s/numa_node", cxlmem_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "numa_node", buf) < 0)
 		memdev->numa_node = -1;
 	else
 		memdev->numa_node = strtol(buf, NULL, 0);
@@ -1341,8 +1395,7 @@ static void *add_cxl_memdev(void *parent, int id, const char *cxlmem_base)
 		goto err_read;
 	host[0] = '\0';
 
-	sprintf(path, "%s/firmware_version", cxlmem_base);
-	if (sysfs_read_attr(ctx, path, buf) == 0) {
+	if (sysfs_dir_read_attr(&dir, "firmware_version", buf) == 0) {
 		memdev->firmware_version = strdup(buf);
 		if (!memdev->firmware_version)
 			goto err_read;
@@ -1361,11 +1414,13 @@ static void *add_cxl_memdev(void *parent, int id, const char *cxlmem_base)
 	cxl_memdev_foreach(ctx, memdev_dup)
 		if (memdev_dup->id == memdev->id) {
 			free_memdev(memdev, NULL);
+			sysfs_dir_close(&dir);
 			free(path);
 			return memdev_dup;
 		}
 
 	list_add(&ctx->memdevs, &memdev->list);
+	sysfs_dir_close(&dir);
 	free(path);
 	return memdev;
 
@@ -1376,6 +1431,7 @@ static void *add_cxl_memdev(void *parent, int id, const char *cxlmem_base)
 	free(memdev->host_path);
 	free(memdev);
  err_dev:
+	sysfs_dir_close(&dir);
 	free(path);
 	return NULL;
 }
@@ -2219,18 +2275,17 @@ static int decoder_id_cmp(struct cxl_decoder *d1, struct cxl_decoder *d2)
 static void *add_cxl_decoder(void *parent, int id, const char *cxldecoder_base)
 {
 	const char *devname = devpath_to_devname(cxldecoder_base);
-	char *path = calloc(1, strlen(cxldecoder_base) + 100);
 	struct cxl_decoder *decoder, *decoder_dup;
 	struct cxl_port *port = parent;
 	struct cxl_ctx *ctx = cxl_port_get_ctx(port);
 	char buf[SYSFS_ATTR_SIZE];
+	struct sysfs_dir dir;
 	char *target_id, *save;
 	size_t i;
 
 	dbg(ctx, "%s: base: \'%s\'\n", devname, cxldecoder_base);
 
-	if (!path)
-		return NULL;
+	sysfs_dir_open(ctx, &dir, cxldecoder_base);
 
 	decoder = calloc(1, sizeof(*decoder));
 	if (!decoder)
@@ -2252,20 +2307,17 @@ static void *add_cxl_decoder(void *parent, int id, const char *cxldecoder_base)
 		goto err_decoder;
 	decoder->buf_len = strlen(cxldecoder_base) + 50;
 
-	sprintf(path, "%s/start", cxldecoder_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "start", buf) < 0)
 		decoder->start = ULLONG_MAX;
 	else
 		decoder->start = strtoull(buf, NULL, 0);
 
-	sprintf(path, "%s/size", cxldecoder_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "size", buf) < 0)
 		decoder->size = ULLONG_MAX;
 	else
 		decoder->size = strtoull(buf, NULL, 0);
 
-	sprintf(path, "%s/mode", cxldecoder_base);
-	if (sysfs_read_attr(ctx, path, buf) == 0) {
+	if (sysfs_dir_read_attr(&dir, "mode", buf) == 0) {
 		if (strcmp(buf, "ram") == 0)
 			decoder->mode = CXL_DECODER_MODE_RAM;
 		else if (strcmp(buf, "pmem") == 0)
@@ -2279,33 +2331,28 @@ static void *add_cxl_decoder(void *parent, int id, const char *cxldecoder_base)
 	} else
 		decoder->mode = CXL_DECODER_MODE_NONE;
 
-	sprintf(path, "%s/interleave_granularity", cxldecoder_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "interleave_granularity", buf) < 0)
 		decoder->interleave_granularity = UINT_MAX;
 	else
 		decoder->interleave_granularity = strtoul(buf, NULL, 0);
 
-	sprintf(path, "%s/interleave_ways", cxldecoder_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "interleave_ways", buf) < 0)
 		decoder->interleave_ways = UINT_MAX;
 	else
 		decoder->interleave_ways = strtoul(buf, NULL, 0);
 
-	sprintf(path, "%s/qos_class", cxldecoder_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "qos_class", buf) < 0)
 		decoder->qos_class = CXL_QOS_CLASS_NONE;
 	else
 		decoder->qos_class = atoi(buf);
 
 	switch (port->type) {
 	case CXL_PORT_ENDPOINT:
-		sprintf(path, "%s/dpa_resource", cxldecoder_base);
-		if (sysfs_read_attr(ctx, path, buf) < 0)
+		if (sysfs_dir_read_attr(&dir, "dpa_resource", buf) < 0)
 			decoder->dpa_resource = ULLONG_MAX;
 		else
 			decoder->dpa_resource = strtoull(buf, NULL, 0);
-		sprintf(path, "%s/dpa_size", cxldecoder_base);
-		if (sysfs_read_attr(ctx, path, buf) < 0)
+		if (sysfs_dir_read_attr(&dir, "dpa_size", buf) < 0)
 			decoder->dpa_size = ULLONG_MAX;
 		else
 			decoder->dpa_size = strtoull(buf, NULL, 0);
@@ -2315,11 +2362,9 @@ static void *add_cxl_decoder(void *parent, int id, const char *cxldecoder_base)
 		decoder->volatile_capable = true;
 		decoder->mem_capable = true;
 		decoder->accelmem_capable = true;
-		sprintf(path, "%s/locked", cxldecoder_base);
-		if (sysfs_read_attr(ctx, path, buf) == 0)
+		if (sysfs_dir_read_attr(&dir, "locked", buf) == 0)
 			decoder->locked = !!strtoul(buf, NULL, 0);
-		sprintf(path, "%s/target_type", cxldecoder_base);
-		if (sysfs_read_attr(ctx, path, buf) == 0) {
+		if (sysfs_dir_read_attr(&dir, "target_type", buf) == 0) {
 			if (strcmp(buf, "accelerator") == 0)
 				decoder->target_type =
 					CXL_DECODER_TTYPE_ACCELERATOR;
@@ -2343,8 +2388,7 @@ static void *add_cxl_decoder(void *parent, int id, const char *cxldecoder_base)
 		for (i = 0; i < ARRAY_SIZE(flags); i++) {
 			struct cxl_decoder_flag *flag = &flags[i];
 
-			sprintf(path, "%s/%s", cxldecoder_base, flag->name);
-			if (sysfs_read_attr(ctx, path, buf) == 0)
+			if (sysfs_dir_read_attr(&dir, flag->name, buf) == 0)
 				*(flag->flag) = !!strtoul(buf, NULL, 0);
 		}
 		decoder->max_available_extent =
@@ -2353,8 +2397,7 @@ static void *add_cxl_decoder(void *parent, int id, const char *cxldecoder_base)
 	}
 	}
 
-	sprintf(path, "%s/target_list", cxldecoder_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "target_list", buf) < 0)
 		buf[0] = '\0';
 
 	for (i = 0, target_id = strtok_r(buf, ",", &save); target_id;
@@ -2399,13 +2442,13 @@ static void *add_cxl_decoder(void *parent, int id, const char *cxldecoder_base)
 	cxl_decoder_foreach(port, decoder_dup)
 		if (decoder_dup->id == decoder->id) {
 			free_decoder(decoder, NULL);
-			free(path);
+			sysfs_dir_close(&dir);
 			return decoder_dup;
 		}
 
 	list_add_sorted(&port->decoders, decoder, list, decoder_id_cmp);
 
-	free(path);
+	sysfs_dir_close(&dir);
 	return decoder;
 
 err_decoder:
@@ -2413,12 +2456,40 @@ err_decoder:
 	free(decoder->dev_buf);
 	free(decoder);
 err:
-	free(path);
+	sysfs_dir_close(&dir);
 	return NULL;
 }
 
-static void cxl_decoders_init(struct cxl_port *port)
+/*
+ * Run @init, one of the per-port child enumerations, for @port and all
+ * the ports that share its parent in parallel. device_parse() waits for
+ * probing to settle first, which polls the ctx udev queue, and libudev
+ * is not thread safe. So wait here on the calling thread and let the
+ * workers skip it.
+ */
+static void cxl_port_enum_siblings(struct cxl_port *port, enum_dev_fn init)
+{
+	struct cxl_ctx *ctx = cxl_port_get_ctx(port);
+	int settled = ctx->probe_settled;
+	struct list_head *siblings;
+
+	if (!port->parent)
+		siblings = &ctx->buses;
+	else if (port->type == CXL_PORT_ENDPOINT)
+		siblings = &port->parent->endpoints;
+	else
+		siblings = &port->parent->child_ports;
+
+	cxl_wait_probe(ctx);
+	ctx->probe_settled = 1;
+	sysfs_enum_parallel(ctx, siblings, struct cxl_port, list,
+			    ctx->enum_jobs, init);
+	ctx->probe_settled = settled;
+}
+
+static void __cxl_decoders_init(void *_port)
 {
+	struct cxl_port *port = _port;
 	struct cxl_ctx *ctx = cxl_port_get_ctx(port);
 	char *decoder_fmt;
 
@@ -2438,6 +2509,16 @@ static void cxl_decoders_init(struct cxl_port *port)
 	free(decoder_fmt);
 }
 
+static void cxl_decoders_init(struct cxl_port *port)
+{
+	if (port->decoders_init)
+		return;
+
+	if (port->ctx->enum_jobs > 1)
+		cxl_port_enum_siblings(port, __cxl_decoders_init);
+	__cxl_decoders_init(port);
+}
+
 CXL_EXPORT struct cxl_decoder *cxl_decoder_get_first(struct cxl_port *port)
 {
 	cxl_decoders_init(port);
@@ -2907,8 +2988,9 @@ err:
 
 }
 
-static void cxl_ports_init(struct cxl_port *port)
+static void __cxl_ports_init(void *_port)
 {
+	struct cxl_port *port = _port;
 	struct cxl_ctx *ctx = cxl_port_get_ctx(port);
 
 	if (port->ports_init)
@@ -2919,6 +3001,16 @@ static void cxl_ports_init(struct cxl_port *port)
 	device_parse(ctx, port->dev_path, "port", port, add_cxl_port);
 }
 
+static void cxl_ports_init(struct cxl_port *port)
+{
+	if (port->ports_init)
+		return;
+
+	if (port->ctx->enum_jobs > 1)
+		cxl_port_enum_siblings(port, __cxl_ports_init);
+	__cxl_ports_init(port);
+}
+
 CXL_EXPORT struct cxl_ctx *cxl_port_get_ctx(struct cxl_port *port)
 {
 	return port->ctx;
@@ -3358,17 +3450,38 @@ CXL_EXPORT struct cxl_ctx *cxl_bus_get_ctx(struct cxl_bus *bus)
 	return cxl_port_get_ctx(&bus->port);
 }
 
+/*
+ * Released commands keep their query, send and payload buffers and are
+ * parked on the memdev for the next cxl_cmd_new(), so that repeated
+ * commands like chunked label transfers or health polling do not
+ * allocate. Commands are released from several threads, e.g. by the
+ * label transfer workers, so the pool is only touched under
+ * ctx->ctl_lock. It is drained when the memdev is freed, hence commands
+ * must be released before the context.
+ */
+#define CXL_CMD_POOL_MAX 4
+
 CXL_EXPORT void cxl_cmd_unref(struct cxl_cmd *cmd)
 {
+	struct cxl_memdev *memdev;
+	struct cxl_ctx *ctx;
+
 	if (!cmd)
 		return;
-	if (--cmd->refcount == 0) {
-		free(cmd->query_cmd);
-		free(cmd->send_cmd);
-		free(cmd->input_payload);
-		free(cmd->output_payload);
-		free(cmd);
+	if (--cmd->refcount)
+		return;
+
+	memdev = cmd->memdev;
+	ctx = memdev->ctx;
+	pthread_mutex_lock(&ctx->ctl_lock);
+	if (memdev->cmd_pool_len < CXL_CMD_POOL_MAX) {
+		list_add(&memdev->cmd_pool, &cmd->list);
+		memdev->cmd_pool_len++;
+		cmd = NULL;
 	}
+	pthread_mutex_unlock(&ctx->ctl_lock);
+	if (cmd)
+		free_cmd(cmd);
 }
 
 CXL_EXPORT void cxl_cmd_ref(struct cxl_cmd *cmd)
@@ -3383,6 +3496,11 @@ static int cxl_cmd_alloc_query(struct cxl_cmd *cmd, int num_cmds)
 	if (!cmd)
 		return -EINVAL;
 
+	/* a recycled command may already have a table of the right size */
+	if (cmd->query_cmd && num_cmds
+			&& cmd->query_cmd->n_commands == (u32)num_cmds)
+		return 0;
+
 	if (cmd->query_cmd != NULL)
 		free(cmd->query_cmd);
 
@@ -3401,9 +3519,24 @@ static int cxl_cmd_alloc_query(struct cxl_cmd *cmd, int num_cmds)
 
 static struct cxl_cmd *cxl_cmd_new(struct cxl_memdev *memdev)
 {
+	struct cxl_ctx *ctx = memdev->ctx;
 	struct cxl_cmd *cmd;
 	size_t size;
 
+	pthread_mutex_lock(&ctx->ctl_lock);
+	cmd = list_pop(&memdev->cmd_pool, struct cxl_cmd, list);
+	if (cmd)
+		memdev->cmd_pool_len--;
+	pthread_mutex_unlock(&ctx->ctl_lock);
+	if (cmd) {
+		cmd->refcount = 0;
+		cmd->query_status = CXL_CMD_QUERY_NOT_RUN;
+		cmd->query_idx = 0;
+		cmd->status = 0;
+		cxl_cmd_ref(cmd);
+		return cmd;
+	}
+
 	size = sizeof(*cmd);
 	cmd = calloc(1, size);
 	if (!cmd)
@@ -3438,40 +3571,98 @@ static int __do_cmd(struct cxl_cmd *cmd, int ioctl_cmd, int fd)
 	return rc;
 }
 
-static int do_cmd(struct cxl_cmd *cmd, int ioctl_cmd)
+/*
+ * Keep the validated memdev node open after the first command rather
+ * than paying for an open(), fstat() and close() on every mailbox
+ * command. The fd is dropped when the device stops responding so the
+ * next command revalidates it. Commands may be issued from several
+ * threads, so the fd is only opened, duplicated and closed under
+ * ctx->ctl_lock, and each command runs on its own duplicate so that a
+ * concurrent close can not pull the fd out from under it. The cached fd
+ * the duplicate was taken from is returned in @cached.
+ */
+static int cmd_ctl_fd(struct cxl_memdev *memdev, int *cached)
 {
-	char *path;
-	struct stat st;
-	unsigned int major, minor;
-	int rc = 0, fd;
-	struct cxl_memdev *memdev = cmd->memdev;
 	struct cxl_ctx *ctx = cxl_memdev_get_ctx(memdev);
 	const char *devname = cxl_memdev_get_devname(memdev);
+	unsigned int major = cxl_memdev_get_major(memdev);
+	unsigned int minor = cxl_memdev_get_minor(memdev);
+	char path[PATH_MAX];
+	struct stat st;
+	int fd;
 
-	major = cxl_memdev_get_major(memdev);
-	minor = cxl_memdev_get_minor(memdev);
+	pthread_mutex_lock(&ctx->ctl_lock);
+	fd = memdev->ctl_fd;
+	if (fd > -1)
+		goto out_dup;
 
-	if (asprintf(&path, "/dev/cxl/%s", devname) < 0)
-		return -ENOMEM;
+	if (snprintf(path, sizeof(path), "/dev/cxl/%s", devname)
+			>= (int) sizeof(path)) {
+		fd = -EINVAL;
+		goto out;
+	}
 
-	fd = open(path, O_RDWR);
+	fd = open(path, O_RDWR|O_CLOEXEC);
 	if (fd < 0) {
-		err(ctx, "failed to open %s: %s\n", path, strerror(errno));
-		rc = -errno;
+		fd = -errno;
+		err(ctx, "failed to open %s: %s\n", path, strerror(-fd));
 		goto out;
 	}
 
 	if (fstat(fd, &st) >= 0 && S_ISCHR(st.st_mode)
 			&& major(st.st_rdev) == major
 			&& minor(st.st_rdev) == minor) {
-		rc = __do_cmd(cmd, ioctl_cmd, fd);
-	} else {
-		err(ctx, "failed to validate %s as a CXL memdev node\n", path);
-		rc = -ENXIO;
+		memdev->ctl_fd = fd;
+		goto out_dup;
 	}
+
+	err(ctx, "failed to validate %s as a CXL memdev node\n", path);
 	close(fd);
+	fd = -ENXIO;
+	goto out;
+out_dup:
+	*cached = fd;
+	fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	if (fd < 0) {
+		fd = -errno;
+		err(ctx, "failed to duplicate %s fd: %s\n", devname,
+		    strerror(-fd));
+	}
 out:
-	free(path);
+	pthread_mutex_unlock(&ctx->ctl_lock);
+	return fd;
+}
+
+/*
+ * Drop the cached fd if the device went away, unless another thread
+ * already replaced it.
+ */
+static void cmd_ctl_fd_check(struct cxl_memdev *memdev, int fd, int rc)
+{
+	struct cxl_ctx *ctx = cxl_memdev_get_ctx(memdev);
+
+	if (rc != -ENXIO && rc != -ENODEV && rc != -EBADF)
+		return;
+	pthread_mutex_lock(&ctx->ctl_lock);
+	if (memdev->ctl_fd == fd) {
+		close(fd);
+		memdev->ctl_fd = -1;
+	}
+	pthread_mutex_unlock(&ctx->ctl_lock);
+}
+
+static int do_cmd(struct cxl_cmd *cmd, int ioctl_cmd)
+{
+	struct cxl_memdev *memdev = cmd->memdev;
+	int rc, fd, cached;
+
+	fd = cmd_ctl_fd(memdev, &cached);
+	if (fd < 0)
+		return fd;
+
+	rc = __do_cmd(cmd, ioctl_cmd, fd);
+	close(fd);
+	cmd_ctl_fd_check(memdev, cached, rc);
 	return rc;
 }
 
@@ -3498,6 +3689,7 @@ static int cxl_cmd_do_query(struct cxl_cmd *cmd)
 	struct cxl_ctx *ctx = cxl_memdev_get_ctx(memdev);
 	const char *devname = cxl_memdev_get_devname(memdev);
 	int rc, n_commands;
+	size_t size;
 
 	switch (cmd->query_status) {
 	case CXL_CMD_QUERY_OK:
@@ -3512,14 +3704,39 @@ static int cxl_cmd_do_query(struct cxl_cmd *cmd)
 		return -EINVAL;
 	}
 
-	rc = alloc_do_query(cmd, 0);
+	/*
+	 * The set of supported commands is fixed for the life of the
+	 * memdev, so only ask the kernel once and hand each new command
+	 * a copy of the cached table.
+	 */
+	if (!memdev->query_cmd) {
+		rc = alloc_do_query(cmd, 0);
+		if (rc)
+			return rc;
+
+		n_commands = cmd->query_cmd->n_commands;
+		dbg(ctx, "%s: supports %d commands\n", devname, n_commands);
+
+		rc = alloc_do_query(cmd, n_commands);
+		if (rc)
+			return rc;
+
+		size = struct_size(cmd->query_cmd, commands,
+				   cmd->query_cmd->n_commands);
+		memdev->query_cmd = malloc(size);
+		if (memdev->query_cmd)
+			memcpy(memdev->query_cmd, cmd->query_cmd, size);
+		return 0;
+	}
+
+	n_commands = memdev->query_cmd->n_commands;
+	rc = cxl_cmd_alloc_query(cmd, n_commands);
 	if (rc)
 		return rc;
+	memcpy(cmd->query_cmd->commands, memdev->query_cmd->commands,
+	       n_commands * sizeof(cmd->query_cmd->commands[0]));
 
-	n_commands = cmd->query_cmd->n_commands;
-	dbg(ctx, "%s: supports %d commands\n", devname, n_commands);
-
-	return alloc_do_query(cmd, n_commands);
+	return 0;
 }
 
 static int cxl_cmd_validate(struct cxl_cmd *cmd, u32 cmd_id)
@@ -3549,6 +3766,30 @@ static int cxl_cmd_validate(struct cxl_cmd *cmd, u32 cmd_id)
 	return -EOPNOTSUPP;
 }
 
+/*
+ * Payload buffers are sized to the mailbox maximum when first allocated
+ * so a recycled command can carry any payload without reallocating.
+ */
+static void *cxl_cmd_payload(struct cxl_cmd *cmd, void **buf, size_t *alloc,
+		size_t size)
+{
+	int payload_max = cmd->memdev->payload_max;
+	size_t want = size;
+
+	if (payload_max > 0 && (size_t) payload_max > size)
+		want = payload_max;
+
+	if (*alloc < size) {
+		free(*buf);
+		*buf = calloc(1, want);
+		*alloc = *buf ? want : 0;
+		return *buf;
+	}
+
+	memset(*buf, 0, size);
+	return *buf;
+}
+
 CXL_EXPORT int cxl_cmd_set_input_payload(struct cxl_cmd *cmd, void *buf,
 		int size)
 {
@@ -3560,8 +3801,8 @@ CXL_EXPORT int cxl_cmd_set_input_payload(struct cxl_cmd *cmd, void *buf,
 	if (!buf) {
 
 		/* If the user didn't supply a buffer, allocate it */
-		cmd->input_payload = calloc(1, size);
-		if (!cmd->input_payload)
+		if (!cxl_cmd_payload(cmd, &cmd->input_payload,
+				     &cmd->input_alloc, size))
 			return -ENOMEM;
 		cmd->send_cmd->in.payload = (u64)cmd->input_payload;
 	} else {
@@ -3588,8 +3829,8 @@ CXL_EXPORT int cxl_cmd_set_output_payload(struct cxl_cmd *cmd, void *buf,
 	if (!buf) {
 
 		/* If the user didn't supply a buffer, allocate it */
-		cmd->output_payload = calloc(1, size);
-		if (!cmd->output_payload)
+		if (!cxl_cmd_payload(cmd, &cmd->output_payload,
+				     &cmd->output_alloc, size))
 			return -ENOMEM;
 		cmd->send_cmd->out.payload = (u64)cmd->output_payload;
 	} else {
@@ -3612,7 +3853,10 @@ static int cxl_cmd_alloc_send(struct cxl_cmd *cmd, u32 cmd_id)
 	size_t size;
 
 	size = sizeof(struct cxl_send_command);
-	cmd->send_cmd = calloc(1, size);
+	if (cmd->send_cmd)
+		memset(cmd->send_cmd, 0, size);
+	else
+		cmd->send_cmd = calloc(1, size);
 	if (!cmd->send_cmd)
 		return -ENOMEM;
 
@@ -3622,15 +3866,15 @@ static int cxl_cmd_alloc_send(struct cxl_cmd *cmd, u32 cmd_id)
 	cmd->send_cmd->id = cmd_id;
 
 	if (cinfo->size_in > 0) {
-		cmd->input_payload = calloc(1, cinfo->size_in);
-		if (!cmd->input_payload)
+		if (!cxl_cmd_payload(cmd, &cmd->input_payload,
+				     &cmd->input_alloc, cinfo->size_in))
 			return -ENOMEM;
 		cmd->send_cmd->in.payload = (u64)cmd->input_payload;
 		cmd->send_cmd->in.size = cinfo->size_in;
 	}
 	if (cinfo->size_out > 0) {
-		cmd->output_payload = calloc(1, cinfo->size_out);
-		if (!cmd->output_payload)
+		if (!cxl_cmd_payload(cmd, &cmd->output_payload,
+				     &cmd->output_alloc, cinfo->size_out))
 			return -ENOMEM;
 		cmd->send_cmd->out.payload = (u64)cmd->output_payload;
 		cmd->send_cmd->out.size = cinfo->size_out;
@@ -4538,74 +4782,216 @@ enum lsa_op {
 	LSA_OP_ZERO,
 };
 
-static int __lsa_op(struct cxl_memdev *memdev, int op, void *buf,
-		size_t length, size_t offset)
+/*
+ * Label transfers are split into payload_max sized chunks. Rather than
+ * building, submitting and freeing a command per chunk, a small set of
+ * commands is built up front and LSA_PIPE_DEPTH workers each reuse one
+ * of them to move chunks until the transfer is done. The device still
+ * executes one mailbox command at a time, but the user/kernel copies
+ * and command setup of one chunk overlap the execution of another.
+ */
+#define LSA_PIPE_DEPTH 4
+
+struct lsa_pipe {
+	struct cxl_memdev *memdev;
+	int op;
+	void *buf;
+	size_t length, offset, chunk;
+	unsigned int *idx;
+	unsigned int nr;
+	unsigned int next;
+	int fd;
+	int ctl_fd;
+	int fd_rc;
+	int rc;
+};
+
+struct lsa_slot {
+	struct lsa_pipe *pipe;
+	struct cxl_cmd *cmd;
+	pthread_t thread;
+};
+
+static struct cxl_cmd *lsa_cmd_new(struct lsa_pipe *pipe)
 {
-	const char *devname = cxl_memdev_get_devname(memdev);
-	struct cxl_ctx *ctx = cxl_memdev_get_ctx(memdev);
-	void *zero_buf = NULL;
+	struct cxl_memdev *memdev = pipe->memdev;
 	struct cxl_cmd *cmd;
-	ssize_t ret_len;
-	int rc = 0;
 
-	switch (op) {
-	case LSA_OP_GET:
-		cmd = cxl_cmd_new_read_label(memdev, offset, length);
-		if (!cmd)
-			return -ENOMEM;
-		rc = cxl_cmd_set_output_payload(cmd, buf, length);
+	if (pipe->op == LSA_OP_GET)
+		return cxl_cmd_new_read_label(memdev, 0, pipe->chunk);
+
+	cmd = cxl_cmd_new_generic(memdev, CXL_MEM_COMMAND_ID_SET_LSA);
+	if (!cmd)
+		return NULL;
+	/* zeroed, which is all LSA_OP_ZERO ever sends */
+	if (cxl_cmd_set_input_payload(cmd, NULL, sizeof(struct cxl_cmd_set_lsa)
+				      + pipe->chunk)) {
+		cxl_cmd_unref(cmd);
+		return NULL;
+	}
+	return cmd;
+}
+
+static int lsa_slot_xfer(struct lsa_slot *slot, unsigned int n)
+{
+	struct lsa_pipe *pipe = slot->pipe;
+	struct cxl_send_command *send = slot->cmd->send_cmd;
+	struct cxl_ctx *ctx = cxl_memdev_get_ctx(pipe->memdev);
+	size_t off = (size_t)n * pipe->chunk;
+	size_t len = min(pipe->chunk, pipe->length - off);
+	int rc;
+
+	if (pipe->op == LSA_OP_GET) {
+		struct cxl_cmd_get_lsa_in *get_lsa = (void *)send->in.payload;
+
+		get_lsa->offset = cpu_to_le32(pipe->offset + off);
+		get_lsa->length = cpu_to_le32(len);
+		/* read straight into the caller's buffer */
+		send->out.payload = (u64)(pipe->buf + off);
+		send->out.size = len;
+	} else {
+		struct cxl_cmd_set_lsa *set_lsa = (void *)send->in.payload;
+
+		set_lsa->offset = cpu_to_le32(pipe->offset + off);
+		if (pipe->op == LSA_OP_SET)
+			memcpy(set_lsa->lsa_data, pipe->buf + off, len);
+		send->in.size = sizeof(*set_lsa) + len;
+	}
+	send->retval = 0;
+
+	rc = __do_cmd(slot->cmd, CXL_MEM_SEND_COMMAND, pipe->fd);
+	if (rc < 0) {
+		__atomic_store_n(&pipe->fd_rc, rc, __ATOMIC_RELAXED);
+		return rc;
+	}
+	if (send->retval) {
+		err(ctx, "%s: offset %#zx: firmware status: %d\n",
+		    cxl_memdev_get_devname(pipe->memdev), pipe->offset + off,
+		    send->retval);
+		return -ENXIO;
+	}
+	return 0;
+}
+
+static void *lsa_slot_worker(void *arg)
+{
+	struct lsa_slot *slot = arg;
+	struct lsa_pipe *pipe = slot->pipe;
+	unsigned int i;
+	int rc, none;
+
+	while (!__atomic_load_n(&pipe->rc, __ATOMIC_RELAXED)) {
+		i = __atomic_fetch_add(&pipe->next, 1, __ATOMIC_RELAXED);
+		if (i >= pipe->nr)
+			break;
+		rc = lsa_slot_xfer(slot, pipe->idx ? pipe->idx[i] : i);
 		if (rc) {
-			err(ctx, "%s: cmd setup failed: %s\n",
-			    cxl_memdev_get_devname(memdev), strerror(-rc));
-			goto out;
-		}
-		break;
-	case LSA_OP_ZERO:
-		zero_buf = calloc(1, length);
-		if (!zero_buf)
-			return -ENOMEM;
-		buf = zero_buf;
-		/* fall through */
-	case LSA_OP_SET:
-		cmd = cxl_cmd_new_write_label(memdev, buf, offset, length);
-		if (!cmd) {
-			rc = -ENOMEM;
-			goto out_free;
+			none = 0;
+			__atomic_compare_exchange_n(&pipe->rc, &none, rc, false,
+						    __ATOMIC_RELAXED,
+						    __ATOMIC_RELAXED);
+			break;
 		}
-		break;
-	default:
-		return -EOPNOTSUPP;
 	}
+	return NULL;
+}
 
-	rc = cxl_cmd_submit(cmd);
-	if (rc < 0) {
-		err(ctx, "%s: cmd submission failed: %s\n",
-			devname, strerror(-rc));
-		goto out;
+static int lsa_pipe_run(struct lsa_pipe *pipe)
+{
+	struct cxl_memdev *memdev = pipe->memdev;
+	struct lsa_slot slot[LSA_PIPE_DEPTH];
+	unsigned int depth, started = 0, i;
+
+	if (!pipe->nr)
+		return 0;
+
+	/* workers share the fd, so open it before they start */
+	pipe->fd = cmd_ctl_fd(memdev, &pipe->ctl_fd);
+	if (pipe->fd < 0)
+		return pipe->fd;
+
+	depth = min(pipe->nr, (unsigned int)LSA_PIPE_DEPTH);
+	for (i = 0; i < depth; i++) {
+		slot[i].pipe = pipe;
+		slot[i].cmd = lsa_cmd_new(pipe);
+		if (!slot[i].cmd)
+			break;
+	}
+	if (i == 0) {
+		close(pipe->fd);
+		return -ENOMEM;
 	}
+	depth = i;
 
-	rc = cxl_cmd_get_mbox_status(cmd);
-	if (rc != 0) {
-		err(ctx, "%s: firmware status: %d\n",
-			devname, rc);
-		rc = -ENXIO;
-		goto out;
+	for (i = 1; i < depth; i++, started++)
+		if (pthread_create(&slot[i].thread, NULL, lsa_slot_worker,
+				   &slot[i]) != 0)
+			break;
+	lsa_slot_worker(&slot[0]);
+	for (i = 1; i <= started; i++)
+		pthread_join(slot[i].thread, NULL);
+
+	for (i = 0; i < depth; i++)
+		cxl_cmd_unref(slot[i].cmd);
+
+	close(pipe->fd);
+	cmd_ctl_fd_check(memdev, pipe->ctl_fd, pipe->fd_rc);
+	return pipe->rc;
+}
+
+static bool lsa_chunk_is_zero(const unsigned char *buf, size_t len)
+{
+	return !len || (buf[0] == 0 && memcmp(buf, buf + 1, len - 1) == 0);
+}
+
+/*
+ * Label writes are far slower than reads, and label updates typically
+ * touch a few slots of a large area. Read back the current contents and
+ * return the chunks that actually change, or NULL to write everything.
+ */
+static unsigned int *lsa_diff(struct lsa_pipe *pipe, unsigned int *nr)
+{
+	struct cxl_ctx *ctx = cxl_memdev_get_ctx(pipe->memdev);
+	struct lsa_pipe rd = *pipe;
+	unsigned char *cur, *want;
+	unsigned int *idx, i, n = 0;
+	int rc;
+
+	cur = malloc(pipe->length);
+	idx = calloc(pipe->nr, sizeof(*idx));
+	if (!cur || !idx)
+		goto err;
+
+	rd.op = LSA_OP_GET;
+	rd.buf = cur;
+	rc = lsa_pipe_run(&rd);
+	if (rc) {
+		dbg(ctx, "%s: label read-back failed: %s\n",
+		    cxl_memdev_get_devname(pipe->memdev), strerror(-rc));
+		goto err;
 	}
 
-	if (op == LSA_OP_GET) {
-		ret_len = cxl_cmd_read_label_get_payload(cmd, buf, length);
-		if (ret_len < 0) {
-			rc = ret_len;
-			goto out;
-		}
+	want = pipe->buf;
+	for (i = 0; i < pipe->nr; i++) {
+		size_t off = (size_t)i * pipe->chunk;
+		size_t len = min(pipe->chunk, pipe->length - off);
+
+		if (pipe->op == LSA_OP_ZERO ? lsa_chunk_is_zero(cur + off, len)
+				: memcmp(cur + off, want + off, len) == 0)
+			continue;
+		idx[n++] = i;
 	}
+	free(cur);
 
-out:
-	cxl_cmd_unref(cmd);
-out_free:
-	free(zero_buf);
-	return rc;
+	dbg(ctx, "%s: %u of %u label chunks changed\n",
+	    cxl_memdev_get_devname(pipe->memdev), n, pipe->nr);
+	*nr = n;
+	return idx;
 
+err:
+	free(idx);
+	free(cur);
+	return NULL;
 }
 
 static int lsa_op(struct cxl_memdev *memdev, int op, void *buf,
@@ -4613,8 +4999,14 @@ static int lsa_op(struct cxl_memdev *memdev, int op, void *buf,
 {
 	const char *devname = cxl_memdev_get_devname(memdev);
 	struct cxl_ctx *ctx = cxl_memdev_get_ctx(memdev);
-	size_t remaining = length, cur_len, cur_off = 0;
 	int label_iter_max, rc = 0;
+	struct lsa_pipe pipe = {
+		.memdev = memdev,
+		.op = op,
+		.buf = buf,
+		.length = length,
+		.offset = offset,
+	};
 
 	if (op != LSA_OP_ZERO && buf == NULL) {
 		err(ctx, "%s: LSA buffer cannot be NULL\n", devname);
@@ -4628,18 +5020,20 @@ static int lsa_op(struct cxl_memdev *memdev, int op, void *buf,
 		return -EINVAL;
 
 	label_iter_max = memdev->payload_max - sizeof(struct cxl_cmd_set_lsa);
-	while (remaining) {
-		cur_len = min((size_t)label_iter_max, remaining);
-		rc = __lsa_op(memdev, op, buf + cur_off,
-				cur_len, offset + cur_off);
-		if (rc)
-			break;
+	if (label_iter_max <= 0)
+		return -EINVAL;
+	pipe.chunk = label_iter_max;
+	pipe.nr = DIV_ROUND_UP(length, pipe.chunk);
 
-		remaining -= cur_len;
-		cur_off += cur_len;
-	}
+	if (op != LSA_OP_GET)
+		pipe.idx = lsa_diff(&pipe, &pipe.nr);
+	rc = lsa_pipe_run(&pipe);
+	free(pipe.idx);
 
-	if (rc && (op == LSA_OP_SET))
+	if (rc)
+		err(ctx, "%s: label %s failed: %s\n", devname,
+		    op == LSA_OP_GET ? "read" : "write", strerror(-rc));
+	if (rc && (op != LSA_OP_GET))
 		err(ctx, "%s: labels may be in an inconsistent state\n",
 			devname);
 	return rc;
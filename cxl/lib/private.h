@@ -56,6 +56,10 @@ struct cxl_memdev {
 	unsigned long long serial;
 	struct cxl_endpoint *endpoint;
 	struct cxl_fw_loader *fwl;
+	struct cxl_mem_query_commands *query_cmd;
+	struct list_head cmd_pool;
+	int cmd_pool_len;
+	int ctl_fd;
 };
 
 struct cxl_dport {
@@ -197,6 +201,7 @@ enum cxl_cmd_query_status {
  * @send_cmd: structure for the Linux 'Send command' ioctl
  * @input_payload: buffer for input payload managed by libcxl
  * @output_payload: buffer for output payload managed by libcxl
+ * @list: node in the memdev's pool of released commands
  * @refcount: reference for passing command buffer around
  * @query_status: status from query_commands
  * @query_idx: index of 'this' command in the query_commands array
@@ -208,6 +213,9 @@ struct cxl_cmd {
 	struct cxl_send_command *send_cmd;
 	void *input_payload;
 	void *output_payload;
+	size_t input_alloc;
+	size_t output_alloc;
+	struct list_node list;
 	int refcount;
 	int query_status;
 	int query_idx;
@@ -59,6 +59,8 @@ static const struct option options[] = {
 		    "include alert configuration information"),
 	OPT_BOOLEAN('L', "media-errors", &param.media_errors,
 		    "include media-error information "),
+	OPT_INTEGER('j', "jobs", &param.jobs,
+		    "max memdevs to query concurrently (default: 1)"),
 	OPT_INCR('v', "verbose", &param.verbose, "increase output detail"),
 #ifdef ENABLE_DEBUG
 	OPT_BOOLEAN(0, "debug", &debug, "debug list walk"),
@@ -146,6 +148,16 @@ int cmd_list(int argc, const char **argv, struct cxl_ctx *ctx)
 		param.ctx.log_priority = LOG_DEBUG;
 	}
 
+	if (param.jobs < 0) {
+		error("-j/--jobs must be positive\n");
+		usage_with_options(u, options);
+	}
+	if (!param.jobs)
+		param.jobs = 1;
+	/* enumeration stays sequential unless --jobs asks otherwise */
+	if (param.jobs > 1)
+		cxl_set_enum_jobs(ctx, param.jobs);
+
 	if (cxl_filter_has(param.port_filter, "root") && param.ports)
 		param.buses = true;
 
@@ -9,12 +9,14 @@
 #include <libgen.h>
 #include <time.h>
 #include <dirent.h>
+#include <signal.h>
 #include <ccan/list/list.h>
 #include <util/json.h>
 #include <util/util.h>
 #include <util/parse-options.h>
 #include <util/parse-configs.h>
 #include <util/strbuf.h>
+#include <util/size.h>
 #include <sys/epoll.h>
 #include <sys/stat.h>
 #include <tracefs.h>
@@ -29,24 +31,157 @@
 #endif
 #include <util/log.h>
 #include <util/event_trace.h>
+#include <util/event_log.h>
 
 static const char *cxl_system = "cxl";
 const char *default_log = "/var/log/cxl-monitor.log";
 
+/* flush buffered notifications once this much output is pending */
+#define MONITOR_FLUSH_SIZE SZ_64K
+
 static struct monitor {
 	const char *log;
+	const char *log_format;
 	struct log_ctx ctx;
+	struct evlog evlog;
+	struct strbuf out;
+	struct trace_agg agg;
+	unsigned int aggregate;
+	bool binary;
 	bool human;
 	bool verbose;
 	bool daemon;
-} monitor;
+} monitor = {
+	.out = STRBUF_INIT,
+};
+
+static void monitor_flush(struct strbuf *out)
+{
+	if (!out->len)
+		return;
+	notice(&monitor, "%s", out->buf);
+	strbuf_setlen(out, 0);
+}
+
+static u64 monitor_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* the format of every cxl event is the schema of a binary log session */
+static int monitor_log_formats(struct evlog *log)
+{
+	size_t sys_len = strlen(cxl_system) + 1;
+	char **events, *format, *buf;
+	int i, size, rc = 0;
+
+	events = tracefs_system_events(NULL, cxl_system);
+	if (!events)
+		return -ENOENT;
+
+	for (i = 0; events[i]; i++) {
+		format = tracefs_event_file_read(NULL, cxl_system, events[i],
+						 "format", &size);
+		if (!format)
+			continue;
+		buf = malloc(sys_len + size);
+		if (!buf) {
+			free(format);
+			rc = -ENOMEM;
+			break;
+		}
+		memcpy(buf, cxl_system, sys_len);
+		memcpy(buf + sys_len, format, size);
+		rc = evlog_append(log, EVLOG_TRACE_FORMAT, 0, buf,
+				  sys_len + size);
+		free(buf);
+		free(format);
+		if (rc)
+			break;
+	}
+	tracefs_list_free(events);
+	return rc;
+}
+
+static int monitor_log_record(struct tep_event *event,
+			      struct tep_record *record, struct event_ctx *ectx)
+{
+	return evlog_append(&monitor.evlog, EVLOG_TRACE_EVENT, record->ts,
+			    record->data, record->size);
+}
+
+/* plain json goes straight into the output buffer, without a json-c tree */
+static int monitor_emit_record(struct tep_event *event,
+			       struct tep_record *record, struct event_ctx *ectx)
+{
+	int rc = trace_event_to_text(event, record, ectx, &monitor.out);
+
+	if (monitor.out.len >= MONITOR_FLUSH_SIZE)
+		monitor_flush(&monitor.out);
+	return rc;
+}
+
+/* everything drained in one pass goes out in few writes */
+static void monitor_print_jlist(struct event_ctx *ectx, int jflag)
+{
+	struct strbuf *out = &monitor.out;
+	struct jlist_node *jnode, *next;
+
+	list_for_each_safe(&ectx->jlist_head, jnode, next, list) {
+		strbuf_addstr(out,
+			json_object_to_json_string_ext(jnode->jobj, jflag));
+		strbuf_addch(out, '\n');
+		if (out->len >= MONITOR_FLUSH_SIZE)
+			monitor_flush(out);
+		list_del(&jnode->list);
+		json_object_put(jnode->jobj);
+		free(jnode);
+	}
+}
+
+static volatile sig_atomic_t monitor_stop;
+
+static void monitor_stop_handler(int sig)
+{
+	monitor_stop = 1;
+}
+
+/*
+ * Stop the event loop on SIGINT or SIGTERM rather than dying, so that
+ * the repeats absorbed by open aggregation windows are reported and
+ * tracing is disabled. The signals stay blocked outside of
+ * epoll_pwait() with @waitmask, so one can not slip in between the
+ * check of monitor_stop and the wait.
+ */
+static int monitor_stop_signals(sigset_t *waitmask)
+{
+	struct sigaction act = { .sa_handler = monitor_stop_handler };
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigemptyset(&act.sa_mask);
+	if (sigaction(SIGINT, &act, NULL) < 0
+			|| sigaction(SIGTERM, &act, NULL) < 0
+			|| sigprocmask(SIG_BLOCK, &mask, waitmask) < 0)
+		return -errno;
+	sigdelset(waitmask, SIGINT);
+	sigdelset(waitmask, SIGTERM);
+	return 0;
+}
 
 static int monitor_event(struct cxl_ctx *ctx)
 {
+	struct strbuf *out = &monitor.out;
 	int fd, epollfd, rc = 0, timeout = -1;
 	struct epoll_event ev, *events;
 	struct tracefs_instance *inst;
 	struct event_ctx ectx;
+	sigset_t waitmask;
 	int jflag;
 
 	events = calloc(1, sizeof(struct epoll_event));
@@ -94,40 +229,98 @@ static int monitor_event(struct cxl_ctx *ctx)
 
 	memset(&ectx, 0, sizeof(ectx));
 	ectx.system = cxl_system;
+	ectx.tep = trace_event_tep_load(cxl_system);
+	if (!ectx.tep) {
+		rc = -ENOMEM;
+		err(&monitor, "failed to load %s event formats\n", cxl_system);
+		goto tep_err;
+	}
+
+	if (monitor.binary) {
+		ectx.parse_event = monitor_log_record;
+		rc = evlog_start_session(&monitor.evlog, cxl_system,
+					 monitor_now_ns());
+		if (rc == 0)
+			rc = monitor_log_formats(&monitor.evlog);
+		if (rc == 0)
+			rc = evlog_flush(&monitor.evlog);
+		if (rc) {
+			err(&monitor, "failed to start the log session: %d\n", rc);
+			goto parse_err;
+		}
+	} else if (!monitor.human)
+		ectx.parse_event = monitor_emit_record;
+
+	if (monitor.aggregate) {
+		monitor.agg.window = monitor.aggregate * 1000;
+		monitor.agg.key = "memdev";
+		list_head_init(&monitor.agg.buckets);
+		ectx.agg = &monitor.agg;
+	}
+
 	if (monitor.human)
 		jflag = JSON_C_TO_STRING_PRETTY;
 	else
 		jflag = JSON_C_TO_STRING_PLAIN;
 
-	while (1) {
-		struct jlist_node *jnode, *next;
+	rc = monitor_stop_signals(&waitmask);
+	if (rc) {
+		err(&monitor, "failed to set up signal handling: %d\n", rc);
+		goto parse_err;
+	}
 
-		rc = epoll_wait(epollfd, events, 1, timeout);
+	while (!monitor_stop) {
+		if (ectx.agg)
+			timeout = trace_agg_timeout(ectx.agg);
+		rc = epoll_pwait(epollfd, events, 1, timeout, &waitmask);
 		if (rc < 0) {
 			rc = -errno;
-			if (errno != EINTR)
-				err(&monitor, "epoll_wait error: %d\n", -errno);
+			if (rc == -EINTR) {
+				rc = 0;
+				continue;
+			}
+			err(&monitor, "epoll_wait error: %d\n", rc);
 			break;
 		}
 
+		/* summarize closed windows ahead of the events that follow */
 		list_head_init(&ectx.jlist_head);
+		if (trace_agg_expire(&ectx, false) < 0)
+			err(&monitor, "failed to summarize repeated events\n");
+		monitor_print_jlist(&ectx, jflag);
+
 		rc = trace_event_parse(inst, &ectx);
 		if (rc < 0)
 			goto parse_err;
 
-		if (list_empty(&ectx.jlist_head))
+		if (monitor.binary) {
+			rc = evlog_flush(&monitor.evlog);
+			if (rc) {
+				err(&monitor, "log write failed: %d\n", rc);
+				goto parse_err;
+			}
 			continue;
+		}
 
-		list_for_each_safe(&ectx.jlist_head, jnode, next, list) {
-			notice(&monitor, "%s\n",
-				json_object_to_json_string_ext(jnode->jobj, jflag));
-			list_del(&jnode->list);
-			json_object_put(jnode->jobj);
-			free(jnode);
+		if (!monitor.human) {
+			monitor_flush(out);
+			continue;
 		}
+
+		monitor_print_jlist(&ectx, jflag);
+		monitor_flush(out);
 	}
 
+	/* don't lose the counts of windows still open */
+	list_head_init(&ectx.jlist_head);
+	if (trace_agg_expire(&ectx, true) < 0)
+		err(&monitor, "failed to summarize repeated events\n");
+	monitor_print_jlist(&ectx, jflag);
+	monitor_flush(out);
 parse_err:
+	trace_event_plans_free(&ectx);
+	tep_free(ectx.tep);
+tep_err:
 	if (trace_event_disable(inst) < 0)
 		err(&monitor, "failed to disable tracing\n");
 event_en_err:
@@ -138,6 +331,7 @@ inst_file_err:
 inst_err:
 	close(epollfd);
 epoll_err:
+	strbuf_release(out);
 	free(events);
 	return rc;
 }
@@ -148,6 +342,11 @@ int cmd_monitor(int argc, const char **argv, struct cxl_ctx *ctx)
 		OPT_FILENAME('l', "log", &monitor.log,
 				"<file> | standard",
 				"where to output the monitor's notification"),
+		OPT_STRING('\0', "log-format", &monitor.log_format,
+				"json | binary",
+				"format of the notifications in the log file"),
+		OPT_UINTEGER('\0', "aggregate", &monitor.aggregate,
+				"coalesce repeats of an event within <n> seconds"),
 		OPT_BOOLEAN('\0', "daemon", &monitor.daemon,
 				"run cxl monitor as a daemon"),
 		OPT_BOOLEAN('u', "human", &monitor.human,
@@ -187,9 +386,33 @@ int cmd_monitor(int argc, const char **argv, struct cxl_ctx *ctx)
 	else
 		monitor.ctx.log_priority = LOG_INFO;
 
-	if (strcmp(log, "./standard") == 0)
+	if (monitor.log_format && strcmp(monitor.log_format, "binary") == 0)
+		monitor.binary = true;
+	else if (monitor.log_format && strcmp(monitor.log_format, "json") != 0) {
+		error("unknown log format: %s\n", monitor.log_format);
+		return -EINVAL;
+	}
+
+	if (monitor.binary && monitor.aggregate) {
+		error("--aggregate is not supported with --log-format=binary\n");
+		return -EINVAL;
+	}
+
+	if (strcmp(log, "./standard") == 0) {
+		if (monitor.binary) {
+			error("--log-format=binary needs a log file\n");
+			return -EINVAL;
+		}
+		monitor.ctx.log_fn = log_standard;
+	} else if (monitor.binary) {
+		/* notifications go to the log, diagnostics to stderr */
+		rc = evlog_open(&monitor.evlog, log);
+		if (rc) {
+			error("open %s failed: %d\n", log, rc);
+			goto out;
+		}
 		monitor.ctx.log_fn = log_standard;
-	else {
+	} else {
 		monitor.ctx.log_file = fopen(log, "a+");
 		if (!monitor.ctx.log_file) {
 			rc = -errno;
@@ -210,7 +433,147 @@ int cmd_monitor(int argc, const char **argv, struct cxl_ctx *ctx)
 	rc = monitor_event(ctx);
 
 out:
+	if (monitor.binary)
+		evlog_close(&monitor.evlog);
 	if (monitor.ctx.log_file)
 		fclose(monitor.ctx.log_file);
 	return rc;
 }
+
+static int decode_session(struct tep_handle **tep, struct evlog_reader *r)
+{
+	struct evlog_session *session = r->payload;
+
+	if (r->size < sizeof(*session))
+		return -EIO;
+
+	tep_free(*tep);
+	*tep = tep_alloc();
+	if (!*tep)
+		return -ENOMEM;
+	tep_set_long_size(*tep, session->long_size);
+	tep_set_page_size(*tep, le32_to_cpu(session->page_size));
+	tep_set_file_bigendian(*tep, session->big_endian ?
+			       TEP_BIG_ENDIAN : TEP_LITTLE_ENDIAN);
+	return 0;
+}
+
+static int decode_format(struct tep_handle *tep, struct evlog_reader *r)
+{
+	const char *system = r->payload;
+	size_t sys_len = strnlen(system, r->size) + 1;
+
+	if (!tep || sys_len >= r->size)
+		return -EIO;
+	if (tep_parse_event(tep, system + sys_len, r->size - sys_len, system))
+		return -EINVAL;
+	return 0;
+}
+
+static void decode_flush(struct strbuf *out)
+{
+	fwrite(out->buf, 1, out->len, stdout);
+	strbuf_setlen(out, 0);
+}
+
+static int decode_emit_record(struct tep_event *event,
+			      struct tep_record *record, struct event_ctx *ectx)
+{
+	int rc = trace_event_to_text(event, record, ectx, &monitor.out);
+
+	if (monitor.out.len >= MONITOR_FLUSH_SIZE)
+		decode_flush(&monitor.out);
+	return rc;
+}
+
+static int decode_event(struct tep_handle *tep, struct evlog_reader *r,
+			struct event_ctx *ectx, int jflag)
+{
+	struct tep_record record = {
+		.ts = r->timestamp,
+		.data = r->payload,
+		.size = r->size,
+	};
+	struct jlist_node *jnode, *next;
+	int rc;
+
+	if (!tep)
+		return -EIO;
+
+	list_head_init(&ectx->jlist_head);
+	rc = trace_event_record(tep, &record, ectx);
+	list_for_each_safe(&ectx->jlist_head, jnode, next, list) {
+		printf("%s\n", json_object_to_json_string_ext(jnode->jobj,
+							      jflag));
+		list_del(&jnode->list);
+		json_object_put(jnode->jobj);
+		free(jnode);
+	}
+	return rc;
+}
+
+int cmd_decode_log(int argc, const char **argv, struct cxl_ctx *ctx)
+{
+	bool human = false;
+	const struct option options[] = {
+		OPT_BOOLEAN('u', "human", &human,
+				"use human friendly output formats"),
+		OPT_END(),
+	};
+	const char * const u[] = {
+		"cxl decode-log <log-file> [<options>]",
+		NULL
+	};
+	struct event_ctx ectx = { .system = cxl_system };
+	struct tep_handle *tep = NULL;
+	struct evlog_reader r;
+	int rc, jflag;
+
+	argc = parse_options(argc, argv, options, u, 0);
+	if (argc != 1)
+		usage_with_options(u, options);
+
+	jflag = human ? JSON_C_TO_STRING_PRETTY : JSON_C_TO_STRING_PLAIN;
+	if (!human)
+		ectx.parse_event = decode_emit_record;
+	rc = evlog_reader_open(&r, argv[0]);
+	if (rc) {
+		error("%s: not a binary monitor log: %s\n", argv[0],
+		      strerror(-rc));
+		return rc;
+	}
+
+	while ((rc = evlog_read(&r)) > 0) {
+		switch (r.type) {
+		case EVLOG_SESSION:
+			/* plans refer to the events of the previous session */
+			trace_event_plans_free(&ectx);
+			rc = decode_session(&tep, &r);
+			break;
+		case EVLOG_TRACE_FORMAT:
+			rc = decode_format(tep, &r);
+			break;
+		case EVLOG_TRACE_EVENT:
+			rc = decode_event(tep, &r, &ectx, jflag);
+			/* events without a format in the session are skipped */
+			if (rc == -ENOENT)
+				rc = 0;
+			break;
+		default:
+			break;
+		}
+		if (rc < 0)
+			break;
+	}
+
+	decode_flush(&monitor.out);
+	if (rc == -EIO)
+		error("%s: log is truncated or corrupt\n", argv[0]);
+	else if (rc < 0)
+		error("%s: decode failed: %s\n", argv[0], strerror(-rc));
+	strbuf_release(&monitor.out);
+	trace_event_plans_free(&ectx);
+	tep_free(tep);
+	evlog_reader_close(&r);
+	return rc;
+}
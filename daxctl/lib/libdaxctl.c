@@ -155,6 +155,8 @@ DAXCTL_EXPORT void daxctl_unref(struct daxctl_ctx *ctx)
 	if (ctx->refcount > 0)
 		return;
 
+	sysfs_cache_flush(ctx);
+
 	list_for_each_safe(&ctx->regions, region, _r, list)
 		free_region(region, &ctx->regions);
 
@@ -482,11 +484,13 @@ static void *add_dax_dev(void *parent, int id, const char *daxdev_base)
 	struct daxctl_ctx *ctx = region->ctx;
 	struct daxctl_dev *dev, *dev_dup;
 	char buf[SYSFS_ATTR_SIZE];
+	struct sysfs_dir dir;
 	struct stat st;
 
 	if (!path)
 		return NULL;
 	dbg(ctx, "%s: base: \'%s\'\n", __func__, daxdev_base);
+	sysfs_dir_open(ctx, &dir, daxdev_base);
 
 	dev = calloc(1, sizeof(*dev));
 	if (!dev)
@@ -500,20 +504,17 @@ static void *add_dax_dev(void *parent, int id, const char *daxdev_base)
 	dev->major = major(st.st_rdev);
 	dev->minor = minor(st.st_rdev);
 
-	sprintf(path, "%s/resource", daxdev_base);
-	if (sysfs_read_attr(ctx, path, buf) == 0)
+	if (sysfs_dir_read_attr(&dir, "resource", buf) == 0)
 		dev->resource = strtoull(buf, NULL, 0);
 	else
 		dev->resource = iomem_get_dev_resource(ctx, daxdev_base);
 
-	sprintf(path, "%s/size", daxdev_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "size", buf) < 0)
 		goto err_read;
 	dev->size = strtoull(buf, NULL, 0);
 
 	/* Device align attribute is only available in v5.10 or up */
-	sprintf(path, "%s/align", daxdev_base);
-	if (!sysfs_read_attr(ctx, path, buf))
+	if (!sysfs_dir_read_attr(&dir, "align", buf))
 		dev->align = strtoull(buf, NULL, 0);
 	else
 		dev->align = 0;
@@ -527,8 +528,7 @@ static void *add_dax_dev(void *parent, int id, const char *daxdev_base)
 		goto err_read;
 	dev->buf_len = strlen(daxdev_base) + 50;
 
-	sprintf(path, "%s/target_node", daxdev_base);
-	if (sysfs_read_attr(ctx, path, buf) == 0)
+	if (sysfs_dir_read_attr(&dir, "target_node", buf) == 0)
 		dev->target_node = strtol(buf, NULL, 0);
 	else
 		dev->target_node = -1;
@@ -536,12 +536,14 @@ static void *add_dax_dev(void *parent, int id, const char *daxdev_base)
 	daxctl_dev_foreach(region, dev_dup)
 		if (dev_dup->id == dev->id) {
 			free_dev(dev, NULL);
+			sysfs_dir_close(&dir);
 			free(path);
 			return dev_dup;
 		}
 	dev->num_mappings = -1;
 	list_head_init(&dev->mappings);
 	list_add(&region->devices, &dev->list);
+	sysfs_dir_close(&dir);
 	free(path);
 	return dev;
 
@@ -550,6 +552,7 @@ static void *add_dax_dev(void *parent, int id, const char *daxdev_base)
 	free(dev->dev_path);
 	free(dev);
  err_dev:
+	sysfs_dir_close(&dir);
 	free(path);
 	return NULL;
 }
@@ -1194,13 +1197,15 @@ static void mappings_init(struct daxctl_dev *dev)
 {
 	struct daxctl_ctx *ctx = daxctl_dev_get_ctx(dev);
 	char buf[SYSFS_ATTR_SIZE];
-	char *path = dev->dev_buf;
+	struct sysfs_dir dir;
+	char attr[32];
 	int i;
 
 	if (dev->num_mappings != -1)
 		return;
 
 	dev->num_mappings = 0;
+	sysfs_dir_open(ctx, &dir, dev->dev_path);
 	for (;;) {
 		struct daxctl_mapping *mapping;
 		unsigned long long pgoff, start, end;
@@ -1213,22 +1218,22 @@ static void mappings_init(struct daxctl_dev *dev)
 			continue;
 		}
 
-		sprintf(path, "%s/mapping%d/start", dev->dev_path, i);
-		if (sysfs_read_attr(ctx, path, buf) < 0) {
+		sprintf(attr, "mapping%d/start", i);
+		if (sysfs_dir_read_attr(&dir, attr, buf) < 0) {
 			free(mapping);
 			break;
 		}
 		start = strtoull(buf, NULL, 0);
 
-		sprintf(path, "%s/mapping%d/end", dev->dev_path, i);
-		if (sysfs_read_attr(ctx, path, buf) < 0) {
+		sprintf(attr, "mapping%d/end", i);
+		if (sysfs_dir_read_attr(&dir, attr, buf) < 0) {
 			free(mapping);
 			break;
 		}
 		end = strtoull(buf, NULL, 0);
 
-		sprintf(path, "%s/mapping%d/page_offset", dev->dev_path, i);
-		if (sysfs_read_attr(ctx, path, buf) < 0) {
+		sprintf(attr, "mapping%d/page_offset", i);
+		if (sysfs_dir_read_attr(&dir, attr, buf) < 0) {
 			free(mapping);
 			break;
 		}
@@ -1242,6 +1247,7 @@ static void mappings_init(struct daxctl_dev *dev)
 		dev->num_mappings++;
 		list_add(&dev->mappings, &mapping->list);
 	}
+	sysfs_dir_close(&dir);
 }
 
 DAXCTL_EXPORT struct daxctl_mapping *daxctl_mapping_get_first(struct daxctl_dev *dev)
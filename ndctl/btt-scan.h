@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2015-2020 Intel Corporation. All rights reserved. */
+#ifndef _NDCTL_BTT_SCAN_H_
+#define _NDCTL_BTT_SCAN_H_
+
+#include <ccan/short_types/short_types.h>
+
+/*
+ * A btt_map_scan_fn resolves @nr raw (little-endian) BTT map entries starting
+ * at external LBA @lba into post-map internal block numbers in @out,
+ * stripping the Z/E flag bits and accounting for entries in the 'initial
+ * state'. It stops at the first entry that maps to a block >= @limit and
+ * returns the number of entries resolved, i.e. @nr if all are in bounds.
+ */
+typedef u32 (*btt_map_scan_fn)(const u32 *map, u32 lba, u32 nr, u32 limit,
+		u32 *out);
+
+u32 btt_map_scan_scalar(const u32 *map, u32 lba, u32 nr, u32 limit, u32 *out);
+#if defined(__x86_64__) || defined(__i386__)
+u32 btt_map_scan_sse42(const u32 *map, u32 lba, u32 nr, u32 limit, u32 *out);
+u32 btt_map_scan_avx2(const u32 *map, u32 lba, u32 nr, u32 limit, u32 *out);
+#endif
+
+/* the fastest implementation the cpu supports, detected once at startup */
+btt_map_scan_fn btt_map_scan_select(void);
+const char *btt_map_scan_name(btt_map_scan_fn fn);
+
+#endif /* _NDCTL_BTT_SCAN_H_ */
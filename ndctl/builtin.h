@@ -28,6 +28,7 @@ int cmd_activate_firmware(int argc, const char **argv, struct ndctl_ctx *ctx);
 int cmd_start_scrub(int argc, const char **argv, struct ndctl_ctx *ctx);
 int cmd_list(int argc, const char **argv, struct ndctl_ctx *ctx);
 int cmd_monitor(int argc, const char **argv, struct ndctl_ctx *ctx);
+int cmd_decode_log(int argc, const char **argv, struct ndctl_ctx *ctx);
 #ifdef ENABLE_TEST
 int cmd_test(int argc, const char **argv, struct ndctl_ctx *ctx);
 #endif
@@ -6,6 +6,7 @@
 #include <setjmp.h>
 #include <signal.h>
 #include <stdint.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <limits.h>
@@ -15,28 +16,27 @@
 #include <uuid/uuid.h>
 #include <sys/types.h>
 #include <util/json.h>
+#include <json-c/json.h>
 #include <util/size.h>
 #include <util/util.h>
+#include <util/strbuf.h>
 #include <util/bitmap.h>
 #include <util/fletcher.h>
 #include <ndctl/ndctl.h>
 #include <ndctl/libndctl.h>
 #include <ndctl/namespace.h>
+#include <ndctl/btt-scan.h>
+#include <ndctl/check.h>
 #include <ccan/endian/endian.h>
+#include <ccan/container_of/container_of.h>
 #include <ccan/minmax/minmax.h>
 #include <ccan/array_size/array_size.h>
 #include <ccan/short_types/short_types.h>
 
-struct check_opts {
-	bool verbose;
-	bool force;
-	bool repair;
-	bool logfix;
-};
-
 struct btt_chk {
 	char *path;
 	int fd;
+	int dio_fd;
 	uuid_t parent_uuid;
 	unsigned long long rawsize;
 	unsigned long long nlba;
@@ -44,8 +44,11 @@ struct btt_chk {
 	int num_arenas;
 	long sys_page_size;
 	struct arena_info *arena;
+	struct btt_state *state;
+	struct btt_sb_probes *probes;
 	struct check_opts *opts;
 	struct log_ctx ctx;
+	log_fn log_fn;
 };
 
 struct arena_info {
@@ -69,9 +72,21 @@ struct arena_info {
 	int num;
 	struct btt_chk *bttc;
 	int log_index[2];
+	/* a fix was found but not applied, i.e. no --repair */
+	bool repair_pending;
 };
 
-static sigjmp_buf sj_env;
+/*
+ * SIGBUS is delivered to the thread that took the fault, so each arena
+ * check worker needs its own recovery point.
+ */
+static __thread sigjmp_buf sj_env;
+
+/*
+ * libndctl is not thread safe, serialize the calls that reconfigure a
+ * namespace when several are checked in parallel
+ */
+static pthread_mutex_t ndctl_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static void sigbus_hdl(int sig, siginfo_t *siginfo, void *ptr)
 {
@@ -84,6 +99,263 @@ static int repair_msg(struct btt_chk *bttc)
 	return 0;
 }
 
+/*
+ * Estimate the number of arenas in a BTT starting at @off, returning the
+ * bytes left over after the last one in @remaining.
+ */
+static int btt_estimate_arenas(struct btt_chk *bttc, int off, u64 *remaining)
+{
+	int est_arenas = 0;
+
+	*remaining = bttc->rawsize - off;
+	while (*remaining) {
+		if (*remaining < ARENA_MIN_SIZE && est_arenas == 0)
+			return -EINVAL;
+		if (*remaining > ARENA_MAX_SIZE) {
+			/* full-size arena */
+			*remaining -= ARENA_MAX_SIZE;
+			est_arenas++;
+			continue;
+		}
+		if (*remaining < ARENA_MIN_SIZE) {
+			/* 'remaining' was too small for another arena */
+			break;
+		} else {
+			/* last, short arena */
+			*remaining = 0;
+			est_arenas++;
+			break;
+		}
+	}
+
+	return est_arenas;
+}
+
+/*
+ * Recovering the first info block probes a number of candidate offsets
+ * for each BTT version, one after the other. Rather than waiting for each
+ * read in turn, btt_sb_prefetch() reads all the candidates up front, on
+ * up to opts->jobs threads, and btt_read_info() is served from those reads while they are
+ * available. Candidates that are only known once the first info block
+ * has been read (its info2off) are fetched in a second round. Once all
+ * candidates are in, their checksums are computed in one
+ * fletcher64_multi() pass rather than one block at a time.
+ */
+#define BTT_SB_PROBES (BTT_NUM_OFFSETS * 4)
+
+struct btt_sb_probe {
+	u64 off;
+	struct btt_sb *sb;
+	ssize_t size;
+	int errnum;
+	bool csum_valid;
+};
+
+struct btt_sb_probes {
+	struct btt_chk *bttc;
+	struct btt_sb_probe probe[BTT_SB_PROBES];
+	int nr;
+	int start;
+	int next;
+};
+
+static struct btt_sb_probe *btt_sb_probe_find(struct btt_sb_probes *probes,
+		u64 off)
+{
+	int i;
+
+	for (i = 0; i < probes->nr; i++)
+		if (probes->probe[i].off == off && probes->probe[i].sb)
+			return &probes->probe[i];
+	return NULL;
+}
+
+static void btt_sb_probe_add(struct btt_sb_probes *probes, u64 off)
+{
+	struct btt_sb_probe *probe;
+
+	if (probes->nr >= BTT_SB_PROBES || btt_sb_probe_find(probes, off))
+		return;
+	if (off + sizeof(struct btt_sb) > probes->bttc->rawsize)
+		return;
+
+	probe = &probes->probe[probes->nr];
+	probe->sb = malloc(sizeof(*probe->sb));
+	if (!probe->sb)
+		return;
+	probe->off = off;
+	probes->nr++;
+}
+
+static void *btt_sb_probe_reader(void *arg)
+{
+	struct btt_sb_probes *probes = arg;
+	struct btt_sb_probe *probe;
+	int i;
+
+	while ((i = __atomic_fetch_add(&probes->next, 1, __ATOMIC_RELAXED))
+			< probes->nr) {
+		probe = &probes->probe[i];
+		probe->size = pread(probes->bttc->fd, probe->sb,
+				sizeof(*probe->sb), probe->off);
+		probe->errnum = probe->size < 0 ? errno : 0;
+	}
+
+	return NULL;
+}
+
+/*
+ * Read the probes added since the last round. The calling thread is one
+ * of the readers, so without --jobs the reads are simply done in turn.
+ */
+static void btt_sb_probe_round(struct btt_sb_probes *probes)
+{
+	pthread_t threads[BTT_SB_PROBES];
+	int i, started, nr_threads;
+
+	nr_threads = min(probes->bttc->opts->jobs,
+			(unsigned int) (probes->nr - probes->start));
+	probes->next = probes->start;
+	for (started = 0; started < nr_threads - 1; started++)
+		if (pthread_create(&threads[started], NULL,
+					btt_sb_probe_reader, probes))
+			break;
+	/* pick up anything the threads (if any) did not get to */
+	btt_sb_probe_reader(probes);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	probes->start = probes->nr;
+}
+
+/* checksum all the fully read candidates at once */
+static void btt_sb_probe_csum(struct btt_sb_probes *probes)
+{
+	struct btt_sb_probe *batch[BTT_SB_PROBES];
+	void *addr[BTT_SB_PROBES];
+	le64 sum_save[BTT_SB_PROBES];
+	u64 sum[BTT_SB_PROBES];
+	int i, nr = 0;
+
+	for (i = 0; i < probes->nr; i++) {
+		struct btt_sb_probe *probe = &probes->probe[i];
+
+		if (!probe->sb || probe->size != sizeof(*probe->sb))
+			continue;
+		/* all infoblocks share the btt_sb layout for checksum */
+		sum_save[nr] = probe->sb->checksum;
+		probe->sb->checksum = 0;
+		addr[nr] = probe->sb;
+		batch[nr++] = probe;
+	}
+	if (!nr)
+		return;
+
+	fletcher64_multi(addr, sizeof(struct btt_sb), true, sum, nr);
+	for (i = 0; i < nr; i++) {
+		batch[i]->sb->checksum = sum_save[i];
+		batch[i]->csum_valid = sum[i] == le64_to_cpu(sum_save[i]);
+	}
+}
+
+static void btt_sb_prefetch(struct btt_chk *bttc)
+{
+	int offsets[BTT_NUM_OFFSETS] = {
+		BTT1_START_OFFSET,
+		BTT2_START_OFFSET,
+	};
+	struct btt_sb_probes *probes;
+	struct btt_sb_probe *probe;
+	int i, est_arenas;
+	u64 remaining;
+
+	probes = calloc(1, sizeof(*probes));
+	if (!probes)
+		return;
+	probes->bttc = bttc;
+
+	/* see __btt_recover_first_sb() for where these offsets come from */
+	for (i = 0; i < BTT_NUM_OFFSETS; i++) {
+		est_arenas = btt_estimate_arenas(bttc, offsets[i], &remaining);
+		if (est_arenas < 0)
+			continue;
+		btt_sb_probe_add(probes, offsets[i]);
+		if (est_arenas == 1)
+			btt_sb_probe_add(probes,
+				rounddown(bttc->rawsize - remaining, SZ_4K)
+				- BTT_INFO_SIZE);
+		else {
+			btt_sb_probe_add(probes, ARENA_MAX_SIZE - BTT_INFO_SIZE
+					+ offsets[i]);
+			btt_sb_probe_add(probes,
+				rounddown(bttc->rawsize - remaining, SZ_4K)
+				- BTT_INFO_SIZE);
+		}
+	}
+	btt_sb_probe_round(probes);
+
+	for (i = 0; i < BTT_NUM_OFFSETS; i++) {
+		u64 info2off;
+
+		probe = btt_sb_probe_find(probes, offsets[i]);
+		if (!probe || probe->size != sizeof(*probe->sb))
+			continue;
+		info2off = le64_to_cpu(probe->sb->info2off);
+		if (info2off)
+			btt_sb_probe_add(probes, info2off + offsets[i]);
+	}
+	btt_sb_probe_round(probes);
+
+	btt_sb_probe_csum(probes);
+
+	dbg(bttc, "prefetched %d info block candidates\n", probes->nr);
+	bttc->probes = probes;
+}
+
+static void btt_sb_prefetch_free(struct btt_chk *bttc)
+{
+	struct btt_sb_probes *probes = bttc->probes;
+	int i;
+
+	if (!probes)
+		return;
+	for (i = 0; i < probes->nr; i++)
+		free(probes->probe[i].sb);
+	free(probes);
+	bttc->probes = NULL;
+}
+
+static void btt_sb_probe_invalidate(struct btt_chk *bttc, u64 off)
+{
+	struct btt_sb_probe *probe;
+
+	if (!bttc->probes)
+		return;
+	probe = btt_sb_probe_find(bttc->probes, off);
+	if (!probe)
+		return;
+	free(probe->sb);
+	probe->sb = NULL;
+}
+
+/* serve a read from the prefetched candidates if possible */
+static ssize_t btt_pread_info(struct btt_chk *bttc, struct btt_sb *btt_sb,
+		u64 off)
+{
+	struct btt_sb_probe *probe = NULL;
+
+	if (bttc->probes)
+		probe = btt_sb_probe_find(bttc->probes, off);
+	if (!probe)
+		return pread(bttc->fd, btt_sb, sizeof(*btt_sb), off);
+
+	if (probe->size < 0) {
+		errno = probe->errnum;
+		return probe->size;
+	}
+	memcpy(btt_sb, probe->sb, probe->size);
+	return probe->size;
+}
+
 /**
  * btt_read_info - read an info block from a given offset
  * @bttc:	the main btt_chk structure for this btt
@@ -97,7 +369,7 @@ static int btt_read_info(struct btt_chk *bttc, struct btt_sb *btt_sb, u64 off)
 {
 	ssize_t size;
 
-	size = pread(bttc->fd, btt_sb, sizeof(*btt_sb), off);
+	size = btt_pread_info(bttc, btt_sb, off);
 	if (size < 0) {
 		err(bttc, "unable to read first info block: %s\n",
 			strerror(errno));
@@ -143,6 +415,7 @@ static int btt_write_info(struct btt_chk *bttc, struct btt_sb *btt_sb, u64 off)
 		err(bttc, "short write of the info block: %ld\n", size);
 		return -ENXIO;
 	}
+	btt_sb_probe_invalidate(bttc, off);
 
 	rc = fsync(bttc->fd);
 	if (rc < 0)
@@ -166,9 +439,10 @@ static int btt_copy_to_info2(struct arena_info *a)
 	if (!a->bttc->opts->repair) {
 		err(a->bttc, "Arena %d: BTT info2 needs to be restored\n",
 			a->num);
+		a->repair_pending = true;
 		return repair_msg(a->bttc);
 	}
-	printf("Arena %d: Restoring BTT info2\n", a->num);
+	info(a->bttc, "Arena %d: Restoring BTT info2\n", a->num);
 	memcpy(a->map.info2, a->map.info, BTT_INFO_SIZE);
 
 	ms_align = (void *)rounddown((u64)a->map.info2, a->bttc->sys_page_size);
@@ -205,6 +479,7 @@ static int btt_map_write(struct arena_info *a, u32 lba, u32 mapping)
 		err(a->bttc,
 			"Arena %d: map[%#x] needs to be updated to %#x\n",
 			a->num, lba, mapping);
+		a->repair_pending = true;
 		return repair_msg(a->bttc);
 	}
 	info(a->bttc, "Arena %d: Updating map[%#x] to %#x\n", a->num,
@@ -293,7 +568,8 @@ static int btt_log_read(struct arena_info *a, u32 lane, struct log_entry *ent)
  * In the non --repair case, even if such a buffer is passed, the write will
  * result in a fault due to the readonly mmap flags.
  */
-static int btt_info_verify(struct btt_chk *bttc, struct btt_sb *btt_sb)
+static int __btt_info_verify(struct btt_chk *bttc, struct btt_sb *btt_sb,
+		bool csum_valid)
 {
 	if (memcmp(btt_sb->signature, BTT_SIG, BTT_SIG_LEN) != 0)
 		return -ENXIO;
@@ -302,21 +578,34 @@ static int btt_info_verify(struct btt_chk *bttc, struct btt_sb *btt_sb)
 		if (uuid_compare(bttc->parent_uuid, btt_sb->parent_uuid) != 0)
 			return -ENXIO;
 
-	if (!verify_infoblock_checksum((union info_block *) btt_sb))
+	if (!csum_valid)
 		return -ENXIO;
 
 	return 0;
 }
 
+static int btt_info_verify(struct btt_chk *bttc, struct btt_sb *btt_sb)
+{
+	return __btt_info_verify(bttc, btt_sb,
+			verify_infoblock_checksum((union info_block *) btt_sb));
+}
+
 static int btt_info_read_verify(struct btt_chk *bttc, struct btt_sb *btt_sb,
 	u64 off)
 {
+	struct btt_sb_probe *probe = NULL;
 	int rc;
 
 	rc = btt_read_info(bttc, btt_sb, off);
 	if (rc)
 		return rc;
-	rc = btt_info_verify(bttc, btt_sb);
+	/* prefetched candidates were already checksummed as a batch */
+	if (bttc->probes)
+		probe = btt_sb_probe_find(bttc->probes, off);
+	if (probe)
+		rc = __btt_info_verify(bttc, btt_sb, probe->csum_valid);
+	else
+		rc = btt_info_verify(bttc, btt_sb);
 	if (rc)
 		return rc;
 	return 0;
@@ -333,6 +622,7 @@ enum btt_errcodes {
 	BTT_MAP_OOB,
 	BTT_BITMAP_ERROR,
 	BTT_LOGFIX_ERR,
+	BTT_SIGBUS,
 };
 
 static void btt_xlat_status(struct arena_info *a, int errcode)
@@ -385,95 +675,369 @@ static void btt_xlat_status(struct arena_info *a, int errcode)
 			"arena %d: rewrite-log error: log may be in an unknown/unrecoverable state\n",
 			a->num);
 		break;
+	case BTT_SIGBUS:
+		err(a->bttc,
+			"arena %d: received a SIGBUS, metadata corruption found\n",
+			a->num);
+		break;
 	default:
 		err(a->bttc, "arena %d: unknown error: %d\n",
 			a->num, errcode);
 	}
 }
 
-/* Check that log entries are self consistent */
-static int btt_check_log_entries(struct arena_info *a)
+/*
+ * The map/log/bitmap verification is fused so that the map, which has an
+ * entry per external LBA and dominates the metadata size, is read exactly
+ * once per check. The flog only has 'nfree' lanes, so it is read up front
+ * and everything the map pass needs from it is kept in struct btt_verify.
+ */
+struct btt_fixup {
+	u32 lane;
+	u32 lba;
+	u32 mapping;
+	u32 new_map;
+};
+
+struct btt_verify {
+	struct arena_info *a;
+	struct log_entry *ent;		/* current ('new') entry of each lane */
+	struct btt_fixup *fixup;	/* map entries that lag behind the flog */
+	u32 nr_fixups;
+	struct btt_fixup *sorted;	/* --repair fixups, sorted by lba */
+	u32 nr_sorted;
+	u32 next_sorted;
+	unsigned long *bm;		/* internal blocks referenced so far */
+	u32 *chunk;			/* resolved map entries, see BTT_SCAN_CHUNK */
+	u32 dup;			/* first block referenced twice by the map */
+	bool has_dup;
+};
+
+/*
+ * Check that log entries are self consistent, and cache the 'new' entry
+ * of each lane. Sequence number errors in any lane take precedence over
+ * out of bounds fields.
+ */
+static int btt_verify_log(struct btt_verify *v)
 {
+	struct arena_info *a = v->a;
 	int idx0 = a->log_index[0];
 	int idx1 = a->log_index[1];
-	unsigned int i;
-	int rc = 0;
+	int seq_err = 0, ent_err = 0;
+	u32 i;
 
-	/*
-	 * First, check both 'slots' for sequence numbers being distinct
-	 * and in bounds
-	 */
 	for (i = 0; i < a->nfree; i++) {
-		struct log_group *log = &a->map.log[i];
+		struct log_entry *ent = &v->ent[i];
+		struct log_group log;
+
+		btt_log_group_read(a, i, &log);
+		if (!seq_err) {
+			if (log_seq(&log, idx0) == log_seq(&log, idx1))
+				seq_err = BTT_LOG_EQL_SEQ;
+			else if (log_seq(&log, idx0) > 3
+					|| log_seq(&log, idx1) > 3)
+				seq_err = BTT_LOG_OOB_SEQ;
+		}
 
-		if (log_seq(log, idx0) == log_seq(log, idx1))
-			return BTT_LOG_EQL_SEQ;
-		if (log_seq(log, idx0) > 3 || log_seq(log, idx1) > 3)
-			return BTT_LOG_OOB_SEQ;
+		memcpy(ent, &log.ent[a->log_index[1 - btt_log_get_old(a, &log)]],
+			LOG_ENT_SIZE);
+		if (ent_err)
+			continue;
+		if (ent->lba >= a->external_nlba)
+			ent_err = BTT_LOG_OOB_LBA;
+		else if (ent->old_map >= a->internal_nlba)
+			ent_err = BTT_LOG_OOB_OLD;
+		else if (ent->new_map >= a->internal_nlba)
+			ent_err = BTT_LOG_OOB_NEW;
 	}
-	/*
-	 * Next, check only the 'new' slot in each lane for the remaining
-	 * fields being in bounds
-	 */
-	for (i = 0; i < a->nfree; i++) {
-		struct log_entry ent;
 
-		rc = btt_log_read(a, i, &ent);
-		if (rc)
-			return rc;
+	return seq_err ? seq_err : ent_err;
+}
+
+static u32 btt_verify_lookup(struct btt_verify *v, u32 lba)
+{
+	u32 i;
+
+	/* with --repair, earlier lanes will have updated the map by now */
+	if (v->a->bttc->opts->repair)
+		for (i = v->nr_fixups; i > 0; i--)
+			if (v->fixup[i - 1].lba == lba)
+				return v->fixup[i - 1].new_map;
+	return btt_map_lookup(v->a, lba);
+}
 
-		if (ent.lba >= a->external_nlba)
-			return BTT_LOG_OOB_LBA;
-		if (ent.old_map >= a->internal_nlba)
-			return BTT_LOG_OOB_OLD;
-		if (ent.new_map >= a->internal_nlba)
-			return BTT_LOG_OOB_NEW;
+/*
+ * Find flog entries that were written without the corresponding map
+ * update. The kernel should also be able to detect and fix this
+ * condition. Only 'nfree' map entries are looked up here, the writes are
+ * deferred until the map pass has ruled out out of bounds entries.
+ */
+static void btt_verify_find_fixups(struct btt_verify *v)
+{
+	struct arena_info *a = v->a;
+	u32 i, mapping;
+
+	for (i = 0; i < a->nfree; i++) {
+		struct log_entry *ent = &v->ent[i];
+
+		mapping = btt_verify_lookup(v, ent->lba);
+		if (ent->new_map != mapping && ent->old_map == mapping)
+			v->fixup[v->nr_fixups++] = (struct btt_fixup) {
+				.lane = i,
+				.lba = ent->lba,
+				.mapping = mapping,
+				.new_map = ent->new_map,
+			};
 	}
-	return rc;
 }
 
-/* Check that map entries are self consistent */
-static int btt_check_map_entries(struct arena_info *a)
+static int btt_fixup_cmp(const void *_a, const void *_b)
 {
-	unsigned int i;
-	u32 mapping;
+	const struct btt_fixup *fa = _a, *fb = _b;
+
+	if (fa->lba != fb->lba)
+		return fa->lba < fb->lba ? -1 : 1;
+	return fa->lane < fb->lane ? -1 : (fa->lane > fb->lane);
+}
 
-	for (i = 0; i < a->external_nlba; i++) {
-		mapping = btt_map_lookup(a, i);
-		if (mapping >= a->internal_nlba)
+/* number of map entries resolved per map scan call */
+#define BTT_SCAN_CHUNK 4096
+
+static bool btt_bitmap_test_and_set(unsigned long *bm, u32 nr)
+{
+	unsigned long *word = &bm[BIT_WORD(nr)];
+	unsigned long mask = BIT_MASK(nr);
+
+	if (*word & mask)
+		return true;
+	*word |= mask;
+	return false;
+}
+
+/*
+ * Check that the map entries for @nr external LBAs starting at @lba are
+ * in bounds, and populate the bitmap of referenced internal blocks. The
+ * bounds check and flag stripping are done a chunk at a time by the
+ * (vectorized) btt_map_scan_fn helper. With --repair, the pending flog
+ * fixups are applied to the resolved values, just as if the map had been
+ * updated before the pass. Fixups are always in bounds, and only ever
+ * replace an in bounds 'old_map', so they can't change the outcome of
+ * the bounds check.
+ */
+static int btt_verify_map_range(struct btt_verify *v, const u32 *map,
+		u32 lba, u32 nr)
+{
+	struct arena_info *a = v->a;
+	btt_map_scan_fn scan = btt_map_scan_select();
+	struct btt_fixup *fixup = v->sorted;
+	u32 i, n, count, end = lba + nr;
+
+	for (; lba < end; lba += count, map += count) {
+		count = min(end - lba, (u32) BTT_SCAN_CHUNK);
+		n = scan(map, lba, count, a->internal_nlba, v->chunk);
+		if (n < count)
 			return BTT_MAP_OOB;
+
+		/* the last lane to touch an lba wins */
+		for (; v->next_sorted < v->nr_sorted
+				&& fixup[v->next_sorted].lba < lba + count;
+				v->next_sorted++)
+			v->chunk[fixup[v->next_sorted].lba - lba] =
+				fixup[v->next_sorted].new_map;
+
+		for (i = 0; i < count; i++) {
+			if (!btt_bitmap_test_and_set(v->bm, v->chunk[i]))
+				continue;
+			if (!v->has_dup) {
+				v->dup = v->chunk[i];
+				v->has_dup = true;
+			}
+		}
 	}
+
 	return 0;
 }
 
-/* Check that each flog entry has the correct corresponding map entry */
-static int btt_check_log_map(struct arena_info *a)
+/*
+ * With --stream, the map is read through an O_DIRECT descriptor in large
+ * aligned chunks rather than being faulted in through the mmap with no
+ * control over read-ahead. A reader thread fills one buffer while the
+ * other one is being verified, and memory use is bounded by the two
+ * buffers regardless of the arena size.
+ */
+#define BTT_STREAM_CHUNK SZ_4M
+#define BTT_STREAM_ALIGN SZ_4K
+
+struct btt_stream {
+	struct arena_info *a;
+	u64 start;		/* map offset rounded down to BTT_STREAM_ALIGN */
+	u64 end;		/* end of the map rounded up to BTT_STREAM_ALIGN */
+	void *buf[2];
+	ssize_t len[2];		/* bytes read into buf[], or -errno */
+	bool full[2];
+	bool stop;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static void *btt_stream_reader(void *data)
 {
-	unsigned int i;
-	u32 mapping;
-	int rc = 0, rc_saved = 0;
+	struct btt_stream *s = data;
+	int fd = s->a->bttc->dio_fd;
+	ssize_t len;
+	bool stop;
+	u64 off;
+	int i;
 
-	for (i = 0; i < a->nfree; i++) {
-		struct log_entry ent;
+	for (off = s->start, i = 0; off < s->end;
+			off += BTT_STREAM_CHUNK, i ^= 1) {
+		pthread_mutex_lock(&s->lock);
+		while (s->full[i] && !s->stop)
+			pthread_cond_wait(&s->cond, &s->lock);
+		stop = s->stop;
+		pthread_mutex_unlock(&s->lock);
+		if (stop)
+			break;
 
-		rc = btt_log_read(a, i, &ent);
-		if (rc)
-			return rc;
-		mapping = btt_map_lookup(a, ent.lba);
+		len = pread(fd, s->buf[i], min(s->end - off,
+					(u64) BTT_STREAM_CHUNK), off);
+		if (len < 0)
+			len = -errno;
+
+		pthread_mutex_lock(&s->lock);
+		s->len[i] = len;
+		s->full[i] = true;
+		pthread_cond_broadcast(&s->cond);
+		pthread_mutex_unlock(&s->lock);
+		if (len <= 0)
+			break;
+	}
 
-		/*
-		 * Case where the flog was written, but map couldn't be
-		 * updated. The kernel should also be able to detect and
-		 * fix this condition.
-		 */
-		if (ent.new_map != mapping && ent.old_map == mapping) {
-			info(a->bttc,
-				"arena %d: log[%d].new_map (%#x) doesn't match map[%#x] (%#x)\n",
-				a->num, i, ent.new_map, ent.lba, mapping);
-			rc = btt_map_write(a, ent.lba, ent.new_map);
-			if (rc)
-				rc_saved = rc;
+	return NULL;
+}
+
+static int btt_verify_map_stream(struct btt_verify *v)
+{
+	struct arena_info *a = v->a;
+	struct btt_chk *bttc = a->bttc;
+	struct btt_stream s = {
+		.a = a,
+	};
+	u32 lba = 0, nr, skip;
+	pthread_t reader;
+	ssize_t want;
+	int i, rc;
+	u64 off;
+
+	s.start = rounddown(a->mapoff, BTT_STREAM_ALIGN);
+	s.end = ALIGN(a->mapoff + (u64) a->external_nlba * sizeof(u32),
+			BTT_STREAM_ALIGN);
+	for (i = 0; i < 2; i++) {
+		rc = posix_memalign(&s.buf[i], BTT_STREAM_ALIGN,
+				BTT_STREAM_CHUNK);
+		if (rc) {
+			s.buf[i] = NULL;
+			rc = -rc;
+			goto out_free;
+		}
+	}
+	pthread_mutex_init(&s.lock, NULL);
+	pthread_cond_init(&s.cond, NULL);
+
+	rc = pthread_create(&reader, NULL, btt_stream_reader, &s);
+	if (rc) {
+		err(bttc, "arena %d: unable to start map reader: %s\n",
+			a->num, strerror(rc));
+		rc = -rc;
+		goto out_destroy;
+	}
+
+	skip = a->mapoff - s.start;
+	for (off = s.start, i = 0; lba < a->external_nlba;
+			off += BTT_STREAM_CHUNK, i ^= 1) {
+		pthread_mutex_lock(&s.lock);
+		while (!s.full[i])
+			pthread_cond_wait(&s.cond, &s.lock);
+		pthread_mutex_unlock(&s.lock);
+
+		want = min(s.end - off, (u64) BTT_STREAM_CHUNK);
+		if (s.len[i] != want) {
+			rc = s.len[i] < 0 ? s.len[i] : -EIO;
+			err(bttc, "arena %d: map read at offset %#lx failed: %s\n",
+				a->num, off, strerror(-rc));
+			break;
 		}
+
+		nr = min((u32) ((want - skip) / sizeof(u32)),
+				a->external_nlba - lba);
+		rc = btt_verify_map_range(v, s.buf[i] + skip, lba, nr);
+		if (rc)
+			break;
+		lba += nr;
+		skip = 0;
+
+		pthread_mutex_lock(&s.lock);
+		s.full[i] = false;
+		pthread_cond_broadcast(&s.cond);
+		pthread_mutex_unlock(&s.lock);
+	}
+
+	pthread_mutex_lock(&s.lock);
+	s.stop = true;
+	pthread_cond_broadcast(&s.cond);
+	pthread_mutex_unlock(&s.lock);
+	pthread_join(reader, NULL);
+ out_destroy:
+	pthread_cond_destroy(&s.cond);
+	pthread_mutex_destroy(&s.lock);
+ out_free:
+	free(s.buf[0]);
+	free(s.buf[1]);
+	return rc;
+}
+
+static int btt_verify_map(struct btt_verify *v)
+{
+	struct arena_info *a = v->a;
+	int rc;
+
+	if (a->bttc->opts->repair && v->nr_fixups) {
+		v->nr_sorted = v->nr_fixups;
+		v->sorted = malloc(v->nr_sorted * sizeof(*v->sorted));
+		if (!v->sorted)
+			return -ENOMEM;
+		memcpy(v->sorted, v->fixup, v->nr_sorted * sizeof(*v->sorted));
+		qsort(v->sorted, v->nr_sorted, sizeof(*v->sorted),
+				btt_fixup_cmp);
+	}
+
+	/* entries must not straddle stream chunks */
+	if (a->bttc->opts->stream && a->mapoff % sizeof(u32) == 0)
+		rc = btt_verify_map_stream(v);
+	else
+		rc = btt_verify_map_range(v, a->map.map, 0, a->external_nlba);
+
+	free(v->sorted);
+	v->sorted = NULL;
+	return rc;
+}
+
+static int btt_verify_apply_fixups(struct btt_verify *v)
+{
+	struct arena_info *a = v->a;
+	int rc, rc_saved = 0;
+	u32 i;
+
+	for (i = 0; i < v->nr_fixups; i++) {
+		struct btt_fixup *fixup = &v->fixup[i];
+
+		info(a->bttc,
+			"arena %d: log[%d].new_map (%#x) doesn't match map[%#x] (%#x)\n",
+			a->num, fixup->lane, fixup->new_map, fixup->lba,
+			fixup->mapping);
+		rc = btt_map_write(a, fixup->lba, fixup->new_map);
+		if (rc)
+			rc_saved = rc;
 	}
 	return rc_saved ? BTT_LOG_MAP_ERR : 0;
 }
@@ -490,56 +1054,76 @@ static int btt_check_info2(struct arena_info *a)
 }
 
 /*
- * This will create a bitmap where each bit corresponds to an internal
- * 'block'. Between the BTT map and flog (representing 'free' blocks),
- * every single internal block must be represented exactly once. This
- * check will detect cases where either one or more blocks are never
- * referenced, or if a block is referenced more than once.
+ * Between the BTT map and flog (representing 'free' blocks), every single
+ * internal block must be represented exactly once. The map's share of the
+ * bitmap was populated by btt_verify_map(), add the flog's share and
+ * detect cases where either one or more blocks are never referenced, or
+ * if a block is referenced more than once.
  */
-static int btt_check_bitmap(struct arena_info *a)
+static int btt_verify_bitmap(struct btt_verify *v)
 {
-	unsigned long *bm;
-	u32 i, btt_mapping;
-	int rc = BTT_BITMAP_ERROR;
-
-	bm = bitmap_alloc(a->internal_nlba);
-	if (bm == NULL)
-		return -ENOMEM;
+	struct arena_info *a = v->a;
+	u32 i;
 
-	/* map 'external_nlba' number of map entries */
-	for (i = 0; i < a->external_nlba; i++) {
-		btt_mapping = btt_map_lookup(a, i);
-		if (test_bit(btt_mapping, bm)) {
-			info(a->bttc,
-				"arena %d: internal block %#x is referenced by two map entries\n",
-				a->num, btt_mapping);
-			goto out;
-		}
-		bitmap_set(bm, btt_mapping, 1);
+	if (v->has_dup) {
+		info(a->bttc,
+			"arena %d: internal block %#x is referenced by two map entries\n",
+			a->num, v->dup);
+		return BTT_BITMAP_ERROR;
 	}
 
-	/* map 'nfree' number of flog entries */
 	for (i = 0; i < a->nfree; i++) {
-		struct log_entry ent;
+		struct log_entry *ent = &v->ent[i];
 
-		rc = btt_log_read(a, i, &ent);
-		if (rc)
-			goto out;
-		if (test_bit(ent.old_map, bm)) {
+		if (test_bit(ent->old_map, v->bm)) {
 			info(a->bttc,
 				"arena %d: internal block %#x is referenced by two map/log entries\n",
-				a->num, ent.old_map);
-			rc = BTT_BITMAP_ERROR;
-			goto out;
+				a->num, ent->old_map);
+			return BTT_BITMAP_ERROR;
 		}
-		bitmap_set(bm, ent.old_map, 1);
+		bitmap_set(v->bm, ent->old_map, 1);
+	}
+
+	if (!bitmap_full(v->bm, a->internal_nlba))
+		return BTT_BITMAP_ERROR;
+	return 0;
+}
+
+static int btt_verify_arena(struct arena_info *a)
+{
+	struct btt_verify v = {
+		.a = a,
+	};
+	int rc;
+
+	v.ent = calloc(a->nfree, sizeof(*v.ent));
+	v.fixup = calloc(a->nfree, sizeof(*v.fixup));
+	v.bm = bitmap_alloc(a->internal_nlba);
+	v.chunk = malloc(BTT_SCAN_CHUNK * sizeof(*v.chunk));
+	if (!v.ent || !v.fixup || !v.bm || !v.chunk) {
+		rc = -ENOMEM;
+		goto out;
 	}
 
-	/* check that the bitmap is full */
-	if (!bitmap_full(bm, a->internal_nlba))
-		rc = BTT_BITMAP_ERROR;
+	rc = btt_verify_log(&v);
+	if (rc)
+		goto out;
+	btt_verify_find_fixups(&v);
+	rc = btt_verify_map(&v);
+	if (rc)
+		goto out;
+	rc = btt_verify_apply_fixups(&v);
+	if (rc)
+		goto out;
+	rc = btt_check_info2(a);
+	if (rc)
+		goto out;
+	rc = btt_verify_bitmap(&v);
  out:
-	free(bm);
+	free(v.chunk);
+	free(v.bm);
+	free(v.fixup);
+	free(v.ent);
 	return rc;
 }
 
@@ -581,40 +1165,461 @@ static int btt_rewrite_log(struct arena_info *a)
 	return 0;
 }
 
-static int btt_check_arenas(struct btt_chk *bttc)
+/*
+ * With --state-file, the info block and flog checksums of every arena
+ * found to be clean are recorded so that a rerun, e.g. after an
+ * interrupted maintenance window, can skip those arenas. Every write to
+ * a BTT consumes a free block through the flog, so an arena whose info
+ * block and flog are unchanged has not been written since it was
+ * verified. The file holds one line per arena, and records for other
+ * BTTs are preserved, so a single file can be shared by several
+ * namespaces:
+ *
+ *	<btt uuid> <arena> <info checksum> <flog checksum> <verified lbas>
+ */
+struct btt_state_ent {
+	uuid_t uuid;
+	int arena;
+	u64 info_csum;
+	u64 log_csum;
+	u32 lba;
+};
+
+struct btt_state {
+	const char *path;
+	struct btt_state_ent *ent;
+	int nr;
+	pthread_mutex_t lock;
+};
+
+/*
+ * When several namespaces are checked in parallel they share a single
+ * copy of the state, so that their updates to the file do not clobber
+ * each other.
+ */
+static pthread_mutex_t btt_state_users_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct btt_state *btt_state_shared;
+static int btt_state_users;
+
+static int btt_state_read(struct btt_chk *bttc, struct btt_state *state)
 {
-	struct arena_info *a = NULL;
-	int i, rc;
+	unsigned long long info_csum, log_csum;
+	struct btt_state_ent ent, *new;
+	char uuid[40];
+	FILE *f;
+	int rc;
 
-	for(i = 0; i < bttc->num_arenas; i++) {
-		info(bttc, "checking arena %d\n", i);
-		a = &bttc->arena[i];
-		rc = btt_check_log_entries(a);
-		if (rc)
-			break;
-		rc = btt_check_map_entries(a);
-		if (rc)
+	f = fopen(state->path, "r");
+	if (!f) {
+		if (errno == ENOENT)
+			return 0;
+		err(bttc, "unable to open state file %s: %s\n", state->path,
+			strerror(errno));
+		return -errno;
+	}
+
+	while ((rc = fscanf(f, "%36s %d %llx %llx %u\n", uuid, &ent.arena,
+					&info_csum, &log_csum, &ent.lba)) == 5) {
+		if (uuid_parse(uuid, ent.uuid) != 0)
 			break;
-		rc = btt_check_log_map(a);
+		ent.info_csum = info_csum;
+		ent.log_csum = log_csum;
+		new = realloc(state->ent, (state->nr + 1) * sizeof(ent));
+		if (!new) {
+			fclose(f);
+			return -ENOMEM;
+		}
+		state->ent = new;
+		state->ent[state->nr++] = ent;
+	}
+	fclose(f);
+
+	if (rc != EOF) {
+		err(bttc, "state file %s is corrupt, ignoring it\n",
+			state->path);
+		state->nr = 0;
+	}
+	dbg(bttc, "loaded %d arena records from %s\n", state->nr,
+		state->path);
+	return 0;
+}
+
+static int btt_state_load(struct btt_chk *bttc)
+{
+	struct btt_state *state;
+	int rc = 0;
+
+	pthread_mutex_lock(&btt_state_users_lock);
+	if (btt_state_shared) {
+		btt_state_users++;
+		bttc->state = btt_state_shared;
+		goto out;
+	}
+
+	state = calloc(1, sizeof(*state));
+	if (!state) {
+		rc = -ENOMEM;
+		goto out;
+	}
+	state->path = bttc->opts->state_file;
+	pthread_mutex_init(&state->lock, NULL);
+
+	rc = btt_state_read(bttc, state);
+	if (rc) {
+		pthread_mutex_destroy(&state->lock);
+		free(state->ent);
+		free(state);
+		goto out;
+	}
+
+	btt_state_shared = state;
+	btt_state_users = 1;
+	bttc->state = state;
+ out:
+	pthread_mutex_unlock(&btt_state_users_lock);
+	return rc;
+}
+
+static void btt_state_free(struct btt_chk *bttc)
+{
+	struct btt_state *state = bttc->state;
+
+	if (!state)
+		return;
+	bttc->state = NULL;
+
+	pthread_mutex_lock(&btt_state_users_lock);
+	if (--btt_state_users == 0) {
+		btt_state_shared = NULL;
+		pthread_mutex_destroy(&state->lock);
+		free(state->ent);
+		free(state);
+	}
+	pthread_mutex_unlock(&btt_state_users_lock);
+}
+
+/* write to a temporary file and rename it, so the file is never torn */
+static int btt_state_save(struct btt_chk *bttc)
+{
+	struct btt_state *state = bttc->state;
+	char uuid[40], *tmp;
+	int i, rc = 0;
+	FILE *f;
+
+	if (asprintf(&tmp, "%s.tmp", state->path) < 0)
+		return -ENOMEM;
+
+	f = fopen(tmp, "w");
+	if (!f) {
+		rc = -errno;
+		goto out;
+	}
+	for (i = 0; i < state->nr; i++) {
+		struct btt_state_ent *ent = &state->ent[i];
+
+		uuid_unparse(ent->uuid, uuid);
+		fprintf(f, "%s %d %#llx %#llx %u\n", uuid, ent->arena,
+			(unsigned long long) ent->info_csum,
+			(unsigned long long) ent->log_csum, ent->lba);
+	}
+	if (fflush(f) != 0 || fsync(fileno(f)) < 0)
+		rc = -errno;
+	if (fclose(f) != 0 && !rc)
+		rc = -errno;
+	if (!rc && rename(tmp, state->path) < 0)
+		rc = -errno;
+	if (rc)
+		unlink(tmp);
+ out:
+	if (rc)
+		err(bttc, "unable to update state file %s: %s\n",
+			state->path, strerror(-rc));
+	free(tmp);
+	return rc;
+}
+
+static void btt_state_ent_init(struct arena_info *a,
+		struct btt_state_ent *ent)
+{
+	memcpy(ent->uuid, a->map.info->uuid, sizeof(ent->uuid));
+	ent->arena = a->num;
+	ent->info_csum = le64_to_cpu(a->map.info->checksum);
+	ent->log_csum = fletcher64(a->map.log, a->nfree * LOG_GRP_SIZE, true);
+	ent->lba = 0;
+}
+
+static struct btt_state_ent *btt_state_find(struct btt_state *state,
+		struct btt_state_ent *ent)
+{
+	int i;
+
+	for (i = 0; i < state->nr; i++)
+		if (uuid_compare(state->ent[i].uuid, ent->uuid) == 0
+				&& state->ent[i].arena == ent->arena)
+			return &state->ent[i];
+	return NULL;
+}
+
+static bool btt_state_is_verified(struct arena_info *a)
+{
+	struct btt_state *state = a->bttc->state;
+	struct btt_state_ent ent, *found;
+	bool verified = false;
+
+	/* --rewrite-log has to touch every arena */
+	if (!state || a->bttc->opts->logfix)
+		return false;
+
+	btt_state_ent_init(a, &ent);
+	pthread_mutex_lock(&state->lock);
+	found = btt_state_find(state, &ent);
+	if (found && found->info_csum == ent.info_csum
+			&& found->log_csum == ent.log_csum
+			&& found->lba == a->external_nlba)
+		verified = true;
+	pthread_mutex_unlock(&state->lock);
+
+	return verified;
+}
+
+static void btt_state_record(struct arena_info *a)
+{
+	struct btt_state *state = a->bttc->state;
+	struct btt_state_ent ent, *found, *new;
+
+	if (!state)
+		return;
+
+	/* take the checksums after any repairs */
+	btt_state_ent_init(a, &ent);
+	ent.lba = a->external_nlba;
+
+	pthread_mutex_lock(&state->lock);
+	found = btt_state_find(state, &ent);
+	if (!found) {
+		new = realloc(state->ent, (state->nr + 1) * sizeof(ent));
+		if (!new) {
+			pthread_mutex_unlock(&state->lock);
+			return;
+		}
+		state->ent = new;
+		found = &state->ent[state->nr++];
+	}
+	*found = ent;
+	btt_state_save(a->bttc);
+	pthread_mutex_unlock(&state->lock);
+}
+
+static int btt_check_arena(struct arena_info *a)
+{
+	int rc;
+
+	if (btt_state_is_verified(a)) {
+		info(a->bttc, "arena %d: verified by a previous check, skipping\n",
+			a->num);
+		return 0;
+	}
+
+	info(a->bttc, "checking arena %d\n", a->num);
+	rc = btt_verify_arena(a);
+	if (rc)
+		return rc;
+
+	if (a->bttc->opts->logfix) {
+		rc = btt_rewrite_log(a);
 		if (rc)
+			return rc;
+	}
+
+	/* an arena that still needs fixing has to be checked again */
+	if (!a->repair_pending)
+		btt_state_record(a);
+	return 0;
+}
+
+/*
+ * While arenas are checked in parallel, the messages of each arena are
+ * held in a per-arena buffer, as a struct btt_log_rec followed by the
+ * NUL terminated message, and passed on to the original log function in
+ * arena order once every arena is done, so the output is the same as
+ * that of a serial check.
+ */
+struct btt_log_rec {
+	int priority;
+	int line;
+	const char *file;
+	const char *fn;
+};
+
+static __thread struct strbuf *arena_log;
+
+static void btt_log_buffered(struct log_ctx *ctx, int priority,
+		const char *file, int line, const char *fn,
+		const char *format, va_list args)
+{
+	struct btt_chk *bttc = container_of(ctx, struct btt_chk, ctx);
+	struct btt_log_rec rec = {
+		.priority = priority,
+		.line = line,
+		.file = file,
+		.fn = fn,
+	};
+	char *msg;
+
+	if (!arena_log) {
+		bttc->log_fn(ctx, priority, file, line, fn, format, args);
+		return;
+	}
+
+	if (vasprintf(&msg, format, args) < 0)
+		return;
+	strbuf_add(arena_log, &rec, sizeof(rec));
+	strbuf_add(arena_log, msg, strlen(msg) + 1);
+	free(msg);
+}
+
+static void btt_log_replay(struct btt_chk *bttc, struct btt_log_rec *rec,
+		const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	bttc->log_fn(&bttc->ctx, rec->priority, rec->file, rec->line, rec->fn,
+			format, args);
+	va_end(args);
+}
+
+static void btt_log_flush(struct btt_chk *bttc, struct strbuf *buf)
+{
+	struct btt_log_rec rec;
+	size_t off = 0;
+	char *msg;
+
+	while (off < buf->len) {
+		memcpy(&rec, &buf->buf[off], sizeof(rec));
+		msg = &buf->buf[off + sizeof(rec)];
+		btt_log_replay(bttc, &rec, "%s", msg);
+		off += sizeof(rec) + strlen(msg) + 1;
+	}
+	strbuf_release(buf);
+}
+
+/*
+ * Arenas are laid out back to back with no shared metadata, so they can
+ * be checked (and repaired) independently of each other.
+ */
+struct btt_check_pool {
+	struct btt_chk *bttc;
+	int next;
+	int *status;
+	struct strbuf *logs;
+};
+
+static int btt_check_arena_sigsafe(struct arena_info *a)
+{
+	if (sigsetjmp(sj_env, 1))
+		return BTT_SIGBUS;
+	return btt_check_arena(a);
+}
+
+static void *btt_check_worker(void *data)
+{
+	struct btt_check_pool *pool = data;
+	struct btt_chk *bttc = pool->bttc;
+	int i;
+
+	for (;;) {
+		i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+		if (i >= bttc->num_arenas)
 			break;
-		rc = btt_check_info2(a);
-		if (rc)
+		arena_log = &pool->logs[i];
+		pool->status[i] = btt_check_arena_sigsafe(&bttc->arena[i]);
+		arena_log = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+ * Check up to opts->jobs arenas concurrently. Unlike the serial path,
+ * which stops at the first inconsistent arena, every arena is checked and
+ * the errors are reported afterwards in arena order.
+ */
+static int btt_check_arenas_parallel(struct btt_chk *bttc)
+{
+	unsigned int nr_threads, started, i;
+	struct btt_check_pool pool = {
+		.bttc = bttc,
+	};
+	pthread_t *threads;
+	int rc = 0;
+
+	nr_threads = min(bttc->opts->jobs, (unsigned int) bttc->num_arenas);
+	/* not info(), the output matches that of a serial check */
+	dbg(bttc, "checking %d arenas with %d threads\n", bttc->num_arenas,
+		nr_threads);
+
+	pool.status = calloc(bttc->num_arenas, sizeof(*pool.status));
+	pool.logs = calloc(bttc->num_arenas, sizeof(*pool.logs));
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (!pool.status || !pool.logs || !threads) {
+		rc = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < (unsigned int) bttc->num_arenas; i++)
+		pool.logs[i] = (struct strbuf) STRBUF_INIT;
+
+	bttc->log_fn = bttc->ctx.log_fn;
+	bttc->ctx.log_fn = btt_log_buffered;
+
+	for (started = 0; started < nr_threads; started++) {
+		rc = pthread_create(&threads[started], NULL, btt_check_worker,
+				&pool);
+		if (rc) {
+			err(bttc, "unable to start arena check thread: %s\n",
+				strerror(rc));
 			break;
-		/*
-		 * bitmap test has to be after check_log_map so that any
-		 * pending log updates have been performed. Otherwise the
-		 * bitmap test may result in a false positive
-		 */
-		rc = btt_check_bitmap(a);
+		}
+	}
+	/* carry on with a smaller pool if only some threads started */
+	if (started == 0) {
+		rc = -rc;
+		goto out;
+	}
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	bttc->ctx.log_fn = bttc->log_fn;
+
+	rc = 0;
+	for (i = 0; i < (unsigned int) bttc->num_arenas; i++) {
+		btt_log_flush(bttc, &pool.logs[i]);
+		if (pool.status[i] == BTT_OK)
+			continue;
+		btt_xlat_status(&bttc->arena[i], pool.status[i]);
+		rc = -ENXIO;
+	}
+ out:
+	if (bttc->log_fn)
+		bttc->ctx.log_fn = bttc->log_fn;
+	free(threads);
+	free(pool.logs);
+	free(pool.status);
+	return rc;
+}
+
+static int btt_check_arenas(struct btt_chk *bttc)
+{
+	struct arena_info *a = NULL;
+	int i, rc = 0;
+
+	if (bttc->opts->jobs > 1 && bttc->num_arenas > 1)
+		return btt_check_arenas_parallel(bttc);
+
+	for(i = 0; i < bttc->num_arenas; i++) {
+		a = &bttc->arena[i];
+		rc = btt_check_arena(a);
 		if (rc)
 			break;
-
-		if (bttc->opts->logfix) {
-			rc = btt_rewrite_log(a);
-			if (rc)
-				break;
-		}
 	}
 
 	if (a && rc != BTT_OK) {
@@ -946,14 +1951,7 @@ static int btt_create_mappings(struct btt_chk *bttc)
 			return -errno;
 		}
 
-		a->map.data_len = a->mapoff - a->dataoff;
-		a->map.data = btt_mmap(bttc, a->map.data_len, a->dataoff);
-		if (!a->map.data) {
-			err(bttc, "mmap arena[%d].data [sz = %#lx, off = %#lx] failed: %s\n",
-				i, a->map.data_len, a->dataoff, strerror(errno));
-			return -errno;
-		}
-
+		/* the data area is never read, so it is not mapped */
 		a->map.map_len = a->logoff - a->mapoff;
 		a->map.map = btt_mmap(bttc, a->map.map_len, a->mapoff);
 		if (!a->map.map) {
@@ -991,8 +1989,6 @@ static void btt_remove_mappings(struct btt_chk *bttc)
 		a = &bttc->arena[i];
 		if (a->map.info)
 			btt_unmap(bttc, a->map.info, a->map.info_len);
-		if (a->map.data)
-			btt_unmap(bttc, a->map.data, a->map.data_len);
 		if (a->map.map)
 			btt_unmap(bttc, a->map.map, a->map.map_len);
 		if (a->map.log)
@@ -1019,31 +2015,14 @@ static int btt_sb_get_expected_offset(struct btt_sb *btt_sb)
 
 static int __btt_recover_first_sb(struct btt_chk *bttc, int off)
 {
-	int rc, est_arenas = 0;
+	int rc, est_arenas;
 	u64 offset, remaining;
 	struct btt_sb *btt_sb;
 
 	/* Estimate the number of arenas */
-	remaining = bttc->rawsize - off;
-	while (remaining) {
-		if (remaining < ARENA_MIN_SIZE && est_arenas == 0)
-			return -EINVAL;
-		if (remaining > ARENA_MAX_SIZE) {
-			/* full-size arena */
-			remaining -= ARENA_MAX_SIZE;
-			est_arenas++;
-			continue;
-		}
-		if (remaining < ARENA_MIN_SIZE) {
-			/* 'remaining' was too small for another arena */
-			break;
-		} else {
-			/* last, short arena */
-			remaining = 0;
-			est_arenas++;
-			break;
-		}
-	}
+	est_arenas = btt_estimate_arenas(bttc, off, &remaining);
+	if (est_arenas < 0)
+		return est_arenas;
 	info(bttc, "estimated arenas: %d, remaining bytes: %#lx\n",
 		est_arenas, remaining);
 
@@ -1147,27 +2126,22 @@ static int btt_recover_first_sb(struct btt_chk *bttc)
 	};
 	int i, rc;
 
+	btt_sb_prefetch(bttc);
 	for (i = 0; i < BTT_NUM_OFFSETS; i++) {
 		rc = __btt_recover_first_sb(bttc, offsets[i]);
 		if (rc == 0) {
 			bttc->start_off = offsets[i];
-			return rc;
+			break;
 		}
 	}
+	btt_sb_prefetch_free(bttc);
 
 	return rc;
 }
 
-int namespace_check(struct ndctl_namespace *ndns, bool verbose, bool force,
-		bool repair, bool logfix)
+int namespace_check(struct ndctl_namespace *ndns, struct check_opts *opts)
 {
 	const char *devname = ndctl_namespace_get_devname(ndns);
-	struct check_opts __opts = {
-		.verbose = verbose,
-		.force = force,
-		.repair = repair,
-		.logfix = logfix,
-	}, *opts = &__opts;
 	int raw_mode, rc, disabled_flag = 0, open_flags;
 	struct btt_sb *btt_sb;
 	struct btt_chk *bttc;
@@ -1178,6 +2152,7 @@ int namespace_check(struct ndctl_namespace *ndns, bool verbose, bool force,
 	bttc = calloc(1, sizeof(*bttc));
 	if (bttc == NULL)
 		return -ENOMEM;
+	bttc->dio_fd = -1;
 
 	log_init(&bttc->ctx, devname, "NDCTL_CHECK_NAMESPACE");
 	if (opts->verbose)
@@ -1209,17 +2184,18 @@ int namespace_check(struct ndctl_namespace *ndns, bool verbose, bool force,
 	ndctl_namespace_get_uuid(ndns, bttc->parent_uuid);
 
 	info(bttc, "checking %s\n", devname);
+	pthread_mutex_lock(&ndctl_lock);
 	if (ndctl_namespace_is_active(ndns)) {
 		if (opts->force) {
 			rc = ndctl_namespace_disable_safe(ndns);
 			if (rc)
-				goto out_bttc;
+				goto out_unlock;
 			disabled_flag = 1;
 		} else {
 			err(bttc, "%s: check aborted, namespace online\n",
 				devname);
 			rc = -EBUSY;
-			goto out_bttc;
+			goto out_unlock;
 		}
 	}
 
@@ -1234,7 +2210,7 @@ int namespace_check(struct ndctl_namespace *ndns, bool verbose, bool force,
 	if (rc < 0) {
 		err(bttc, "%s: failed to set the raw mode flag: %s (%d)\n",
 			devname, strerror(abs(rc)), rc);
-		goto out_ns;
+		goto out_ns_locked;
 	}
 	/*
 	 * Now enable the namespace.  This will result in a pmem device
@@ -1244,11 +2220,12 @@ int namespace_check(struct ndctl_namespace *ndns, bool verbose, bool force,
 	if (rc != 0) {
 		err(bttc, "%s: failed to enable in raw mode: %s (%d)\n",
 			devname, strerror(abs(rc)), rc);
-		goto out_ns;
+		goto out_ns_locked;
 	}
 
 	sprintf(path, "/dev/%s", ndctl_namespace_get_block_device(ndns));
 	bttc->path = path;
+	pthread_mutex_unlock(&ndctl_lock);
 
 	btt_sb = malloc(sizeof(*btt_sb));
 	if (btt_sb == NULL) {
@@ -1269,6 +2246,16 @@ int namespace_check(struct ndctl_namespace *ndns, bool verbose, bool force,
 		goto out_sb;
 	}
 
+	if (opts->stream) {
+		bttc->dio_fd = open(bttc->path, O_RDONLY|O_DIRECT);
+		if (bttc->dio_fd < 0) {
+			err(bttc, "unable to open %s for direct I/O: %s\n",
+				bttc->path, strerror(errno));
+			rc = -errno;
+			goto out_close;
+		}
+	}
+
 	/*
 	 * This is where we jump to if we receive a SIGBUS, prior to doing any
 	 * mmaped reads, and can safely abort
@@ -1325,21 +2312,166 @@ int namespace_check(struct ndctl_namespace *ndns, bool verbose, bool force,
 		}
 	}
 
+	if (opts->state_file) {
+		rc = btt_state_load(bttc);
+		if (rc)
+			goto out_unmap;
+	}
+
 	rc = btt_check_arenas(bttc);
 
+ out_unmap:
+	btt_state_free(bttc);
 	btt_remove_mappings(bttc);
  out_close:
+	if (bttc->dio_fd >= 0)
+		close(bttc->dio_fd);
 	close(bttc->fd);
  out_sb:
 	free(btt_sb);
  out_ns:
+	pthread_mutex_lock(&ndctl_lock);
+ out_ns_locked:
 	ndctl_namespace_set_raw_mode(ndns, raw_mode);
 	ndctl_namespace_disable_invalidate(ndns);
 	if (disabled_flag)
 		if(ndctl_namespace_enable(ndns) < 0)
 			err(bttc, "%s: failed to re-enable namespace\n",
 				devname);
+ out_unlock:
+	pthread_mutex_unlock(&ndctl_lock);
  out_bttc:
 	free(bttc);
 	return rc;
 }
+
+/*
+ * Checking 'all' namespaces with --parallel hands each region to one of
+ * up to @parallel workers, which checks the region's namespaces in turn.
+ * Namespaces in different regions are backed by different DIMMs (or
+ * interleave sets), so this spreads the load without making the checks
+ * compete for the same media.
+ */
+struct namespace_check_pool {
+	struct ndctl_namespace **ndns;
+	struct check_opts *opts;
+	pthread_mutex_t lock;
+	int *status;
+	int next;
+	int count;
+};
+
+static void *namespace_check_worker(void *arg)
+{
+	struct namespace_check_pool *pool = arg;
+	struct ndctl_region *region;
+	int first, last, i;
+
+	for (;;) {
+		/* claim the next run of namespaces from the same region */
+		pthread_mutex_lock(&pool->lock);
+		first = pool->next;
+		if (first >= pool->count) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		region = ndctl_namespace_get_region(pool->ndns[first]);
+		for (last = first + 1; last < pool->count; last++)
+			if (ndctl_namespace_get_region(pool->ndns[last]) != region)
+				break;
+		pool->next = last;
+		pthread_mutex_unlock(&pool->lock);
+
+		for (i = first; i < last; i++)
+			pool->status[i] = namespace_check(pool->ndns[i],
+					pool->opts);
+	}
+
+	return NULL;
+}
+
+static struct json_object *namespace_check_to_json(
+		struct ndctl_namespace *ndns, int status)
+{
+	struct ndctl_region *region = ndctl_namespace_get_region(ndns);
+	struct json_object *jndns, *jobj;
+
+	jndns = json_object_new_object();
+	if (!jndns)
+		return NULL;
+
+	jobj = json_object_new_string(ndctl_namespace_get_devname(ndns));
+	if (jobj)
+		json_object_object_add(jndns, "dev", jobj);
+
+	jobj = json_object_new_string(ndctl_region_get_devname(region));
+	if (jobj)
+		json_object_object_add(jndns, "region", jobj);
+
+	jobj = json_object_new_string(status ? "failed" : "ok");
+	if (jobj)
+		json_object_object_add(jndns, "status", jobj);
+
+	if (status) {
+		jobj = json_object_new_string(strerror(abs(status)));
+		if (jobj)
+			json_object_object_add(jndns, "error", jobj);
+	}
+
+	return jndns;
+}
+
+int namespace_check_parallel(struct ndctl_namespace **ndns, int count,
+		struct check_opts *opts, unsigned int parallel, int *processed)
+{
+	struct namespace_check_pool pool = {
+		.ndns = ndns,
+		.opts = opts,
+		.count = count,
+	};
+	struct json_object *jnamespaces;
+	pthread_t *threads;
+	int i, rc = 0, started;
+
+	*processed = 0;
+	pool.status = calloc(count, sizeof(int));
+	threads = calloc(parallel, sizeof(pthread_t));
+	if (!pool.status || !threads) {
+		rc = -ENOMEM;
+		goto out;
+	}
+	pthread_mutex_init(&pool.lock, NULL);
+
+	for (started = 0; started < (int) parallel; started++)
+		if (pthread_create(&threads[started], NULL,
+					namespace_check_worker, &pool))
+			break;
+	/* with no threads at all, do the work from this one */
+	if (!started)
+		namespace_check_worker(&pool);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&pool.lock);
+
+	jnamespaces = json_object_new_array();
+	for (i = 0; i < count; i++) {
+		struct json_object *jndns;
+
+		if (pool.status[i] == 0)
+			(*processed)++;
+		else if (!rc)
+			rc = pool.status[i];
+
+		if (!jnamespaces)
+			continue;
+		jndns = namespace_check_to_json(ndns[i], pool.status[i]);
+		if (jndns)
+			json_object_array_add(jnamespaces, jndns);
+	}
+	if (jnamespaces)
+		util_display_json_array(stdout, jnamespaces, 0);
+ out:
+	free(threads);
+	free(pool.status);
+	return rc;
+}
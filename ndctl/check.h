@@ -0,0 +1,23 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2015-2020 Intel Corporation. All rights reserved. */
+#ifndef __NDCTL_CHECK_H__
+#define __NDCTL_CHECK_H__
+#include <stdbool.h>
+
+struct ndctl_namespace;
+
+struct check_opts {
+	bool verbose;
+	bool force;
+	bool repair;
+	bool logfix;
+	bool stream;
+	unsigned int jobs;
+	const char *state_file;
+};
+
+int namespace_check(struct ndctl_namespace *ndns, struct check_opts *opts);
+int namespace_check_parallel(struct ndctl_namespace **ndns, int count,
+		struct check_opts *opts, unsigned int parallel, int *processed);
+
+#endif /* __NDCTL_CHECK_H__ */
@@ -391,6 +391,11 @@ static int action_write(struct ndctl_dimm *dimm, struct action_context *actx)
 		return -ENXIO;
 	}
 
+	/* only send the extents that differ from the current label data */
+	rc = ndctl_cmd_cfg_write_set_diff(cmd_write);
+	if (rc)
+		goto out;
+
 	size = ndctl_cmd_cfg_read_get_size(cmd_read);
 	rc = rw_bin(actx->f_in, cmd_write, size, param.offset, WRITE);
 	if (rc)
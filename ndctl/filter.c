@@ -2,6 +2,7 @@
 // Copyright (C) 2015-2020 Intel Corporation. All rights reserved.
 #include <stdio.h>
 #include <string.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <unistd.h>
@@ -13,42 +14,136 @@
 
 #include "filter.h"
 
-struct ndctl_bus *util_bus_filter(struct ndctl_bus *bus, const char *__ident)
+/*
+ * A filter identifier is a space separated list of device names, or of
+ * ids when the first entry is a number, or "all". The util_*_filter()
+ * helpers run for every object at every level of a topology walk, so
+ * each distinct identifier is only split and parsed once. The parsed
+ * identifiers live until the walk completes, or until exit for the
+ * commands that call the helpers directly.
+ */
+struct util_ident {
+	struct util_ident *next;
+	char *ident;
+	char *buf;
+	bool all;
+	unsigned long id;
+	int count;
+	char **names;
+	unsigned long (*ns_ids)[2];
+};
+
+static struct util_ident *util_idents;
+
+static void util_ident_free(struct util_ident *ui)
 {
-	char *end = NULL, *ident, *save;
-	unsigned long bus_id, id;
-	const char *provider, *devname, *name;
+	free(ui->buf);
+	free(ui->ident);
+	free(ui->names);
+	free(ui->ns_ids);
+	free(ui);
+}
 
-	if (!__ident)
-		return bus;
+static const struct util_ident *util_ident_get(const char *__ident)
+{
+	struct util_ident *ui;
+	char *end = NULL, *save, *name;
+	int count = 0;
 
-	ident = strdup(__ident);
-	if (!ident)
-		return NULL;
+	for (ui = util_idents; ui; ui = ui->next)
+		if (strcmp(ui->ident, __ident) == 0)
+			return ui;
 
-	for (name = strtok_r(ident, " ", &save); name;
+	ui = calloc(1, sizeof(*ui));
+	if (!ui)
+		return NULL;
+	ui->ident = strdup(__ident);
+	ui->buf = strdup(__ident);
+	if (!ui->ident || !ui->buf)
+		goto err;
+
+	for (name = ui->buf; *name; name++)
+		if (*name != ' ' && (name == ui->buf || name[-1] == ' '))
+			count++;
+	ui->names = calloc(count, sizeof(*ui->names));
+	ui->ns_ids = calloc(count, sizeof(*ui->ns_ids));
+	if (count && (!ui->names || !ui->ns_ids))
+		goto err;
+
+	ui->id = ULONG_MAX;
+	for (name = strtok_r(ui->buf, " ", &save); name;
 			name = strtok_r(NULL, " ", &save)) {
 		if (strcmp(name, "all") == 0)
-			break;
-
-		bus_id = strtoul(ident, &end, 0);
-		if (end == ident || end[0])
-			bus_id = ULONG_MAX;
+			ui->all = true;
+		if (ui->count == 0) {
+			ui->id = strtoul(name, &end, 0);
+			if (end == name || end[0])
+				ui->id = ULONG_MAX;
+		}
+		if (sscanf(name, "%ld.%ld", &ui->ns_ids[ui->count][0],
+					&ui->ns_ids[ui->count][1]) != 2)
+			ui->ns_ids[ui->count][0] = ULONG_MAX;
+		ui->names[ui->count++] = name;
+	}
 
-		provider = ndctl_bus_get_provider(bus);
-		devname = ndctl_bus_get_devname(bus);
-		id = ndctl_bus_get_id(bus);
+	ui->next = util_idents;
+	util_idents = ui;
+	return ui;
+ err:
+	util_ident_free(ui);
+	return NULL;
+}
 
-		if (bus_id < ULONG_MAX && bus_id == id)
-			break;
+/* drop the parsed identifiers, returns how many there were */
+int util_filter_release(void)
+{
+	struct util_ident *ui, *next;
+	int count = 0;
 
-		if (bus_id == ULONG_MAX && (strcmp(provider, name) == 0
-				|| strcmp(devname, name) == 0))
-			break;
+	for (ui = util_idents; ui; ui = next, count++) {
+		next = ui->next;
+		util_ident_free(ui);
 	}
-	free(ident);
+	util_idents = NULL;
+	return count;
+}
+
+static void __attribute__((destructor)) util_filter_exit(void)
+{
+	util_filter_release();
+}
+
+/* match by the leading numeric id if there is one, else by name */
+static bool util_ident_match(const struct util_ident *ui, unsigned long id,
+		const char *name1, const char *name2)
+{
+	int i;
+
+	if (ui->all)
+		return true;
+	if (ui->id < ULONG_MAX)
+		return ui->count && ui->id == id;
+	for (i = 0; i < ui->count; i++)
+		if (strcmp(ui->names[i], name1) == 0
+				|| (name2 && strcmp(ui->names[i], name2) == 0))
+			return true;
+	return false;
+}
+
+struct ndctl_bus *util_bus_filter(struct ndctl_bus *bus, const char *__ident)
+{
+	const struct util_ident *ui;
+
+	if (!__ident)
+		return bus;
+
+	ui = util_ident_get(__ident);
+	if (!ui)
+		return NULL;
 
-	if (name)
+	if (util_ident_match(ui, ndctl_bus_get_id(bus),
+				ndctl_bus_get_provider(bus),
+				ndctl_bus_get_devname(bus)))
 		return bus;
 	return NULL;
 }
@@ -56,38 +151,17 @@ struct ndctl_bus *util_bus_filter(struct ndctl_bus *bus, const char *__ident)
 struct ndctl_region *util_region_filter(struct ndctl_region *region,
 		const char *__ident)
 {
-	char *end = NULL, *ident, *save;
-	const char *name, *region_name;
-	unsigned long region_id, id;
+	const struct util_ident *ui;
 
 	if (!__ident)
 		return region;
 
-	ident = strdup(__ident);
-	if (!ident)
+	ui = util_ident_get(__ident);
+	if (!ui)
 		return NULL;
 
-	for (name = strtok_r(ident, " ", &save); name;
-			name = strtok_r(NULL, " ", &save)) {
-		if (strcmp(name, "all") == 0)
-			break;
-
-		region_id = strtoul(ident, &end, 0);
-		if (end == ident || end[0])
-			region_id = ULONG_MAX;
-
-		region_name = ndctl_region_get_devname(region);
-		id = ndctl_region_get_id(region);
-
-		if (region_id < ULONG_MAX && region_id == id)
-			break;
-
-		if (region_id == ULONG_MAX && strcmp(region_name, name) == 0)
-			break;
-	}
-	free(ident);
-
-	if (name)
+	if (util_ident_match(ui, ndctl_region_get_id(region),
+				ndctl_region_get_devname(region), NULL))
 		return region;
 	return NULL;
 }
@@ -96,72 +170,44 @@ struct ndctl_namespace *util_namespace_filter(struct ndctl_namespace *ndns,
 		const char *__ident)
 {
 	struct ndctl_region *region = ndctl_namespace_get_region(ndns);
-	unsigned long region_id, ndns_id;
-	const char *name;
-	char *ident, *save;
+	const struct util_ident *ui;
+	int i;
 
 	if (!__ident)
 		return ndns;
 
-	ident = strdup(__ident);
-	if (!ident)
+	ui = util_ident_get(__ident);
+	if (!ui)
 		return NULL;
+	if (ui->all)
+		return ndns;
 
-	for (name = strtok_r(ident, " ", &save); name;
-			name = strtok_r(NULL, " ", &save)) {
-		if (strcmp(name, "all") == 0)
-			break;
-
-		if (strcmp(name, ndctl_namespace_get_devname(ndns)) == 0)
-			break;
+	for (i = 0; i < ui->count; i++) {
+		if (strcmp(ui->names[i], ndctl_namespace_get_devname(ndns)) == 0)
+			return ndns;
 
-		if (sscanf(name, "%ld.%ld", &region_id, &ndns_id) == 2
-				&& ndctl_region_get_id(region) == region_id
-				&& ndctl_namespace_get_id(ndns) == ndns_id)
-			break;
+		if (ui->ns_ids[i][0] != ULONG_MAX
+				&& ndctl_region_get_id(region) == ui->ns_ids[i][0]
+				&& ndctl_namespace_get_id(ndns) == ui->ns_ids[i][1])
+			return ndns;
 	}
-	free(ident);
-
-	if (name)
-		return ndns;
 	return NULL;
 }
 
 struct ndctl_dimm *util_dimm_filter(struct ndctl_dimm *dimm,
 		const char *__ident)
 {
-	char *end = NULL, *ident, *save;
-	const char *name, *dimm_name;
-	unsigned long dimm_id, id;
+	const struct util_ident *ui;
 
 	if (!__ident)
 		return dimm;
 
-	ident = strdup(__ident);
-	if (!ident)
+	ui = util_ident_get(__ident);
+	if (!ui)
 		return NULL;
 
-	for (name = strtok_r(ident, " ", &save); name;
-			name = strtok_r(NULL, " ", &save)) {
-		if (strcmp(name, "all") == 0)
-			break;
-
-		dimm_id = strtoul(ident, &end, 0);
-		if (end == ident || end[0])
-			dimm_id = ULONG_MAX;
-
-		dimm_name = ndctl_dimm_get_devname(dimm);
-		id = ndctl_dimm_get_id(dimm);
-
-		if (dimm_id < ULONG_MAX && dimm_id == id)
-			break;
-
-		if (dimm_id == ULONG_MAX && strcmp(dimm_name, name) == 0)
-			break;
-	}
-	free(ident);
-
-	if (name)
+	if (util_ident_match(ui, ndctl_dimm_get_id(dimm),
+				ndctl_dimm_get_devname(dimm), NULL))
 		return dimm;
 	return NULL;
 }
@@ -464,5 +510,6 @@ int ndctl_filter_walk(struct ndctl_ctx *ctx, struct ndctl_filter_ctx *fctx,
 			}
 		}
 	}
+	util_filter_release();
 	return 0;
 }
@@ -1,6 +1,8 @@
 // SPDX-License-Identifier: GPL-2.0
 // Copyright (C) 2015-2020 Intel Corporation. All rights reserved.
+#include <errno.h>
 #include <limits.h>
+#include <stdlib.h>
 #include <uuid/uuid.h>
 #include <json-c/json.h>
 #include <ndctl/ndctl.h>
@@ -9,33 +11,42 @@
 
 #include "json.h"
 
-static void smart_threshold_to_json(struct ndctl_dimm *dimm,
-		struct json_object *jhealth)
+void util_smart_decode(struct util_smart *smart, struct ndctl_cmd *cmd)
 {
-	unsigned int alarm_control;
-	struct json_object *jobj;
-	struct ndctl_cmd *cmd;
-	int rc;
-
-	cmd = ndctl_dimm_cmd_new_smart_threshold(dimm);
-	if (!cmd)
-		return;
+	smart->flags = ndctl_cmd_smart_get_flags(cmd);
+	smart->health = ndctl_cmd_smart_get_health(cmd);
+	smart->media_temperature = ndctl_cmd_smart_get_media_temperature(cmd);
+	smart->ctrl_temperature = ndctl_cmd_smart_get_ctrl_temperature(cmd);
+	smart->spares = ndctl_cmd_smart_get_spares(cmd);
+	smart->alarm_flags = ndctl_cmd_smart_get_alarm_flags(cmd);
+	smart->life_used = ndctl_cmd_smart_get_life_used(cmd);
+	smart->shutdown_state = ndctl_cmd_smart_get_shutdown_state(cmd);
+	smart->shutdown_count = ndctl_cmd_smart_get_shutdown_count(cmd);
+}
 
-	rc = ndctl_cmd_submit_xlat(cmd);
-	if (rc < 0)
-		goto out;
+void util_smart_threshold_decode(struct util_smart_threshold *thresh,
+		struct ndctl_cmd *cmd)
+{
+	thresh->alarm_control = ndctl_cmd_smart_threshold_get_alarm_control(cmd);
+	thresh->media_temperature =
+		ndctl_cmd_smart_threshold_get_media_temperature(cmd);
+	thresh->ctrl_temperature =
+		ndctl_cmd_smart_threshold_get_ctrl_temperature(cmd);
+	thresh->spares = ndctl_cmd_smart_threshold_get_spares(cmd);
+}
 
-	alarm_control = ndctl_cmd_smart_threshold_get_alarm_control(cmd);
-	if (alarm_control & ND_SMART_TEMP_TRIP) {
-		unsigned int temp;
-		double t;
+static void smart_threshold_to_json(const struct util_smart_threshold *thresh,
+		struct json_object *jhealth)
+{
+	struct json_object *jobj;
+	double t;
 
+	if (thresh->alarm_control & ND_SMART_TEMP_TRIP) {
 		jobj = json_object_new_boolean(true);
 		if (jobj)
 			json_object_object_add(jhealth,
 				"alarm_enabled_media_temperature", jobj);
-		temp = ndctl_cmd_smart_threshold_get_temperature(cmd);
-		t = ndctl_decode_smart_temperature(temp);
+		t = ndctl_decode_smart_temperature(thresh->media_temperature);
 		jobj = json_object_new_double(t);
 		if (jobj)
 			json_object_object_add(jhealth,
@@ -47,16 +58,12 @@ static void smart_threshold_to_json(struct ndctl_dimm *dimm,
 				"alarm_enabled_media_temperature", jobj);
 	}
 
-	if (alarm_control & ND_SMART_CTEMP_TRIP) {
-		unsigned int temp;
-		double t;
-
+	if (thresh->alarm_control & ND_SMART_CTEMP_TRIP) {
 		jobj = json_object_new_boolean(true);
 		if (jobj)
 			json_object_object_add(jhealth,
 				"alarm_enabled_ctrl_temperature", jobj);
-		temp = ndctl_cmd_smart_threshold_get_ctrl_temperature(cmd);
-		t = ndctl_decode_smart_temperature(temp);
+		t = ndctl_decode_smart_temperature(thresh->ctrl_temperature);
 		jobj = json_object_new_double(t);
 		if (jobj)
 			json_object_object_add(jhealth,
@@ -68,15 +75,12 @@ static void smart_threshold_to_json(struct ndctl_dimm *dimm,
 				"alarm_enabled_ctrl_temperature", jobj);
 	}
 
-	if (alarm_control & ND_SMART_SPARE_TRIP) {
-		unsigned int spares;
-
+	if (thresh->alarm_control & ND_SMART_SPARE_TRIP) {
 		jobj = json_object_new_boolean(true);
 		if (jobj)
 			json_object_object_add(jhealth,
 				"alarm_enabled_spares", jobj);
-		spares = ndctl_cmd_smart_threshold_get_spares(cmd);
-		jobj = json_object_new_int(spares);
+		jobj = json_object_new_int(thresh->spares);
 		if (jobj)
 			json_object_object_add(jhealth,
 				"spares_threshold", jobj);
@@ -86,37 +90,25 @@ static void smart_threshold_to_json(struct ndctl_dimm *dimm,
 			json_object_object_add(jhealth,
 				"alarm_enabled_spares", jobj);
 	}
-
- out:
-	ndctl_cmd_unref(cmd);
 }
 
-struct json_object *util_dimm_health_to_json(struct ndctl_dimm *dimm)
+/*
+ * Build a health object from decoded smart and, if not NULL, threshold
+ * payloads, with only the @fields (ND_SMART_*_VALID) of @smart present.
+ */
+struct json_object *util_smart_to_json(const struct util_smart *smart,
+		unsigned int fields, const struct util_smart_threshold *thresh)
 {
 	struct json_object *jhealth = json_object_new_object();
 	struct json_object *jobj;
-	struct ndctl_cmd *cmd;
-	unsigned int flags;
-	int rc;
+	double t;
 
 	if (!jhealth)
 		return NULL;
 
-	cmd = ndctl_dimm_cmd_new_smart(dimm);
-	if (!cmd)
-		goto err;
-
-	rc = ndctl_cmd_submit_xlat(cmd);
-	if (rc < 0) {
-		jobj = json_object_new_string("unknown");
-		if (jobj)
-			json_object_object_add(jhealth, "health_state", jobj);
-		goto out;
-	}
-
-	flags = ndctl_cmd_smart_get_flags(cmd);
-	if (flags & ND_SMART_HEALTH_VALID) {
-		unsigned int health = ndctl_cmd_smart_get_health(cmd);
+	fields &= smart->flags;
+	if (fields & ND_SMART_HEALTH_VALID) {
+		unsigned int health = smart->health;
 
 		if (health & ND_SMART_FATAL_HEALTH)
 			jobj = json_object_new_string("fatal");
@@ -130,35 +122,29 @@ struct json_object *util_dimm_health_to_json(struct ndctl_dimm *dimm)
 			json_object_object_add(jhealth, "health_state", jobj);
 	}
 
-	if (flags & ND_SMART_TEMP_VALID) {
-		unsigned int temp = ndctl_cmd_smart_get_temperature(cmd);
-		double t = ndctl_decode_smart_temperature(temp);
-
+	if (fields & ND_SMART_TEMP_VALID) {
+		t = ndctl_decode_smart_temperature(smart->media_temperature);
 		jobj = json_object_new_double(t);
 		if (jobj)
 			json_object_object_add(jhealth, "temperature_celsius", jobj);
 	}
 
-	if (flags & ND_SMART_CTEMP_VALID) {
-		unsigned int temp = ndctl_cmd_smart_get_ctrl_temperature(cmd);
-		double t = ndctl_decode_smart_temperature(temp);
-
+	if (fields & ND_SMART_CTEMP_VALID) {
+		t = ndctl_decode_smart_temperature(smart->ctrl_temperature);
 		jobj = json_object_new_double(t);
 		if (jobj)
 			json_object_object_add(jhealth,
 					"controller_temperature_celsius", jobj);
 	}
 
-	if (flags & ND_SMART_SPARES_VALID) {
-		unsigned int spares = ndctl_cmd_smart_get_spares(cmd);
-
-		jobj = json_object_new_int(spares);
+	if (fields & ND_SMART_SPARES_VALID) {
+		jobj = json_object_new_int(smart->spares);
 		if (jobj)
 			json_object_object_add(jhealth, "spares_percentage", jobj);
 	}
 
-	if (flags & ND_SMART_ALARM_VALID) {
-		unsigned int alarm_flags = ndctl_cmd_smart_get_alarm_flags(cmd);
+	if (fields & ND_SMART_ALARM_VALID) {
+		unsigned int alarm_flags = smart->alarm_flags;
 		bool temp_flag = !!(alarm_flags & ND_SMART_TEMP_TRIP);
 		bool ctrl_temp_flag = !!(alarm_flags & ND_SMART_CTEMP_TRIP);
 		bool spares_flag = !!(alarm_flags & ND_SMART_SPARE_TRIP);
@@ -176,39 +162,153 @@ struct json_object *util_dimm_health_to_json(struct ndctl_dimm *dimm)
 			json_object_object_add(jhealth, "alarm_spares", jobj);
 	}
 
-	smart_threshold_to_json(dimm, jhealth);
+	if (thresh)
+		smart_threshold_to_json(thresh, jhealth);
 
-	if (flags & ND_SMART_USED_VALID) {
-		unsigned int life_used = ndctl_cmd_smart_get_life_used(cmd);
-
-		jobj = json_object_new_int(life_used);
+	if (fields & ND_SMART_USED_VALID) {
+		jobj = json_object_new_int(smart->life_used);
 		if (jobj)
 			json_object_object_add(jhealth, "life_used_percentage", jobj);
 	}
 
-	if (flags & ND_SMART_SHUTDOWN_VALID) {
-		unsigned int shutdown = ndctl_cmd_smart_get_shutdown_state(cmd);
-
-		jobj = json_object_new_string(shutdown ? "dirty" : "clean");
+	if (fields & ND_SMART_SHUTDOWN_VALID) {
+		jobj = json_object_new_string(smart->shutdown_state ?
+				"dirty" : "clean");
 		if (jobj)
 			json_object_object_add(jhealth, "shutdown_state", jobj);
 	}
 
-	if (flags & ND_SMART_SHUTDOWN_COUNT_VALID) {
-		unsigned int shutdown = ndctl_cmd_smart_get_shutdown_count(cmd);
-
-		jobj = json_object_new_int(shutdown);
+	if (fields & ND_SMART_SHUTDOWN_COUNT_VALID) {
+		jobj = json_object_new_int(smart->shutdown_count);
 		if (jobj)
 			json_object_object_add(jhealth, "shutdown_count", jobj);
 	}
 
+	return jhealth;
+}
+
+/*
+ * Build the health object from a submitted smart command and, if it
+ * succeeded, smart-threshold command.
+ */
+static struct json_object *smart_to_json(struct ndctl_cmd *cmd, int rc,
+		struct ndctl_cmd *thresh, int thresh_rc)
+{
+	struct util_smart_threshold t;
+	struct util_smart smart;
+	struct json_object *jhealth, *jobj;
+
+	if (rc < 0) {
+		jhealth = json_object_new_object();
+		if (!jhealth)
+			return NULL;
+		jobj = json_object_new_string("unknown");
+		if (jobj)
+			json_object_object_add(jhealth, "health_state", jobj);
+		return jhealth;
+	}
+
+	util_smart_decode(&smart, cmd);
+	if (thresh && thresh_rc >= 0) {
+		util_smart_threshold_decode(&t, thresh);
+		return util_smart_to_json(&smart, smart.flags, &t);
+	}
+	return util_smart_to_json(&smart, smart.flags, NULL);
+}
+
+struct json_object *util_dimm_health_to_json(struct ndctl_dimm *dimm)
+{
+	struct ndctl_cmd *cmd, *thresh = NULL;
+	struct json_object *jhealth;
+	int rc, thresh_rc = -ENXIO;
+
+	cmd = ndctl_dimm_cmd_new_smart(dimm);
+	if (!cmd)
+		return NULL;
+
+	rc = ndctl_cmd_submit_xlat(cmd);
+	if (rc >= 0) {
+		thresh = ndctl_dimm_cmd_new_smart_threshold(dimm);
+		if (thresh)
+			thresh_rc = ndctl_cmd_submit_xlat(thresh);
+	}
+
+	jhealth = smart_to_json(cmd, rc, thresh, thresh_rc);
+	ndctl_cmd_unref(thresh);
 	ndctl_cmd_unref(cmd);
 	return jhealth;
+}
+
+/*
+ * Same as util_dimm_health_to_json() for @count dimms, with the smart
+ * commands of all dimms submitted concurrently, followed by the
+ * smart-threshold commands of the dimms whose smart command succeeded.
+ * @jhealth[i] is the health of @dimms[i], or NULL.
+ */
+void util_dimms_health_to_json(struct ndctl_ctx *ctx, struct ndctl_dimm **dimms,
+		struct json_object **jhealth, int count)
+{
+	struct ndctl_cmd_batch *batch, *tbatch = NULL;
+	struct ndctl_cmd **cmd, **thresh;
+	int i;
+
+	cmd = calloc(count, sizeof(*cmd));
+	thresh = calloc(count, sizeof(*thresh));
+	batch = ndctl_cmd_batch_new(ctx);
+	if (!cmd || !thresh || !batch) {
+		/* fall back to one at a time */
+		for (i = 0; i < count; i++)
+			jhealth[i] = util_dimm_health_to_json(dimms[i]);
+		goto out;
+	}
+
+	for (i = 0; i < count; i++) {
+		cmd[i] = ndctl_dimm_cmd_new_smart(dimms[i]);
+		if (cmd[i] && ndctl_cmd_batch_add(batch, cmd[i], NULL, NULL))
+			goto err;
+	}
+	ndctl_cmd_batch_wait(batch);
+
+	/* as in the serial case, no thresholds without smart data */
+	tbatch = ndctl_cmd_batch_new(ctx);
+	if (!tbatch)
+		goto err;
+	for (i = 0; i < count; i++) {
+		if (!cmd[i] || ndctl_cmd_batch_get_status(batch, cmd[i]) < 0)
+			continue;
+		thresh[i] = ndctl_dimm_cmd_new_smart_threshold(dimms[i]);
+		if (thresh[i] && ndctl_cmd_batch_add(tbatch, thresh[i],
+					NULL, NULL))
+			goto err;
+	}
+	ndctl_cmd_batch_wait(tbatch);
+
+	for (i = 0; i < count; i++) {
+		if (!cmd[i]) {
+			jhealth[i] = NULL;
+			continue;
+		}
+		jhealth[i] = smart_to_json(cmd[i],
+			ndctl_cmd_batch_get_status(batch, cmd[i]), thresh[i],
+			thresh[i] ? ndctl_cmd_batch_get_status(tbatch, thresh[i])
+				: -ENXIO);
+	}
+	goto out;
+
  err:
-	json_object_put(jhealth);
-	jhealth = NULL;
+	ndctl_cmd_batch_free(tbatch);
+	ndctl_cmd_batch_free(batch);
+	tbatch = NULL;
+	batch = NULL;
+	for (i = 0; i < count; i++)
+		jhealth[i] = util_dimm_health_to_json(dimms[i]);
  out:
-	if (cmd)
-		ndctl_cmd_unref(cmd);
-	return jhealth;
+	for (i = 0; cmd && i < count; i++) {
+		ndctl_cmd_unref(thresh[i]);
+		ndctl_cmd_unref(cmd[i]);
+	}
+	ndctl_cmd_batch_free(tbatch);
+	ndctl_cmd_batch_free(batch);
+	free(thresh);
+	free(cmd);
 }
@@ -17,7 +17,39 @@ struct json_object *util_dimm_to_json(struct ndctl_dimm *dimm,
 		unsigned long flags);
 struct json_object *util_mapping_to_json(struct ndctl_mapping *mapping,
 		unsigned long flags);
+
+/*
+ * A decoded smart payload, each field valid when the matching
+ * ND_SMART_*_VALID bit is set in @flags.
+ */
+struct util_smart {
+	unsigned int flags;
+	unsigned int health;
+	unsigned int media_temperature;
+	unsigned int ctrl_temperature;
+	unsigned int spares;
+	unsigned int alarm_flags;
+	unsigned int life_used;
+	unsigned int shutdown_state;
+	unsigned int shutdown_count;
+};
+
+/* a decoded smart-threshold payload */
+struct util_smart_threshold {
+	unsigned int alarm_control;
+	unsigned int media_temperature;
+	unsigned int ctrl_temperature;
+	unsigned int spares;
+};
+
+void util_smart_decode(struct util_smart *smart, struct ndctl_cmd *cmd);
+void util_smart_threshold_decode(struct util_smart_threshold *thresh,
+		struct ndctl_cmd *cmd);
+struct json_object *util_smart_to_json(const struct util_smart *smart,
+		unsigned int fields, const struct util_smart_threshold *thresh);
 struct json_object *util_dimm_health_to_json(struct ndctl_dimm *dimm);
+void util_dimms_health_to_json(struct ndctl_ctx *ctx, struct ndctl_dimm **dimms,
+		struct json_object **jhealth, int count);
 struct json_object *util_dimm_firmware_to_json(struct ndctl_dimm *dimm,
 		unsigned long flags);
 struct json_object *util_region_capabilities_to_json(struct ndctl_region *region);
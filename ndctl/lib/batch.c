@@ -0,0 +1,253 @@
+// SPDX-License-Identifier: LGPL-2.1
+// Copyright (C) 2014-2020, Intel Corporation. All rights reserved.
+#include <errno.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <ndctl/libndctl.h>
+#include "private.h"
+
+/*
+ * A command batch submits a set of commands concurrently. Commands are
+ * queued per device, i.e. per dimm or, for bus commands, per bus, and
+ * each device's queue is drained in order by one worker thread, so a
+ * device never has more than one command in flight. Completions are
+ * reaped by ndctl_cmd_batch_wait(), which runs each command's callback
+ * from the calling thread.
+ *
+ * Workers only run ndctl_cmd_submit_xlat(). That touches the command,
+ * read-only dimm and bus attributes, and the device's cached control
+ * node fd, which is opened and dropped under the ctx ctl_lock. Nothing
+ * else in the ctx is safe to use from several threads, so the workers
+ * must not do more than that.
+ */
+#define NDCTL_CMD_BATCH_MAX_THREADS 16
+
+struct ndctl_cmd_batch_ent {
+	struct ndctl_cmd *cmd;
+	ndctl_cmd_batch_fn done;
+	void *data;
+	int next;
+	int rc;
+	bool completed;
+	bool reaped;
+};
+
+struct ndctl_cmd_batch_lane {
+	void *dev;
+	int head;
+	int tail;
+};
+
+struct ndctl_cmd_batch {
+	struct ndctl_ctx *ctx;
+	struct ndctl_cmd_batch_ent *ent;
+	struct ndctl_cmd_batch_lane *lane;
+	int nr_ent;
+	int nr_lanes;
+	int next_lane;
+	int completed;
+	int reaped;
+	pthread_t threads[NDCTL_CMD_BATCH_MAX_THREADS];
+	int nr_threads;
+	bool submitted;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+NDCTL_EXPORT struct ndctl_cmd_batch *ndctl_cmd_batch_new(struct ndctl_ctx *ctx)
+{
+	struct ndctl_cmd_batch *batch;
+
+	batch = calloc(1, sizeof(*batch));
+	if (!batch)
+		return NULL;
+	batch->ctx = ctx;
+	pthread_mutex_init(&batch->lock, NULL);
+	pthread_cond_init(&batch->cond, NULL);
+
+	return batch;
+}
+
+NDCTL_EXPORT int ndctl_cmd_batch_add(struct ndctl_cmd_batch *batch,
+		struct ndctl_cmd *cmd, ndctl_cmd_batch_fn done, void *data)
+{
+	struct ndctl_cmd_batch_lane *lane = NULL, *lanes;
+	struct ndctl_cmd_batch_ent *ent;
+	void *dev;
+	int i;
+
+	if (batch->submitted)
+		return -EBUSY;
+
+	dev = cmd->dimm ? (void *) cmd->dimm : (void *) cmd_to_bus(cmd);
+	for (i = 0; i < batch->nr_lanes; i++)
+		if (batch->lane[i].dev == dev) {
+			lane = &batch->lane[i];
+			break;
+		}
+
+	if (!lane) {
+		lanes = realloc(batch->lane,
+				(batch->nr_lanes + 1) * sizeof(*lanes));
+		if (!lanes)
+			return -ENOMEM;
+		batch->lane = lanes;
+		lane = &batch->lane[batch->nr_lanes++];
+		lane->dev = dev;
+		lane->head = -1;
+		lane->tail = -1;
+	}
+
+	ent = realloc(batch->ent, (batch->nr_ent + 1) * sizeof(*ent));
+	if (!ent)
+		return -ENOMEM;
+	batch->ent = ent;
+	ent = &batch->ent[batch->nr_ent];
+	*ent = (struct ndctl_cmd_batch_ent) {
+		.cmd = cmd,
+		.done = done,
+		.data = data,
+		.next = -1,
+	};
+
+	if (lane->tail < 0)
+		lane->head = batch->nr_ent;
+	else
+		batch->ent[lane->tail].next = batch->nr_ent;
+	lane->tail = batch->nr_ent++;
+	ndctl_cmd_ref(cmd);
+
+	return 0;
+}
+
+static void *ndctl_cmd_batch_worker(void *arg)
+{
+	struct ndctl_cmd_batch *batch = arg;
+	struct ndctl_cmd_batch_ent *ent;
+	int lane, i, rc;
+
+	while ((lane = __atomic_fetch_add(&batch->next_lane, 1,
+					__ATOMIC_RELAXED)) < batch->nr_lanes) {
+		for (i = batch->lane[lane].head; i >= 0; i = ent->next) {
+			ent = &batch->ent[i];
+			rc = ndctl_cmd_submit_xlat(ent->cmd);
+
+			pthread_mutex_lock(&batch->lock);
+			ent->rc = rc;
+			ent->completed = true;
+			batch->completed++;
+			pthread_cond_signal(&batch->cond);
+			pthread_mutex_unlock(&batch->lock);
+		}
+	}
+
+	return NULL;
+}
+
+NDCTL_EXPORT int ndctl_cmd_batch_submit(struct ndctl_cmd_batch *batch)
+{
+	struct ndctl_ctx *ctx = batch->ctx;
+	int nr_threads, rc;
+
+	if (batch->submitted)
+		return -EBUSY;
+	batch->submitted = true;
+
+	nr_threads = batch->nr_lanes;
+	if (nr_threads > NDCTL_CMD_BATCH_MAX_THREADS)
+		nr_threads = NDCTL_CMD_BATCH_MAX_THREADS;
+
+	for (; batch->nr_threads < nr_threads; batch->nr_threads++) {
+		rc = pthread_create(&batch->threads[batch->nr_threads], NULL,
+				ndctl_cmd_batch_worker, batch);
+		if (rc) {
+			dbg(ctx, "failed to start worker %d: %s\n",
+					batch->nr_threads, strerror(rc));
+			break;
+		}
+	}
+
+	/* fall back to submitting from this thread */
+	if (!batch->nr_threads && batch->nr_lanes)
+		ndctl_cmd_batch_worker(batch);
+
+	dbg(ctx, "%d commands to %d devices on %d threads\n", batch->nr_ent,
+			batch->nr_lanes, batch->nr_threads);
+	return 0;
+}
+
+static void ndctl_cmd_batch_join(struct ndctl_cmd_batch *batch)
+{
+	int i;
+
+	for (i = 0; i < batch->nr_threads; i++)
+		pthread_join(batch->threads[i], NULL);
+	batch->nr_threads = 0;
+}
+
+NDCTL_EXPORT int ndctl_cmd_batch_wait(struct ndctl_cmd_batch *batch)
+{
+	struct ndctl_cmd_batch_ent *ent;
+	int i, rc = 0;
+
+	if (!batch->submitted) {
+		rc = ndctl_cmd_batch_submit(batch);
+		if (rc)
+			return rc;
+	}
+
+	pthread_mutex_lock(&batch->lock);
+	while (batch->reaped < batch->nr_ent) {
+		while (batch->completed == batch->reaped)
+			pthread_cond_wait(&batch->cond, &batch->lock);
+
+		for (i = 0; i < batch->nr_ent; i++) {
+			ent = &batch->ent[i];
+			if (!ent->completed || ent->reaped)
+				continue;
+			ent->reaped = true;
+			batch->reaped++;
+			if (ent->rc < 0 && !rc)
+				rc = ent->rc;
+			if (!ent->done)
+				continue;
+			pthread_mutex_unlock(&batch->lock);
+			ent->done(ent->cmd, ent->rc, ent->data);
+			pthread_mutex_lock(&batch->lock);
+		}
+	}
+	pthread_mutex_unlock(&batch->lock);
+
+	ndctl_cmd_batch_join(batch);
+	return rc;
+}
+
+NDCTL_EXPORT int ndctl_cmd_batch_get_status(struct ndctl_cmd_batch *batch,
+		struct ndctl_cmd *cmd)
+{
+	int i;
+
+	for (i = 0; i < batch->nr_ent; i++)
+		if (batch->ent[i].cmd == cmd && batch->ent[i].reaped)
+			return batch->ent[i].rc;
+	return -ENXIO;
+}
+
+NDCTL_EXPORT void ndctl_cmd_batch_free(struct ndctl_cmd_batch *batch)
+{
+	int i;
+
+	if (!batch)
+		return;
+
+	/* outstanding commands complete, but their callbacks are skipped */
+	ndctl_cmd_batch_join(batch);
+	for (i = 0; i < batch->nr_ent; i++)
+		ndctl_cmd_unref(batch->ent[i].cmd);
+	pthread_cond_destroy(&batch->cond);
+	pthread_mutex_destroy(&batch->lock);
+	free(batch->lane);
+	free(batch->ent);
+	free(batch);
+}
@@ -152,15 +152,26 @@ static int __label_validate(struct nvdimm_data *ndd)
 		to_namespace_index(ndd, 1),
 	};
 	const int num_index = ARRAY_SIZE(nsindex);
+	u64 sum_save[2], sum[2];
 	bool valid[2] = { 0 };
 	int i, num_valid = 0;
 	u32 seq;
 
+	/* checksum both index blocks in one pass */
+	for (i = 0; i < num_index; i++) {
+		sum_save[i] = le64_to_cpu(nsindex[i]->checksum);
+		nsindex[i]->checksum = cpu_to_le64(0);
+	}
+	fletcher64_multi((void **) nsindex, sizeof_namespace_index(ndd), 1,
+			sum, num_index);
+	for (i = 0; i < num_index; i++)
+		nsindex[i]->checksum = cpu_to_le64(sum_save[i]);
+
 	for (i = 0; i < num_index; i++) {
 		u32 nslot;
 		u8 sig[NSINDEX_SIG_LEN];
-		u64 sum_save, sum, size;
 		unsigned int version, labelsize;
+		u64 size;
 
 		memcpy(sig, nsindex[i]->sig, NSINDEX_SIG_LEN);
 		if (memcmp(sig, NSINDEX_SIGNATURE, NSINDEX_SIG_LEN) != 0) {
@@ -182,11 +193,7 @@ static int __label_validate(struct nvdimm_data *ndd)
 			continue;
 		}
 
-		sum_save = le64_to_cpu(nsindex[i]->checksum);
-		nsindex[i]->checksum = cpu_to_le64(0);
-		sum = fletcher64(nsindex[i], sizeof_namespace_index(ndd), 1);
-		nsindex[i]->checksum = cpu_to_le64(sum_save);
-		if (sum != sum_save) {
+		if (sum[i] != sum_save[i]) {
 			dbg(ctx, "nsindex%d checksum invalid\n", i);
 			continue;
 		}
@@ -609,6 +616,8 @@ NDCTL_EXPORT int ndctl_dimm_zero_label_extent(struct ndctl_dimm *dimm,
 		rc = -ENOTTY;
 		goto out_read;
 	}
+	/* skip extents that are already zero, best effort */
+	ndctl_cmd_cfg_write_set_diff(cmd_write);
 	if (ndctl_cmd_cfg_write_zero_data(cmd_write) < 0) {
 		rc = -ENXIO;
 		goto out_write;
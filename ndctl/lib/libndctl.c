@@ -115,6 +115,13 @@ struct ndctl_mapping {
 	struct list_node list;
 };
 
+/* attributes of a region that are read on first use, see region_load() */
+enum {
+	REGION_LAZY_MODULE = 1 << 0,
+	REGION_LAZY_PERSISTENCE = 1 << 1,
+	REGION_LAZY_FLUSH = 1 << 2,
+};
+
 /**
  * struct ndctl_region - container for 'pmem' or 'block' capacity
  * @module: kernel module
@@ -126,6 +133,7 @@ struct ndctl_mapping {
  * @nstype: the resulting type of namespace this region produces
  * @numa_node: numa node attribute
  * @target_node: target node were this region to be onlined
+ * @loaded: REGION_LAZY_* attributes read so far, see region_load()
  *
  * A region may alias between pmem and block-window access methods.  The
  * region driver is tasked with parsing the label (if their is one) and
@@ -176,8 +184,11 @@ struct ndctl_region {
 	enum ndctl_persistence_domain persistence_domain;
 	/* file descriptor for deep flush sysfs entry */
 	int flush_fd;
+	unsigned int loaded;
 };
 
+static void region_load(struct ndctl_region *region, unsigned int attrs);
+
 /**
  * struct ndctl_btt - stacked block device provided sector atomicity
  * @module: kernel module (nd_btt)
@@ -281,6 +292,35 @@ NDCTL_EXPORT const char *ndctl_get_config_path(struct ndctl_ctx *ctx)
 	return ctx->config_path;
 }
 
+/**
+ * ndctl_set_enum_jobs - set the number of threads used to enumerate objects
+ * @ctx: ndctl library context
+ * @jobs: thread count, 1 (the default) enumerates sequentially
+ *
+ * With @jobs > 1, the first lookup of the dimms or regions of one bus
+ * populates those of all busses in parallel, and the first lookup of the
+ * namespaces of one region populates those of all its sibling regions.
+ * Object lists keep the same order as with sequential enumeration. The
+ * log function set with ndctl_set_log_fn() is then also called from the
+ * enumeration threads, and must be safe to call concurrently. The
+ * default can also be set with the NDCTL_ENUM_JOBS environment variable.
+ */
+NDCTL_EXPORT int ndctl_set_enum_jobs(struct ndctl_ctx *ctx, int jobs)
+{
+	if (!ctx || jobs < 1)
+		return -EINVAL;
+	ctx->enum_jobs = jobs;
+
+	return 0;
+}
+
+NDCTL_EXPORT int ndctl_get_enum_jobs(struct ndctl_ctx *ctx)
+{
+	if (ctx == NULL)
+		return 1;
+	return ctx->enum_jobs;
+}
+
 /**
  * ndctl_new - instantiate a new library context
  * @ctx: context to establish
@@ -322,6 +362,8 @@ NDCTL_EXPORT int ndctl_new(struct ndctl_ctx **ctx)
 	log_init(&c->ctx, "libndctl", "NDCTL_LOG");
 	c->udev = udev;
 	c->timeout = 5000;
+	c->enum_jobs = 1;
+	pthread_mutex_init(&c->ctl_lock, NULL);
 	list_head_init(&c->busses);
 
 	info(c, "ctx %p created\n", c);
@@ -339,6 +381,17 @@ NDCTL_EXPORT int ndctl_new(struct ndctl_ctx **ctx)
 		dbg(c, "timeout = %ld\n", tmo);
 	}
 
+	env = secure_getenv("NDCTL_ENUM_JOBS");
+	if (env != NULL) {
+		long jobs;
+		char *end;
+
+		jobs = strtol(env, &end, 0);
+		if (jobs > 0 && jobs <= INT_MAX && !*end)
+			c->enum_jobs = jobs;
+		dbg(c, "enum_jobs = %d\n", c->enum_jobs);
+	}
+
 	c->udev_queue = udev_queue_new(udev);
 	if (!c->udev_queue)
 		err(c, "failed to retrieve udev queue\n");
@@ -574,6 +627,16 @@ static void free_stale_daxs(struct ndctl_region *region)
 		free_dax(dax, &region->stale_daxs);
 }
 
+/* drop a cached control node fd, see cmd_ctl_fd() */
+static void ctl_fd_close(struct ndctl_ctx *ctx, int *fd)
+{
+	pthread_mutex_lock(&ctx->ctl_lock);
+	if (*fd > -1)
+		close(*fd);
+	*fd = -1;
+	pthread_mutex_unlock(&ctx->ctl_lock);
+}
+
 static void free_region(struct ndctl_region *region)
 {
 	struct ndctl_bus *bus = region->bus;
@@ -613,6 +676,8 @@ static void free_dimm(struct ndctl_dimm *dimm)
 		kmod_module_unref(dimm->module);
 	if (dimm->health_eventfd > -1)
 		close(dimm->health_eventfd);
+	if (dimm->ctl_fd > -1)
+		close(dimm->ctl_fd);
 	ndctl_cmd_unref(dimm->ndd.cmd_read);
 	free(dimm);
 }
@@ -635,6 +700,10 @@ static void free_bus(struct ndctl_bus *bus, struct list_head *head)
 	free(bus->bus_buf);
 	free(bus->wait_probe_path);
 	free(bus->scrub_path);
+	free(bus->dimm_by_id);
+	free(bus->dimm_by_handle);
+	if (bus->ctl_fd > -1)
+		close(bus->ctl_fd);
 	free(bus);
 }
 
@@ -644,6 +713,7 @@ static void free_context(struct ndctl_ctx *ctx)
 
 	list_for_each_safe(&ctx->busses, bus, _b, list)
 		free_bus(bus, &ctx->busses);
+	pthread_mutex_destroy(&ctx->ctl_lock);
 	free(ctx);
 }
 
@@ -661,6 +731,7 @@ NDCTL_EXPORT struct ndctl_ctx *ndctl_unref(struct ndctl_ctx *ctx)
 	ctx->refcount--;
 	if (ctx->refcount > 0)
 		return NULL;
+	sysfs_cache_flush(ctx);
 	udev_queue_unref(ctx->udev_queue);
 	udev_unref(ctx->udev);
 	kmod_unref(ctx->kmod_ctx);
@@ -733,7 +804,7 @@ static int device_parse(struct ndctl_ctx *ctx, struct ndctl_bus *bus,
 		const char *base_path, const char *dev_name, void *parent,
 		add_dev_fn add_dev)
 {
-	if (bus)
+	if (bus && !ctx->probe_settled)
 		ndctl_bus_wait_probe(bus);
 	return sysfs_device_parse(ctx, base_path, dev_name, parent, add_dev);
 }
@@ -898,6 +969,7 @@ static int is_subsys_cxl(const char *subsys)
 static void *add_bus(void *parent, int id, const char *ctl_base)
 {
 	char buf[SYSFS_ATTR_SIZE];
+	struct sysfs_dir dir;
 	struct ndctl_ctx *ctx = parent;
 	struct ndctl_bus *bus, *bus_dup;
 	char *path = calloc(1, strlen(ctl_base) + 100);
@@ -905,6 +977,8 @@ static void *add_bus(void *parent, int id, const char *ctl_base)
 	if (!path)
 		return NULL;
 
+	sysfs_dir_open(ctx, &dir, ctl_base);
+
 	bus = calloc(1, sizeof(*bus));
 	if (!bus)
 		goto err_bus;
@@ -912,19 +986,17 @@ static void *add_bus(void *parent, int id, const char *ctl_base)
 	list_head_init(&bus->regions);
 	bus->ctx = ctx;
 	bus->id = id;
+	bus->ctl_fd = -1;
 
-	sprintf(path, "%s/dev", ctl_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0
+	if (sysfs_dir_read_attr(&dir, "dev", buf) < 0
 			|| sscanf(buf, "%d:%d", &bus->major, &bus->minor) != 2)
 		goto err_read;
 
-	sprintf(path, "%s/device/commands", ctl_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "device/commands", buf) < 0)
 		goto err_read;
 	bus->cmd_mask = parse_commands(buf, 0);
 
-	sprintf(path, "%s/device/nfit/revision", ctl_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0) {
+	if (sysfs_dir_read_attr(&dir, "device/nfit/revision", buf) < 0) {
 		bus->has_nfit = 0;
 		bus->revision = -1;
 	} else {
@@ -932,8 +1004,7 @@ static void *add_bus(void *parent, int id, const char *ctl_base)
 		bus->revision = strtoul(buf, NULL, 0);
 	}
 
-	sprintf(path, "%s/device/of_node/compatible", ctl_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "device/of_node/compatible", buf) < 0)
 		bus->has_of_node = 0;
 	else
 		bus->has_of_node = 1;
@@ -944,14 +1015,12 @@ static void *add_bus(void *parent, int id, const char *ctl_base)
 	else
 		bus->has_cxl = 0;
 
-	sprintf(path, "%s/device/nfit/dsm_mask", ctl_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "device/nfit/dsm_mask", buf) < 0)
 		bus->nfit_dsm_mask = 0;
 	else
 		bus->nfit_dsm_mask = strtoul(buf, NULL, 0);
 
-	sprintf(path, "%s/device/provider", ctl_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "device/provider", buf) < 0)
 		goto err_read;
 
 	bus->provider = strdup(buf);
@@ -972,14 +1041,12 @@ static void *add_bus(void *parent, int id, const char *ctl_base)
 		bus->scrub_path = NULL;
 	}
 
-	sprintf(path, "%s/device/firmware/activate", ctl_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "device/firmware/activate", buf) < 0)
 		bus->fwa_state = NDCTL_FWA_INVALID;
 	else
 		bus->fwa_state = fwa_to_state(buf);
 
-	sprintf(path, "%s/device/firmware/capability", ctl_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "device/firmware/capability", buf) < 0)
 		bus->fwa_method = fwa_method_to_method(NULL);
 	else
 		bus->fwa_method = fwa_method_to_method(buf);
@@ -1000,11 +1067,13 @@ static void *add_bus(void *parent, int id, const char *ctl_base)
 				&& strcmp(ndctl_bus_get_devname(bus_dup),
 					ndctl_bus_get_devname(bus)) == 0) {
 			free_bus(bus, NULL);
+			sysfs_dir_close(&dir);
 			free(path);
 			return bus_dup;
 		}
 
 	list_add(&ctx->busses, &bus->list);
+	sysfs_dir_close(&dir);
 	free(path);
 
 	return bus;
@@ -1018,11 +1087,36 @@ static void *add_bus(void *parent, int id, const char *ctl_base)
 	free(bus->bus_buf);
 	free(bus);
  err_bus:
+	sysfs_dir_close(&dir);
 	free(path);
 
 	return NULL;
 }
 
+/*
+ * Run @init, one of the child enumerations, for every device on the list
+ * at @head (with its list_node at @off) in parallel. Callers fall back
+ * to the sequential @init if this fails. device_parse() waits for
+ * probing to settle first, which polls the ctx udev queue, and libudev
+ * is not thread safe. So wait for @bus, or all busses, here on the
+ * calling thread and let the workers skip it.
+ */
+static void enum_parallel(struct ndctl_ctx *ctx, struct ndctl_bus *bus,
+		struct list_head *head, size_t off, enum_dev_fn init)
+{
+	struct ndctl_bus *iter;
+	int settled = ctx->probe_settled;
+
+	if (bus)
+		ndctl_bus_wait_probe(bus);
+	else
+		list_for_each(&ctx->busses, iter, list)
+			ndctl_bus_wait_probe(iter);
+	ctx->probe_settled = 1;
+	__sysfs_enum_parallel(&ctx->ctx, head, off, ctx->enum_jobs, init);
+	ctx->probe_settled = settled;
+}
+
 static void busses_init(struct ndctl_ctx *ctx)
 {
 	if (ctx->busses_init)
@@ -1034,6 +1128,15 @@ static void busses_init(struct ndctl_ctx *ctx)
 
 NDCTL_EXPORT void ndctl_invalidate(struct ndctl_ctx *ctx)
 {
+	struct ndctl_dimm *dimm;
+	struct ndctl_bus *bus;
+
+	/* devices may have come and gone, revalidate the control nodes */
+	list_for_each(&ctx->busses, bus, list) {
+		ctl_fd_close(ctx, &bus->ctl_fd);
+		list_for_each(&bus->dimms, dimm, list)
+			ctl_fd_close(ctx, &dimm->ctl_fd);
+	}
 	ctx->busses_init = 0;
 }
 
@@ -1137,7 +1240,7 @@ ndctl_bus_get_persistence_domain(struct ndctl_bus *bus)
 	/* iterate through region to get the region persistence domain */
 	ndctl_region_foreach(bus, region) {
 		/* we are looking for the least persistence domain */
-		if (pd < region->persistence_domain)
+		if (pd < ndctl_region_get_persistence_domain(region))
 			pd = region->persistence_domain;
 	}
 
@@ -1303,7 +1406,10 @@ NDCTL_EXPORT unsigned long long ndctl_region_get_resource(struct ndctl_region *r
 
 NDCTL_EXPORT int ndctl_region_deep_flush(struct ndctl_region *region)
 {
-	int rc = pwrite(region->flush_fd, "1\n", 1, 0);
+	int rc;
+
+	region_load(region, REGION_LAZY_FLUSH);
+	rc = pwrite(region->flush_fd, "1\n", 1, 0);
 
 	return (rc == -1) ? -errno : 0;
 }
@@ -1761,16 +1867,20 @@ static int populate_dimm_attributes(struct ndctl_dimm *dimm,
 	struct ndctl_ctx *ctx = dimm->bus->ctx;
 	char *path = calloc(1, strlen(dimm_base) + 100);
 	const char *bus_prefix = dimm->bus_prefix;
+	struct sysfs_dir dir;
+	char attr[16];
 
 	if (!path)
 		return -ENOMEM;
 
+	sprintf(path, "%s/%s", dimm_base, bus_prefix);
+	sysfs_dir_open(ctx, &dir, path);
+
 	/*
 	 * 'unique_id' may not be available on older kernels, so don't
 	 * fail if the read fails.
 	 */
-	sprintf(path, "%s/%s/id", dimm_base, bus_prefix);
-	if (sysfs_read_attr(ctx, path, buf) == 0) {
+	if (sysfs_dir_read_attr(&dir, "id", buf) == 0) {
 		unsigned int b[9];
 
 		dimm->unique_id = strdup(buf);
@@ -1784,62 +1894,49 @@ static int populate_dimm_attributes(struct ndctl_dimm *dimm,
 		}
 	}
 
-	sprintf(path, "%s/%s/handle", dimm_base, bus_prefix);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "handle", buf) < 0)
 		goto err_read;
 	dimm->handle = strtoul(buf, NULL, 0);
 
-	sprintf(path, "%s/%s/phys_id", dimm_base, bus_prefix);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "phys_id", buf) < 0)
 		goto err_read;
 	dimm->phys_id = strtoul(buf, NULL, 0);
 
-	sprintf(path, "%s/%s/serial", dimm_base, bus_prefix);
-	if (sysfs_read_attr(ctx, path, buf) == 0)
+	if (sysfs_dir_read_attr(&dir, "serial", buf) == 0)
 		dimm->serial = strtoul(buf, NULL, 0);
 
-	sprintf(path, "%s/%s/vendor", dimm_base, bus_prefix);
-	if (sysfs_read_attr(ctx, path, buf) == 0)
+	if (sysfs_dir_read_attr(&dir, "vendor", buf) == 0)
 		dimm->vendor_id = strtoul(buf, NULL, 0);
 
-	sprintf(path, "%s/%s/device", dimm_base, bus_prefix);
-	if (sysfs_read_attr(ctx, path, buf) == 0)
+	if (sysfs_dir_read_attr(&dir, "device", buf) == 0)
 		dimm->device_id = strtoul(buf, NULL, 0);
 
-	sprintf(path, "%s/%s/rev_id", dimm_base, bus_prefix);
-	if (sysfs_read_attr(ctx, path, buf) == 0)
+	if (sysfs_dir_read_attr(&dir, "rev_id", buf) == 0)
 		dimm->revision_id = strtoul(buf, NULL, 0);
 
-	sprintf(path, "%s/%s/dirty_shutdown", dimm_base, bus_prefix);
-	if (sysfs_read_attr(ctx, path, buf) == 0)
+	if (sysfs_dir_read_attr(&dir, "dirty_shutdown", buf) == 0)
 		dimm->dirty_shutdown = strtoll(buf, NULL, 0);
 
-	sprintf(path, "%s/%s/subsystem_vendor", dimm_base, bus_prefix);
-	if (sysfs_read_attr(ctx, path, buf) == 0)
+	if (sysfs_dir_read_attr(&dir, "subsystem_vendor", buf) == 0)
 		dimm->subsystem_vendor_id = strtoul(buf, NULL, 0);
 
-	sprintf(path, "%s/%s/subsystem_device", dimm_base, bus_prefix);
-	if (sysfs_read_attr(ctx, path, buf) == 0)
+	if (sysfs_dir_read_attr(&dir, "subsystem_device", buf) == 0)
 		dimm->subsystem_device_id = strtoul(buf, NULL, 0);
 
-	sprintf(path, "%s/%s/subsystem_rev_id", dimm_base, bus_prefix);
-	if (sysfs_read_attr(ctx, path, buf) == 0)
+	if (sysfs_dir_read_attr(&dir, "subsystem_rev_id", buf) == 0)
 		dimm->subsystem_revision_id = strtoul(buf, NULL, 0);
 
-	sprintf(path, "%s/%s/family", dimm_base, bus_prefix);
-	if (sysfs_read_attr(ctx, path, buf) == 0)
+	if (sysfs_dir_read_attr(&dir, "family", buf) == 0)
 		dimm->cmd_family = strtoul(buf, NULL, 0);
 
-	sprintf(path, "%s/%s/dsm_mask", dimm_base, bus_prefix);
-	if (sysfs_read_attr(ctx, path, buf) == 0)
+	if (sysfs_dir_read_attr(&dir, "dsm_mask", buf) == 0)
 		dimm->nfit_dsm_mask = strtoul(buf, NULL, 0);
 
-	sprintf(path, "%s/%s/format", dimm_base, bus_prefix);
-	if (sysfs_read_attr(ctx, path, buf) == 0)
+	if (sysfs_dir_read_attr(&dir, "format", buf) == 0)
 		dimm->format[0] = strtoul(buf, NULL, 0);
 	for (i = 1; i < dimm->formats; i++) {
-		sprintf(path, "%s/%s/format%d", dimm_base, bus_prefix, i);
-		if (sysfs_read_attr(ctx, path, buf) == 0)
+		sprintf(attr, "format%d", i);
+		if (sysfs_dir_read_attr(&dir, attr, buf) == 0)
 			dimm->format[i] = strtoul(buf, NULL, 0);
 	}
 
@@ -1850,7 +1947,7 @@ static int populate_dimm_attributes(struct ndctl_dimm *dimm,
 
 	rc = 0;
  err_read:
-
+	sysfs_dir_close(&dir);
 	free(path);
 	return rc;
 }
@@ -1912,6 +2009,54 @@ out:
 	return rc;
 }
 
+/*
+ * Read the attributes in @attrs (DIMM_LAZY_*) that have not been
+ * loaded yet. Returns the subset that was read by this call.
+ */
+static unsigned int dimm_load(struct ndctl_dimm *dimm, unsigned int attrs)
+{
+	struct ndctl_ctx *ctx = ndctl_dimm_get_ctx(dimm);
+	char *path = dimm->dimm_buf;
+	char buf[SYSFS_ATTR_SIZE];
+	int len = dimm->buf_len;
+
+	attrs &= ~dimm->loaded;
+	dimm->loaded |= attrs;
+
+	if (attrs & DIMM_LAZY_MODULE) {
+		if (snprintf(path, len, "%s/modalias", dimm->dimm_path) < len
+				&& sysfs_read_attr(ctx, path, buf) == 0)
+			dimm->module = util_modalias_to_module(ctx, buf);
+	}
+
+	if (attrs & DIMM_LAZY_FLAGS) {
+		if (snprintf(path, len, "%s/flags", dimm->dimm_path) >= len
+				|| sysfs_read_attr(ctx, path, buf) < 0) {
+			dimm->locked = -1;
+			dimm->aliased = -1;
+		} else
+			parse_dimm_flags(dimm, buf);
+	}
+
+	if (attrs & DIMM_LAZY_FWA) {
+		if (snprintf(path, len, "%s/firmware/activate",
+				dimm->dimm_path) >= len
+				|| sysfs_read_attr(ctx, path, buf) < 0)
+			dimm->fwa_state = NDCTL_FWA_INVALID;
+		else
+			dimm->fwa_state = fwa_to_state(buf);
+
+		if (snprintf(path, len, "%s/firmware/result",
+				dimm->dimm_path) >= len
+				|| sysfs_read_attr(ctx, path, buf) < 0)
+			dimm->fwa_result = NDCTL_FWA_RESULT_INVALID;
+		else
+			dimm->fwa_result = fwa_result_to_result(buf);
+	}
+
+	return attrs;
+}
+
 static void *add_dimm(void *parent, int id, const char *dimm_base)
 {
 	int formats, i, rc = -ENODEV;
@@ -1919,14 +2064,11 @@ static void *add_dimm(void *parent, int id, const char *dimm_base)
 	char buf[SYSFS_ATTR_SIZE];
 	struct ndctl_bus *bus = parent;
 	struct ndctl_ctx *ctx = bus->ctx;
-	char *path = calloc(1, strlen(dimm_base) + 100);
-
-	if (!path)
-		return NULL;
+	struct sysfs_dir dir;
 
-	sprintf(path, "%s/%s/formats", dimm_base,
-		ndctl_bus_has_nfit(bus) ? "nfit" : "papr");
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	sysfs_dir_open(ctx, &dir, dimm_base);
+	if (sysfs_dir_read_attr(&dir, ndctl_bus_has_nfit(bus) ?
+				"nfit/formats" : "papr/formats", buf) < 0)
 		formats = 1;
 	else
 		formats = clamp(strtoul(buf, NULL, 0), 1UL, 2UL);
@@ -1937,14 +2079,12 @@ static void *add_dimm(void *parent, int id, const char *dimm_base)
 	dimm->bus = bus;
 	dimm->id = id;
 
-	sprintf(path, "%s/dev", dimm_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "dev", buf) < 0)
 		goto err_read;
 	if (sscanf(buf, "%d:%d", &dimm->major, &dimm->minor) != 2)
 		goto err_read;
 
-	sprintf(path, "%s/commands", dimm_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "commands", buf) < 0)
 		goto err_read;
 	dimm->cmd_mask = parse_commands(buf, 1);
 
@@ -1957,11 +2097,6 @@ static void *add_dimm(void *parent, int id, const char *dimm_base)
 	if (!dimm->dimm_path)
 		goto err_read;
 
-	sprintf(path, "%s/modalias", dimm_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
-		goto err_read;
-	dimm->module = util_modalias_to_module(ctx, buf);
-
 	dimm->handle = -1;
 	dimm->phys_id = -1;
 	dimm->serial = -1;
@@ -1969,6 +2104,7 @@ static void *add_dimm(void *parent, int id, const char *dimm_base)
 	dimm->device_id = -1;
 	dimm->revision_id = -1;
 	dimm->health_eventfd = -1;
+	dimm->ctl_fd = -1;
 	dimm->dirty_shutdown = -ENOENT;
 	dimm->subsystem_vendor_id = -1;
 	dimm->subsystem_device_id = -1;
@@ -1980,25 +2116,11 @@ static void *add_dimm(void *parent, int id, const char *dimm_base)
 	for (i = 0; i < formats; i++)
 		dimm->format[i] = -1;
 
-	sprintf(path, "%s/flags", dimm_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0) {
-		dimm->locked = -1;
-		dimm->aliased = -1;
-	} else
-		parse_dimm_flags(dimm, buf);
-
-	sprintf(path, "%s/firmware/activate", dimm_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
-		dimm->fwa_state = NDCTL_FWA_INVALID;
-	else
-		dimm->fwa_state = fwa_to_state(buf);
-
-	sprintf(path, "%s/firmware/result", dimm_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
-		dimm->fwa_result = NDCTL_FWA_RESULT_INVALID;
-	else
-		dimm->fwa_result = fwa_result_to_result(buf);
-
+	/*
+	 * The kernel module, lock / alias flags and firmware activation
+	 * state are only needed by a few operations, they are read on
+	 * first use by dimm_load().
+	 */
 	dimm->formats = formats;
 	/* Check if the given dimm supports nfit */
 	if (ndctl_bus_has_nfit(bus)) {
@@ -2051,19 +2173,23 @@ static void *add_dimm(void *parent, int id, const char *dimm_base)
 	}
 
 	list_add(&bus->dimms, &dimm->list);
-	free(path);
+	/* stale the lookup tables, see dimm_index() */
+	bus->dimm_gen++;
+	sysfs_dir_close(&dir);
 
 	return dimm;
 
  err_read:
 	free_dimm(dimm);
  err_dimm:
-	free(path);
+	sysfs_dir_close(&dir);
 	return NULL;
 }
 
-static void dimms_init(struct ndctl_bus *bus)
+static void __dimms_init(void *_bus)
 {
+	struct ndctl_bus *bus = _bus;
+
 	if (bus->dimms_init)
 		return;
 
@@ -2071,6 +2197,17 @@ static void dimms_init(struct ndctl_bus *bus)
 	device_parse(bus->ctx, bus, bus->bus_path, "nmem", bus, add_dimm);
 }
 
+static void dimms_init(struct ndctl_bus *bus)
+{
+	if (bus->dimms_init)
+		return;
+
+	if (bus->ctx->enum_jobs > 1)
+		enum_parallel(bus->ctx, NULL, &bus->ctx->busses,
+			      offsetof(struct ndctl_bus, list), __dimms_init);
+	__dimms_init(bus);
+}
+
 NDCTL_EXPORT struct ndctl_dimm *ndctl_dimm_get_first(struct ndctl_bus *bus)
 {
 	dimms_init(bus);
@@ -2207,11 +2344,13 @@ NDCTL_EXPORT int ndctl_dimm_has_errors(struct ndctl_dimm *dimm)
 
 NDCTL_EXPORT int ndctl_dimm_locked(struct ndctl_dimm *dimm)
 {
+	dimm_load(dimm, DIMM_LAZY_FLAGS);
 	return dimm->locked;
 }
 
 NDCTL_EXPORT int ndctl_dimm_aliased(struct ndctl_dimm *dimm)
 {
+	dimm_load(dimm, DIMM_LAZY_FLAGS);
 	return dimm->aliased;
 }
 
@@ -2406,6 +2545,9 @@ NDCTL_EXPORT int ndctl_dimm_disable(struct ndctl_dimm *dimm)
 	if (!ndctl_dimm_is_enabled(dimm))
 		return 0;
 
+	/* don't hold the control node open across a driver change */
+	ctl_fd_close(ctx, &dimm->ctl_fd);
+
 	util_unbind(dimm->dimm_path, ctx);
 
 	if (ndctl_dimm_is_enabled(dimm)) {
@@ -2425,6 +2567,7 @@ NDCTL_EXPORT int ndctl_dimm_enable(struct ndctl_dimm *dimm)
 	if (ndctl_dimm_is_enabled(dimm))
 		return 0;
 
+	dimm_load(dimm, DIMM_LAZY_MODULE);
 	util_bind(devname, dimm->module, "nd", ctx);
 
 	if (!ndctl_dimm_is_enabled(dimm)) {
@@ -2443,6 +2586,7 @@ static int dimm_set_arm(struct ndctl_dimm *dimm, bool arm)
 	char *path = dimm->dimm_buf;
 	int len = dimm->buf_len;
 
+	dimm_load(dimm, DIMM_LAZY_FWA);
 	if (dimm->fwa_state == NDCTL_FWA_INVALID)
 		return NDCTL_FWA_INVALID;
 
@@ -2476,8 +2620,10 @@ NDCTL_EXPORT enum ndctl_fwa_state ndctl_dimm_get_fw_activate_state(
 	char buf[SYSFS_ATTR_SIZE];
 	int len = dimm->buf_len;
 
-	if (dimm->fwa_state == NDCTL_FWA_INVALID)
-		return NDCTL_FWA_INVALID;
+	/* a fresh load is as current as a re-read */
+	if (dimm_load(dimm, DIMM_LAZY_FWA)
+			|| dimm->fwa_state == NDCTL_FWA_INVALID)
+		return dimm->fwa_state;
 
 	if (snprintf(path, len, "%s/firmware/activate", dimm->dimm_path) >= len) {
 		err(ctx, "%s: buffer too small!\n", ndctl_dimm_get_devname(dimm));
@@ -2499,8 +2645,9 @@ NDCTL_EXPORT enum ndctl_fwa_result ndctl_dimm_get_fw_activate_result(
 	char buf[SYSFS_ATTR_SIZE];
 	int len = dimm->buf_len;
 
-	if (dimm->fwa_result == NDCTL_FWA_RESULT_INVALID)
-		return NDCTL_FWA_RESULT_INVALID;
+	if (dimm_load(dimm, DIMM_LAZY_FWA)
+			|| dimm->fwa_result == NDCTL_FWA_RESULT_INVALID)
+		return dimm->fwa_result;
 
 	if (snprintf(path, len, "%s/firmware/result", dimm->dimm_path) >= len) {
 		err(ctx, "%s: buffer too small!\n", ndctl_dimm_get_devname(dimm));
@@ -2513,11 +2660,94 @@ NDCTL_EXPORT enum ndctl_fwa_result ndctl_dimm_get_fw_activate_result(
 	return fwa_result_to_result(buf);
 }
 
+static int dimm_key_cmp(const void *a, const void *b)
+{
+	const struct ndctl_dimm_key *x = a, *y = b;
+
+	if (x->key != y->key)
+		return x->key < y->key ? -1 : 1;
+	return x->pos - y->pos;
+}
+
+/*
+ * Sorted views of bus->dimms by id and by handle, so that lookups (for
+ * example resolving every region mapping to its dimm) are a binary
+ * search rather than a list walk. Dimms are only ever added to a bus,
+ * by add_dimm(), which bumps bus->dimm_gen so that the next lookup
+ * rebuilds the tables. Otherwise a lookup does not touch the list.
+ */
+static bool dimm_index(struct ndctl_bus *bus)
+{
+	struct ndctl_dimm_key *by_id, *by_handle;
+	struct ndctl_dimm *dimm;
+	int n = 0;
+
+	dimms_init(bus);
+	if (bus->dimm_by_id && bus->dimm_keys_gen == bus->dimm_gen)
+		return true;
+
+	ndctl_dimm_foreach(bus, dimm)
+		n++;
+
+	by_id = calloc(n, sizeof(*by_id));
+	by_handle = calloc(n, sizeof(*by_handle));
+	if (n && (!by_id || !by_handle)) {
+		free(by_id);
+		free(by_handle);
+		return false;
+	}
+
+	n = 0;
+	ndctl_dimm_foreach(bus, dimm) {
+		by_id[n] = (struct ndctl_dimm_key) {
+			.key = ndctl_dimm_get_id(dimm),
+			.pos = n,
+			.dimm = dimm,
+		};
+		by_handle[n] = by_id[n];
+		by_handle[n].key = dimm->handle;
+		n++;
+	}
+	qsort(by_id, n, sizeof(*by_id), dimm_key_cmp);
+	qsort(by_handle, n, sizeof(*by_handle), dimm_key_cmp);
+
+	free(bus->dimm_by_id);
+	free(bus->dimm_by_handle);
+	bus->dimm_by_id = by_id;
+	bus->dimm_by_handle = by_handle;
+	bus->nr_dimm_keys = n;
+	bus->dimm_keys_gen = bus->dimm_gen;
+	return true;
+}
+
+/* first dimm, in list order, with @key */
+static struct ndctl_dimm *dimm_index_find(const struct ndctl_dimm_key *keys,
+		int n, unsigned int key)
+{
+	int lo = 0, hi = n;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (keys[mid].key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < n && keys[lo].key == key)
+		return keys[lo].dimm;
+	return NULL;
+}
+
 NDCTL_EXPORT struct ndctl_dimm *ndctl_dimm_get_by_handle(struct ndctl_bus *bus,
 		unsigned int handle)
 {
 	struct ndctl_dimm *dimm;
 
+	if (dimm_index(bus))
+		return dimm_index_find(bus->dimm_by_handle, bus->nr_dimm_keys,
+				       handle);
+
 	ndctl_dimm_foreach(bus, dimm)
 		if (dimm->handle == handle)
 			return dimm;
@@ -2529,6 +2759,9 @@ static struct ndctl_dimm *ndctl_dimm_get_by_id(struct ndctl_bus *bus, unsigned i
 {
 	struct ndctl_dimm *dimm;
 
+	if (dimm_index(bus))
+		return dimm_index_find(bus->dimm_by_id, bus->nr_dimm_keys, id);
+
 	ndctl_dimm_foreach(bus, dimm)
 		if (ndctl_dimm_get_id(dimm) == id)
 			return dimm;
@@ -2644,6 +2877,60 @@ static enum ndctl_persistence_domain region_get_pd_type(char *name)
 		return PERSISTENCE_UNKNOWN;
 }
 
+/*
+ * Read the attributes in @attrs (REGION_LAZY_*) that have not been
+ * loaded yet.
+ */
+static void region_load(struct ndctl_region *region, unsigned int attrs)
+{
+	struct ndctl_ctx *ctx = ndctl_region_get_ctx(region);
+	char *path = region->region_buf;
+	int len = region->buf_len, perm;
+	char buf[SYSFS_ATTR_SIZE];
+
+	attrs &= ~region->loaded;
+	region->loaded |= attrs;
+
+	if (attrs & REGION_LAZY_MODULE) {
+		if (snprintf(path, len, "%s/modalias",
+				region->region_path) < len
+				&& sysfs_read_attr(ctx, path, buf) == 0)
+			region->module = util_modalias_to_module(ctx, buf);
+	}
+
+	if (attrs & REGION_LAZY_PERSISTENCE) {
+		if (snprintf(path, len, "%s/persistence_domain",
+				region->region_path) >= len
+				|| sysfs_read_attr(ctx, path, buf) < 0)
+			region->persistence_domain = PERSISTENCE_UNKNOWN;
+		else
+			region->persistence_domain = region_get_pd_type(buf);
+	}
+
+	if (attrs & REGION_LAZY_FLUSH) {
+		if (snprintf(path, len, "%s/deep_flush",
+				region->region_path) >= len)
+			return;
+		region->flush_fd = open(path, O_RDWR | O_CLOEXEC);
+		if (region->flush_fd == -1)
+			return;
+
+		if (pread(region->flush_fd, buf, 1, 0) == -1) {
+			close(region->flush_fd);
+			region->flush_fd = -1;
+			return;
+		}
+
+		/* pread() doesn't add NUL termination */
+		buf[1] = 0;
+		perm = strtol(buf, NULL, 0);
+		if (perm == 0) {
+			close(region->flush_fd);
+			region->flush_fd = -1;
+		}
+	}
+}
+
 static void *add_region(void *parent, int id, const char *region_base)
 {
 	char buf[SYSFS_ATTR_SIZE];
@@ -2651,10 +2938,12 @@ static void *add_region(void *parent, int id, const char *region_base)
 	struct ndctl_bus *bus = parent;
 	struct ndctl_ctx *ctx = bus->ctx;
 	char *path = calloc(1, strlen(region_base) + 100);
-	int perm, rc;
+	struct sysfs_dir dir;
+	int rc;
 
 	if (!path)
 		return NULL;
+	sysfs_dir_open(ctx, &dir, region_base);
 
 	region = calloc(1, sizeof(*region));
 	if (!region)
@@ -2672,49 +2961,37 @@ static void *add_region(void *parent, int id, const char *region_base)
 	region->bus = bus;
 	region->id = id;
 
-	sprintf(path, "%s/size", region_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "size", buf) < 0)
 		goto err_read;
 	region->size = strtoull(buf, NULL, 0);
 
-	sprintf(path, "%s/mappings", region_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "mappings", buf) < 0)
 		goto err_read;
 	region->num_mappings = strtoul(buf, NULL, 0);
 
-	sprintf(path, "%s/%s/range_index", region_base,
-		ndctl_bus_has_nfit(bus) ? "nfit": "papr");
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, ndctl_bus_has_nfit(bus) ?
+				"nfit/range_index" : "papr/range_index", buf) < 0)
 		region->range_index = -1;
 	else
 		region->range_index = strtoul(buf, NULL, 0);
 
-	sprintf(path, "%s/read_only", region_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "read_only", buf) < 0)
 		goto err_read;
 	region->ro = strtoul(buf, NULL, 0);
 
-	sprintf(path, "%s/modalias", region_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
-		goto err_read;
-	region->module = util_modalias_to_module(ctx, buf);
-
-	sprintf(path, "%s/numa_node", region_base);
-	if ((rc = sysfs_read_attr(ctx, path, buf)) == 0)
+	if ((rc = sysfs_dir_read_attr(&dir, "numa_node", buf)) == 0)
 		region->numa_node = strtol(buf, NULL, 0);
 	else if (rc == -ENOENT)
 		region->numa_node = NUMA_NO_ATTR;
 	else
 		region->numa_node = NUMA_NO_NODE;
 
-	sprintf(path, "%s/target_node", region_base);
-	if (sysfs_read_attr(ctx, path, buf) == 0)
+	if (sysfs_dir_read_attr(&dir, "target_node", buf) == 0)
 		region->target_node = strtol(buf, NULL, 0);
 	else
 		region->target_node = -1;
 
-	sprintf(path, "%s/align", region_base);
-	if (sysfs_read_attr(ctx, path, buf) == 0)
+	if (sysfs_dir_read_attr(&dir, "align", buf) == 0)
 		region->align = strtoul(buf, NULL, 0);
 	else
 		region->align = ULONG_MAX;
@@ -2731,35 +3008,15 @@ static void *add_region(void *parent, int id, const char *region_base)
 	if (!region->region_path)
 		goto err_read;
 
-	list_add(&bus->regions, &region->list);
-
-	/* get the persistence domain attrib */
-	sprintf(path, "%s/persistence_domain", region_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
-		region->persistence_domain = PERSISTENCE_UNKNOWN;
-	else
-		region->persistence_domain = region_get_pd_type(buf);
-
-	sprintf(path, "%s/deep_flush", region_base);
-	region->flush_fd = open(path, O_RDWR | O_CLOEXEC);
-	if (region->flush_fd == -1)
-		goto out;
-
-	if (pread(region->flush_fd, buf, 1, 0) == -1) {
-		close(region->flush_fd);
-		region->flush_fd = -1;
-		goto out;
-	}
+	/*
+	 * The kernel module, persistence domain and deep flush control are
+	 * read on first use by region_load().
+	 */
+	region->flush_fd = -1;
 
-	/* pread() doesn't add NUL termination */
-	buf[1] = 0;
-	perm = strtol(buf, NULL, 0);
-	if (perm == 0) {
-		close(region->flush_fd);
-		region->flush_fd = -1;
-	}
+	list_add(&bus->regions, &region->list);
 
- out:
+	sysfs_dir_close(&dir);
 	free(path);
 	return region;
 
@@ -2767,13 +3024,16 @@ static void *add_region(void *parent, int id, const char *region_base)
 	free(region->region_buf);
 	free(region);
  err_region:
+	sysfs_dir_close(&dir);
 	free(path);
 
 	return NULL;
 }
 
-static void regions_init(struct ndctl_bus *bus)
+static void __regions_init(void *_bus)
 {
+	struct ndctl_bus *bus = _bus;
+
 	if (bus->regions_init)
 		return;
 
@@ -2781,6 +3041,17 @@ static void regions_init(struct ndctl_bus *bus)
 	device_parse(bus->ctx, bus, bus->bus_path, "region", bus, add_region);
 }
 
+static void regions_init(struct ndctl_bus *bus)
+{
+	if (bus->regions_init)
+		return;
+
+	if (bus->ctx->enum_jobs > 1)
+		enum_parallel(bus->ctx, NULL, &bus->ctx->busses,
+			      offsetof(struct ndctl_bus, list), __regions_init);
+	__regions_init(bus);
+}
+
 NDCTL_EXPORT struct ndctl_region *ndctl_region_get_first(struct ndctl_bus *bus)
 {
 	regions_init(bus);
@@ -3018,6 +3289,7 @@ NDCTL_EXPORT struct badblock *ndctl_region_get_first_badblock(struct ndctl_regio
 NDCTL_EXPORT enum ndctl_persistence_domain
 ndctl_region_get_persistence_domain(struct ndctl_region *region)
 {
+	region_load(region, REGION_LAZY_PERSISTENCE);
 	return region->persistence_domain;
 }
 
@@ -3418,11 +3690,44 @@ NDCTL_EXPORT ssize_t ndctl_cmd_cfg_write_zero_data(struct ndctl_cmd *cfg_write)
 	return iter->total_xfer;
 }
 
+/**
+ * ndctl_cmd_cfg_write_set_diff - only transfer label extents that change
+ * @cfg_write: a cfg_write command whose data has not been modified yet
+ *
+ * Snapshot the label data that @cfg_write's source cfg_read retrieved
+ * from the device. When @cfg_write is submitted, each max_xfer sized
+ * extent that still matches the snapshot is skipped, so rewriting or
+ * zeroing a mostly unchanged label area costs a fraction of the
+ * set-config-data commands. The snapshot covers the whole label area,
+ * so the extent may still be changed afterwards.
+ */
+NDCTL_EXPORT int ndctl_cmd_cfg_write_set_diff(struct ndctl_cmd *cfg_write)
+{
+	struct ndctl_cmd_iter *iter = &cfg_write->iter;
+	struct ndctl_cmd *cfg_size;
+	u32 config_size;
+
+	if (cfg_write->type != ND_CMD_SET_CONFIG_DATA || cfg_write->status < 1)
+		return -EINVAL;
+	if (iter->cmp_buf)
+		return 0;
+
+	/* total_buf is shared with cfg_read and sized to the label area */
+	cfg_size = cfg_write->source->source;
+	config_size = cfg_size->get_size->config_size;
+	iter->cmp_buf = malloc(config_size);
+	if (!iter->cmp_buf)
+		return -ENOMEM;
+	memcpy(iter->cmp_buf, iter->total_buf, config_size);
+	return 0;
+}
+
 NDCTL_EXPORT void ndctl_cmd_unref(struct ndctl_cmd *cmd)
 {
 	if (!cmd)
 		return;
 	if (--cmd->refcount == 0) {
+		free(cmd->iter.cmp_buf);
 		if (cmd->source)
 			ndctl_cmd_unref(cmd->source);
 		else
@@ -3491,8 +3796,8 @@ NDCTL_EXPORT int ndctl_cmd_xlat_firmware_status(struct ndctl_cmd *cmd)
 
 static int do_cmd(int fd, int ioctl_cmd, struct ndctl_cmd *cmd)
 {
-	int rc;
-	u32 offset;
+	int rc = 0;
+	u32 offset, skipped = 0;
 	const char *name, *sub_name = NULL;
 	struct ndctl_dimm *dimm = cmd->dimm;
 	struct ndctl_bus *bus = cmd_to_bus(cmd);
@@ -3523,6 +3828,15 @@ static int do_cmd(int fd, int ioctl_cmd, struct ndctl_cmd *cmd)
 		cmd->set_xfer(cmd, min(iter->total_xfer - offset,
 				iter->max_xfer));
 		cmd->set_offset(cmd, offset);
+		/* diff write: don't rewrite extents the device already holds */
+		if (iter->dir == WRITE && iter->cmp_buf
+				&& memcmp(iter->cmp_buf + offset,
+					iter->total_buf + offset,
+					cmd->get_xfer(cmd)) == 0) {
+			rc = 0;
+			skipped++;
+			continue;
+		}
 		if (iter->dir == WRITE)
 			memcpy(iter->data, iter->total_buf + offset,
 					cmd->get_xfer(cmd));
@@ -3541,25 +3855,123 @@ static int do_cmd(int fd, int ioctl_cmd, struct ndctl_cmd *cmd)
 		}
 	}
 
-	dbg(ctx, "bus: %d dimm: %#x cmd: %s%s%s total: %d max_xfer: %d status: %d fw: %d (%s)\n",
+	dbg(ctx, "bus: %d dimm: %#x cmd: %s%s%s total: %d max_xfer: %d skipped: %d status: %d fw: %d (%s)\n",
 			bus->id, dimm ? ndctl_dimm_get_handle(dimm) : 0,
 			name, sub_name ? ":" : "", sub_name ? sub_name : "",
-			iter->total_xfer, iter->max_xfer, rc,
+			iter->total_xfer, iter->max_xfer, skipped, rc,
 			cmd->get_firmware_status(cmd),
 			rc < 0 ? strerror(errno) : "success");
 
+	/* the device now holds what was written, diff against that next */
+	if (iter->dir == WRITE && iter->cmp_buf && rc == 0)
+		memcpy(iter->cmp_buf, iter->total_buf, iter->total_xfer);
+
 	return rc;
 }
 
-NDCTL_EXPORT int ndctl_cmd_submit(struct ndctl_cmd *cmd)
+/*
+ * Opening and validating the control node costs an open(), fstat() and
+ * close() per command, which adds up for multi-chunk label transfers,
+ * firmware updates and health polling. Keep the fd open on the dimm or
+ * bus object after the first submission instead. It is closed when the
+ * object is freed, when the dimm or one of its regions is disabled, and
+ * by ndctl_invalidate(), and dropped whenever the device stops
+ * responding, so that the next submission revalidates it. Since any of
+ * those can happen while another thread has a command in flight, each
+ * submission issues its ioctl on its own dup() of the cached fd, which
+ * is still far cheaper than reopening the node.
+ */
+static int cmd_ctl_fd_open(struct ndctl_ctx *ctx, const char *prefix,
+		unsigned int id, unsigned int major, unsigned int minor)
 {
+	char path[20];
 	struct stat st;
-	char path[20], *prefix;
-	unsigned int major, minor, id;
-	int rc = 0, fd, len = sizeof(path);
+	int fd;
+
+	if (snprintf(path, sizeof(path), "/dev/%s%u", prefix, id)
+			>= (int) sizeof(path))
+		return -EINVAL;
+
+	fd = open(path, O_RDWR|O_CLOEXEC);
+	if (fd < 0) {
+		err(ctx, "failed to open %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+
+	if (fstat(fd, &st) >= 0 && S_ISCHR(st.st_mode)
+			&& major(st.st_rdev) == major
+			&& minor(st.st_rdev) == minor)
+		return fd;
+
+	err(ctx, "failed to validate %s as a control node\n", path);
+	close(fd);
+	return -ENXIO;
+}
+
+/*
+ * Commands for one device may be submitted from several threads, e.g. by
+ * a command batch, so the fd is opened, duplicated and dropped under the
+ * ctx lock. Returns a private fd for the caller to close, and the cached
+ * fd it was duplicated from in @cached.
+ */
+int cmd_ctl_fd(struct ndctl_cmd *cmd, int *cached)
+{
+	struct ndctl_bus *bus = cmd_to_bus(cmd);
+	struct ndctl_ctx *ctx = ndctl_bus_get_ctx(bus);
+	struct ndctl_dimm *dimm = cmd->dimm;
+	int fd;
+
+	pthread_mutex_lock(&ctx->ctl_lock);
+	if (dimm) {
+		if (dimm->ctl_fd < 0)
+			dimm->ctl_fd = cmd_ctl_fd_open(ctx, "nmem",
+					ndctl_dimm_get_id(dimm),
+					ndctl_dimm_get_major(dimm),
+					ndctl_dimm_get_minor(dimm));
+		fd = dimm->ctl_fd;
+	} else {
+		if (bus->ctl_fd < 0)
+			bus->ctl_fd = cmd_ctl_fd_open(ctx, "ndctl",
+					ndctl_bus_get_id(bus),
+					ndctl_bus_get_major(bus),
+					ndctl_bus_get_minor(bus));
+		fd = bus->ctl_fd;
+	}
+	*cached = fd;
+	if (fd > -1) {
+		fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+		if (fd < 0) {
+			fd = -errno;
+			err(ctx, "failed to duplicate control fd: %s\n",
+					strerror(-fd));
+		}
+	}
+	pthread_mutex_unlock(&ctx->ctl_lock);
+
+	return fd;
+}
+
+static void cmd_ctl_fd_invalidate(struct ndctl_cmd *cmd, int fd)
+{
+	struct ndctl_bus *bus = cmd_to_bus(cmd);
+	struct ndctl_ctx *ctx = ndctl_bus_get_ctx(bus);
+	int *ctl_fd = cmd->dimm ? &cmd->dimm->ctl_fd : &bus->ctl_fd;
+
+	/* another submission may have replaced it already */
+	pthread_mutex_lock(&ctx->ctl_lock);
+	if (*ctl_fd == fd) {
+		close(fd);
+		*ctl_fd = -1;
+	}
+	pthread_mutex_unlock(&ctx->ctl_lock);
+}
+
+NDCTL_EXPORT int ndctl_cmd_submit(struct ndctl_cmd *cmd)
+{
 	int ioctl_cmd = to_ioctl_cmd(cmd->type, !!cmd->dimm);
 	struct ndctl_bus *bus = cmd_to_bus(cmd);
 	struct ndctl_ctx *ctx = ndctl_bus_get_ctx(bus);
+	int rc, fd, cached;
 
 	if (!cmd->get_firmware_status) {
 		err(ctx, "missing status retrieval\n");
@@ -3571,39 +3983,17 @@ NDCTL_EXPORT int ndctl_cmd_submit(struct ndctl_cmd *cmd)
 		goto out;
 	}
 
-	if (cmd->dimm) {
-		prefix = "nmem";
-		id = ndctl_dimm_get_id(cmd->dimm);
-		major = ndctl_dimm_get_major(cmd->dimm);
-		minor = ndctl_dimm_get_minor(cmd->dimm);
-	} else {
-		prefix = "ndctl";
-		id = ndctl_bus_get_id(cmd->bus);
-		major = ndctl_bus_get_major(cmd->bus);
-		minor = ndctl_bus_get_minor(cmd->bus);
-	}
-
-	if (snprintf(path, len, "/dev/%s%u", prefix, id) >= len) {
-		rc = -EINVAL;
-		goto out;
-	}
-
-	fd = open(path, O_RDWR);
+	fd = cmd_ctl_fd(cmd, &cached);
 	if (fd < 0) {
-		err(ctx, "failed to open %s: %s\n", path, strerror(errno));
-		rc = -errno;
+		/* nothing was cached, the next submission retries the open */
+		rc = fd;
 		goto out;
 	}
 
-	if (fstat(fd, &st) >= 0 && S_ISCHR(st.st_mode)
-			&& major(st.st_rdev) == major
-			&& minor(st.st_rdev) == minor) {
-		rc = do_cmd(fd, ioctl_cmd, cmd);
-	} else {
-		err(ctx, "failed to validate %s as a control node\n", path);
-		rc = -ENXIO;
-	}
+	rc = do_cmd(fd, ioctl_cmd, cmd);
 	close(fd);
+	if (rc == -ENXIO || rc == -ENODEV || rc == -EBADF)
+		cmd_ctl_fd_invalidate(cmd, cached);
  out:
 	cmd->status = rc;
 	return rc;
@@ -3676,6 +4066,7 @@ NDCTL_EXPORT int ndctl_region_enable(struct ndctl_region *region)
 	if (ndctl_region_is_enabled(region))
 		return 0;
 
+	region_load(region, REGION_LAZY_MODULE);
 	util_bind(devname, region->module, "nd", ctx);
 
 	if (!ndctl_region_is_enabled(region)) {
@@ -3705,6 +4096,17 @@ NDCTL_EXPORT void ndctl_region_cleanup(struct ndctl_region *region)
 	free_stale_daxs(region);
 }
 
+/* the region's dimms and bus are revalidated after it is reconfigured */
+static void region_ctl_fd_close(struct ndctl_region *region)
+{
+	struct ndctl_ctx *ctx = ndctl_region_get_ctx(region);
+	struct ndctl_mapping *mapping;
+
+	ctl_fd_close(ctx, &region->bus->ctl_fd);
+	ndctl_mapping_foreach(region, mapping)
+		ctl_fd_close(ctx, &ndctl_mapping_get_dimm(mapping)->ctl_fd);
+}
+
 static int ndctl_region_disable(struct ndctl_region *region, int cleanup)
 {
 	struct ndctl_ctx *ctx = ndctl_region_get_ctx(region);
@@ -3719,6 +4121,7 @@ static int ndctl_region_disable(struct ndctl_region *region, int cleanup)
 		err(ctx, "%s: failed to disable\n", devname);
 		return -EBUSY;
 	}
+	region_ctl_fd_close(region);
 	region->namespaces_init = 0;
 	region->btts_init = 0;
 	region->pfns_init = 0;
@@ -4047,15 +4450,14 @@ static enum ndctl_namespace_mode enforce_name_to_id(const char *name)
 static void *add_namespace(void *parent, int id, const char *ndns_base)
 {
 	const char *devname = devpath_to_devname(ndns_base);
-	char *path = calloc(1, strlen(ndns_base) + 100);
 	struct ndctl_namespace *ndns, *ndns_dup;
 	struct ndctl_region *region = parent;
 	struct ndctl_bus *bus = region->bus;
 	struct ndctl_ctx *ctx = bus->ctx;
 	char buf[SYSFS_ATTR_SIZE];
+	struct sysfs_dir dir;
 
-	if (!path)
-		return NULL;
+	sysfs_dir_open(ctx, &dir, ndns_base);
 
 	ndns = calloc(1, sizeof(*ndns));
 	if (!ndns)
@@ -4065,48 +4467,40 @@ static void *add_namespace(void *parent, int id, const char *ndns_base)
 	ndns->generation = region->generation;
 	list_head_init(&ndns->injected_bb);
 
-	sprintf(path, "%s/nstype", ndns_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "nstype", buf) < 0)
 		goto err_read;
 	ndns->type = strtoul(buf, NULL, 0);
 
-	sprintf(path, "%s/size", ndns_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "size", buf) < 0)
 		goto err_read;
 	ndns->size = strtoull(buf, NULL, 0);
 
-	sprintf(path, "%s/resource", ndns_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "resource", buf) < 0)
 		ndns->resource = ULLONG_MAX;
 	else
 		ndns->resource = strtoull(buf, NULL, 0);
 
-	sprintf(path, "%s/force_raw", ndns_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "force_raw", buf) < 0)
 		goto err_read;
 	ndns->raw_mode = strtoul(buf, NULL, 0);
 
-	sprintf(path, "%s/numa_node", ndns_base);
-	if (sysfs_read_attr(ctx, path, buf) == 0)
+	if (sysfs_dir_read_attr(&dir, "numa_node", buf) == 0)
 		ndns->numa_node = strtol(buf, NULL, 0);
 	else
 		ndns->numa_node = -1;
 
-	sprintf(path, "%s/target_node", ndns_base);
-	if (sysfs_read_attr(ctx, path, buf) == 0)
+	if (sysfs_dir_read_attr(&dir, "target_node", buf) == 0)
 		ndns->target_node = strtol(buf, NULL, 0);
 	else
 		ndns->target_node = -1;
 
-	sprintf(path, "%s/holder_class", ndns_base);
-	if (sysfs_read_attr(ctx, path, buf) == 0)
+	if (sysfs_dir_read_attr(&dir, "holder_class", buf) == 0)
 		ndns->enforce_mode = enforce_name_to_id(buf);
 
 	switch (ndns->type) {
 	case ND_DEVICE_NAMESPACE_BLK:
 	case ND_DEVICE_NAMESPACE_PMEM:
-		sprintf(path, "%s/sector_size", ndns_base);
-		if (sysfs_read_attr(ctx, path, buf) == 0)
+		if (sysfs_dir_read_attr(&dir, "sector_size", buf) == 0)
 			parse_lbasize_supported(ctx, devname, buf,
 					&ndns->lbasize);
 		else if (ndns->type == ND_DEVICE_NAMESPACE_BLK) {
@@ -4118,18 +4512,16 @@ static void *add_namespace(void *parent, int id, const char *ndns_base)
 		} else
 			parse_lbasize_supported(ctx, devname, "",
 					&ndns->lbasize);
-		sprintf(path, "%s/alt_name", ndns_base);
-		if (sysfs_read_attr(ctx, path, buf) < 0)
+		if (sysfs_dir_read_attr(&dir, "alt_name", buf) < 0)
 			goto err_read;
 		ndns->alt_name = strdup(buf);
 		if (!ndns->alt_name)
 			goto err_read;
 
-		sprintf(path, "%s/uuid", ndns_base);
-		if (sysfs_read_attr(ctx, path, buf) < 0)
+		if (sysfs_dir_read_attr(&dir, "uuid", buf) < 0)
 			goto err_read;
 		if (strlen(buf) && uuid_parse(buf, ndns->uuid) < 0) {
-			dbg(ctx, "%s:%s\n", path, buf);
+			dbg(ctx, "%s/uuid:%s\n", ndns_base, buf);
 			goto err_read;
 		}
 		break;
@@ -4146,20 +4538,19 @@ static void *add_namespace(void *parent, int id, const char *ndns_base)
 		goto err_read;
 	ndns->buf_len = strlen(ndns_base) + 50;
 
-	sprintf(path, "%s/modalias", ndns_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "modalias", buf) < 0)
 		goto err_read;
 	ndns->module = util_modalias_to_module(ctx, buf);
 
 	ndctl_namespace_foreach(region, ndns_dup)
 		if (ndns_dup->id == ndns->id) {
 			free_namespace(ndns, NULL);
-			free(path);
+			sysfs_dir_close(&dir);
 			return ndns_dup;
 		}
 
 	list_add(&region->namespaces, &ndns->list);
-	free(path);
+	sysfs_dir_close(&dir);
 	return ndns;
 
  err_read:
@@ -4168,12 +4559,13 @@ static void *add_namespace(void *parent, int id, const char *ndns_base)
 	free(ndns->alt_name);
 	free(ndns);
  err_namespace:
-	free(path);
+	sysfs_dir_close(&dir);
 	return NULL;
 }
 
-static void namespaces_init(struct ndctl_region *region)
+static void __namespaces_init(void *_region)
 {
+	struct ndctl_region *region = _region;
 	struct ndctl_bus *bus = region->bus;
 	struct ndctl_ctx *ctx = bus->ctx;
 	char ndns_fmt[20];
@@ -4186,6 +4578,21 @@ static void namespaces_init(struct ndctl_region *region)
 	device_parse(ctx, bus, region->region_path, ndns_fmt, region, add_namespace);
 }
 
+static void namespaces_init(struct ndctl_region *region)
+{
+	struct ndctl_bus *bus = region->bus;
+	struct ndctl_ctx *ctx = bus->ctx;
+
+	if (region->namespaces_init)
+		return;
+
+	if (ctx->enum_jobs > 1)
+		enum_parallel(ctx, bus, &bus->regions,
+			      offsetof(struct ndctl_region, list),
+			      __namespaces_init);
+	__namespaces_init(region);
+}
+
 NDCTL_EXPORT struct ndctl_namespace *ndctl_namespace_get_first(struct ndctl_region *region)
 {
 	namespaces_init(region);
@@ -5155,13 +5562,12 @@ static void *add_btt(void *parent, int id, const char *btt_base)
 {
 	struct ndctl_ctx *ctx = ndctl_region_get_ctx(parent);
 	const char *devname = devpath_to_devname(btt_base);
-	char *path = calloc(1, strlen(btt_base) + 100);
 	struct ndctl_region *region = parent;
 	struct ndctl_btt *btt, *btt_dup;
 	char buf[SYSFS_ATTR_SIZE];
+	struct sysfs_dir dir;
 
-	if (!path)
-		return NULL;
+	sysfs_dir_open(ctx, &dir, btt_base);
 
 	btt = calloc(1, sizeof(*btt));
 	if (!btt)
@@ -5179,30 +5585,26 @@ static void *add_btt(void *parent, int id, const char *btt_base)
 		goto err_read;
 	btt->buf_len = strlen(btt_base) + 50;
 
-	sprintf(path, "%s/modalias", btt_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "modalias", buf) < 0)
 		goto err_read;
 	btt->module = util_modalias_to_module(ctx, buf);
 
-	sprintf(path, "%s/uuid", btt_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "uuid", buf) < 0)
 		goto err_read;
 	if (strlen(buf) && uuid_parse(buf, btt->uuid) < 0)
 		goto err_read;
 
-	sprintf(path, "%s/sector_size", btt_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "sector_size", buf) < 0)
 		goto err_read;
 	if (parse_lbasize_supported(ctx, devname, buf, &btt->lbasize) < 0)
 		goto err_read;
 
-	sprintf(path, "%s/size", btt_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "size", buf) < 0)
 		btt->size = ULLONG_MAX;
 	else
 		btt->size = strtoull(buf, NULL, 0);
 
-	free(path);
+	sysfs_dir_close(&dir);
 	ndctl_btt_foreach(region, btt_dup)
 		if (btt->id == btt_dup->id) {
 			btt_dup->size = btt->size;
@@ -5219,7 +5621,7 @@ static void *add_btt(void *parent, int id, const char *btt_base)
 	free(btt->btt_path);
 	free(btt);
  err_btt:
-	free(path);
+	sysfs_dir_close(&dir);
 	return NULL;
 }
 
@@ -5512,12 +5914,11 @@ NDCTL_EXPORT int ndctl_btt_is_configured(struct ndctl_btt *btt)
 static void *__add_pfn(struct ndctl_pfn *pfn, const char *pfn_base)
 {
 	struct ndctl_ctx *ctx = ndctl_region_get_ctx(pfn->region);
-	char *path = calloc(1, strlen(pfn_base) + 100);
 	struct ndctl_region *region = pfn->region;
 	char buf[SYSFS_ATTR_SIZE];
+	struct sysfs_dir dir;
 
-	if (!path)
-		return NULL;
+	sysfs_dir_open(ctx, &dir, pfn_base);
 
 	pfn->generation = region->generation;
 
@@ -5530,19 +5931,16 @@ static void *__add_pfn(struct ndctl_pfn *pfn, const char *pfn_base)
 		goto err_read;
 	pfn->buf_len = strlen(pfn_base) + 50;
 
-	sprintf(path, "%s/modalias", pfn_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "modalias", buf) < 0)
 		goto err_read;
 	pfn->module = util_modalias_to_module(ctx, buf);
 
-	sprintf(path, "%s/uuid", pfn_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "uuid", buf) < 0)
 		goto err_read;
 	if (strlen(buf) && uuid_parse(buf, pfn->uuid) < 0)
 		goto err_read;
 
-	sprintf(path, "%s/mode", pfn_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "mode", buf) < 0)
 		goto err_read;
 	if (strcmp(buf, "none") == 0)
 		pfn->loc = NDCTL_PFN_LOC_NONE;
@@ -5553,20 +5951,17 @@ static void *__add_pfn(struct ndctl_pfn *pfn, const char *pfn_base)
 	else
 		goto err_read;
 
-	sprintf(path, "%s/align", pfn_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "align", buf) < 0)
 		pfn->align = 0;
 	else
 		pfn->align = strtoul(buf, NULL, 0);
 
-	sprintf(path, "%s/resource", pfn_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "resource", buf) < 0)
 		pfn->resource = ULLONG_MAX;
 	else
 		pfn->resource = strtoull(buf, NULL, 0);
 
-	sprintf(path, "%s/size", pfn_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "size", buf) < 0)
 		pfn->size = ULLONG_MAX;
 	else
 		pfn->size = strtoull(buf, NULL, 0);
@@ -5577,20 +5972,19 @@ static void *__add_pfn(struct ndctl_pfn *pfn, const char *pfn_base)
 	 * attribute then it's safe to assume that we running on x86 where
 	 * 4KiB and 2MiB have always been supported.
 	 */
-	sprintf(path, "%s/supported_alignments", pfn_base);
-	if (sysfs_read_attr(ctx, path, buf) < 0)
+	if (sysfs_dir_read_attr(&dir, "supported_alignments", buf) < 0)
 		sprintf(buf, "%d %d", SZ_4K, SZ_2M);
 
 	if (parse_lbasize_supported(ctx, pfn_base, buf, &pfn->alignments) < 0)
 		goto err_read;
 
-	free(path);
+	sysfs_dir_close(&dir);
 	return pfn;
 
  err_read:
 	free(pfn->pfn_buf);
 	free(pfn->pfn_path);
-	free(path);
+	sysfs_dir_close(&dir);
 	return NULL;
 }
 
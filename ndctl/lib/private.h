@@ -5,6 +5,7 @@
 
 #include <errno.h>
 #include <stdbool.h>
+#include <pthread.h>
 #include <syslog.h>
 #include <string.h>
 #include <libudev.h>
@@ -33,6 +34,13 @@ struct nvdimm_data {
 	int ns_current, ns_next;
 };
 
+/* attributes of a dimm that are read on first use, see dimm_load() */
+enum {
+	DIMM_LAZY_MODULE = 1 << 0,
+	DIMM_LAZY_FLAGS = 1 << 1,
+	DIMM_LAZY_FWA = 1 << 2,
+};
+
 /**
  * struct ndctl_dimm - memory device as identified by NFIT
  * @module: kernel module (libnvdimm)
@@ -48,6 +56,7 @@ struct nvdimm_data {
  * @imc: memory-controller-id in the socket
  * @channel: channel-id in the memory-controller
  * @dimm: dimm-id in the channel
+ * @ctl_fd: cached fd of /dev/nmemX for command submission, or -1
  * @formats: number of support interfaces
  * @format: array of format interface code numbers
  */
@@ -77,6 +86,7 @@ struct ndctl_dimm {
 	char *dimm_buf;
 	char *bus_prefix;
 	int health_eventfd;
+	int ctl_fd;
 	int buf_len;
 	int id;
 	union dimm_flags {
@@ -93,6 +103,7 @@ struct ndctl_dimm {
 	} flags;
 	int locked;
 	int aliased;
+	unsigned int loaded;
 	struct list_node list;
 	int formats;
 	int format[0];
@@ -114,6 +125,7 @@ static inline enum dsm_support test_dimm_dsm(struct ndctl_dimm *dimm, int fn)
 }
 
 void region_flag_refresh(struct ndctl_region *region);
+int cmd_ctl_fd(struct ndctl_cmd *cmd, int *cached);
 
 /**
  * struct ndctl_ctx - library user context to find "nd" instances
@@ -137,6 +149,11 @@ struct ndctl_ctx {
 	struct kmod_ctx *kmod_ctx;
 	struct daxctl_ctx *daxctl_ctx;
 	unsigned long timeout;
+	int enum_jobs;
+	/* probing settled ahead of a parallel enumeration, see enum_parallel() */
+	int probe_settled;
+	/* guards opening and closing the cached bus and dimm ctl_fd */
+	pthread_mutex_t ctl_lock;
 	void *private_data;
 };
 
@@ -152,6 +169,13 @@ struct ndctl_ctx {
  * nfit_test module provides multiple test busses with provider names of
  * the format "nfit_test.N"
  */
+/* one sorted lookup table entry, see dimm_index() */
+struct ndctl_dimm_key {
+	unsigned int key;
+	int pos;
+	struct ndctl_dimm *dimm;
+};
+
 struct ndctl_bus {
 	struct ndctl_ctx *ctx;
 	unsigned int id, major, minor, revision;
@@ -173,6 +197,12 @@ struct ndctl_bus {
 	unsigned long nfit_dsm_mask;
 	enum ndctl_fwa_state fwa_state;
 	enum ndctl_fwa_method fwa_method;
+	int ctl_fd;
+	struct ndctl_dimm_key *dimm_by_id;
+	struct ndctl_dimm_key *dimm_by_handle;
+	int nr_dimm_keys;
+	unsigned int dimm_gen;
+	unsigned int dimm_keys_gen;
 };
 
 /**
@@ -260,6 +290,7 @@ struct ndctl_cmd {
 		u8 *data; /* pointer to the data buffer location in cmd */
 		u32 max_xfer;
 		char *total_buf;
+		char *cmp_buf; /* device contents, for a diff write */
 		u32 total_xfer;
 		int dir;
 	} iter;
@@ -101,6 +101,8 @@ void ndctl_set_userdata(struct ndctl_ctx *ctx, void *userdata);
 void *ndctl_get_userdata(struct ndctl_ctx *ctx);
 int ndctl_set_config_path(struct ndctl_ctx *ctx, char *config_path);
 const char *ndctl_get_config_path(struct ndctl_ctx *ctx);
+int ndctl_set_enum_jobs(struct ndctl_ctx *ctx, int jobs);
+int ndctl_get_enum_jobs(struct ndctl_ctx *ctx);
 
 enum ndctl_persistence_domain {
 	PERSISTENCE_NONE = 0,
@@ -361,6 +363,7 @@ int ndctl_cmd_cfg_write_set_extent(struct ndctl_cmd *cfg_write,
 ssize_t ndctl_cmd_cfg_write_set_data(struct ndctl_cmd *cfg_write, void *buf,
 		unsigned int len, unsigned int offset);
 ssize_t ndctl_cmd_cfg_write_zero_data(struct ndctl_cmd *cfg_write);
+int ndctl_cmd_cfg_write_set_diff(struct ndctl_cmd *cfg_write);
 void ndctl_cmd_unref(struct ndctl_cmd *cmd);
 void ndctl_cmd_ref(struct ndctl_cmd *cmd);
 int ndctl_cmd_get_type(struct ndctl_cmd *cmd);
@@ -748,6 +751,24 @@ enum ndctl_fwa_state ndctl_dimm_fw_activate_arm(struct ndctl_dimm *dimm);
 int ndctl_cmd_xlat_firmware_status(struct ndctl_cmd *cmd);
 int ndctl_cmd_submit_xlat(struct ndctl_cmd *cmd);
 
+/*
+ * Submit several commands concurrently, with at most one in flight per
+ * dimm (or bus). @rc is the ndctl_cmd_submit_xlat() result. The commands
+ * are submitted from library threads: don't touch them, or disable their
+ * devices, until they are reaped, and expect the ctx log function to be
+ * called from those threads.
+ */
+struct ndctl_cmd_batch;
+typedef void (*ndctl_cmd_batch_fn)(struct ndctl_cmd *cmd, int rc, void *data);
+struct ndctl_cmd_batch *ndctl_cmd_batch_new(struct ndctl_ctx *ctx);
+int ndctl_cmd_batch_add(struct ndctl_cmd_batch *batch, struct ndctl_cmd *cmd,
+		ndctl_cmd_batch_fn done, void *data);
+int ndctl_cmd_batch_submit(struct ndctl_cmd_batch *batch);
+int ndctl_cmd_batch_wait(struct ndctl_cmd_batch *batch);
+int ndctl_cmd_batch_get_status(struct ndctl_cmd_batch *batch,
+		struct ndctl_cmd *cmd);
+void ndctl_cmd_batch_free(struct ndctl_cmd_batch *batch);
+
 #define ND_PASSPHRASE_SIZE	32
 #define ND_KEY_DESC_LEN	22
 #define ND_KEY_DESC_PREFIX  7
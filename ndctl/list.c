@@ -318,6 +318,92 @@ static bool filter_region(struct ndctl_region *region,
 	return true;
 }
 
+/*
+ * With --health, the smart commands of all the dimms that are going to be
+ * listed are submitted concurrently ahead of the listing walk, which then
+ * picks up each dimm's health from here.
+ */
+static struct {
+	struct ndctl_dimm **dimm;
+	struct json_object **jhealth;
+	int count;
+} health;
+
+static bool health_filter_bus(struct ndctl_bus *bus,
+		struct ndctl_filter_ctx *ctx)
+{
+	return true;
+}
+
+static bool health_filter_region(struct ndctl_region *region,
+		struct ndctl_filter_ctx *ctx)
+{
+	return false;
+}
+
+static void health_filter_dimm(struct ndctl_dimm *dimm,
+		struct ndctl_filter_ctx *ctx)
+{
+	struct ndctl_dimm **dimms;
+
+	if (!list.configured && !list.idle && !ndctl_dimm_is_enabled(dimm))
+		return;
+
+	dimms = realloc(health.dimm, (health.count + 1) * sizeof(*dimms));
+	if (!dimms)
+		return;
+	health.dimm = dimms;
+	health.dimm[health.count++] = dimm;
+}
+
+static void health_prefetch(struct ndctl_ctx *ctx,
+		struct ndctl_filter_params *p)
+{
+	struct ndctl_filter_ctx fctx = {
+		.filter_bus = health_filter_bus,
+		.filter_dimm = health_filter_dimm,
+		.filter_region = health_filter_region,
+	};
+
+	if (ndctl_filter_walk(ctx, &fctx, p) || !health.count)
+		return;
+
+	health.jhealth = calloc(health.count, sizeof(*health.jhealth));
+	if (!health.jhealth) {
+		health.count = 0;
+		return;
+	}
+	util_dimms_health_to_json(ctx, health.dimm, health.jhealth,
+			health.count);
+}
+
+/* the prefetched health of @dimm, or a fresh query if there is none */
+static struct json_object *health_get(struct ndctl_dimm *dimm)
+{
+	struct json_object *jhealth;
+	int i;
+
+	for (i = 0; i < health.count; i++) {
+		if (health.dimm[i] != dimm)
+			continue;
+		jhealth = health.jhealth[i];
+		health.jhealth[i] = NULL;
+		return jhealth;
+	}
+	return util_dimm_health_to_json(dimm);
+}
+
+static void health_release(void)
+{
+	int i;
+
+	for (i = 0; i < health.count; i++)
+		json_object_put(health.jhealth[i]);
+	free(health.jhealth);
+	free(health.dimm);
+	health.count = 0;
+}
+
 static void filter_dimm(struct ndctl_dimm *dimm, struct ndctl_filter_ctx *ctx)
 {
 	struct list_filter_arg *lfa = ctx->list;
@@ -346,7 +432,7 @@ static void filter_dimm(struct ndctl_dimm *dimm, struct ndctl_filter_ctx *ctx)
 	if (list.health) {
 		struct json_object *jhealth;
 
-		jhealth = util_dimm_health_to_json(dimm);
+		jhealth = health_get(dimm);
 		if (jhealth)
 			json_object_object_add(jdimm, "health", jhealth);
 		else if (ndctl_dimm_is_cmd_supported(dimm, ND_CMD_SMART)) {
@@ -355,6 +441,7 @@ static void filter_dimm(struct ndctl_dimm *dimm, struct ndctl_filter_ctx *ctx)
 			 * that otherwise supports smart data retrieval
 			 * commands.
 			 */
+			json_object_put(jdimm);
 			fail("\n");
 			return;
 		}
@@ -544,7 +631,11 @@ int cmd_list(int argc, const char **argv, struct ndctl_ctx *ctx)
 	fctx.list = &lfa;
 	lfa.flags = listopts_to_flags();
 
+	if (list.dimms && list.health)
+		health_prefetch(ctx, &param);
+
 	rc = ndctl_filter_walk(ctx, &fctx, &param);
+	health_release();
 	if (rc)
 		return rc;
 
@@ -6,11 +6,13 @@
 #include <libgen.h>
 #include <time.h>
 #include <dirent.h>
+#include <signal.h>
 #include <util/json.h>
 #include <util/util.h>
 #include <util/parse-options.h>
 #include <util/parse-configs.h>
 #include <util/strbuf.h>
+#include <util/event_log.h>
 #include <ndctl/ndctl.h>
 #include <ndctl/libndctl.h>
 #include <sys/epoll.h>
@@ -33,19 +35,58 @@ static struct monitor {
 	const char *log;
 	const char *configs;
 	const char *dimm_event;
+	const char *log_format;
+	const char *aggregate_conf;
+	struct evlog evlog;
+	bool binary;
 	bool daemon;
 	bool human;
 	bool verbose;
 	unsigned int poll_timeout;
+	unsigned int aggregate;
 	unsigned int event_flags;
 	struct log_ctx ctx;
 } monitor;
 
+/*
+ * Repeats of the notification that opened the window, i.e. with the same
+ * event flags, folded into one summary when the window closes. @min and
+ * @max cover the @varied ND_SMART_*_VALID fields.
+ */
+struct monitor_agg {
+	bool open;
+	unsigned int event_flags;
+	/* CLOCK_BOOTTIME end of the window, in milliseconds */
+	unsigned long long deadline;
+	unsigned long count;
+	u64 first;
+	u64 last;
+	unsigned int varied;
+	struct util_smart min;
+	struct util_smart max;
+};
+
 struct monitor_dimm {
 	struct ndctl_dimm *dimm;
 	int health_eventfd;
-	unsigned int health;
 	unsigned int event_flags;
+	/*
+	 * Last sample, and the sample last sent in a notification. The
+	 * ND_SMART_*_VALID bits of the smart fields also name them in a
+	 * delta mask.
+	 */
+	struct util_smart smart;
+	struct util_smart reported;
+	/* ND_SMART_*_VALID mask of fields that differ from @reported */
+	unsigned int changed;
+	/* alarm thresholds, read for notifications only */
+	bool thresh_valid;
+	bool thresh_reported;
+	struct util_smart_threshold thresh;
+	struct util_smart_threshold reported_thresh;
+	/* CLOCK_BOOTTIME deadline of the next poll, in milliseconds */
+	unsigned long long next_poll;
+	struct monitor_agg agg;
 	struct list_node list;
 };
 
@@ -60,7 +101,9 @@ do { \
 			VERSION, __func__, __LINE__, ##__VA_ARGS__); \
 } while (0)
 
-static struct json_object *dimm_event_to_json(struct monitor_dimm *mdimm)
+/* @selected: events being monitored, @active: events raised by the dimm */
+static struct json_object *dimm_event_to_json(unsigned int selected,
+		unsigned int active)
 {
 	struct json_object *jevent, *jobj;
 	bool spares_flag, media_temp_flag, ctrl_temp_flag,
@@ -72,45 +115,40 @@ static struct json_object *dimm_event_to_json(struct monitor_dimm *mdimm)
 		return NULL;
 	}
 
-	if (monitor.event_flags & ND_EVENT_SPARES_REMAINING) {
-		spares_flag = !!(mdimm->event_flags
-				& ND_EVENT_SPARES_REMAINING);
+	if (selected & ND_EVENT_SPARES_REMAINING) {
+		spares_flag = !!(active & ND_EVENT_SPARES_REMAINING);
 		jobj = json_object_new_boolean(spares_flag);
 		if (jobj)
 			json_object_object_add(jevent,
 				"dimm-spares-remaining", jobj);
 	}
 
-	if (monitor.event_flags & ND_EVENT_MEDIA_TEMPERATURE) {
-		media_temp_flag = !!(mdimm->event_flags
-				& ND_EVENT_MEDIA_TEMPERATURE);
+	if (selected & ND_EVENT_MEDIA_TEMPERATURE) {
+		media_temp_flag = !!(active & ND_EVENT_MEDIA_TEMPERATURE);
 		jobj = json_object_new_boolean(media_temp_flag);
 		if (jobj)
 			json_object_object_add(jevent,
 				"dimm-media-temperature", jobj);
 	}
 
-	if (monitor.event_flags & ND_EVENT_CTRL_TEMPERATURE) {
-		ctrl_temp_flag = !!(mdimm->event_flags
-				& ND_EVENT_CTRL_TEMPERATURE);
+	if (selected & ND_EVENT_CTRL_TEMPERATURE) {
+		ctrl_temp_flag = !!(active & ND_EVENT_CTRL_TEMPERATURE);
 		jobj = json_object_new_boolean(ctrl_temp_flag);
 		if (jobj)
 			json_object_object_add(jevent,
 				"dimm-controller-temperature", jobj);
 	}
 
-	if (monitor.event_flags & ND_EVENT_HEALTH_STATE) {
-		health_state_flag = !!(mdimm->event_flags
-				& ND_EVENT_HEALTH_STATE);
+	if (selected & ND_EVENT_HEALTH_STATE) {
+		health_state_flag = !!(active & ND_EVENT_HEALTH_STATE);
 		jobj = json_object_new_boolean(health_state_flag);
 		if (jobj)
 			json_object_object_add(jevent,
 				"dimm-health-state", jobj);
 	}
 
-	if (monitor.event_flags & ND_EVENT_UNCLEAN_SHUTDOWN) {
-		unclean_shutdown_flag = !!(mdimm->event_flags
-				& ND_EVENT_UNCLEAN_SHUTDOWN);
+	if (selected & ND_EVENT_UNCLEAN_SHUTDOWN) {
+		unclean_shutdown_flag = !!(active & ND_EVENT_UNCLEAN_SHUTDOWN);
 		jobj = json_object_new_boolean(unclean_shutdown_flag);
 		if (jobj)
 			json_object_object_add(jevent,
@@ -120,67 +158,435 @@ static struct json_object *dimm_event_to_json(struct monitor_dimm *mdimm)
 	return jevent;
 }
 
-static int notify_dimm_event(struct monitor_dimm *mdimm)
+static unsigned int smart_delta(const struct util_smart *old,
+		const struct util_smart *new)
 {
-	struct json_object *jmsg, *jdimm, *jobj;
-	struct timespec ts;
-	char timestamp[32];
+	unsigned int both = old->flags & new->flags;
+	unsigned int delta = new->flags & ~old->flags;
+
+#define smart_field_delta(bit, field) \
+	if ((both & (bit)) && old->field != new->field) \
+		delta |= (bit)
+
+	smart_field_delta(ND_SMART_HEALTH_VALID, health);
+	smart_field_delta(ND_SMART_MTEMP_VALID, media_temperature);
+	smart_field_delta(ND_SMART_CTEMP_VALID, ctrl_temperature);
+	smart_field_delta(ND_SMART_SPARES_VALID, spares);
+	smart_field_delta(ND_SMART_ALARM_VALID, alarm_flags);
+	smart_field_delta(ND_SMART_USED_VALID, life_used);
+	smart_field_delta(ND_SMART_SHUTDOWN_VALID, shutdown_state);
+	smart_field_delta(ND_SMART_SHUTDOWN_COUNT_VALID, shutdown_count);
+#undef smart_field_delta
+
+	return delta;
+}
+
+/*
+ * The health fields of the next notification for @mdimm: the health state
+ * is always present, the other fields only when they changed since the
+ * dimm was last reported.
+ */
+static unsigned int dimm_health_fields(struct monitor_dimm *mdimm)
+{
+	struct util_smart *smart = &mdimm->smart;
+
+	if (!mdimm->reported.flags)
+		return smart->flags;
+	return mdimm->changed | (smart->flags & ND_SMART_HEALTH_VALID);
+}
+
+/*
+ * The alarm thresholds go with the first notification for @mdimm, then
+ * only when they were reprogrammed since the last one.
+ */
+static const struct util_smart_threshold *dimm_health_thresh(
+		struct monitor_dimm *mdimm)
+{
+	if (!mdimm->thresh_valid)
+		return NULL;
+	if (!mdimm->reported.flags || !mdimm->thresh_reported)
+		return &mdimm->thresh;
+	if (memcmp(&mdimm->thresh, &mdimm->reported_thresh,
+				sizeof(mdimm->thresh)) != 0)
+		return &mdimm->thresh;
+	return NULL;
+}
+
+/* build the "health" object of a notification from a sample */
+static struct json_object *health_to_json(const struct util_smart *smart,
+		unsigned int fields, const struct util_smart_threshold *thresh)
+{
+	struct json_object *jhealth, *jobj;
+
+	if (smart->flags)
+		return util_smart_to_json(smart, fields, thresh);
+
+	jhealth = json_object_new_object();
+	if (!jhealth)
+		return NULL;
+	jobj = json_object_new_string("unknown");
+	if (jobj)
+		json_object_object_add(jhealth, "health_state", jobj);
+	return jhealth;
+}
+
+static struct json_object *timestamp_to_json(u64 timestamp)
+{
+	char buf[32];
+
+	sprintf(buf, "%10llu.%09llu", timestamp / 1000000000ULL,
+			timestamp % 1000000000ULL);
+	return json_object_new_string(buf);
+}
+
+static struct json_object *notification_to_json(u64 timestamp, int pid,
+		struct json_object *jevent, struct json_object *jdimm)
+{
+	struct json_object *jmsg, *jobj;
 
 	jmsg = json_object_new_object();
 	if (!jmsg) {
-		fail("\n");
-		return -ENOMEM;
+		json_object_put(jevent);
+		json_object_put(jdimm);
+		return NULL;
 	}
 
-	clock_gettime(CLOCK_REALTIME, &ts);
-	sprintf(timestamp, "%10ld.%09ld", ts.tv_sec, ts.tv_nsec);
-	jobj = json_object_new_string(timestamp);
+	jobj = timestamp_to_json(timestamp);
 	if (jobj)
 		json_object_object_add(jmsg, "timestamp", jobj);
 
-	jobj = json_object_new_int(getpid());
+	jobj = json_object_new_int(pid);
 	if (jobj)
 		json_object_object_add(jmsg, "pid", jobj);
 
-	jobj = dimm_event_to_json(mdimm);
-	if (jobj)
-		json_object_object_add(jmsg, "event", jobj);
-
-	jdimm = util_dimm_to_json(mdimm->dimm, 0);
+	if (jevent)
+		json_object_object_add(jmsg, "event", jevent);
 	if (jdimm)
 		json_object_object_add(jmsg, "dimm", jdimm);
 
-	jobj = util_dimm_health_to_json(mdimm->dimm);
-	if (jobj)
-		json_object_object_add(jdimm, "health", jobj);
+	return jmsg;
+}
 
+static int monitor_json_flags(void)
+{
 	if (monitor.human)
-		notice(&monitor, "%s\n", json_object_to_json_string_ext(jmsg,
-						JSON_C_TO_STRING_PRETTY));
-	else
-		notice(&monitor, "%s\n", json_object_to_json_string_ext(jmsg,
-						JSON_C_TO_STRING_PLAIN));
+		return JSON_C_TO_STRING_PRETTY;
+	return JSON_C_TO_STRING_PLAIN;
+}
+
+/*
+ * The binary log form of a notification. The dimm is identified by the
+ * attributes that don't need the device to be present to decode.
+ */
+struct monitor_dimm_record {
+	le32 selected;
+	le32 active;
+	le32 fields;
+	le32 smart_flags;
+	le32 health;
+	le32 media_temperature;
+	le32 ctrl_temperature;
+	le32 spares;
+	le32 alarm_flags;
+	le32 life_used;
+	le32 shutdown_state;
+	le32 shutdown_count;
+	le32 handle;
+	le16 phys_id;
+	/* non-zero when the threshold fields below are present */
+	le16 thresh_valid;
+	char dev[32];
+	char id[40];
+	le32 alarm_control;
+	le32 media_temperature_threshold;
+	le32 ctrl_temperature_threshold;
+	le32 spares_threshold;
+};
+
+static int log_dimm_event(struct monitor_dimm *mdimm, u64 timestamp,
+		unsigned int fields, const struct util_smart_threshold *thresh)
+{
+	struct ndctl_dimm *dimm = mdimm->dimm;
+	struct util_smart *smart = &mdimm->smart;
+	const char *id = ndctl_dimm_get_unique_id(dimm);
+	struct monitor_dimm_record rec = {
+		.selected = cpu_to_le32(monitor.event_flags),
+		.active = cpu_to_le32(mdimm->event_flags),
+		.fields = cpu_to_le32(fields),
+		.smart_flags = cpu_to_le32(smart->flags),
+		.health = cpu_to_le32(smart->health),
+		.media_temperature = cpu_to_le32(smart->media_temperature),
+		.ctrl_temperature = cpu_to_le32(smart->ctrl_temperature),
+		.spares = cpu_to_le32(smart->spares),
+		.alarm_flags = cpu_to_le32(smart->alarm_flags),
+		.life_used = cpu_to_le32(smart->life_used),
+		.shutdown_state = cpu_to_le32(smart->shutdown_state),
+		.shutdown_count = cpu_to_le32(smart->shutdown_count),
+		.handle = cpu_to_le32(ndctl_dimm_get_handle(dimm)),
+		.phys_id = cpu_to_le16(ndctl_dimm_get_phys_id(dimm)),
+	};
+
+	strncpy(rec.dev, ndctl_dimm_get_devname(dimm), sizeof(rec.dev) - 1);
+	if (id)
+		strncpy(rec.id, id, sizeof(rec.id) - 1);
+	if (thresh) {
+		rec.thresh_valid = cpu_to_le16(1);
+		rec.alarm_control = cpu_to_le32(thresh->alarm_control);
+		rec.media_temperature_threshold =
+			cpu_to_le32(thresh->media_temperature);
+		rec.ctrl_temperature_threshold =
+			cpu_to_le32(thresh->ctrl_temperature);
+		rec.spares_threshold = cpu_to_le32(thresh->spares);
+	}
+	return evlog_append(&monitor.evlog, EVLOG_DIMM_EVENT, timestamp,
+			&rec, sizeof(rec));
+}
+
+static u64 monitor_realtime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long long monitor_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_BOOTTIME, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
 
-	free(jobj);
-	free(jdimm);
-	free(jmsg);
+/* the numeric health fields summarized by an aggregate */
+#define AGG_FIELDS (ND_SMART_MTEMP_VALID | ND_SMART_CTEMP_VALID \
+		| ND_SMART_SPARES_VALID | ND_SMART_USED_VALID \
+		| ND_SMART_SHUTDOWN_COUNT_VALID)
+
+static void agg_absorb(struct monitor_agg *agg,
+		const struct util_smart *smart, u64 timestamp)
+{
+	struct util_smart *min = &agg->min, *max = &agg->max;
+	unsigned int valid = smart->flags & AGG_FIELDS;
+
+	if (!agg->count) {
+		agg->first = timestamp;
+		*min = *smart;
+		*max = *smart;
+	}
+	agg->last = timestamp;
+	agg->count++;
+
+#define agg_field(bit, field) \
+	if (valid & (bit)) { \
+		if (smart->field < min->field) \
+			min->field = smart->field; \
+		if (smart->field > max->field) \
+			max->field = smart->field; \
+		if (min->field != max->field) \
+			agg->varied |= (bit); \
+	}
+
+	agg_field(ND_SMART_MTEMP_VALID, media_temperature);
+	agg_field(ND_SMART_CTEMP_VALID, ctrl_temperature);
+	agg_field(ND_SMART_SPARES_VALID, spares);
+	agg_field(ND_SMART_USED_VALID, life_used);
+	agg_field(ND_SMART_SHUTDOWN_COUNT_VALID, shutdown_count);
+#undef agg_field
+}
+
+/*
+ * Close the aggregation window of @mdimm, reporting the repeats it
+ * absorbed, if any, in one notification.
+ */
+static int notify_dimm_aggregate(struct monitor_dimm *mdimm)
+{
+	struct monitor_agg *agg = &mdimm->agg;
+	struct json_object *jmsg, *jagg, *jobj;
+	int rc = 0;
+
+	if (!agg->open)
+		return 0;
+	agg->open = false;
+	if (!agg->count)
+		return 0;
+
+	jmsg = notification_to_json(monitor_realtime_ns(), getpid(),
+			dimm_event_to_json(monitor.event_flags,
+				agg->event_flags),
+			util_dimm_to_json(mdimm->dimm, 0));
+	jagg = json_object_new_object();
+	if (!jmsg || !jagg) {
+		fail("\n");
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	jobj = json_object_new_int64(agg->count);
+	if (jobj)
+		json_object_object_add(jagg, "count", jobj);
+	jobj = timestamp_to_json(agg->first);
+	if (jobj)
+		json_object_object_add(jagg, "first_timestamp", jobj);
+	jobj = timestamp_to_json(agg->last);
+	if (jobj)
+		json_object_object_add(jagg, "last_timestamp", jobj);
+	jobj = health_to_json(&agg->min, agg->varied, NULL);
+	if (jobj)
+		json_object_object_add(jagg, "min", jobj);
+	jobj = health_to_json(&agg->max, agg->varied, NULL);
+	if (jobj)
+		json_object_object_add(jagg, "max", jobj);
+	json_object_object_add(jmsg, "aggregate", jagg);
+	jagg = NULL;
+
+	notice(&monitor, "%s\n", json_object_to_json_string_ext(jmsg,
+				monitor_json_flags()));
+out:
+	json_object_put(jagg);
+	json_object_put(jmsg);
+	memset(agg, 0, sizeof(*agg));
+	return rc;
+}
+
+/*
+ * Re-read the alarm thresholds of @mdimm for a notification. They only
+ * change when they are reprogrammed, so the periodic sample skips them.
+ */
+static void monitor_dimm_thresholds(struct monitor_dimm *mdimm)
+{
+	struct ndctl_cmd *cmd;
+
+	mdimm->thresh_valid = false;
+	if (!ndctl_dimm_is_cmd_supported(mdimm->dimm, ND_CMD_SMART_THRESHOLD))
+		return;
+	cmd = ndctl_dimm_cmd_new_smart_threshold(mdimm->dimm);
+	if (!cmd)
+		return;
+	if (ndctl_cmd_submit_xlat(cmd) >= 0) {
+		util_smart_threshold_decode(&mdimm->thresh, cmd);
+		mdimm->thresh_valid = true;
+	}
+	ndctl_cmd_unref(cmd);
+}
+
+static int notify_dimm_event(struct monitor_dimm *mdimm)
+{
+	unsigned int fields = dimm_health_fields(mdimm);
+	const struct util_smart_threshold *thresh;
+	struct json_object *jmsg, *jdimm, *jobj;
+	u64 timestamp = monitor_realtime_ns();
+	struct monitor_agg *agg = &mdimm->agg;
+	int rc;
+
+	if (monitor.aggregate) {
+		unsigned long long now = monitor_now_ms();
+
+		/* a repeat within the window only updates the summary */
+		if (agg->open && agg->event_flags == mdimm->event_flags
+				&& now < agg->deadline) {
+			agg_absorb(agg, &mdimm->smart, timestamp);
+			goto out;
+		}
+		rc = notify_dimm_aggregate(mdimm);
+		if (rc)
+			return rc;
+		agg->open = true;
+		agg->event_flags = mdimm->event_flags;
+		agg->deadline = now + monitor.aggregate * 1000ULL;
+	}
+
+	monitor_dimm_thresholds(mdimm);
+	thresh = dimm_health_thresh(mdimm);
+
+	if (monitor.binary) {
+		rc = log_dimm_event(mdimm, timestamp, fields, thresh);
+		if (rc) {
+			fail("\n");
+			return rc;
+		}
+		goto out;
+	}
+
+	jdimm = util_dimm_to_json(mdimm->dimm, 0);
+	if (jdimm) {
+		jobj = health_to_json(&mdimm->smart, fields, thresh);
+		if (jobj)
+			json_object_object_add(jdimm, "health", jobj);
+	}
+
+	jmsg = notification_to_json(timestamp, getpid(),
+			dimm_event_to_json(monitor.event_flags,
+				mdimm->event_flags), jdimm);
+	if (!jmsg) {
+		fail("\n");
+		return -ENOMEM;
+	}
+
+	notice(&monitor, "%s\n", json_object_to_json_string_ext(jmsg,
+				monitor_json_flags()));
+	json_object_put(jmsg);
+out:
+	mdimm->reported = mdimm->smart;
+	mdimm->changed = 0;
+	if (mdimm->thresh_valid) {
+		mdimm->reported_thresh = mdimm->thresh;
+		mdimm->thresh_reported = true;
+	}
 	return 0;
 }
 
-static struct monitor_dimm *util_dimm_event_filter(struct monitor_dimm *mdimm,
-		unsigned int event_flags)
+/*
+ * Refresh the cached smart payload of @mdimm with a single smart command,
+ * and derive the event flags and the fields changed since the last
+ * notification from it.
+ */
+static int monitor_dimm_sample(struct monitor_dimm *mdimm)
 {
-	unsigned int health;
+	const char *name = ndctl_dimm_get_devname(mdimm->dimm);
+	struct util_smart smart = { 0 };
+	unsigned int event_flags = 0;
+	struct ndctl_cmd *cmd;
+	int rc;
+
+	cmd = ndctl_dimm_cmd_new_smart(mdimm->dimm);
+	if (!cmd) {
+		err(&monitor, "%s: no smart command support\n", name);
+		return -ENOTTY;
+	}
+	rc = ndctl_cmd_submit_xlat(cmd);
+	if (rc < 0) {
+		err(&monitor, "%s: smart command failed\n", name);
+		ndctl_cmd_unref(cmd);
+		return rc;
+	}
 
-	mdimm->event_flags = ndctl_dimm_get_event_flags(mdimm->dimm);
-	if (mdimm->event_flags == UINT_MAX)
-		return NULL;
+	util_smart_decode(&smart, cmd);
+	ndctl_cmd_unref(cmd);
+
+	if (smart.alarm_flags & ND_SMART_SPARE_TRIP)
+		event_flags |= ND_EVENT_SPARES_REMAINING;
+	if (smart.alarm_flags & ND_SMART_MTEMP_TRIP)
+		event_flags |= ND_EVENT_MEDIA_TEMPERATURE;
+	if (smart.alarm_flags & ND_SMART_CTEMP_TRIP)
+		event_flags |= ND_EVENT_CTRL_TEMPERATURE;
+	if (smart.shutdown_state)
+		event_flags |= ND_EVENT_UNCLEAN_SHUTDOWN;
+	if ((smart_delta(&mdimm->smart, &smart) & ND_SMART_HEALTH_VALID)
+			&& (mdimm->smart.flags & ND_SMART_HEALTH_VALID))
+		event_flags |= ND_EVENT_HEALTH_STATE;
+
+	mdimm->event_flags = event_flags;
+	mdimm->smart = smart;
+	mdimm->changed = smart_delta(&mdimm->reported, &smart);
+	return 0;
+}
 
-	health = ndctl_dimm_get_health(mdimm->dimm);
-	if (health == UINT_MAX)
+static struct monitor_dimm *util_dimm_event_filter(struct monitor_dimm *mdimm,
+		unsigned int event_flags)
+{
+	if (monitor_dimm_sample(mdimm))
 		return NULL;
-	if (mdimm->health != health)
-		mdimm->event_flags |= ND_EVENT_HEALTH_STATE;
 
 	if (mdimm->event_flags & event_flags)
 		return mdimm;
@@ -266,11 +672,8 @@ static void filter_dimm(struct ndctl_dimm *dimm, struct ndctl_filter_ctx *fctx)
 
 	mdimm->dimm = dimm;
 	mdimm->health_eventfd = ndctl_dimm_get_health_eventfd(dimm);
-	mdimm->health = ndctl_dimm_get_health(dimm);
-	mdimm->event_flags = ndctl_dimm_get_event_flags(dimm);
 
-	if (mdimm->event_flags
-			&& util_dimm_event_filter(mdimm, monitor.event_flags)) {
+	if (util_dimm_event_filter(mdimm, monitor.event_flags)) {
 		if (notify_dimm_event(mdimm)) {
 			err(&monitor, "%s: notify dimm event failed\n", name);
 			free(mdimm);
@@ -290,18 +693,87 @@ static bool filter_bus(struct ndctl_bus *bus, struct ndctl_filter_ctx *fctx)
 	return true;
 }
 
+static int monitor_report(struct monitor_dimm *mdimm)
+{
+	int rc = notify_dimm_event(mdimm);
+
+	if (rc) {
+		err(&monitor, "%s: notify dimm event failed\n",
+				ndctl_dimm_get_devname(mdimm->dimm));
+		did_fail = 1;
+	}
+	return rc;
+}
+
+/*
+ * With --poll each dimm gets its own deadline, spread evenly across the
+ * interval, so that a poll period costs one smart command per dimm
+ * rather than a burst of them all at once. Open aggregation windows
+ * wake the monitor up as well, to report their summary on time.
+ */
+static int monitor_poll_timeout(struct monitor_filter_arg *mfa,
+		unsigned long long now)
+{
+	unsigned long long next = ULLONG_MAX;
+	struct monitor_dimm *mdimm;
+
+	list_for_each(&mfa->dimms, mdimm, list) {
+		if (monitor.poll_timeout && mdimm->next_poll < next)
+			next = mdimm->next_poll;
+		if (mdimm->agg.open && mdimm->agg.deadline < next)
+			next = mdimm->agg.deadline;
+	}
+	if (next == ULLONG_MAX)
+		return -1;
+	if (next <= now)
+		return 0;
+	if (next - now > INT_MAX)
+		return INT_MAX;
+	return next - now;
+}
+
+static volatile sig_atomic_t monitor_stop;
+
+static void monitor_stop_handler(int sig)
+{
+	monitor_stop = 1;
+}
+
+/*
+ * Stop the event loop on SIGINT or SIGTERM rather than dying, so that
+ * the repeats absorbed by open aggregation windows are reported. The
+ * signals stay blocked outside of epoll_pwait() with @waitmask, so one
+ * can not slip in between the check of monitor_stop and the wait.
+ */
+static int monitor_stop_signals(sigset_t *waitmask)
+{
+	struct sigaction act = { .sa_handler = monitor_stop_handler };
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigemptyset(&act.sa_mask);
+	if (sigaction(SIGINT, &act, NULL) < 0
+			|| sigaction(SIGTERM, &act, NULL) < 0
+			|| sigprocmask(SIG_BLOCK, &mask, waitmask) < 0)
+		return -errno;
+	sigdelset(waitmask, SIGINT);
+	sigdelset(waitmask, SIGTERM);
+	return 0;
+}
+
 static int monitor_event(struct ndctl_ctx *ctx,
 		struct monitor_filter_arg *mfa)
 {
+	unsigned long long interval, now;
 	struct epoll_event ev, *events;
-	int nfds, epollfd, i, rc = 0, polltimeout = -1;
+	int nfds, epollfd, i, rc = 0;
 	struct monitor_dimm *mdimm;
+	sigset_t waitmask;
 	char buf;
-	/* last time a full poll happened */
-	struct timespec fullpoll_ts, ts;
 
-	if (monitor.poll_timeout)
-		polltimeout = monitor.poll_timeout * 1000;
+	interval = monitor.poll_timeout * 1000ULL;
 
 	events = calloc(mfa->num_dimm, sizeof(struct epoll_event));
 	if (!events) {
@@ -314,6 +786,8 @@ static int monitor_event(struct ndctl_ctx *ctx,
 		rc = -errno;
 		goto out;
 	}
+	now = monitor_now_ms();
+	i = 0;
 	list_for_each(&mfa->dimms, mdimm, list) {
 		memset(&ev, 0, sizeof(ev));
 		rc = pread(mdimm->health_eventfd, &buf, sizeof(buf), 0);
@@ -329,42 +803,41 @@ static int monitor_event(struct ndctl_ctx *ctx,
 			rc = -errno;
 			goto out;
 		}
+		mdimm->next_poll = now + interval * ++i / mfa->num_dimm;
 	}
 
-	clock_gettime(CLOCK_BOOTTIME, &fullpoll_ts);
-	while (1) {
+	rc = monitor_stop_signals(&waitmask);
+	if (rc) {
+		err(&monitor, "failed to set up signal handling: %d\n", rc);
+		goto out;
+	}
+
+	while (!monitor_stop) {
 		did_fail = 0;
-		nfds = epoll_wait(epollfd, events, mfa->num_dimm, polltimeout);
+		if (monitor.binary) {
+			rc = evlog_flush(&monitor.evlog);
+			if (rc) {
+				err(&monitor, "log write failed: %d\n", rc);
+				goto out;
+			}
+		}
+		nfds = epoll_pwait(epollfd, events, mfa->num_dimm,
+				monitor_poll_timeout(mfa, monitor_now_ms()),
+				&waitmask);
 		if (nfds < 0 && errno != EINTR) {
 			err(&monitor, "epoll_wait error: (%s)\n", strerror(errno));
 			rc = -errno;
 			goto out;
 		}
 
-		/* If needed force a full poll of dimm health */
-		clock_gettime(CLOCK_BOOTTIME, &ts);
-		if ((fullpoll_ts.tv_sec - ts.tv_sec) > monitor.poll_timeout) {
-			nfds = 0;
-			dbg(&monitor, "forcing a full poll\n");
-		}
-
-		/* If we timed out then fill events array with all dimms */
-		if (nfds == 0) {
-			list_for_each(&mfa->dimms, mdimm, list)
-				events[nfds++].data.ptr = mdimm;
-			fullpoll_ts = ts;
-		}
-
+		/* a health event is always reported if its flags match */
+		now = monitor_now_ms();
 		for (i = 0; i < nfds; i++) {
 			mdimm = events[i].data.ptr;
 			if (util_dimm_event_filter(mdimm, monitor.event_flags)) {
-				rc = notify_dimm_event(mdimm);
-				if (rc) {
-					err(&monitor, "%s: notify dimm event failed\n",
-						ndctl_dimm_get_devname(mdimm->dimm));
-					did_fail = 1;
+				rc = monitor_report(mdimm);
+				if (rc)
 					goto out;
-				}
 			}
 			rc = pread(mdimm->health_eventfd, &buf, sizeof(buf), 0);
 			if (rc < 0) {
@@ -372,10 +845,47 @@ static int monitor_event(struct ndctl_ctx *ctx,
 				rc = -errno;
 				goto out;
 			}
+			mdimm->next_poll = now + interval;
+		}
+
+		list_for_each(&mfa->dimms, mdimm, list) {
+			if (!mdimm->agg.open || mdimm->agg.deadline > now)
+				continue;
+			rc = notify_dimm_aggregate(mdimm);
+			if (rc)
+				goto out;
+		}
+
+		/* a poll is only reported if the payload changed */
+		list_for_each(&mfa->dimms, mdimm, list) {
+			if (!interval || mdimm->next_poll > now)
+				continue;
+			dbg(&monitor, "%s: poll\n",
+					ndctl_dimm_get_devname(mdimm->dimm));
+			if (util_dimm_event_filter(mdimm, monitor.event_flags)
+					&& mdimm->changed) {
+				rc = monitor_report(mdimm);
+				if (rc)
+					goto out;
+			}
+			/* don't catch up on polls missed during a suspend */
+			mdimm->next_poll += interval;
+			if (mdimm->next_poll <= now)
+				mdimm->next_poll = now + interval;
 		}
 		if (did_fail)
 			return 1;
 	}
+
+	/* don't lose the repeats of windows still open */
+	rc = 0;
+	list_for_each(&mfa->dimms, mdimm, list) {
+		rc = notify_dimm_aggregate(mdimm);
+		if (rc)
+			break;
+	}
+	if (monitor.binary && evlog_flush(&monitor.evlog))
+		err(&monitor, "log write failed\n");
  out:
 	free(events);
 	return rc;
@@ -518,6 +1028,12 @@ static int parse_monitor_config(const struct config *configs,
 
 		if (!monitor.log)
 			set_monitor_conf(&monitor.log, "log", value, seek);
+		if (!monitor.log_format)
+			set_monitor_conf(&monitor.log_format, "log-format",
+					value, seek);
+		if (!monitor.aggregate)
+			set_monitor_conf(&monitor.aggregate_conf, "aggregate",
+					value, seek);
 	}
 	fclose(f);
 out:
@@ -540,6 +1056,9 @@ int cmd_monitor(int argc, const char **argv, struct ndctl_ctx *ctx)
 		OPT_FILENAME('l', "log", &monitor.log,
 				"<file> | syslog | standard",
 				"where to output the monitor's notification"),
+		OPT_STRING('\0', "log-format", &monitor.log_format,
+				"json | binary",
+				"format of the notifications in the log file"),
 		OPT_STRING('c', "config-file", &monitor.configs,
 				"config-file", "override default configs"),
 		OPT_BOOLEAN('\0', "daemon", &monitor.daemon,
@@ -550,6 +1069,8 @@ int cmd_monitor(int argc, const char **argv, struct ndctl_ctx *ctx)
 				"emit extra debug messages to log"),
 		OPT_UINTEGER('p', "poll", &monitor.poll_timeout,
 			     "poll and report events/status every <n> seconds"),
+		OPT_UINTEGER('\0', "aggregate", &monitor.aggregate,
+			     "coalesce repeats of an event within <n> seconds"),
 		OPT_END(),
 	};
 	const char * const u[] = {
@@ -585,6 +1106,7 @@ int cmd_monitor(int argc, const char **argv, struct ndctl_ctx *ctx)
 
 	log_init(&monitor.ctx, "ndctl/monitor", "NDCTL_MONITOR_LOG");
 	monitor.ctx.log_fn = log_standard;
+	monitor.evlog.fd = -1;
 
 	if (monitor.verbose)
 		monitor.ctx.log_priority = LOG_DEBUG;
@@ -607,6 +1129,39 @@ int cmd_monitor(int argc, const char **argv, struct ndctl_ctx *ctx)
 			goto out;
 	}
 
+	if (monitor.aggregate_conf) {
+		char *end;
+
+		monitor.aggregate = strtoul(monitor.aggregate_conf, &end, 0);
+		if (*end) {
+			error("invalid aggregate: %s\n", monitor.aggregate_conf);
+			rc = -EINVAL;
+			goto out;
+		}
+	}
+
+	if (monitor.log_format && strcmp(monitor.log_format, "binary") == 0)
+		monitor.binary = true;
+	else if (monitor.log_format && strcmp(monitor.log_format, "json") != 0) {
+		error("unknown log format: %s\n", monitor.log_format);
+		rc = -EINVAL;
+		goto out;
+	}
+	if (monitor.binary && (!monitor.log
+				|| strcmp(monitor.log, "syslog") == 0
+				|| strcmp(monitor.log, "standard") == 0
+				|| strcmp(monitor.log, "./syslog") == 0
+				|| strcmp(monitor.log, "./standard") == 0)) {
+		error("--log-format=binary needs a log file\n");
+		rc = -EINVAL;
+		goto out;
+	}
+	if (monitor.binary && monitor.aggregate) {
+		error("--aggregate is not supported with --log-format=binary\n");
+		rc = -EINVAL;
+		goto out;
+	}
+
 	if (monitor.log) {
 		if (strncmp(monitor.log, "./", 2) != 0)
 			fix_filename(prefix, (const char **)&monitor.log);
@@ -614,7 +1169,14 @@ int cmd_monitor(int argc, const char **argv, struct ndctl_ctx *ctx)
 			monitor.ctx.log_fn = log_syslog;
 		else if (strcmp(monitor.log, "./standard") == 0)
 			monitor.ctx.log_fn = log_standard;
-		else {
+		else if (monitor.binary) {
+			monitor.ctx.log_fn = log_standard;
+			rc = evlog_open(&monitor.evlog, monitor.log);
+			if (rc) {
+				error("open %s failed: %d\n", monitor.log, rc);
+				goto out;
+			}
+		} else {
 			monitor.ctx.log_file = fopen(monitor.log, "a+");
 			if (!monitor.ctx.log_file) {
 				error("open %s failed\n", monitor.log);
@@ -626,7 +1188,8 @@ int cmd_monitor(int argc, const char **argv, struct ndctl_ctx *ctx)
 	}
 
 	if (monitor.daemon) {
-		if (!monitor.log || strncmp(monitor.log, "./", 2) == 0)
+		if (!monitor.log || strncmp(monitor.log, "./", 2) == 0
+				|| monitor.binary)
 			monitor.ctx.log_fn = log_syslog;
 		if (daemon(0, 0) != 0) {
 			err(&monitor, "daemon start failed\n");
@@ -635,6 +1198,19 @@ int cmd_monitor(int argc, const char **argv, struct ndctl_ctx *ctx)
 		info(&monitor, "ndctl monitor daemon started\n");
 	}
 
+	/* after daemon() so that the session records the monitor's pid */
+	if (monitor.binary) {
+		rc = evlog_start_session(&monitor.evlog, "ndctl",
+				monitor_realtime_ns());
+		if (rc == 0)
+			rc = evlog_flush(&monitor.evlog);
+		if (rc) {
+			err(&monitor, "failed to start the log session: %d\n",
+					rc);
+			goto out;
+		}
+	}
+
 	if (parse_monitor_event(&monitor, ctx))
 		goto out;
 
@@ -661,9 +1237,141 @@ int cmd_monitor(int argc, const char **argv, struct ndctl_ctx *ctx)
 
 	rc = monitor_event(ctx, &mfa);
 out:
+	if (monitor.binary)
+		evlog_close(&monitor.evlog);
 	if (monitor.ctx.log_file)
 		fclose(monitor.ctx.log_file);
 	if (path)
 		free(path);
 	return rc;
 }
+
+static struct json_object *dimm_record_to_json(struct monitor_dimm_record *rec)
+{
+	unsigned int handle = le32_to_cpu(rec->handle);
+	unsigned short phys_id = le16_to_cpu(rec->phys_id);
+	struct util_smart smart = {
+		.flags = le32_to_cpu(rec->smart_flags),
+		.health = le32_to_cpu(rec->health),
+		.media_temperature = le32_to_cpu(rec->media_temperature),
+		.ctrl_temperature = le32_to_cpu(rec->ctrl_temperature),
+		.spares = le32_to_cpu(rec->spares),
+		.alarm_flags = le32_to_cpu(rec->alarm_flags),
+		.life_used = le32_to_cpu(rec->life_used),
+		.shutdown_state = le32_to_cpu(rec->shutdown_state),
+		.shutdown_count = le32_to_cpu(rec->shutdown_count),
+	};
+	struct util_smart_threshold thresh = {
+		.alarm_control = le32_to_cpu(rec->alarm_control),
+		.media_temperature =
+			le32_to_cpu(rec->media_temperature_threshold),
+		.ctrl_temperature =
+			le32_to_cpu(rec->ctrl_temperature_threshold),
+		.spares = le32_to_cpu(rec->spares_threshold),
+	};
+	struct json_object *jdimm, *jobj;
+
+	jdimm = json_object_new_object();
+	if (!jdimm)
+		return NULL;
+
+	rec->dev[sizeof(rec->dev) - 1] = '\0';
+	jobj = json_object_new_string(rec->dev);
+	if (jobj)
+		json_object_object_add(jdimm, "dev", jobj);
+
+	rec->id[sizeof(rec->id) - 1] = '\0';
+	if (rec->id[0]) {
+		jobj = json_object_new_string(rec->id);
+		if (jobj)
+			json_object_object_add(jdimm, "id", jobj);
+	}
+
+	if (handle < UINT_MAX) {
+		jobj = util_json_object_hex(handle, 0);
+		if (jobj)
+			json_object_object_add(jdimm, "handle", jobj);
+	}
+
+	if (phys_id < USHRT_MAX) {
+		jobj = util_json_object_hex(phys_id, 0);
+		if (jobj)
+			json_object_object_add(jdimm, "phys_id", jobj);
+	}
+
+	jobj = health_to_json(&smart, le32_to_cpu(rec->fields),
+			le16_to_cpu(rec->thresh_valid) ? &thresh : NULL);
+	if (jobj)
+		json_object_object_add(jdimm, "health", jobj);
+
+	return jdimm;
+}
+
+int cmd_decode_log(int argc, const char **argv, struct ndctl_ctx *ctx)
+{
+	const struct option options[] = {
+		OPT_BOOLEAN('u', "human", &monitor.human,
+				"use human friendly output formats"),
+		OPT_END(),
+	};
+	const char * const u[] = {
+		"ndctl decode-log <log-file> [<options>]",
+		NULL
+	};
+	struct monitor_dimm_record *rec;
+	struct evlog_session *session;
+	struct json_object *jmsg;
+	struct evlog_reader r;
+	int rc, pid = -1;
+
+	argc = parse_options(argc, argv, options, u, 0);
+	if (argc != 1)
+		usage_with_options(u, options);
+
+	rc = evlog_reader_open(&r, argv[0]);
+	if (rc) {
+		error("%s: not a binary monitor log: %s\n", argv[0],
+				strerror(-rc));
+		return rc;
+	}
+
+	while ((rc = evlog_read(&r)) > 0) {
+		if (r.type == EVLOG_SESSION) {
+			session = r.payload;
+			if (r.size < sizeof(*session)) {
+				rc = -EIO;
+				break;
+			}
+			pid = le32_to_cpu(session->pid);
+			continue;
+		}
+
+		/* records of other monitors are left to their decoder */
+		if (r.type != EVLOG_DIMM_EVENT)
+			continue;
+		if (r.size < sizeof(*rec)) {
+			rc = -EIO;
+			break;
+		}
+
+		rec = r.payload;
+		jmsg = notification_to_json(r.timestamp, pid,
+				dimm_event_to_json(le32_to_cpu(rec->selected),
+					le32_to_cpu(rec->active)),
+				dimm_record_to_json(rec));
+		if (!jmsg) {
+			rc = -ENOMEM;
+			break;
+		}
+		printf("%s\n", json_object_to_json_string_ext(jmsg,
+					monitor_json_flags()));
+		json_object_put(jmsg);
+	}
+
+	if (rc == -EIO)
+		error("%s: log is truncated or corrupt\n", argv[0]);
+	else if (rc < 0)
+		error("%s: decode failed: %s\n", argv[0], strerror(-rc));
+	evlog_reader_close(&r);
+	return rc;
+}
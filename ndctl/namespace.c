@@ -24,6 +24,7 @@
 #include <util/parse-options.h>
 #include <ccan/minmax/minmax.h>
 
+#include "check.h"
 #include "filter.h"
 #include "json.h"
 
@@ -31,7 +32,11 @@ static bool verbose;
 static bool force;
 static bool repair;
 static bool logfix;
+static bool stream;
 static bool scrub;
+static unsigned int jobs;
+static const char *state_file;
+static unsigned int parallel;
 static struct parameters {
 	bool do_scan;
 	bool mode_default;
@@ -142,7 +147,13 @@ OPT_BOOLEAN('R', "autorecover", &param.autorecover, "automatically cleanup on fa
 #define CHECK_OPTIONS() \
 OPT_BOOLEAN('R', "repair", &repair, "perform metadata repairs"), \
 OPT_BOOLEAN('L', "rewrite-log", &logfix, "regenerate the log"), \
-OPT_BOOLEAN('f', "force", &force, "check namespace even if currently active")
+OPT_BOOLEAN('f', "force", &force, "check namespace even if currently active"), \
+OPT_BOOLEAN('S', "stream", &stream, "read the BTT map with direct I/O instead of mmap"), \
+OPT_UINTEGER('j', "jobs", &jobs, "check up to <n> BTT arenas in parallel"), \
+OPT_FILENAME('F', "state-file", &state_file, "state-file", \
+	"skip arenas verified clean by a previous check, and record progress"), \
+OPT_UINTEGER('P', "parallel", &parallel, \
+	"check namespaces in up to <n> regions in parallel")
 
 #define CLEAR_OPTIONS() \
 OPT_BOOLEAN('s', "scrub", &scrub, "run a scrub to find latent errors")
@@ -1306,9 +1317,6 @@ static int namespace_reconfig(struct ndctl_region *region,
 	return setup_namespace(region, ndns, &p);
 }
 
-int namespace_check(struct ndctl_namespace *ndns, bool verbose, bool force,
-		bool repair, bool logfix);
-
 static int bus_send_clear(struct ndctl_bus *bus, unsigned long long start,
 		unsigned long long size)
 {
@@ -2115,13 +2123,35 @@ out:
 	return rc;
 }
 
+static int check_list_add(struct ndctl_namespace ***list, int *nr,
+		struct ndctl_namespace *ndns)
+{
+	struct ndctl_namespace **new;
+
+	new = realloc(*list, (*nr + 1) * sizeof(*new));
+	if (!new)
+		return -ENOMEM;
+	new[(*nr)++] = ndns;
+	*list = new;
+	return 0;
+}
+
 static int do_xaction_namespace(const char *namespace,
 		enum device_action action, struct ndctl_ctx *ctx,
 		int *processed)
 {
+	struct ndctl_namespace *ndns, *_n, **check_list = NULL;
 	struct read_infoblock_ctx ri_ctx = { 0 };
-	struct ndctl_namespace *ndns, *_n;
-	int rc = -ENXIO, saved_rc = 0;
+	int rc = -ENXIO, saved_rc = 0, check_nr = 0;
+	struct check_opts check_opts = {
+		.verbose = verbose,
+		.force = force,
+		.repair = repair,
+		.logfix = logfix,
+		.stream = stream,
+		.jobs = jobs,
+		.state_file = state_file,
+	};
 	struct ndctl_region *region;
 	const char *ndns_name;
 	struct ndctl_bus *bus;
@@ -2260,8 +2290,13 @@ static int do_xaction_namespace(const char *namespace,
 						rc = 0;
 					break;
 				case ACTION_CHECK:
-					rc = namespace_check(ndns, verbose,
-							force, repair, logfix);
+					if (parallel > 1) {
+						/* checked below, once all are found */
+						rc = check_list_add(&check_list,
+								&check_nr, ndns);
+						break;
+					}
+					rc = namespace_check(ndns, &check_opts);
 					if (rc == 0)
 						(*processed)++;
 					break;
@@ -2299,6 +2334,12 @@ static int do_xaction_namespace(const char *namespace,
 	if (ri_ctx.jblocks)
 		util_display_json_array(ri_ctx.f_out, ri_ctx.jblocks, 0);
 
+	if (check_nr) {
+		rc = namespace_check_parallel(check_list, check_nr,
+				&check_opts, parallel, processed);
+		free(check_list);
+	}
+
 	if (action == ACTION_CREATE && rc == -EAGAIN) {
 		/*
 		 * Namespace creation searched through all candidate
@@ -185,8 +185,6 @@ struct free_entry {
 struct arena_map {
 	struct btt_sb *info;
 	size_t info_len;
-	void *data;
-	size_t data_len;
 	u32 *map;
 	size_t map_len;
 	struct log_group *log;
@@ -92,6 +92,7 @@ static struct cmd_struct commands[] = {
 	{ "wait-overwrite", { cmd_wait_overwrite } },
 	{ "list", { cmd_list } },
 	{ "monitor", { cmd_monitor } },
+	{ "decode-log", { cmd_decode_log } },
 	{ "help", { cmd_help } },
 	#ifdef ENABLE_TEST
 	{ "test", { cmd_test } },
@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2015-2020 Intel Corporation. All rights reserved. */
+#ifndef __TEST_BENCH_H__
+#define __TEST_BENCH_H__
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+/*
+ * Scaffolding for the tests that validate the implementations of a
+ * helper against each other and compare their throughput.
+ */
+
+#define fail() fprintf(stderr, "%s: failed at: %d\n", __func__, __LINE__)
+
+/* @cpu: the feature the implementation needs, NULL for none */
+#define DECLARE_BACKEND(fn_type) \
+struct backend { \
+	const char *name; \
+	fn_type fn; \
+	const char *cpu; \
+}
+
+static inline bool cpu_supports(const char *cpu)
+{
+	if (!cpu)
+		return true;
+#if defined(__x86_64__) || defined(__i386__)
+	/* __builtin_cpu_supports() only takes string literals */
+	if (strcmp(cpu, "sse4.2") == 0)
+		return __builtin_cpu_supports("sse4.2");
+	if (strcmp(cpu, "avx2") == 0)
+		return __builtin_cpu_supports("avx2");
+#endif
+	return false;
+}
+
+static inline double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* print the rate of @count @unit (millions) processed in @secs */
+static inline void report(const char *name, double count, const char *unit,
+		double secs)
+{
+	printf("%-8s %8.1f %s/sec\n", name, count / secs / 1e6, unit);
+}
+
+#endif /* __TEST_BENCH_H__ */
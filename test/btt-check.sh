@@ -25,6 +25,8 @@ trap 'err $LINENO' ERR
 # }
 
 check_min_kver "4.14" || do_skip "may not support badblocks clearing on pmem via btt"
+check_prereq "jq"
+check_prereq "uuidgen"
 
 create()
 {
@@ -59,6 +61,14 @@ test_normal()
 	# disable the namespace
 	$NDCTL disable-namespace $dev
 	$NDCTL check-namespace $dev
+	$NDCTL check-namespace --jobs=4 $dev
+	$NDCTL check-namespace --stream $dev
+	rm -f btt-check-state
+	$NDCTL check-namespace --state-file=btt-check-state $dev
+	$NDCTL check-namespace -v --state-file=btt-check-state $dev 2>&1 | \
+		grep "verified by a previous check"
+	rm -f btt-check-state
+	$NDCTL check-namespace --parallel=4 $dev | jq -r ".[].status" | grep -q ok
 	$NDCTL enable-namespace $dev
 	post_repair_test
 }
@@ -136,10 +146,89 @@ test_bitmap()
 	unset_raw
 	$NDCTL disable-namespace $dev
 	$NDCTL check-namespace $dev 2>&1 | grep "bitmap error"
+	$NDCTL check-namespace --stream $dev 2>&1 | grep "bitmap error"
 	# This is not repairable
 	reset && create
 }
 
+# print the bytes of the little endian u64 $1 as printf escapes
+le64()
+{
+	local i
+
+	for (( i=0 ; i<8 ; i++ )); do
+		printf '\\x%02x' $(( ($1 >> (8 * i)) & 0xff ))
+	done
+}
+
+# set the u64 at byte $2 of the info block at offset $1 of the raw device
+# to $3, and refresh the fletcher64 checksum in the last 8 bytes
+info_set_u64()
+{
+	local off=$1 lo=0 hi=0 w
+
+	printf "$(le64 $3)" | dd of=/dev/$raw_bdev bs=1 seek=$((off + $2)) \
+		conv=notrunc 2> /dev/null
+	printf "$(le64 0)" | dd of=/dev/$raw_bdev bs=1 seek=$((off + 4088)) \
+		conv=notrunc 2> /dev/null
+	for w in $(od -An -v -t u4 -j $off -N 4096 /dev/$raw_bdev); do
+		lo=$(( (lo + w) & 0xffffffff ))
+		hi=$(( (hi + lo) & 0xffffffff ))
+	done
+	printf "$(le64 $(( (hi << 32) | lo )))" | \
+		dd of=/dev/$raw_bdev bs=1 seek=$((off + 4088)) conv=notrunc \
+		2> /dev/null
+}
+
+# check a namespace with two arenas, made by chaining two copies of the
+# arena the kernel formats for a small namespace, serially and in
+# parallel, and expect the same output
+test_jobs()
+{
+	echo "=== ${FUNCNAME[0]} ==="
+	local uuid start info2off arena
+
+	uuid=$(uuidgen)
+	reset
+	json=$($NDCTL create-namespace -b $NFIT_TEST_BUS0 -t pmem -m sector \
+		-s 16M -u $uuid)
+	eval "$(echo "$json" | json2var)"
+	set_raw
+	# BTT 2.0 starts at the beginning of the namespace, 1.1 4K into it
+	start=0
+	if [ "$(dd if=/dev/$raw_bdev bs=14 count=1 2> /dev/null)" != \
+			"BTT_ARENA_INFO" ]; then
+		start=4096
+	fi
+	info2off=$(od -An -t u8 -j $((start + 112)) -N 8 /dev/$raw_bdev)
+	arena=$((info2off + 4096))
+	dd if=/dev/$raw_bdev of=btt-arena bs=$bs skip=$((start / bs)) \
+		count=$((arena / bs))
+
+	reset
+	json=$($NDCTL create-namespace -b $NFIT_TEST_BUS0 -t pmem -m sector \
+		-s 48M -u $uuid)
+	eval "$(echo "$json" | json2var)"
+	set_raw
+	dd if=btt-arena of=/dev/$raw_bdev bs=$bs seek=$((start / bs)) \
+		conv=notrunc
+	dd if=btt-arena of=/dev/$raw_bdev bs=$bs \
+		seek=$(((start + arena) / bs)) conv=notrunc
+	rm -f btt-arena
+	# nextoff of the first arena's info and info2 blocks
+	info_set_u64 $start 80 $arena
+	info_set_u64 $((start + info2off)) 80 $arena
+	$NDCTL disable-namespace $dev
+	echo 0 > /sys/bus/nd/devices/$dev/force_raw
+
+	$NDCTL check-namespace -v --jobs=1 $dev > btt-check-serial 2>&1
+	grep -q "found 2 BTT arenas" btt-check-serial
+	$NDCTL check-namespace -v --jobs=4 $dev > btt-check-parallel 2>&1
+	cmp btt-check-serial btt-check-parallel
+	rm -f btt-check-serial btt-check-parallel
+	reset && create
+}
+
 do_tests()
 {
 	test_normal
@@ -147,6 +236,7 @@ do_tests()
 	test_bad_info2
 	test_bad_info
 	test_bitmap
+	test_jobs
 }
 
 # setup (reset nfit_test dimms, create the BTT namespace)
@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2015-2020 Intel Corporation. All rights reserved.
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <util/bitmap.h>
+#include <ndctl/namespace.h>
+#include <ndctl/btt-scan.h>
+#include <ccan/array_size/array_size.h>
+
+#include "bench.h"
+
+/*
+ * Validate the btt_map_scan_fn backends against each other, and report
+ * their throughput relative to the per-entry btt_map_lookup() +
+ * test_bit() / bitmap_set() loop that check-namespace used to run.
+ */
+
+#define NR_ENTRIES (1U << 24)
+#define CHUNK 4096
+
+DECLARE_BACKEND(btt_map_scan_fn);
+
+static struct backend backends[] = {
+	{ "scalar", btt_map_scan_scalar, NULL },
+#if defined(__x86_64__) || defined(__i386__)
+	{ "sse4.2", btt_map_scan_sse42, "sse4.2" },
+	{ "avx2", btt_map_scan_avx2, "avx2" },
+#endif
+};
+
+/* build a valid map: a random permutation, with some 'initial state' entries */
+static u32 *map_alloc(void)
+{
+	u32 *map = malloc(NR_ENTRIES * sizeof(*map));
+	u32 i, j, t;
+
+	if (!map)
+		return NULL;
+	for (i = 0; i < NR_ENTRIES; i++)
+		map[i] = i;
+	for (i = NR_ENTRIES - 1; i > 0; i--) {
+		j = random() % (i + 1);
+		t = map[i];
+		map[i] = map[j];
+		map[j] = t;
+	}
+	for (i = 0; i < NR_ENTRIES; i++) {
+		if (map[i] == i && random() & 1)
+			continue;
+		map[i] = cpu_to_le32(map[i] | (random() % 3 + 1) << MAP_ERR_SHIFT);
+	}
+	return map;
+}
+
+static int legacy_loop(const u32 *map, unsigned long *bm)
+{
+	u32 i, raw, mapping;
+
+	for (i = 0; i < NR_ENTRIES; i++) {
+		raw = le32_to_cpu(map[i]);
+		mapping = (raw & MAP_ENT_NORMAL) ? raw & MAP_LBA_MASK : i;
+		if (mapping >= NR_ENTRIES)
+			return -ERANGE;
+		if (test_bit(mapping, bm))
+			return -EEXIST;
+		bitmap_set(bm, mapping, 1);
+	}
+	return 0;
+}
+
+static int scan_loop(btt_map_scan_fn scan, const u32 *map, unsigned long *bm,
+		u32 *out)
+{
+	u32 lba, i, nr;
+
+	for (lba = 0; lba < NR_ENTRIES; lba += CHUNK) {
+		nr = scan(&map[lba], lba, CHUNK, NR_ENTRIES, out);
+		if (nr < CHUNK)
+			return -ERANGE;
+		for (i = 0; i < nr; i++) {
+			unsigned long *word = &bm[BIT_WORD(out[i])];
+
+			if (*word & BIT_MASK(out[i]))
+				return -EEXIST;
+			*word |= BIT_MASK(out[i]);
+		}
+	}
+	return 0;
+}
+
+/* corrupt single entries and check every backend stops at the same spot */
+static int test_oob(u32 *map)
+{
+	u32 *ref = malloc(CHUNK * sizeof(*ref));
+	u32 *out = malloc(CHUNK * sizeof(*out));
+	unsigned int i, b;
+	int rc = 0;
+
+	if (!ref || !out) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < 1000; i++) {
+		u32 lba = random() % (NR_ENTRIES - CHUNK);
+		u32 nr = random() % CHUNK + 1;
+		u32 pos = random() % nr, save = map[lba + pos];
+		u32 limit = NR_ENTRIES, expect;
+
+		if (i & 1)
+			map[lba + pos] = cpu_to_le32(MAP_ENT_NORMAL | NR_ENTRIES);
+		else if (i & 2)
+			limit = lba + pos + 1; /* initial-state entries too */
+		expect = btt_map_scan_scalar(&map[lba], lba, nr, limit, ref);
+
+		for (b = 0; b < ARRAY_SIZE(backends); b++) {
+			if (!cpu_supports(backends[b].cpu))
+				continue;
+			memset(out, 0xff, CHUNK * sizeof(*out));
+			if (backends[b].fn(&map[lba], lba, nr, limit, out)
+					!= expect
+					|| memcmp(out, ref, expect * sizeof(*out))) {
+				fprintf(stderr, "%s: mismatch lba: %#x nr: %u\n",
+						backends[b].name, lba, nr);
+				fail();
+				rc = -ENXIO;
+			}
+		}
+		map[lba + pos] = save;
+	}
+ out:
+	free(out);
+	free(ref);
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long *bm = bitmap_alloc(NR_ENTRIES);
+	u32 *out = malloc(CHUNK * sizeof(*out));
+	u32 *map = map_alloc();
+	unsigned int b;
+	double start;
+	int rc;
+
+	if (!bm || !out || !map) {
+		fail();
+		return EXIT_FAILURE;
+	}
+
+	rc = test_oob(map);
+	if (rc)
+		return EXIT_FAILURE;
+
+	printf("default: %s\n", btt_map_scan_name(btt_map_scan_select()));
+
+	start = now();
+	rc = legacy_loop(map, bm);
+	report("legacy", NR_ENTRIES, "M entries", now() - start);
+	if (rc || !bitmap_full(bm, NR_ENTRIES)) {
+		fail();
+		return EXIT_FAILURE;
+	}
+
+	for (b = 0; b < ARRAY_SIZE(backends); b++) {
+		if (!cpu_supports(backends[b].cpu)) {
+			printf("%-8s unsupported\n", backends[b].name);
+			continue;
+		}
+		memset(bm, 0, BITS_TO_LONGS(NR_ENTRIES) * sizeof(long));
+		start = now();
+		rc = scan_loop(backends[b].fn, map, bm, out);
+		report(backends[b].name, NR_ENTRIES, "M entries",
+				now() - start);
+		if (rc || !bitmap_full(bm, NR_ENTRIES)) {
+			fail();
+			return EXIT_FAILURE;
+		}
+	}
+
+	free(map);
+	free(out);
+	free(bm);
+	return EXIT_SUCCESS;
+}
@@ -37,6 +37,11 @@ eval $(echo $json | json2var)
 [ $sector_size != $SECTOR_SIZE ] && echo "fail: $LINENO" &&  exit 1
 [ $mode != "sector" ] && echo "fail: $LINENO" &&  exit 1
 
+# parallel enumeration must list the same objects in the same order
+serial=$($NDCTL list -BDRNi)
+parallel=$(NDCTL_ENUM_JOBS=4 $NDCTL list -BDRNi)
+[ "$serial" != "$parallel" ] && echo "fail: $LINENO" &&  exit 1
+
 # free capacity for blk creation
 $NDCTL destroy-namespace -f $dev
 
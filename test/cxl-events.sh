@@ -98,6 +98,69 @@ echo 1 > /sys/kernel/tracing/tracing_on
 test_region_info
 echo 0 > /sys/kernel/tracing/tracing_on
 
+# run a monitor, with $2 as extra options, across two bursts of events
+monitor_bursts()
+{
+	$CXL monitor -l "$1" $2 &
+	monitor_pid=$!
+	sleep 2
+	echo 1 > "${dev_path}/${memdevs[0]}/event_trigger"
+	echo 1 > "${dev_path}/${memdevs[0]}/event_trigger"
+	sleep 2
+	# stopping it closes any window still open
+	kill -TERM $monitor_pid
+	wait $monitor_pid
+}
+
+# numeric fields that differ between events, as [name, min, max], leaving
+# out the timestamps the device stamps at trigger time
+range='([.[0] | to_entries[] | select(.value | type == "number") | .key
+	| select(test("timestamp|_ts$") | not)] | sort) as $keys
+	| [$keys[] as $k | [$k, (map(.[$k]) | min), (map(.[$k]) | max)]
+		| select(.[1] != .[2])]'
+
+test_aggregate()
+{
+	if "$CXL" monitor --help 2>&1 | grep -q unavailable; then
+		echo "TEST: cxl monitor not built, skipping aggregation"
+		return
+	fi
+
+	plain=$(mktemp)
+	agg=$(mktemp)
+
+	monitor_bursts "$plain"
+	monitor_bursts "$agg" "--aggregate=600"
+
+	# the repeats of each event from a memdev, summarized from the plain log
+	expect=$(jq -s -S -c "group_by([.event, .memdev])
+		| map(select(length > 1) | {event: .[0].event,
+			memdev: .[0].memdev, count: (length - 1),
+			range: (.[1:] | $range)})
+		| sort" "$plain")
+	found=$(jq -s -S -c 'map(select(has("first_timestamp"))
+		| .min as $min | .max as $max | {event, memdev, count,
+			range: [$min | keys[] | select(test("timestamp|_ts$") | not)
+				| [., $min[.], $max[.]]]})
+		| sort' "$agg")
+	[[ "$expect" != "[]" ]] || err "$LINENO"
+	[[ "$found" == "$expect" ]] || err "$LINENO"
+
+	# each event from a memdev is reported once, ahead of its summary
+	jq -s -e 'map(select(has("first_timestamp") | not))
+		| group_by([.event, .memdev]) | all(length == 1)' "$agg"
+	jq -s -e '(map(select(has("first_timestamp") | not))
+			| map({key: (.event + "/" + .memdev), value: .timestamp})
+			| from_entries) as $first
+		| map(select(has("first_timestamp")))
+		| all($first[.event + "/" + .memdev] <= .first_timestamp
+			and .first_timestamp <= .last_timestamp)' "$agg"
+
+	rm -f "$plain" "$agg"
+}
+
+test_aggregate
+
 check_dmesg "$LINENO"
 
 modprobe -r cxl_test
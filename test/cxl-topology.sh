@@ -128,6 +128,17 @@ count=$(jq "map(select(.pmem_size == $pmem_size)) | length" <<< $json)
 ((bridges == 2 && count == 8 || bridges == 3 && count == 10 ||
   bridges == 4 && count == 11)) || err "$LINENO"
 
+# check that querying memdev mailboxes concurrently yields the same
+# listing as querying them one at a time
+serial=$($CXL list -b cxl_test -M -H -A -I -F --jobs=1)
+parallel=$($CXL list -b cxl_test -M -H -A -I -F --jobs=4)
+[ "$serial" = "$parallel" ] || err "$LINENO"
+
+# ...and that enumerating sibling ports in parallel keeps the same order
+serial=$($CXL list -b cxl_test -BPDET --jobs=1)
+parallel=$($CXL list -b cxl_test -BPDET --jobs=4)
+[ "$serial" = "$parallel" ] || err "$LINENO"
+
 
 # check that switch ports disappear after all of their memdevs have been
 # disabled, and return when the memdevs are enabled.
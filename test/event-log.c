@@ -0,0 +1,214 @@
+// SPDX-License-Identifier: GPL-2.0
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <util/size.h>
+#include <util/event_log.h>
+
+/*
+ * Round trip records through the binary monitor log: small records that
+ * share the write buffer, one larger than the buffer, a second session
+ * appended to an existing log by another process, as a daemonized
+ * monitor would, the rejection of text and truncated logs, and the
+ * recovery of a torn log on reopen.
+ */
+
+#define fail() fprintf(stderr, "%s: failed at: %d\n", __func__, __LINE__)
+
+#define NR_RECORDS 1000
+#define BIG_SIZE (SZ_64K * 3 + 7)
+
+static void fill(unsigned char *buf, size_t size, unsigned int seed)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		buf[i] = seed + i * 31;
+}
+
+static int write_session(const char *path, unsigned char *big)
+{
+	unsigned char rec[64];
+	struct evlog log;
+	unsigned int i;
+	int rc;
+
+	rc = evlog_open(&log, path);
+	if (rc) {
+		fail();
+		return rc;
+	}
+
+	rc = evlog_start_session(&log, "test", 1);
+	for (i = 0; rc == 0 && i < NR_RECORDS; i++) {
+		fill(rec, i % sizeof(rec), i);
+		rc = evlog_append(&log, EVLOG_DIMM_EVENT, i, rec,
+				i % sizeof(rec));
+		if (rc == 0 && i == NR_RECORDS / 2)
+			rc = evlog_append(&log, EVLOG_TRACE_EVENT, i, big,
+					BIG_SIZE);
+	}
+	if (rc)
+		fail();
+	evlog_close(&log);
+	return rc;
+}
+
+/* like write_session(), from a child process */
+static int write_session_child(const char *path, unsigned char *big,
+		pid_t *pid)
+{
+	int status;
+
+	*pid = fork();
+	if (*pid < 0) {
+		fail();
+		return -errno;
+	}
+	if (*pid == 0)
+		_exit(write_session(path, big) ? EXIT_FAILURE : EXIT_SUCCESS);
+	if (waitpid(*pid, &status, 0) != *pid || !WIFEXITED(status)
+			|| WEXITSTATUS(status) != EXIT_SUCCESS) {
+		fail();
+		return -ECHILD;
+	}
+	return 0;
+}
+
+/* @pid: the process expected to have written the session */
+static int read_session(struct evlog_reader *r, unsigned char *big, pid_t pid)
+{
+	struct evlog_session *session;
+	unsigned char rec[64];
+	unsigned int i;
+
+	if (evlog_read(r) != 1 || r->type != EVLOG_SESSION
+			|| r->size != sizeof(*session)) {
+		fail();
+		return -EINVAL;
+	}
+	session = r->payload;
+	if (strcmp(session->source, "test") != 0
+			|| le32_to_cpu(session->pid) != (u32) pid) {
+		fail();
+		return -EINVAL;
+	}
+
+	for (i = 0; i < NR_RECORDS; i++) {
+		fill(rec, i % sizeof(rec), i);
+		if (evlog_read(r) != 1 || r->type != EVLOG_DIMM_EVENT
+				|| r->timestamp != i
+				|| r->size != i % sizeof(rec)
+				|| memcmp(r->payload, rec, r->size) != 0) {
+			fail();
+			return -EINVAL;
+		}
+		if (i != NR_RECORDS / 2)
+			continue;
+		if (evlog_read(r) != 1 || r->type != EVLOG_TRACE_EVENT
+				|| r->size != BIG_SIZE
+				|| memcmp(r->payload, big, BIG_SIZE) != 0) {
+			fail();
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	char path[] = "/tmp/event-log-XXXXXX";
+	struct evlog_reader r;
+	unsigned char *big;
+	struct evlog log;
+	int fd, rc = EXIT_FAILURE;
+	pid_t child;
+
+	big = malloc(BIG_SIZE);
+	fd = mkstemp(path);
+	if (!big || fd < 0) {
+		fail();
+		return EXIT_FAILURE;
+	}
+	fill(big, BIG_SIZE, 7);
+
+	/* two sessions, the second appended after a reopen */
+	if (write_session(path, big) || write_session_child(path, big, &child))
+		goto out;
+
+	if (evlog_reader_open(&r, path)) {
+		fail();
+		goto out;
+	}
+	if (read_session(&r, big, getpid()) || read_session(&r, big, child)
+			|| evlog_read(&r) != 0) {
+		evlog_reader_close(&r);
+		goto out;
+	}
+	evlog_reader_close(&r);
+
+	/* a record cut short reads as an error, not as the end of the log */
+	if (ftruncate(fd, lseek(fd, 0, SEEK_END) - 1) < 0) {
+		fail();
+		goto out;
+	}
+	if (evlog_reader_open(&r, path)) {
+		fail();
+		goto out;
+	}
+	while ((rc = evlog_read(&r)) > 0)
+		;
+	evlog_reader_close(&r);
+	if (rc != -EIO) {
+		fail();
+		rc = EXIT_FAILURE;
+		goto out;
+	}
+	/* reopening cuts the torn record off before appending */
+	if (evlog_open(&log, path)
+			|| evlog_append(&log, EVLOG_DIMM_EVENT, 7, "tail", 4)) {
+		fail();
+		rc = EXIT_FAILURE;
+		goto out;
+	}
+	evlog_close(&log);
+	if (evlog_reader_open(&r, path)) {
+		fail();
+		rc = EXIT_FAILURE;
+		goto out;
+	}
+	while ((rc = evlog_read(&r)) > 0)
+		if (r.timestamp == 7 && r.size == 4
+				&& memcmp(r.payload, "tail", 4) == 0)
+			break;
+	if (rc > 0)
+		rc = evlog_read(&r);
+	evlog_reader_close(&r);
+	if (rc != 0) {
+		fail();
+		rc = EXIT_FAILURE;
+		goto out;
+	}
+	rc = EXIT_FAILURE;
+
+	/* neither the writer nor the reader accept a text log */
+	if (ftruncate(fd, 0) < 0 || write(fd, "{\"pid\":1}\n", 10) != 10) {
+		fail();
+		goto out;
+	}
+	if (evlog_open(&log, path) != -EINVAL
+			|| evlog_reader_open(&r, path) != -EINVAL) {
+		fail();
+		goto out;
+	}
+
+	rc = EXIT_SUCCESS;
+out:
+	close(fd);
+	unlink(path);
+	free(big);
+	return rc;
+}
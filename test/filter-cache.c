@@ -0,0 +1,220 @@
+// SPDX-License-Identifier: GPL-2.0
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <libkmod.h>
+#include <ndctl/libndctl.h>
+#include <ndctl/filter.h>
+#include <test.h>
+
+/*
+ * The util_*_filter() helpers keep each identifier they parse until the
+ * walk completes, and the dimm lookups by handle and id answer from
+ * tables that are rebuilt when the bus dimm list has grown. Check that
+ * cached identifiers keep matching the same objects, that a walk leaves
+ * nothing cached, and that lookups agree with the dimm list however the
+ * bus was enumerated.
+ */
+
+#define fail() fprintf(stderr, "%s: failed at: %d\n", __func__, __LINE__)
+
+static int count_matches(struct ndctl_bus *bus, const char *ident)
+{
+	struct ndctl_dimm *dimm;
+	int count = 0;
+
+	ndctl_dimm_foreach(bus, dimm)
+		if (util_dimm_filter(dimm, ident))
+			count++;
+	return count;
+}
+
+static int test_idents(struct ndctl_bus *bus)
+{
+	struct ndctl_dimm *dimm = ndctl_dimm_get_first(bus);
+	struct ndctl_dimm *next = dimm ? ndctl_dimm_get_next(dimm) : NULL;
+	char id[16], pair[64];
+	int i, ndimm = 0;
+
+	if (!next) {
+		fail();
+		return -ENXIO;
+	}
+	ndctl_dimm_foreach(bus, dimm)
+		ndimm++;
+	dimm = ndctl_dimm_get_first(bus);
+	snprintf(id, sizeof(id), "%u", ndctl_dimm_get_id(dimm));
+	snprintf(pair, sizeof(pair), "%s %s", ndctl_dimm_get_devname(dimm),
+			ndctl_dimm_get_devname(next));
+
+	util_filter_release();
+	/* the second pass is answered from the cached identifiers */
+	for (i = 0; i < 2; i++) {
+		if (count_matches(bus, "all") != ndimm
+				|| count_matches(bus,
+					ndctl_dimm_get_devname(next)) != 1
+				|| count_matches(bus, id) != 1
+				|| count_matches(bus, pair) != 2
+				|| !util_dimm_filter(dimm, id)
+				|| util_dimm_filter(next, id)) {
+			fail();
+			return -ENXIO;
+		}
+	}
+
+	if (util_filter_release() != 4 || util_filter_release() != 0) {
+		fail();
+		return -ENXIO;
+	}
+	return 0;
+}
+
+static bool filter_bus(struct ndctl_bus *bus, struct ndctl_filter_ctx *fctx)
+{
+	return true;
+}
+
+static void filter_dimm(struct ndctl_dimm *dimm, struct ndctl_filter_ctx *fctx)
+{
+	(*(int *) fctx->arg)++;
+}
+
+static bool filter_region(struct ndctl_region *region,
+		struct ndctl_filter_ctx *fctx)
+{
+	return true;
+}
+
+static int test_walk(struct ndctl_ctx *ctx, struct ndctl_bus *bus)
+{
+	struct ndctl_dimm *dimm = ndctl_dimm_get_first(bus);
+	struct ndctl_filter_params param = {
+		.bus = ndctl_bus_get_provider(bus),
+		.dimm = ndctl_dimm_get_devname(dimm),
+	};
+	int count = 0;
+	struct ndctl_filter_ctx fctx = {
+		.filter_bus = filter_bus,
+		.filter_dimm = filter_dimm,
+		.filter_region = filter_region,
+		.arg = &count,
+	};
+
+	if (ndctl_filter_walk(ctx, &fctx, &param) || count != 1) {
+		fail();
+		return -ENXIO;
+	}
+
+	/* nothing parsed during the walk outlives it */
+	if (util_filter_release() != 0) {
+		fail();
+		return -ENXIO;
+	}
+	return 0;
+}
+
+static int test_lookup(struct ndctl_bus *bus)
+{
+	struct ndctl_dimm *dimm;
+	int i;
+
+	for (i = 0; i < 2; i++)
+		ndctl_dimm_foreach(bus, dimm) {
+			unsigned int handle = ndctl_dimm_get_handle(dimm);
+
+			if (ndctl_dimm_get_by_handle(bus, handle) != dimm) {
+				fprintf(stderr, "%s: lookup of %#x failed\n",
+						ndctl_dimm_get_devname(dimm),
+						handle);
+				return -ENXIO;
+			}
+		}
+	if (ndctl_dimm_get_by_handle(bus, ~0U)) {
+		fail();
+		return -ENXIO;
+	}
+	return 0;
+}
+
+static int do_test(struct ndctl_ctx *ctx, struct ndctl_test *test)
+{
+	struct ndctl_bus *bus = ndctl_bus_get_by_provider(ctx, "nfit_test.0");
+	struct ndctl_ctx *fresh;
+	struct ndctl_dimm *dimm;
+	unsigned int handle;
+	int rc;
+
+	if (!bus) {
+		fail();
+		return -ENXIO;
+	}
+
+	rc = test_idents(bus);
+	if (!rc)
+		rc = test_walk(ctx, bus);
+	if (!rc)
+		rc = test_lookup(bus);
+	if (rc)
+		return rc;
+
+	/* re-enumerating the busses leaves the built tables valid */
+	ndctl_invalidate(ctx);
+	bus = ndctl_bus_get_by_provider(ctx, "nfit_test.0");
+	if (!bus || test_lookup(bus)) {
+		fail();
+		return -ENXIO;
+	}
+
+	/*
+	 * On a fresh context the first lookup is what adds the dimms, so
+	 * the tables must be built after the list generation moved on.
+	 */
+	handle = ndctl_dimm_get_handle(ndctl_dimm_get_first(bus));
+	rc = ndctl_new(&fresh);
+	if (rc)
+		return rc;
+	bus = ndctl_bus_get_by_provider(fresh, "nfit_test.0");
+	dimm = bus ? ndctl_dimm_get_by_handle(bus, handle) : NULL;
+	if (!dimm || ndctl_dimm_get_handle(dimm) != handle
+			|| test_lookup(bus)) {
+		fail();
+		rc = -ENXIO;
+	}
+	ndctl_unref(fresh);
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	struct ndctl_test *test = ndctl_test_new(0);
+	struct kmod_module *mod;
+	struct kmod_ctx *kmod_ctx;
+	struct ndctl_ctx *ctx;
+	int rc;
+
+	if (!test) {
+		fprintf(stderr, "failed to initialize test\n");
+		return EXIT_FAILURE;
+	}
+
+	rc = ndctl_new(&ctx);
+	if (rc)
+		return ndctl_test_result(test, rc);
+	ndctl_set_log_priority(ctx, LOG_DEBUG);
+
+	rc = ndctl_test_init(&kmod_ctx, &mod, NULL, LOG_DEBUG, test);
+	if (rc < 0) {
+		ndctl_test_skip(test);
+		fprintf(stderr, "nfit_test unavailable skipping tests\n");
+		ndctl_unref(ctx);
+		return ndctl_test_result(test, 77);
+	}
+
+	rc = do_test(ctx, test);
+	kmod_module_remove_module(mod, 0);
+	kmod_unref(kmod_ctx);
+	ndctl_unref(ctx);
+	return ndctl_test_result(test, rc);
+}
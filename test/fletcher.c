@@ -0,0 +1,132 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2015-2020 Intel Corporation. All rights reserved.
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <util/size.h>
+#include <util/fletcher.h>
+#include <ccan/array_size/array_size.h>
+
+#include "bench.h"
+
+/*
+ * Validate the fletcher64_multi() backends against fletcher64(), and
+ * report their throughput relative to checksumming the same blocks one
+ * at a time.
+ */
+
+#define NR_BLOCKS 4096
+#define BLOCK_SIZE SZ_4K
+#define ROUNDS 16
+#define TOTAL_BYTES ((double) NR_BLOCKS * BLOCK_SIZE * ROUNDS)
+
+DECLARE_BACKEND(fletcher64_multi_fn);
+
+static struct backend backends[] = {
+	{ "scalar", fletcher64_multi_scalar, NULL },
+#if defined(__x86_64__) || defined(__i386__)
+	{ "avx2", fletcher64_multi_avx2, "avx2" },
+#endif
+};
+
+/* odd lengths, short groups, and unaligned buffers */
+static int test_multi(void **blocks)
+{
+	u64 ref[8], sum[8];
+	void *addr[8];
+	unsigned int i, b;
+	int j, nr, rc = 0;
+
+	for (i = 0; i < 1000; i++) {
+		size_t len = random() % BLOCK_SIZE;
+		bool le = random() & 1;
+
+		nr = random() % ARRAY_SIZE(addr) + 1;
+		for (j = 0; j < nr; j++) {
+			addr[j] = (char *) blocks[random() % NR_BLOCKS]
+				+ random() % 4;
+			ref[j] = fletcher64(addr[j], len, le);
+		}
+
+		for (b = 0; b < ARRAY_SIZE(backends); b++) {
+			if (!cpu_supports(backends[b].cpu))
+				continue;
+			memset(sum, 0, sizeof(sum));
+			backends[b].fn(addr, len, le, sum, nr);
+			if (memcmp(sum, ref, nr * sizeof(u64)) == 0)
+				continue;
+			fprintf(stderr, "%s: mismatch len: %zu nr: %d\n",
+					backends[b].name, len, nr);
+			fail();
+			rc = -ENXIO;
+		}
+	}
+
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	u64 *ref = calloc(NR_BLOCKS, sizeof(*ref));
+	u64 *sum = calloc(NR_BLOCKS, sizeof(*sum));
+	void **blocks = calloc(NR_BLOCKS, sizeof(*blocks));
+	unsigned int b, i, r;
+	double start;
+
+	if (!ref || !sum || !blocks) {
+		fail();
+		return EXIT_FAILURE;
+	}
+
+	/* the extra word leaves room for the unaligned cases */
+	for (i = 0; i < NR_BLOCKS; i++) {
+		u32 *block = malloc(BLOCK_SIZE + sizeof(u32));
+		unsigned int j;
+
+		if (!block) {
+			fail();
+			return EXIT_FAILURE;
+		}
+		for (j = 0; j < BLOCK_SIZE / sizeof(u32) + 1; j++)
+			block[j] = random() ^ random() << 16;
+		blocks[i] = block;
+	}
+
+	if (test_multi(blocks))
+		return EXIT_FAILURE;
+
+	printf("default: %s\n",
+			fletcher64_multi_name(fletcher64_multi_select()));
+
+	start = now();
+	for (r = 0; r < ROUNDS; r++)
+		for (i = 0; i < NR_BLOCKS; i++)
+			ref[i] = fletcher64(blocks[i], BLOCK_SIZE, true);
+	report("single", TOTAL_BYTES, "MB", now() - start);
+
+	for (b = 0; b < ARRAY_SIZE(backends); b++) {
+		if (!cpu_supports(backends[b].cpu)) {
+			printf("%-8s unsupported\n", backends[b].name);
+			continue;
+		}
+		memset(sum, 0, NR_BLOCKS * sizeof(*sum));
+		start = now();
+		for (r = 0; r < ROUNDS; r++)
+			backends[b].fn(blocks, BLOCK_SIZE, true, sum,
+					NR_BLOCKS);
+		report(backends[b].name, TOTAL_BYTES, "MB",
+				now() - start);
+		if (memcmp(sum, ref, NR_BLOCKS * sizeof(*sum)) != 0) {
+			fail();
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (i = 0; i < NR_BLOCKS; i++)
+		free(blocks[i]);
+	free(blocks);
+	free(sum);
+	free(ref);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,72 @@
+#!/bin/bash -Ex
+# SPDX-License-Identifier: GPL-2.0
+
+rc=77
+
+. $(dirname $0)/common
+
+check_prereq "jq"
+
+set -e
+trap 'err $LINENO' ERR
+
+# setup (reset nfit_test dimms)
+modprobe nfit_test
+reset
+
+rc=1
+
+# the regions are disabled so the label area can be written directly
+$NDCTL disable-region -b $NFIT_TEST_BUS0 all
+dimm=$($NDCTL list -b $NFIT_TEST_BUS0 -Di | jq -r ".[0].dev")
+lsa=$(mktemp /tmp/lsa-$dimm.XXXX)
+log=$(mktemp /tmp/lsa-log-$dimm.XXXX)
+
+# print "<extents> <skipped>" for the set_data command in the debug log
+set_data_counts()
+{
+	grep "cmd: set_data total:" $log | tail -1 | \
+		sed -e 's/.*total: \([0-9]*\) max_xfer: \([0-9]*\) skipped: \([0-9]*\).*/\1 \2 \3/' | \
+		while read total max_xfer skipped; do
+			echo $(( (total + max_xfer - 1) / max_xfer )) $skipped
+		done
+}
+
+# expect_skipped <all|none>
+expect_skipped()
+{
+	read extents skipped <<< "$(set_data_counts)"
+	[ -n "$extents" ] || { echo "no set_data command logged"; err $LINENO; }
+	[ $extents -gt 1 ] || { echo "label area fits one transfer"; err $LINENO; }
+	case $1 in
+	all)  [ $skipped -eq $extents ] || err $LINENO ;;
+	none) [ $skipped -eq 0 ] || err $LINENO ;;
+	esac
+}
+
+$NDCTL read-labels -o $lsa $dimm
+size=$(stat -c %s $lsa)
+dd if=/dev/urandom of=$lsa bs=$size count=1
+
+# new contents are transferred in full, a rewrite of them not at all
+$NDCTL write-labels -v -i $lsa $dimm > $log 2>&1
+expect_skipped none
+$NDCTL write-labels -v -i $lsa $dimm > $log 2>&1
+expect_skipped all
+
+# the same goes for zeroing a non-zero and an already zero label area
+$NDCTL zero-labels -v $dimm > $log 2>&1
+expect_skipped none
+$NDCTL zero-labels -v $dimm > $log 2>&1
+expect_skipped all
+
+$NDCTL read-labels -o $lsa $dimm
+cmp $lsa <(head -c $size /dev/zero)
+
+rm -f $lsa $log
+$NDCTL init-labels -f -b $NFIT_TEST_BUS0 all
+$NDCTL enable-region -b $NFIT_TEST_BUS0 all
+
+_cleanup
+
+exit 0
@@ -154,6 +154,90 @@ test_filter_dimmevent()
 	stop_monitor
 }
 
+test_health_delta()
+{
+	monitor_dimms=$(get_monitor_dimm | awk '{print $1}')
+	$NDCTL inject-smart -N "$monitor_dimms"
+	jhealth=$($NDCTL list -H -d "$monitor_dimms" | jq .[0].health)
+	temp=$(jq -r .temperature_celsius <<<"$jhealth")
+	temp=${temp%.*}
+	thresh=$(jq -r .temperature_threshold <<<"$jhealth")
+	thresh=${thresh%.*}
+
+	# the first notification for a dimm carries every health field
+	start_monitor "-d $monitor_dimms"
+	inject_smart "-U"
+	[[ $(jq -s -c '.[0].dimm.health | keys' "$logfile") == \
+		$(jq -c keys <<<"$jhealth") ]]
+
+	# later ones carry the health state and the fields that changed
+	truncate --size 0 "$logfile"
+	inject_smart "-m $((temp + 1))"
+	[[ $(jq -s -c '.[-1].dimm.health | keys' "$logfile") == \
+		'["health_state","temperature_celsius"]' ]]
+
+	# thresholds reprogrammed mid-run go with the next notification
+	truncate --size 0 "$logfile"
+	inject_smart "-M $((thresh - 1))"
+	inject_smart "-m $((temp + 2))"
+	jq -s -e "[.[].dimm.health.temperature_threshold | numbers] | last == $((thresh - 1))" \
+		"$logfile"
+	stop_monitor
+
+	$NDCTL inject-smart -M "$thresh" "$monitor_dimms"
+	$NDCTL inject-smart -N "$monitor_dimms"
+}
+
+test_aggregate()
+{
+	monitor_dimms=$(get_monitor_dimm | awk '{print $1}')
+	$NDCTL inject-smart -N "$monitor_dimms"
+	temp=$($NDCTL list -H -d "$monitor_dimms" | jq -r .[0].health.temperature_celsius)
+	temp=${temp%.*}
+
+	# the first event is reported, the repeats fold into the window
+	start_monitor "-d $monitor_dimms --aggregate=600"
+	inject_smart "-U"
+	inject_smart "-m $((temp + 2))"
+	inject_smart "-m $((temp + 1))"
+	inject_smart "-m $((temp + 3))"
+
+	# the window is still open, stopping the monitor summarizes it
+	kill -TERM $monitor_pid
+	wait $monitor_pid
+	jlog=$(jq -s -c . "$logfile")
+	[[ $(jq 'length' <<<"$jlog") -eq 2 ]]
+	[[ $(jq '.[0] | has("aggregate")' <<<"$jlog") == "false" ]]
+	jq -e '.[1].aggregate as $agg
+		| $agg.count == 3
+		and .[0].timestamp <= $agg.first_timestamp
+		and $agg.first_timestamp < $agg.last_timestamp
+		and ($agg.min | keys) == ["temperature_celsius"]
+		and ($agg.max | keys) == ["temperature_celsius"]
+		and $agg.min.temperature_celsius == '$((temp + 1))'
+		and $agg.max.temperature_celsius == '$((temp + 3))'' <<<"$jlog"
+	rm "$logfile"
+
+	$NDCTL inject-smart -N "$monitor_dimms"
+}
+
+test_binary_log()
+{
+	monitor_dimms=$(get_monitor_dimm | awk '{print $1}')
+	logfile=$(mktemp)
+	$NDCTL monitor -c "$monitor_conf" -d "$monitor_dimms" -l "$logfile" \
+		--log-format=binary &
+	monitor_pid=$!
+	sync; sleep 3
+	call_notify
+	jlog=$($NDCTL decode-log "$logfile")
+	notify_dimms=$(jq ."dimm"."dev" <<<"$jlog" | sort | uniq | xargs)
+	[[ "$monitor_dimms" == "$notify_dimms" ]]
+	notify_pids=$(jq ."pid" <<<"$jlog" | sort | uniq | xargs)
+	[[ "$notify_pids" == "$monitor_pid" ]]
+	stop_monitor
+}
+
 do_tests()
 {
 	test_filter_dimm
@@ -162,6 +246,9 @@ do_tests()
 	test_filter_namespace
 	test_conf_file
 	test_filter_dimmevent
+	test_health_delta
+	test_aggregate
+	test_binary_log
 }
 
 modprobe nfit_test
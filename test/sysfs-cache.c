@@ -0,0 +1,185 @@
+// SPDX-License-Identifier: GPL-2.0
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <util/log.h>
+#include <util/sysfs.h>
+
+/*
+ * Exercise the NDCTL_SYSFS_CACHE snapshot with plain files standing in
+ * for sysfs attributes: a saved snapshot answers the next load, is
+ * ignored once the uevent seqnum it was taken at has moved on or when
+ * others may write it, and is removed by a sysfs write.
+ */
+
+#define fail() fprintf(stderr, "%s: failed at: %d\n", __func__, __LINE__)
+
+static char dir[] = "/tmp/sysfs-cache.XXXXXX";
+static char attr[PATH_MAX], knob[PATH_MAX], cache[PATH_MAX];
+
+static int set_file(const char *path, const char *val)
+{
+	FILE *f = fopen(path, "w");
+
+	if (!f)
+		return -errno;
+	fprintf(f, "%s\n", val);
+	return fclose(f) ? -errno : 0;
+}
+
+static int expect(struct log_ctx *ctx, const char *want)
+{
+	char buf[SYSFS_ATTR_SIZE];
+	int rc;
+
+	rc = __sysfs_read_attr(ctx, attr, buf);
+	if (rc < 0 || strcmp(buf, want) != 0) {
+		fprintf(stderr, "read '%s' (%d), expected '%s'\n", buf, rc,
+				want);
+		return -ENXIO;
+	}
+	return 0;
+}
+
+/* save a fresh snapshot with the attribute reading @val */
+static int save(struct log_ctx *ctx, const char *val)
+{
+	unlink(cache);
+	if (set_file(attr, val) || expect(ctx, val)) {
+		fail();
+		return -ENXIO;
+	}
+	__sysfs_cache_flush(ctx);
+	if (access(cache, F_OK) != 0) {
+		fail();
+		return -ENOENT;
+	}
+	return 0;
+}
+
+static int test_load(struct log_ctx *ctx)
+{
+	if (save(ctx, "one") || set_file(attr, "two"))
+		return -ENXIO;
+
+	/* the first read is answered by the snapshot, the next one live */
+	if (expect(ctx, "one") || expect(ctx, "two")) {
+		fail();
+		return -ENXIO;
+	}
+	__sysfs_cache_flush(ctx);
+	return 0;
+}
+
+static int test_seqnum(struct log_ctx *ctx)
+{
+	uint64_t seqnum;
+	int fd, rc = 0;
+
+	if (save(ctx, "one") || set_file(attr, "two"))
+		return -ENXIO;
+
+	/* the seqnum follows the 8 byte magic */
+	fd = open(cache, O_RDWR);
+	if (fd < 0 || pread(fd, &seqnum, sizeof(seqnum), 8) != sizeof(seqnum))
+		rc = -EIO;
+	seqnum++;
+	if (!rc && pwrite(fd, &seqnum, sizeof(seqnum), 8) != sizeof(seqnum))
+		rc = -EIO;
+	if (fd >= 0)
+		close(fd);
+	if (rc) {
+		fail();
+		return rc;
+	}
+
+	if (expect(ctx, "two")) {
+		fail();
+		return -ENXIO;
+	}
+	__sysfs_cache_flush(ctx);
+	return 0;
+}
+
+static int test_private(struct log_ctx *ctx)
+{
+	if (save(ctx, "one") || set_file(attr, "two"))
+		return -ENXIO;
+
+	if (chmod(cache, 0666) < 0 || expect(ctx, "two")) {
+		fail();
+		return -ENXIO;
+	}
+	__sysfs_cache_flush(ctx);
+	return 0;
+}
+
+static int test_write(struct log_ctx *ctx)
+{
+	if (save(ctx, "one") || set_file(attr, "two"))
+		return -ENXIO;
+
+	if (__sysfs_write_attr(ctx, knob, "1") < 0) {
+		fail();
+		return -ENXIO;
+	}
+	if (access(cache, F_OK) == 0) {
+		fail();
+		return -EEXIST;
+	}
+
+	/* nothing is answered from, or saved to, a snapshot after a write */
+	if (expect(ctx, "two")) {
+		fail();
+		return -ENXIO;
+	}
+	__sysfs_cache_flush(ctx);
+	if (access(cache, F_OK) == 0) {
+		fail();
+		return -EEXIST;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct log_ctx ctx;
+	int rc;
+
+	if (access("/sys/kernel/uevent_seqnum", R_OK) != 0)
+		return 77;
+	if (!mkdtemp(dir)) {
+		fail();
+		return EXIT_FAILURE;
+	}
+	snprintf(attr, sizeof(attr), "%s/attr", dir);
+	snprintf(knob, sizeof(knob), "%s/knob", dir);
+	snprintf(cache, sizeof(cache), "%s/sysfs-cache.cache", dir);
+	if (set_file(knob, "0")) {
+		fail();
+		return EXIT_FAILURE;
+	}
+
+	log_init(&ctx, "sysfs-cache", "NDCTL_TEST");
+	setenv("NDCTL_SYSFS_CACHE", dir, 1);
+
+	rc = test_load(&ctx);
+	if (!rc)
+		rc = test_seqnum(&ctx);
+	if (!rc)
+		rc = test_private(&ctx);
+	if (!rc)
+		rc = test_write(&ctx);
+
+	unlink(cache);
+	unlink(attr);
+	unlink(knob);
+	rmdir(dir);
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
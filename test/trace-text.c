@@ -0,0 +1,234 @@
+// SPDX-License-Identifier: GPL-2.0
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <tracefs.h>
+#include <uuid/uuid.h>
+#include <event-parse.h>
+#include <json-c/json.h>
+#include <util/json.h>
+#include <util/strbuf.h>
+#include <ccan/list/list.h>
+#include <ccan/array_size/array_size.h>
+#include <util/event_trace.h>
+
+/*
+ * trace_event_to_text() writes trace records as json without going
+ * through json-c. Feed it records of a synthetic event covering each kind
+ * of field it formats, and check each line byte for byte against the
+ * JSON_C_TO_STRING_PLAIN output of the equivalent json-c object.
+ */
+
+#define fail() fprintf(stderr, "%s: failed at: %d\n", __func__, __LINE__)
+
+static const char format[] =
+	"name: trace_text\n"
+	"ID: 1\n"
+	"format:\n"
+	"\tfield:unsigned short common_type;\toffset:0;\tsize:2;\tsigned:0;\n"
+	"\tfield:unsigned char common_flags;\toffset:2;\tsize:1;\tsigned:0;\n"
+	"\tfield:unsigned char common_preempt_count;\toffset:3;\tsize:1;\tsigned:0;\n"
+	"\tfield:int common_pid;\toffset:4;\tsize:4;\tsigned:1;\n"
+	"\n"
+	"\tfield:__data_loc char[] memdev;\toffset:8;\tsize:4;\tsigned:0;\n"
+	"\tfield:s8 s8;\toffset:12;\tsize:1;\tsigned:1;\n"
+	"\tfield:u8 u8;\toffset:13;\tsize:1;\tsigned:0;\n"
+	"\tfield:s16 s16;\toffset:14;\tsize:2;\tsigned:1;\n"
+	"\tfield:s32 s32;\toffset:16;\tsize:4;\tsigned:1;\n"
+	"\tfield:u32 u32;\toffset:20;\tsize:4;\tsigned:0;\n"
+	"\tfield:s64 s64;\toffset:24;\tsize:8;\tsigned:1;\n"
+	"\tfield:u64 u64;\toffset:32;\tsize:8;\tsigned:0;\n"
+	"\tfield:u8 bytes[4];\toffset:40;\tsize:4;\tsigned:0;\n"
+	"\tfield:s16 words[2];\toffset:44;\tsize:4;\tsigned:1;\n"
+	"\tfield:uuid_t uuid;\toffset:48;\tsize:16;\tsigned:0;\n"
+	"\n"
+	"print fmt: \"memdev=%s\", __get_str(memdev)\n";
+
+#define REC_STRING 64
+
+struct sample {
+	const char *memdev;
+	int8_t s8;
+	uint8_t u8;
+	int16_t s16;
+	int32_t s32;
+	uint32_t u32;
+	int64_t s64;
+	uint64_t u64;
+	uint8_t bytes[4];
+	int16_t words[2];
+};
+
+static const struct sample samples[] = {
+	{ "mem0", 0, 0, 0, 0, 0, 0, 0, { 0 }, { 0 } },
+	{ "mem1", INT8_MIN, UINT8_MAX, INT16_MIN, INT32_MIN, UINT32_MAX,
+		INT64_MIN, UINT64_MAX, { 0, 1, 0x80, 0xff },
+		{ INT16_MIN, INT16_MAX } },
+	{ "quote\"back\\slash/", INT8_MAX, 1, INT16_MAX, INT32_MAX, 1,
+		INT64_MAX, (uint64_t) INT64_MAX + 1, { 1, 2, 3, 4 }, { -1, 1 } },
+	{ "ctl\x01\x1f\b\f\n\r\t\x7f", -1, 2, -1, -1, 2, -1, 2, { 0 },
+		{ 0 } },
+	{ "utf8 \xc3\xa9", 1, 3, 1, 1, 3, 1, 3, { 0 }, { 0 } },
+	{ "", 0, 0, 0, 0, 0, 0, 0, { 0 }, { 0 } },
+};
+
+static int build_record(const struct sample *s, const uuid_t uuid,
+		unsigned char *data, size_t size)
+{
+	size_t len = strlen(s->memdev) + 1;
+	uint32_t loc = len << 16 | REC_STRING;
+	uint16_t type = 1;
+
+	if (REC_STRING + len > size)
+		return -E2BIG;
+	memset(data, 0, size);
+	memcpy(data + 0, &type, sizeof(type));
+	memcpy(data + 8, &loc, sizeof(loc));
+	memcpy(data + 12, &s->s8, sizeof(s->s8));
+	memcpy(data + 13, &s->u8, sizeof(s->u8));
+	memcpy(data + 14, &s->s16, sizeof(s->s16));
+	memcpy(data + 16, &s->s32, sizeof(s->s32));
+	memcpy(data + 20, &s->u32, sizeof(s->u32));
+	memcpy(data + 24, &s->s64, sizeof(s->s64));
+	memcpy(data + 32, &s->u64, sizeof(s->u64));
+	memcpy(data + 40, s->bytes, sizeof(s->bytes));
+	memcpy(data + 44, s->words, sizeof(s->words));
+	memcpy(data + 48, uuid, sizeof(uuid_t));
+	memcpy(data + REC_STRING, s->memdev, len);
+	return REC_STRING + len;
+}
+
+static void add_num(struct json_object *jobj, const char *key, int64_t val)
+{
+	json_object_object_add(jobj, key, json_object_new_int64(val));
+}
+
+/* what event_to_json() builds for @s */
+static struct json_object *sample_to_json(const struct sample *s,
+		const uuid_t uuid, unsigned long long ts)
+{
+	struct json_object *jobj, *jarray;
+	char uuid_str[40];
+	unsigned int i;
+
+	jobj = json_object_new_object();
+	if (!jobj)
+		return NULL;
+
+	json_object_object_add(jobj, "system",
+			json_object_new_string("cxl"));
+	json_object_object_add(jobj, "event",
+			json_object_new_string("trace_text"));
+	json_object_object_add(jobj, "timestamp", util_json_new_u64(ts));
+	json_object_object_add(jobj, "memdev",
+			json_object_new_string(s->memdev));
+	add_num(jobj, "s8", s->s8);
+	add_num(jobj, "u8", s->u8);
+	add_num(jobj, "s16", s->s16);
+	add_num(jobj, "s32", s->s32);
+	add_num(jobj, "u32", s->u32);
+	add_num(jobj, "s64", s->s64);
+	json_object_object_add(jobj, "u64", util_json_new_u64(s->u64));
+
+	jarray = json_object_new_array();
+	for (i = 0; i < ARRAY_SIZE(s->bytes); i++)
+		json_object_array_add(jarray,
+				json_object_new_int64(s->bytes[i]));
+	json_object_object_add(jobj, "bytes", jarray);
+
+	jarray = json_object_new_array();
+	for (i = 0; i < ARRAY_SIZE(s->words); i++)
+		json_object_array_add(jarray,
+				json_object_new_int64(s->words[i]));
+	json_object_object_add(jobj, "words", jarray);
+
+	uuid_unparse(uuid, uuid_str);
+	json_object_object_add(jobj, "uuid",
+			json_object_new_string(uuid_str));
+	return jobj;
+}
+
+static int test_sample(struct tep_event *event, struct event_ctx *ectx,
+		const struct sample *s, unsigned long long ts)
+{
+	struct strbuf sb = STRBUF_INIT;
+	unsigned char data[128];
+	struct tep_record record = {
+		.ts = ts,
+		.data = data,
+	};
+	struct json_object *jobj;
+	const char *expect;
+	uuid_t uuid;
+	int rc;
+
+	uuid_generate(uuid);
+	record.size = build_record(s, uuid, data, sizeof(data));
+	if (record.size < 0) {
+		fail();
+		return record.size;
+	}
+
+	jobj = sample_to_json(s, uuid, ts);
+	if (!jobj) {
+		fail();
+		return -ENOMEM;
+	}
+	expect = json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PLAIN);
+
+	rc = trace_event_to_text(event, &record, ectx, &sb);
+	if (rc == 0 && (sb.len != strlen(expect) + 1
+				|| memcmp(sb.buf, expect, sb.len - 1) != 0
+				|| sb.buf[sb.len - 1] != '\n')) {
+		fprintf(stderr, "expected: %s\n     got: %.*s", expect,
+				(int) sb.len, sb.buf);
+		rc = -ENXIO;
+	}
+	if (rc)
+		fail();
+
+	json_object_put(jobj);
+	strbuf_release(&sb);
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	struct event_ctx ectx = {
+		.system = "cxl",
+	};
+	struct tep_event *event;
+	struct tep_handle *tep;
+	int rc = EXIT_FAILURE;
+	unsigned int i;
+
+	list_head_init(&ectx.jlist_head);
+	tep = tep_alloc();
+	if (!tep) {
+		fail();
+		return EXIT_FAILURE;
+	}
+	if (tep_parse_event(tep, format, sizeof(format) - 1, "cxl")) {
+		fail();
+		goto out;
+	}
+	event = tep_find_event_by_name(tep, "cxl", "trace_text");
+	if (!event) {
+		fail();
+		goto out;
+	}
+
+	/* twice, the second pass formats from the cached plan */
+	for (i = 0; i < 2 * ARRAY_SIZE(samples); i++)
+		if (test_sample(event, &ectx, &samples[i % ARRAY_SIZE(samples)],
+					1000000000ULL * i + i))
+			goto out;
+	rc = EXIT_SUCCESS;
+out:
+	trace_event_plans_free(&ectx);
+	tep_free(tep);
+	return rc;
+}
@@ -0,0 +1,236 @@
+// SPDX-License-Identifier: GPL-2.0
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <util/event_log.h>
+
+#define EVLOG_BUF_SIZE SZ_64K
+
+/*
+ * Offset just past the last complete record of a log of @size bytes. A
+ * monitor killed in the middle of a flush leaves a torn record there.
+ */
+static off_t evlog_complete(int fd, off_t size)
+{
+	off_t off = EVLOG_MAGIC_LEN;
+	struct evlog_rec rec;
+
+	while (size - off >= (off_t) sizeof(rec)) {
+		off_t next;
+
+		if (pread(fd, &rec, sizeof(rec), off) != sizeof(rec))
+			return -EIO;
+		if (le32_to_cpu(rec.size) > EVLOG_REC_MAX)
+			break;
+		next = off + sizeof(rec) + le32_to_cpu(rec.size);
+		if (next > size)
+			break;
+		off = next;
+	}
+	return off;
+}
+
+/*
+ * Open @path for appending binary records, writing the magic if the file
+ * is new. A non-empty file must already be a binary log, so a text log is
+ * never mixed with binary records. A torn record at the end of the log is
+ * cut off so that new records do not land in the middle of it.
+ */
+int evlog_open(struct evlog *log, const char *path)
+{
+	char magic[EVLOG_MAGIC_LEN];
+	struct stat st;
+	int rc;
+
+	memset(log, 0, sizeof(*log));
+	log->fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	if (log->fd < 0)
+		return -errno;
+
+	if (fstat(log->fd, &st) < 0) {
+		rc = -errno;
+		goto err;
+	}
+
+	if (st.st_size == 0) {
+		if (write(log->fd, EVLOG_MAGIC, EVLOG_MAGIC_LEN)
+				!= EVLOG_MAGIC_LEN) {
+			rc = -EIO;
+			goto err;
+		}
+	} else if (pread(log->fd, magic, sizeof(magic), 0) != sizeof(magic)
+			|| memcmp(magic, EVLOG_MAGIC, EVLOG_MAGIC_LEN) != 0) {
+		rc = -EINVAL;
+		goto err;
+	} else {
+		off_t end = evlog_complete(log->fd, st.st_size);
+
+		if (end < 0) {
+			rc = end;
+			goto err;
+		}
+		if (end < st.st_size && ftruncate(log->fd, end) < 0) {
+			rc = -errno;
+			goto err;
+		}
+	}
+
+	log->size = EVLOG_BUF_SIZE;
+	log->buf = malloc(log->size);
+	if (!log->buf) {
+		rc = -ENOMEM;
+		goto err;
+	}
+	return 0;
+err:
+	close(log->fd);
+	log->fd = -1;
+	return rc;
+}
+
+int evlog_start_session(struct evlog *log, const char *source, u64 timestamp)
+{
+	struct evlog_session session = {
+		.pid = cpu_to_le32(getpid()),
+		.page_size = cpu_to_le32(getpagesize()),
+		.long_size = sizeof(long),
+		.big_endian = __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__,
+	};
+
+	strncpy(session.source, source, sizeof(session.source) - 1);
+	return evlog_append(log, EVLOG_SESSION, timestamp, &session,
+			sizeof(session));
+}
+
+int evlog_flush(struct evlog *log)
+{
+	size_t done = 0;
+	ssize_t rc;
+
+	while (done < log->len) {
+		rc = write(log->fd, log->buf + done, log->len - done);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		done += rc;
+	}
+	log->len = 0;
+	return 0;
+}
+
+/* queue a record, writing out the buffer only when it fills up */
+int evlog_append(struct evlog *log, enum evlog_type type, u64 timestamp,
+		const void *data, size_t size)
+{
+	size_t need = sizeof(struct evlog_rec) + size;
+	struct evlog_rec rec = {
+		.size = cpu_to_le32(size),
+		.type = cpu_to_le16(type),
+		.timestamp = cpu_to_le64(timestamp),
+	};
+	int rc;
+
+	if (size > EVLOG_REC_MAX)
+		return -E2BIG;
+
+	if (log->len + need > log->size) {
+		rc = evlog_flush(log);
+		if (rc)
+			return rc;
+	}
+
+	if (need > log->size) {
+		char *buf = realloc(log->buf, need);
+
+		if (!buf)
+			return -ENOMEM;
+		log->buf = buf;
+		log->size = need;
+	}
+
+	memcpy(log->buf + log->len, &rec, sizeof(rec));
+	memcpy(log->buf + log->len + sizeof(rec), data, size);
+	log->len += need;
+	return 0;
+}
+
+void evlog_close(struct evlog *log)
+{
+	if (log->fd < 0)
+		return;
+	evlog_flush(log);
+	close(log->fd);
+	free(log->buf);
+	log->fd = -1;
+	log->buf = NULL;
+}
+
+int evlog_reader_open(struct evlog_reader *r, const char *path)
+{
+	char magic[EVLOG_MAGIC_LEN];
+
+	memset(r, 0, sizeof(*r));
+	r->f = fopen(path, "r");
+	if (!r->f)
+		return -errno;
+
+	if (fread(magic, sizeof(magic), 1, r->f) != 1
+			|| memcmp(magic, EVLOG_MAGIC, EVLOG_MAGIC_LEN) != 0) {
+		fclose(r->f);
+		r->f = NULL;
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * Read the next record into r->type, r->timestamp, r->size and
+ * r->payload. Returns 1 for a record, 0 at the end of the log, and -EIO
+ * if the log ends in the middle of a record.
+ */
+int evlog_read(struct evlog_reader *r)
+{
+	struct evlog_rec rec;
+	size_t n;
+
+	n = fread(&rec, 1, sizeof(rec), r->f);
+	if (n == 0 && feof(r->f))
+		return 0;
+	if (n != sizeof(rec))
+		return -EIO;
+
+	r->type = le16_to_cpu(rec.type);
+	r->timestamp = le64_to_cpu(rec.timestamp);
+	r->size = le32_to_cpu(rec.size);
+	if (r->size > EVLOG_REC_MAX)
+		return -EIO;
+
+	/* one spare byte keeps string payloads terminated */
+	if (r->size + 1 > r->alloc) {
+		void *payload = realloc(r->payload, r->size + 1);
+
+		if (!payload)
+			return -ENOMEM;
+		r->payload = payload;
+		r->alloc = r->size + 1;
+	}
+
+	if (r->size && fread(r->payload, r->size, 1, r->f) != 1)
+		return -EIO;
+	((char *) r->payload)[r->size] = '\0';
+	return 1;
+}
+
+void evlog_reader_close(struct evlog_reader *r)
+{
+	if (r->f)
+		fclose(r->f);
+	free(r->payload);
+	r->f = NULL;
+	r->payload = NULL;
+}
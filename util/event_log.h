@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __UTIL_EVENT_LOG_H__
+#define __UTIL_EVENT_LOG_H__
+
+#include <stdio.h>
+#include <stddef.h>
+#include <ccan/endian/endian.h>
+#include <ccan/short_types/short_types.h>
+#include <util/size.h>
+
+/*
+ * Binary monitor log: EVLOG_MAGIC followed by length-prefixed records.
+ * Each monitor run appends an EVLOG_SESSION record, then the schema
+ * records needed to decode its events (e.g. EVLOG_TRACE_FORMAT), then the
+ * events themselves. Record headers and the session are little endian;
+ * the payload of an EVLOG_TRACE_EVENT is the raw trace record in the
+ * byte order named by the session.
+ */
+#define EVLOG_MAGIC "NDEVLOG1"
+#define EVLOG_MAGIC_LEN 8
+#define EVLOG_REC_MAX SZ_16M
+
+enum evlog_type {
+	EVLOG_SESSION = 1,
+	EVLOG_TRACE_FORMAT,	/* "<system>\0<tracefs format text>" */
+	EVLOG_TRACE_EVENT,	/* raw trace record data */
+	EVLOG_DIMM_EVENT,	/* struct monitor_dimm_record, ndctl/monitor.c */
+};
+
+struct evlog_rec {
+	le32 size;		/* payload bytes following the header */
+	le16 type;
+	le16 reserved;
+	le64 timestamp;
+};
+
+struct evlog_session {
+	le32 pid;
+	le32 page_size;
+	u8 long_size;
+	u8 big_endian;
+	u8 reserved[2];
+	char source[16];
+};
+
+struct evlog {
+	int fd;
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+int evlog_open(struct evlog *log, const char *path);
+int evlog_start_session(struct evlog *log, const char *source, u64 timestamp);
+int evlog_append(struct evlog *log, enum evlog_type type, u64 timestamp,
+		const void *data, size_t size);
+int evlog_flush(struct evlog *log);
+void evlog_close(struct evlog *log);
+
+struct evlog_reader {
+	FILE *f;
+	unsigned int type;
+	u64 timestamp;
+	void *payload;
+	size_t size;
+	size_t alloc;
+};
+
+int evlog_reader_open(struct evlog_reader *r, const char *path);
+int evlog_read(struct evlog_reader *r);
+void evlog_reader_close(struct evlog_reader *r);
+#endif /* __UTIL_EVENT_LOG_H__ */
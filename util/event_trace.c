@@ -9,6 +9,7 @@
 #include <util/strbuf.h>
 #include <ccan/list/list.h>
 #include <uuid/uuid.h>
+#include <time.h>
 #include <tracefs.h>
 #include "event_trace.h"
 
@@ -96,24 +97,16 @@ static struct json_object *num_to_json(void *num, int elem_size, unsigned long f
 	return json_object_new_int64(val);
 }
 
-static int event_to_json(struct tep_event *event, struct tep_record *record,
-			 struct event_ctx *ctx)
+static int event_to_jobj(struct tep_event *event, struct tep_record *record,
+			 struct json_object **jout)
 {
 	struct json_object *jevent, *jobj, *jarray;
 	struct tep_format_field **fields;
-	struct jlist_node *jnode;
 	int i, j, rc = 0;
 
-	jnode = malloc(sizeof(*jnode));
-	if (!jnode)
-		return -ENOMEM;
-
 	jevent = json_object_new_object();
-	if (!jevent) {
-		rc = -ENOMEM;
-		goto err_jnode;
-	}
-	jnode->jobj = jevent;
+	if (!jevent)
+		return -ENOMEM;
 
 	fields = tep_event_fields(event);
 	if (!fields) {
@@ -227,16 +220,597 @@ static int event_to_json(struct tep_event *event, struct tep_record *record,
 		}
 	}
 
-	list_add_tail(&ctx->jlist_head, &jnode->list);
+	free(fields);
+	*jout = jevent;
 	return 0;
 
 err_jevent:
+	free(fields);
 	json_object_put(jevent);
-err_jnode:
-	free(jnode);
 	return rc;
 }
 
+static int event_to_json(struct tep_event *event, struct tep_record *record,
+			 struct event_ctx *ctx)
+{
+	struct jlist_node *jnode;
+	int rc;
+
+	jnode = malloc(sizeof(*jnode));
+	if (!jnode)
+		return -ENOMEM;
+
+	rc = event_to_jobj(event, record, &jnode->jobj);
+	if (rc) {
+		free(jnode);
+		return rc;
+	}
+
+	list_add_tail(&ctx->jlist_head, &jnode->list);
+	return 0;
+}
+
+enum trace_field_kind {
+	TRACE_FIELD_STRING,
+	TRACE_FIELD_ARRAY,
+	TRACE_FIELD_UUID,
+	TRACE_FIELD_NUMBER,
+};
+
+struct trace_field_plan {
+	const char *name;
+	enum trace_field_kind kind;
+	int offset;
+	int size;
+	int elementsize;
+	unsigned long flags;
+};
+
+/*
+ * How to emit the records of one event type, resolved from its format
+ * once instead of looking every field up by name in every record.
+ * @fallback events (odd element sizes, or fields named like the fixed
+ * keys) keep going through the json-c tree so the output stays the same.
+ */
+struct trace_event_plan {
+	struct tep_event *event;
+	bool fallback;
+	int nr_fields;
+	struct trace_field_plan fields[];
+};
+
+static bool plan_size_ok(int size)
+{
+	return size == 1 || size == 2 || size == 4 || size == 8;
+}
+
+static struct trace_event_plan *event_plan_build(struct tep_event *event)
+{
+	struct tep_format_field **fields;
+	struct trace_event_plan *plan;
+	int i, nr;
+
+	fields = tep_event_fields(event);
+	if (!fields)
+		return NULL;
+
+	for (nr = 0; fields[nr]; nr++)
+		;
+	plan = calloc(1, sizeof(*plan) + nr * sizeof(plan->fields[0]));
+	if (!plan) {
+		free(fields);
+		return NULL;
+	}
+	plan->event = event;
+	plan->nr_fields = nr;
+
+	for (i = 0; i < nr; i++) {
+		struct tep_format_field *f = fields[i];
+		struct trace_field_plan *fp = &plan->fields[i];
+
+		fp->name = f->name;
+		fp->offset = f->offset;
+		fp->size = f->size;
+		fp->elementsize = f->elementsize;
+		fp->flags = f->flags;
+
+		if ((f->flags & TEP_FIELD_IS_STRING) &&
+		    (f->flags & TEP_FIELD_IS_DYNAMIC))
+			fp->kind = TRACE_FIELD_STRING;
+		else if (f->flags & TEP_FIELD_IS_ARRAY)
+			fp->kind = TRACE_FIELD_ARRAY;
+		else if (strcasestr(f->type, "uuid_t"))
+			fp->kind = TRACE_FIELD_UUID;
+		else
+			fp->kind = TRACE_FIELD_NUMBER;
+
+		if (fp->kind == TRACE_FIELD_ARRAY ||
+		    fp->kind == TRACE_FIELD_NUMBER)
+			if (!plan_size_ok(fp->elementsize))
+				plan->fallback = true;
+		if (strcmp(f->name, "system") == 0 ||
+		    strcmp(f->name, "event") == 0 ||
+		    strcmp(f->name, "timestamp") == 0)
+			plan->fallback = true;
+	}
+
+	free(fields);
+	return plan;
+}
+
+static struct trace_event_plan *event_plan(struct event_ctx *ectx,
+					   struct tep_event *event)
+{
+	struct trace_event_plan **plans;
+	int id = event->id;
+
+	if (id < 0)
+		return NULL;
+
+	if (id >= ectx->nr_plans) {
+		plans = realloc(ectx->plans, (id + 1) * sizeof(*plans));
+		if (!plans)
+			return NULL;
+		memset(plans + ectx->nr_plans, 0,
+		       (id + 1 - ectx->nr_plans) * sizeof(*plans));
+		ectx->plans = plans;
+		ectx->nr_plans = id + 1;
+	}
+
+	if (!ectx->plans[id] || ectx->plans[id]->event != event) {
+		free(ectx->plans[id]);
+		ectx->plans[id] = event_plan_build(event);
+	}
+	return ectx->plans[id];
+}
+
+void trace_event_plans_free(struct event_ctx *ectx)
+{
+	int i;
+
+	for (i = 0; i < ectx->nr_plans; i++)
+		free(ectx->plans[i]);
+	free(ectx->plans);
+	ectx->plans = NULL;
+	ectx->nr_plans = 0;
+}
+
+static void text_add_u64(struct strbuf *sb, unsigned long long val)
+{
+	char buf[24], *p = buf + sizeof(buf);
+
+	do {
+		*--p = '0' + val % 10;
+		val /= 10;
+	} while (val);
+	strbuf_add(sb, p, buf + sizeof(buf) - p);
+}
+
+static void text_add_s64(struct strbuf *sb, long long val)
+{
+	if (val < 0) {
+		strbuf_addch(sb, '-');
+		text_add_u64(sb, -(unsigned long long) val);
+	} else
+		text_add_u64(sb, val);
+}
+
+static void text_add_key(struct strbuf *sb, const char *key)
+{
+	strbuf_addch(sb, ',');
+	strbuf_addch(sb, '"');
+	strbuf_addstr(sb, key);
+	strbuf_add(sb, "\":", 2);
+}
+
+/* escaped the way json-c does for JSON_C_TO_STRING_PLAIN */
+static void text_add_string(struct strbuf *sb, const char *str, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	size_t i, start = 0;
+
+	strbuf_addch(sb, '"');
+	for (i = 0; i < len; i++) {
+		unsigned char c = str[i];
+		const char *esc = NULL;
+
+		switch (c) {
+		case '\b': esc = "\\b"; break;
+		case '\n': esc = "\\n"; break;
+		case '\r': esc = "\\r"; break;
+		case '\t': esc = "\\t"; break;
+		case '\f': esc = "\\f"; break;
+		case '"': esc = "\\\""; break;
+		case '\\': esc = "\\\\"; break;
+		case '/': esc = "\\/"; break;
+		default:
+			if (c >= ' ')
+				continue;
+		}
+
+		strbuf_add(sb, str + start, i - start);
+		start = i + 1;
+		if (esc) {
+			strbuf_addstr(sb, esc);
+		} else {
+			strbuf_add(sb, "\\u00", 4);
+			strbuf_addch(sb, hex[c >> 4]);
+			strbuf_addch(sb, hex[c & 0xf]);
+		}
+	}
+	strbuf_add(sb, str + start, len - start);
+	strbuf_addch(sb, '"');
+}
+
+/* the text form of num_to_json() */
+static void text_add_num(struct strbuf *sb, const void *num, int size,
+			 unsigned long flags)
+{
+	bool sign = flags & TEP_FIELD_IS_SIGNED;
+
+	switch (size) {
+	case 1:
+		if (sign)
+			text_add_s64(sb, *(int8_t *)num);
+		else
+			text_add_u64(sb, *(uint8_t *)num);
+		break;
+	case 2:
+		if (sign)
+			text_add_s64(sb, *(int16_t *)num);
+		else
+			text_add_u64(sb, *(uint16_t *)num);
+		break;
+	case 4:
+		if (sign)
+			text_add_s64(sb, *(int32_t *)num);
+		else
+			text_add_u64(sb, *(uint32_t *)num);
+		break;
+	case 8:
+		if (sign)
+			text_add_s64(sb, *(int64_t *)num);
+		else if (HAVE_JSON_U64)
+			text_add_u64(sb, *(uint64_t *)num);
+		else
+			text_add_s64(sb, *(int64_t *)num);
+		break;
+	}
+}
+
+static void *plan_field_data(struct tep_event *event, struct tep_record *record,
+			     struct trace_field_plan *fp, int *len)
+{
+	unsigned long long loc;
+	int offset;
+
+	if (fp->offset + fp->size > record->size)
+		return NULL;
+
+	if (!(fp->flags & TEP_FIELD_IS_DYNAMIC)) {
+		*len = fp->size;
+		return (char *) record->data + fp->offset;
+	}
+
+	loc = tep_read_number(event->tep, (char *) record->data + fp->offset,
+			      fp->size);
+	offset = loc & 0xffff;
+	*len = loc >> 16;
+	if (fp->flags & TEP_FIELD_IS_RELATIVE)
+		offset += fp->offset + fp->size;
+	if (offset + *len > record->size)
+		return NULL;
+	return (char *) record->data + offset;
+}
+
+/*
+ * Append @record to @sb as a single line of plain json, the same text
+ * event_to_json() and JSON_C_TO_STRING_PLAIN would produce, without
+ * building a json-c tree. Once @sb has grown to fit, no memory is
+ * allocated per record.
+ */
+int trace_event_to_text(struct tep_event *event, struct tep_record *record,
+			struct event_ctx *ectx, struct strbuf *sb)
+{
+	struct trace_event_plan *plan = event_plan(ectx, event);
+	struct json_object *jevent;
+	int i, j, len, rc;
+
+	if (!plan || plan->fallback) {
+		rc = event_to_jobj(event, record, &jevent);
+		if (rc)
+			return rc;
+		strbuf_addstr(sb, json_object_to_json_string_ext(jevent,
+					JSON_C_TO_STRING_PLAIN));
+		strbuf_addch(sb, '\n');
+		json_object_put(jevent);
+		return 0;
+	}
+
+	strbuf_add(sb, "{\"system\":", 10);
+	text_add_string(sb, event->system, strlen(event->system));
+	text_add_key(sb, "event");
+	text_add_string(sb, event->name, strlen(event->name));
+	text_add_key(sb, "timestamp");
+	if (HAVE_JSON_U64)
+		text_add_u64(sb, record->ts);
+	else
+		text_add_s64(sb, record->ts);
+
+	for (i = 0; i < plan->nr_fields; i++) {
+		struct trace_field_plan *fp = &plan->fields[i];
+		unsigned char *data;
+		char uuid[40];
+
+		data = plan_field_data(event, record, fp, &len);
+		if (!data)
+			continue;
+
+		text_add_key(sb, fp->name);
+		switch (fp->kind) {
+		case TRACE_FIELD_STRING:
+			text_add_string(sb, (char *) data,
+					strnlen((char *) data, len));
+			break;
+		case TRACE_FIELD_ARRAY:
+			strbuf_addch(sb, '[');
+			for (j = 0; j < fp->size / fp->elementsize; j++) {
+				if (j)
+					strbuf_addch(sb, ',');
+				text_add_num(sb, data, fp->elementsize,
+					     fp->flags);
+				data += fp->elementsize;
+			}
+			strbuf_addch(sb, ']');
+			break;
+		case TRACE_FIELD_UUID:
+			uuid_unparse(data, uuid);
+			text_add_string(sb, uuid, strlen(uuid));
+			break;
+		case TRACE_FIELD_NUMBER:
+			text_add_num(sb, data, fp->elementsize, fp->flags);
+			break;
+		}
+	}
+	strbuf_add(sb, "}\n", 2);
+	return 0;
+}
+
+/*
+ * Repeats of an event from one device within the aggregation window,
+ * after the first one which is emitted as usual. @range holds the min
+ * and max of each numeric field of the event's plan.
+ */
+struct trace_agg_bucket {
+	struct list_node list;
+	struct tep_event *event;
+	char key[32];
+	unsigned long long opened;
+	unsigned long count;
+	u64 first_ts;
+	u64 last_ts;
+	int nr_fields;
+	struct {
+		u64 min;
+		u64 max;
+	} range[];
+};
+
+static unsigned long long agg_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+/* numeric fields widened to 64 bits, signed ones sign extended */
+static u64 plan_num(const void *num, int size, unsigned long flags)
+{
+	bool sign = flags & TEP_FIELD_IS_SIGNED;
+
+	switch (size) {
+	case 1:
+		return sign ? (u64) *(int8_t *)num : *(uint8_t *)num;
+	case 2:
+		return sign ? (u64) *(int16_t *)num : *(uint16_t *)num;
+	case 4:
+		return sign ? (u64) *(int32_t *)num : *(uint32_t *)num;
+	default:
+		return *(uint64_t *)num;
+	}
+}
+
+static bool agg_field(struct trace_field_plan *fp)
+{
+	return fp->kind == TRACE_FIELD_NUMBER && plan_size_ok(fp->elementsize)
+		&& strncmp(fp->name, "common_", 7) != 0;
+}
+
+static bool agg_less(u64 a, u64 b, unsigned long flags)
+{
+	if (flags & TEP_FIELD_IS_SIGNED)
+		return (s64) a < (s64) b;
+	return a < b;
+}
+
+/*
+ * Returns true if @record repeats an event already seen from the same
+ * device in the current window and was folded into its bucket, false if
+ * it should be emitted.
+ */
+static bool trace_agg_absorb(struct event_ctx *ectx, struct tep_event *event,
+			     struct tep_record *record)
+{
+	struct trace_event_plan *plan = event_plan(ectx, event);
+	struct trace_agg *agg = ectx->agg;
+	struct trace_agg_bucket *b;
+	char key[sizeof(b->key)] = "";
+	unsigned char *data;
+	int i, len;
+
+	if (!plan)
+		return false;
+
+	for (i = 0; i < plan->nr_fields; i++) {
+		struct trace_field_plan *fp = &plan->fields[i];
+
+		if (fp->kind != TRACE_FIELD_STRING ||
+		    strcmp(fp->name, agg->key) != 0)
+			continue;
+		data = plan_field_data(event, record, fp, &len);
+		if (data)
+			snprintf(key, sizeof(key), "%.*s", len, data);
+		break;
+	}
+
+	list_for_each(&agg->buckets, b, list)
+		if (b->event == event && strcmp(b->key, key) == 0)
+			break;
+
+	if (&b->list == &agg->buckets.n) {
+		/* first of its kind in this window, emit it */
+		b = calloc(1, sizeof(*b) +
+			   plan->nr_fields * sizeof(b->range[0]));
+		if (!b)
+			return false;
+		b->event = event;
+		strcpy(b->key, key);
+		b->opened = agg_now_ms();
+		b->nr_fields = plan->nr_fields;
+		list_add_tail(&agg->buckets, &b->list);
+		return false;
+	}
+
+	for (i = 0; i < plan->nr_fields; i++) {
+		struct trace_field_plan *fp = &plan->fields[i];
+		u64 val;
+
+		if (!agg_field(fp))
+			continue;
+		data = plan_field_data(event, record, fp, &len);
+		if (!data)
+			continue;
+		val = plan_num(data, fp->elementsize, fp->flags);
+		if (!b->count || agg_less(val, b->range[i].min, fp->flags))
+			b->range[i].min = val;
+		if (!b->count || agg_less(b->range[i].max, val, fp->flags))
+			b->range[i].max = val;
+	}
+
+	if (!b->count)
+		b->first_ts = record->ts;
+	b->last_ts = record->ts;
+	b->count++;
+	return true;
+}
+
+static struct json_object *agg_num_to_json(u64 val, unsigned long flags)
+{
+	if (flags & TEP_FIELD_IS_SIGNED)
+		return json_object_new_int64(val);
+	return util_json_new_u64(val);
+}
+
+static struct json_object *agg_to_json(struct event_ctx *ectx,
+				       struct trace_agg_bucket *b)
+{
+	struct trace_event_plan *plan = event_plan(ectx, b->event);
+	struct json_object *jagg, *jmin, *jmax;
+	int i;
+
+	jagg = json_object_new_object();
+	jmin = json_object_new_object();
+	jmax = json_object_new_object();
+	if (!jagg || !jmin || !jmax)
+		goto err;
+
+	json_object_object_add(jagg, "system",
+			       json_object_new_string(b->event->system));
+	json_object_object_add(jagg, "event",
+			       json_object_new_string(b->event->name));
+	if (b->key[0])
+		json_object_object_add(jagg, ectx->agg->key,
+				       json_object_new_string(b->key));
+	json_object_object_add(jagg, "count", util_json_new_u64(b->count));
+	json_object_object_add(jagg, "first_timestamp",
+			       util_json_new_u64(b->first_ts));
+	json_object_object_add(jagg, "last_timestamp",
+			       util_json_new_u64(b->last_ts));
+
+	/* only the fields that varied, the rest match the emitted event */
+	for (i = 0; plan && i < b->nr_fields && i < plan->nr_fields; i++) {
+		struct trace_field_plan *fp = &plan->fields[i];
+
+		if (!agg_field(fp) || b->range[i].min == b->range[i].max)
+			continue;
+		json_object_object_add(jmin, fp->name,
+				agg_num_to_json(b->range[i].min, fp->flags));
+		json_object_object_add(jmax, fp->name,
+				agg_num_to_json(b->range[i].max, fp->flags));
+	}
+	json_object_object_add(jagg, "min", jmin);
+	json_object_object_add(jagg, "max", jmax);
+	return jagg;
+
+err:
+	json_object_put(jmax);
+	json_object_put(jmin);
+	json_object_put(jagg);
+	return NULL;
+}
+
+/*
+ * Close the buckets whose window has passed, or all of them with @all.
+ * Buckets that absorbed repeats are summarized as json objects on
+ * ectx->jlist_head.
+ */
+int trace_agg_expire(struct event_ctx *ectx, bool all)
+{
+	unsigned long long now = agg_now_ms();
+	struct trace_agg *agg = ectx->agg;
+	struct trace_agg_bucket *b, *next;
+	struct jlist_node *jnode;
+	int rc = 0;
+
+	if (!agg)
+		return 0;
+
+	list_for_each_safe(&agg->buckets, b, next, list) {
+		if (!all && now - b->opened < agg->window)
+			continue;
+		if (b->count) {
+			jnode = malloc(sizeof(*jnode));
+			if (jnode)
+				jnode->jobj = agg_to_json(ectx, b);
+			if (!jnode || !jnode->jobj) {
+				free(jnode);
+				rc = -ENOMEM;
+			} else
+				list_add_tail(&ectx->jlist_head, &jnode->list);
+		}
+		list_del(&b->list);
+		free(b);
+	}
+	return rc;
+}
+
+/* milliseconds until the oldest bucket closes, or -1 if none are open */
+int trace_agg_timeout(struct trace_agg *agg)
+{
+	unsigned long long now = agg_now_ms(), next = ULLONG_MAX;
+	struct trace_agg_bucket *b;
+
+	list_for_each(&agg->buckets, b, list)
+		if (b->opened + agg->window < next)
+			next = b->opened + agg->window;
+	if (next == ULLONG_MAX)
+		return -1;
+	if (next <= now)
+		return 0;
+	return next - now;
+}
+
 static int event_parse(struct tep_event *event, struct tep_record *record,
 		       int cpu, void *ctx)
 {
@@ -256,23 +830,56 @@ static int event_parse(struct tep_event *event, struct tep_record *record,
 			return 0;
 	}
 
+	if (event_ctx->agg && trace_agg_absorb(event_ctx, event, record))
+		return 0;
+
 	if (event_ctx->parse_event)
 		return event_ctx->parse_event(event, record, event_ctx);
 
 	return event_to_json(event, record, event_ctx);
 }
 
+/*
+ * Run a single record, e.g. one read back from a binary event log, through
+ * the same filtering and conversion as trace_event_parse().
+ */
+int trace_event_record(struct tep_handle *tep, struct tep_record *record,
+		       struct event_ctx *ectx)
+{
+	struct tep_event *event = tep_find_event_by_record(tep, record);
+
+	if (!event)
+		return -ENOENT;
+	return event_parse(event, record, record->cpu, ectx);
+}
+
+/*
+ * Parse the event formats of @system once, for callers that consume the
+ * trace buffers repeatedly. Hand the result to trace_event_parse() via
+ * event_ctx.tep, and release it with tep_free().
+ */
+struct tep_handle *trace_event_tep_load(const char *system)
+{
+	const char * const systems[] = { system, NULL };
+
+	return tracefs_local_events_system(NULL, systems);
+}
+
 int trace_event_parse(struct tracefs_instance *inst, struct event_ctx *ectx)
 {
-	struct tep_handle *tep;
+	struct tep_handle *tep = ectx->tep;
 	int rc;
 
-	tep = tracefs_local_events(NULL);
-	if (!tep)
-		return -ENOMEM;
+	/* without a caller provided handle, load all formats for this pass */
+	if (!tep) {
+		tep = tracefs_local_events(NULL);
+		if (!tep)
+			return -ENOMEM;
+	}
 
 	rc = tracefs_iterate_raw_events(tep, inst, NULL, 0, event_parse, ectx);
-	tep_free(tep);
+	if (tep != ectx->tep)
+		tep_free(tep);
 	return rc;
 }
 
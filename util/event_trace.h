@@ -7,6 +7,9 @@
 #include <ccan/list/list.h>
 #include <ccan/short_types/short_types.h>
 
+struct strbuf;
+struct trace_event_plan;
+
 struct jlist_node {
 	struct json_object *jobj;
 	struct list_node list;
@@ -18,6 +21,16 @@ struct cxl_poison_ctx {
 	struct cxl_memdev *memdev;
 };
 
+/*
+ * Coalesce repeats of an event from the same device, named by the string
+ * field @key, that arrive within @window milliseconds of the first.
+ */
+struct trace_agg {
+	unsigned int window;
+	const char *key;
+	struct list_head buckets;
+};
+
 struct event_ctx {
 	const char *system;
 	struct list_head jlist_head;
@@ -25,11 +38,23 @@ struct event_ctx {
 	int event_pid; /* optional */
 	struct cxl_poison_ctx *poison_ctx; /* optional */
 	unsigned long json_flags;
+	struct tep_handle *tep; /* optional, see trace_event_tep_load() */
+	struct trace_event_plan **plans; /* by event id, see trace_event_to_text() */
+	int nr_plans;
+	struct trace_agg *agg; /* optional, see trace_agg_expire() */
 	int (*parse_event)(struct tep_event *event, struct tep_record *record,
 			   struct event_ctx *ctx);
 };
 
 int trace_event_parse(struct tracefs_instance *inst, struct event_ctx *ectx);
+struct tep_handle *trace_event_tep_load(const char *system);
+int trace_event_record(struct tep_handle *tep, struct tep_record *record,
+		       struct event_ctx *ectx);
+int trace_event_to_text(struct tep_event *event, struct tep_record *record,
+			struct event_ctx *ectx, struct strbuf *sb);
+void trace_event_plans_free(struct event_ctx *ectx);
+int trace_agg_expire(struct event_ctx *ectx, bool all);
+int trace_agg_timeout(struct trace_agg *agg);
 int trace_event_enable(struct tracefs_instance *inst, const char *system,
 		       const char *event);
 int trace_event_disable(struct tracefs_instance *inst);
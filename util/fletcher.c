@@ -0,0 +1,152 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2015-2020 Intel Corporation. All rights reserved.
+#include <stddef.h>
+#include <util/fletcher.h>
+#include <ccan/endian/endian.h>
+#include <ccan/short_types/short_types.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FLETCHER_X86
+#endif
+
+#define FLETCHER_LANES 4
+
+static inline u32 fletcher_word(const u32 *buf, size_t i, bool le)
+{
+	return le ? le32_to_cpu((le32) buf[i]) : buf[i];
+}
+
+/*
+ * Each word depends on the running sum of the words before it, so a
+ * single buffer can not be split up. Instead, interleave independent
+ * buffers so that their dependency chains can execute in parallel.
+ */
+static void fletcher64_x2(void * const *addr, size_t len, bool le, u64 *sum)
+{
+	const u32 *buf0 = addr[0], *buf1 = addr[1];
+	u32 lo0 = 0, lo1 = 0;
+	u64 hi0 = 0, hi1 = 0;
+	size_t i;
+
+	for (i = 0; i < len / sizeof(u32); i++) {
+		lo0 += fletcher_word(buf0, i, le);
+		lo1 += fletcher_word(buf1, i, le);
+		hi0 += lo0;
+		hi1 += lo1;
+	}
+
+	sum[0] = hi0 << 32 | lo0;
+	sum[1] = hi1 << 32 | lo1;
+}
+
+void fletcher64_multi_scalar(void * const *addr, size_t len, bool le,
+		u64 *sum, int nr)
+{
+	for (; nr >= 2; addr += 2, sum += 2, nr -= 2)
+		fletcher64_x2(addr, len, le, sum);
+	if (nr)
+		sum[0] = fletcher64(addr[0], len, le);
+}
+
+#ifdef FLETCHER_X86
+/*
+ * Checksum 4 buffers at a time, one per lane: load 4 words of each,
+ * transpose them so that each vector holds the same word of every
+ * buffer, and then run the scalar recurrence on all lanes at once. The
+ * 32-bit sums wrap just like 'lo32' does, and are widened before being
+ * added to the 64-bit 'hi32' sums.
+ *
+ * x86 is little-endian, so @le makes no difference. Groups of fewer than
+ * 4 buffers are padded with the first buffer, and the result of the
+ * padding lanes is discarded.
+ */
+__attribute__((target("avx2")))
+void fletcher64_multi_avx2(void * const *addr, size_t len, bool le,
+		u64 *sum, int nr)
+{
+	size_t i, words = len / sizeof(u32);
+	const u32 *buf[FLETCHER_LANES];
+	u32 lo32[FLETCHER_LANES];
+	u64 hi32[FLETCHER_LANES];
+	int b, lanes;
+
+	for (; nr > 0; addr += lanes, sum += lanes, nr -= lanes) {
+		__m128i lo = _mm_setzero_si128();
+		__m256i hi = _mm256_setzero_si256();
+
+		lanes = nr < FLETCHER_LANES ? nr : FLETCHER_LANES;
+		if (lanes == 1) {
+			sum[0] = fletcher64(addr[0], len, le);
+			continue;
+		}
+
+		for (b = 0; b < FLETCHER_LANES; b++)
+			buf[b] = addr[b < lanes ? b : 0];
+
+		for (i = 0; i + 4 <= words; i += 4) {
+			__m128i w0 = _mm_loadu_si128((const __m128i *) &buf[0][i]);
+			__m128i w1 = _mm_loadu_si128((const __m128i *) &buf[1][i]);
+			__m128i w2 = _mm_loadu_si128((const __m128i *) &buf[2][i]);
+			__m128i w3 = _mm_loadu_si128((const __m128i *) &buf[3][i]);
+			__m128i t0 = _mm_unpacklo_epi32(w0, w1);
+			__m128i t1 = _mm_unpacklo_epi32(w2, w3);
+			__m128i t2 = _mm_unpackhi_epi32(w0, w1);
+			__m128i t3 = _mm_unpackhi_epi32(w2, w3);
+
+			lo = _mm_add_epi32(lo, _mm_unpacklo_epi64(t0, t1));
+			hi = _mm256_add_epi64(hi, _mm256_cvtepu32_epi64(lo));
+			lo = _mm_add_epi32(lo, _mm_unpackhi_epi64(t0, t1));
+			hi = _mm256_add_epi64(hi, _mm256_cvtepu32_epi64(lo));
+			lo = _mm_add_epi32(lo, _mm_unpacklo_epi64(t2, t3));
+			hi = _mm256_add_epi64(hi, _mm256_cvtepu32_epi64(lo));
+			lo = _mm_add_epi32(lo, _mm_unpackhi_epi64(t2, t3));
+			hi = _mm256_add_epi64(hi, _mm256_cvtepu32_epi64(lo));
+		}
+		_mm_storeu_si128((__m128i *) lo32, lo);
+		_mm256_storeu_si256((__m256i *) hi32, hi);
+
+		for (b = 0; b < lanes; b++) {
+			size_t j;
+
+			for (j = i; j < words; j++) {
+				lo32[b] += buf[b][j];
+				hi32[b] += lo32[b];
+			}
+			sum[b] = hi32[b] << 32 | lo32[b];
+		}
+	}
+}
+#endif
+
+static fletcher64_multi_fn fletcher64_multi_impl = fletcher64_multi_scalar;
+
+static void __attribute__((constructor)) fletcher64_multi_init(void)
+{
+#ifdef FLETCHER_X86
+	/* constructors may run before the cpu model is initialized */
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		fletcher64_multi_impl = fletcher64_multi_avx2;
+#endif
+}
+
+fletcher64_multi_fn fletcher64_multi_select(void)
+{
+	return fletcher64_multi_impl;
+}
+
+void fletcher64_multi(void * const *addr, size_t len, bool le, u64 *sum,
+		int nr)
+{
+	fletcher64_multi_impl(addr, len, le, sum, nr);
+}
+
+const char *fletcher64_multi_name(fletcher64_multi_fn fn)
+{
+#ifdef FLETCHER_X86
+	if (fn == fletcher64_multi_avx2)
+		return "avx2";
+#endif
+	return "scalar";
+}
@@ -23,4 +23,26 @@ static inline u64 fletcher64(void *addr, size_t len, bool le)
 	return hi32 << 32 | lo32;
 }
 
+/*
+ * fletcher64_multi() stores the fletcher64() of each of the @nr buffers
+ * of @len bytes at @addr in @sum. The buffers are checksummed in
+ * parallel, which is cheaper than one after the other when validating
+ * several index or info blocks at once.
+ */
+typedef void (*fletcher64_multi_fn)(void * const *addr, size_t len, bool le,
+		u64 *sum, int nr);
+
+void fletcher64_multi_scalar(void * const *addr, size_t len, bool le,
+		u64 *sum, int nr);
+#if defined(__x86_64__) || defined(__i386__)
+void fletcher64_multi_avx2(void * const *addr, size_t len, bool le,
+		u64 *sum, int nr);
+#endif
+
+/* the backend is picked once, at load time */
+fletcher64_multi_fn fletcher64_multi_select(void);
+const char *fletcher64_multi_name(fletcher64_multi_fn fn);
+void fletcher64_multi(void * const *addr, size_t len, bool le, u64 *sum,
+		int nr);
+
 #endif /* _NDCTL_FLETCHER_H_ */
@@ -56,8 +56,11 @@ void do_log(struct log_ctx *ctx, int priority, const char *file,
 static void log_stderr(struct log_ctx *ctx, int priority, const char *file,
 		int line, const char *fn, const char *format, va_list args)
 {
+	/* keep the prefix with its message when logging from threads */
+	flockfile(stderr);
 	fprintf(stderr, "%s: %s: ", ctx->owner, fn);
 	vfprintf(stderr, format, args);
+	funlockfile(stderr);
 }
 
 static int log_priority(const char *priority)
@@ -9,18 +9,453 @@
 #include <string.h>
 #include <ctype.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <dirent.h>
 #include <libkmod.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <ccan/list/list.h>
 
 #include <util/log.h>
 #include <util/sysfs.h>
 
-int __sysfs_read_attr(struct log_ctx *ctx, const char *path, char *buf)
+/*
+ * Opt-in snapshot of sysfs reads, for tools that are run over and over
+ * against an unchanged topology. With NDCTL_SYSFS_CACHE=<dir> set, the
+ * result of every attribute read and device directory scan is saved at
+ * context teardown to <dir>/<owner>.cache. The next context loads it
+ * with a single mmap() and answers reads from it, provided no uevent has
+ * been generated since (/sys/kernel/uevent_seqnum is unchanged) and the
+ * snapshot is younger than NDCTL_SYSFS_CACHE_TTL seconds (default 60).
+ *
+ * Each cached path is answered at most once per load, repeated reads of
+ * the same attribute (polling loops, re-reads after a write) always go
+ * to sysfs. Any sysfs write by the process removes the saved snapshot
+ * and stops a new one from being saved. Both <dir> and the snapshot
+ * must be owned by the effective user and not be writable by anyone
+ * else, or the snapshot is neither loaded nor saved.
+ *
+ * The snapshot state below is static to this file, of which libndctl,
+ * libdaxctl and libcxl each link their own copy. So each library keeps
+ * its own snapshot, named after the owner of the first of its contexts
+ * to read sysfs (e.g. libndctl.cache), shared by all of that library's
+ * contexts in the process and saved when the first of them is torn
+ * down. Failed reads are cached with their error and an empty value.
+ */
+#define SYSFS_CACHE_MAGIC "NDSYSFS1"
+#define SYSFS_CACHE_TTL 60
+
+struct sysfs_cache_hdr {
+	char magic[8];
+	uint64_t seqnum;
+	uint64_t time;
+	uint32_t count;
+	uint32_t size;
+};
+
+struct sysfs_cache_ent {
+	uint32_t key;	/* offset of the NUL terminated path */
+	uint32_t val;	/* offset of the value */
+	uint32_t len;	/* length of the value */
+	int32_t rc;	/* result of the original read */
+};
+
+struct sysfs_cache_add {
+	char *key;
+	char *val;
+	uint32_t len;
+	int32_t rc;
+};
+
+enum {
+	SYSFS_CACHE_INIT,
+	SYSFS_CACHE_OFF,
+	SYSFS_CACHE_ON,
+};
+
+static struct sysfs_cache {
+	int state;
+	bool dirty;
+	char *path;
+	uint64_t seqnum;
+	void *map;
+	size_t map_len;
+	const struct sysfs_cache_ent *ent;
+	uint32_t count;
+	unsigned char *used;
+	struct sysfs_cache_add *add;
+	int nr_add, alloc_add;
+} sysfs_cache;
+
+/* enumeration may run on several threads, see __sysfs_enum_parallel() */
+static pthread_mutex_t sysfs_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t kmod_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int read_uevent_seqnum(uint64_t *seqnum)
+{
+	char buf[32];
+	int fd, n;
+
+	fd = open("/sys/kernel/uevent_seqnum", O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return -EIO;
+	buf[n] = 0;
+	*seqnum = strtoull(buf, NULL, 10);
+	return 0;
+}
+
+static bool sysfs_cache_valid(const void *map, size_t len, uint64_t seqnum,
+		unsigned long ttl)
+{
+	const struct sysfs_cache_hdr *hdr = map;
+	const struct sysfs_cache_ent *ent = map + sizeof(*hdr);
+	uint64_t now = time(NULL);
+	uint32_t i;
+
+	if (len < sizeof(*hdr) || memcmp(hdr->magic, SYSFS_CACHE_MAGIC, 8)
+			|| hdr->size != len || hdr->seqnum != seqnum
+			|| hdr->time > now || now - hdr->time > ttl
+			|| hdr->count > (len - sizeof(*hdr)) / sizeof(*ent))
+		return false;
+
+	for (i = 0; i < hdr->count; i++) {
+		if (ent[i].key >= len || ent[i].val > len
+				|| ent[i].len > len - ent[i].val
+				|| !memchr(map + ent[i].key, 0,
+					   len - ent[i].key))
+			return false;
+	}
+	return true;
+}
+
+/* nobody but the effective user may have planted or altered @st */
+static bool sysfs_cache_trusted(struct log_ctx *ctx, const char *path,
+		const struct stat *st)
+{
+	if (st->st_uid == geteuid() && !(st->st_mode & (S_IWGRP|S_IWOTH)))
+		return true;
+	log_dbg(ctx, "%s: not private to uid %u, ignoring\n", path,
+		(unsigned int) geteuid());
+	return false;
+}
+
+static void sysfs_cache_load(struct log_ctx *ctx)
+{
+	struct sysfs_cache *c = &sysfs_cache;
+	unsigned long ttl = SYSFS_CACHE_TTL;
+	const char *dir, *env;
+	struct stat st;
+	void *map;
+	int fd;
+
+	c->state = SYSFS_CACHE_OFF;
+	dir = secure_getenv("NDCTL_SYSFS_CACHE");
+	if (!dir || !*dir)
+		return;
+	env = secure_getenv("NDCTL_SYSFS_CACHE_TTL");
+	if (env)
+		ttl = strtoul(env, NULL, 0);
+
+	if (read_uevent_seqnum(&c->seqnum) < 0)
+		return;
+	if (stat(dir, &st) < 0 || !S_ISDIR(st.st_mode)
+			|| !sysfs_cache_trusted(ctx, dir, &st))
+		return;
+	if (asprintf(&c->path, "%s/%s.cache", dir,
+		     ctx->owner ? ctx->owner : "sysfs") < 0) {
+		c->path = NULL;
+		return;
+	}
+	c->state = SYSFS_CACHE_ON;
+
+	fd = open(c->path, O_RDONLY|O_CLOEXEC|O_NOFOLLOW);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0
+			|| !sysfs_cache_trusted(ctx, c->path, &st)) {
+		close(fd);
+		return;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return;
+
+	if (!sysfs_cache_valid(map, st.st_size, c->seqnum, ttl)) {
+		log_dbg(ctx, "%s: stale, rescanning\n", c->path);
+		munmap(map, st.st_size);
+		return;
+	}
+
+	c->map = map;
+	c->map_len = st.st_size;
+	c->ent = map + sizeof(struct sysfs_cache_hdr);
+	c->count = ((struct sysfs_cache_hdr *) map)->count;
+	c->used = calloc(c->count, 1);
+	if (!c->used) {
+		munmap(map, st.st_size);
+		c->map = NULL;
+		c->count = 0;
+		return;
+	}
+	log_dbg(ctx, "%s: loaded %u entries\n", c->path, c->count);
+}
+
+static int sysfs_cache_find(const char *path)
+{
+	struct sysfs_cache *c = &sysfs_cache;
+	int lo = 0, hi = (int) c->count - 1;
+
+	while (lo <= hi) {
+		int mid = lo + (hi - lo) / 2;
+		int cmp = strcmp(path, c->map + c->ent[mid].key);
+
+		if (cmp == 0)
+			return mid;
+		if (cmp < 0)
+			hi = mid - 1;
+		else
+			lo = mid + 1;
+	}
+	return -1;
+}
+
+/*
+ * Look @path up in the loaded snapshot. Returns the cached value, with
+ * its length in @len and the original read result in @rc, or NULL if
+ * @path has to be read from sysfs. @record is set when that live result
+ * should be added to the next snapshot.
+ */
+static const char *sysfs_cache_lookup(struct log_ctx *ctx, const char *path,
+		uint32_t *len, int *rc, bool *record)
+{
+	struct sysfs_cache *c = &sysfs_cache;
+	int i;
+
+	*record = false;
+	if (c->state == SYSFS_CACHE_INIT)
+		sysfs_cache_load(ctx);
+	if (c->state != SYSFS_CACHE_ON || c->dirty)
+		return NULL;
+
+	i = sysfs_cache_find(path);
+	if (i < 0) {
+		*record = true;
+		return NULL;
+	}
+	if (c->used[i])
+		return NULL;
+	c->used[i] = 1;
+
+	*len = c->ent[i].len;
+	*rc = c->ent[i].rc;
+	return c->map + c->ent[i].val;
+}
+
+static void sysfs_cache_record(const char *path, const char *val,
+		uint32_t len, int rc)
+{
+	struct sysfs_cache *c = &sysfs_cache;
+	struct sysfs_cache_add *add;
+
+	if (c->nr_add == c->alloc_add) {
+		int alloc = c->alloc_add ? c->alloc_add * 2 : 256;
+
+		add = realloc(c->add, alloc * sizeof(*add));
+		if (!add) {
+			c->dirty = true;
+			return;
+		}
+		c->add = add;
+		c->alloc_add = alloc;
+	}
+
+	add = &c->add[c->nr_add];
+	add->key = strdup(path);
+	add->val = malloc(len + 1);
+	if (!add->key || !add->val) {
+		free(add->key);
+		free(add->val);
+		c->dirty = true;
+		return;
+	}
+	memcpy(add->val, val, len);
+	add->val[len] = 0;
+	add->len = len;
+	add->rc = rc;
+	c->nr_add++;
+}
+
+static const char *sysfs_cache_get(struct log_ctx *ctx, const char *path,
+		uint32_t *len, int *rc, bool *record)
+{
+	const char *val;
+
+	pthread_mutex_lock(&sysfs_cache_lock);
+	val = sysfs_cache_lookup(ctx, path, len, rc, record);
+	pthread_mutex_unlock(&sysfs_cache_lock);
+
+	/* the snapshot stays mapped until __sysfs_cache_flush() */
+	return val;
+}
+
+static void sysfs_cache_put(const char *path, const char *val, uint32_t len,
+		int rc)
+{
+	pthread_mutex_lock(&sysfs_cache_lock);
+	sysfs_cache_record(path, val, len, rc);
+	pthread_mutex_unlock(&sysfs_cache_lock);
+}
+
+static int sysfs_cache_add_cmp(const void *a, const void *b)
+{
+	const struct sysfs_cache_add *x = a, *y = b;
+
+	return strcmp(x->key, y->key);
+}
+
+static void sysfs_cache_reset(void)
+{
+	struct sysfs_cache *c = &sysfs_cache;
+	int i;
+
+	for (i = 0; i < c->nr_add; i++) {
+		free(c->add[i].key);
+		free(c->add[i].val);
+	}
+	free(c->add);
+	free(c->used);
+	free(c->path);
+	if (c->map)
+		munmap(c->map, c->map_len);
+	memset(c, 0, sizeof(*c));
+}
+
+static int sysfs_cache_write(int fd, struct sysfs_cache_add *add, int count,
+		uint64_t seqnum)
+{
+	struct sysfs_cache_hdr hdr = {
+		.magic = SYSFS_CACHE_MAGIC,
+		.seqnum = seqnum,
+		.time = time(NULL),
+		.count = count,
+	};
+	struct sysfs_cache_ent *ent;
+	size_t off, size;
+	FILE *f;
+	int i;
+
+	ent = calloc(count, sizeof(*ent));
+	if (!ent)
+		return -ENOMEM;
+
+	off = sizeof(hdr) + count * sizeof(*ent);
+	for (i = 0; i < count; i++) {
+		ent[i].key = off;
+		off += strlen(add[i].key) + 1;
+		ent[i].val = off;
+		ent[i].len = add[i].len;
+		ent[i].rc = add[i].rc;
+		off += add[i].len;
+	}
+	size = off;
+	if (size > UINT32_MAX) {
+		free(ent);
+		return -EFBIG;
+	}
+	hdr.size = size;
+
+	f = fdopen(fd, "w");
+	if (!f) {
+		free(ent);
+		return -errno;
+	}
+	fwrite(&hdr, sizeof(hdr), 1, f);
+	fwrite(ent, sizeof(*ent), count, f);
+	for (i = 0; i < count; i++) {
+		fwrite(add[i].key, strlen(add[i].key) + 1, 1, f);
+		fwrite(add[i].val, add[i].len, 1, f);
+	}
+	free(ent);
+	if (fflush(f) != 0 || ferror(f)) {
+		fclose(f);
+		return -EIO;
+	}
+	return fclose(f) ? -errno : 0;
+}
+
+/* save what this context read, if the topology held still meanwhile */
+void __sysfs_cache_flush(struct log_ctx *ctx)
 {
-	int fd = open(path, O_RDONLY|O_CLOEXEC);
+	struct sysfs_cache *c = &sysfs_cache;
+	struct sysfs_cache_add *all = NULL;
+	int i, j, n = 0, fd = -1, rc;
+	uint64_t seqnum;
+	char *tmp = NULL;
+
+	pthread_mutex_lock(&sysfs_cache_lock);
+	if (c->state != SYSFS_CACHE_ON || c->dirty || !c->nr_add)
+		goto out;
+	if (read_uevent_seqnum(&seqnum) < 0 || seqnum != c->seqnum)
+		goto out;
+
+	/* merge the loaded snapshot with the new reads, by path */
+	all = calloc(c->count + c->nr_add, sizeof(*all));
+	if (!all)
+		goto out;
+	for (i = 0; i < (int) c->count; i++)
+		all[n++] = (struct sysfs_cache_add) {
+			.key = c->map + c->ent[i].key,
+			.val = c->map + c->ent[i].val,
+			.len = c->ent[i].len,
+			.rc = c->ent[i].rc,
+		};
+	for (i = 0; i < c->nr_add; i++)
+		all[n++] = c->add[i];
+	qsort(all, n, sizeof(*all), sysfs_cache_add_cmp);
+	for (i = 1, j = 1; i < n; i++)
+		if (strcmp(all[j - 1].key, all[i].key) != 0)
+			all[j++] = all[i];
+	if (n)
+		n = j;
+
+	if (asprintf(&tmp, "%s.XXXXXX", c->path) < 0) {
+		tmp = NULL;
+		goto out;
+	}
+	fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd < 0)
+		goto out;
+	rc = sysfs_cache_write(fd, all, n, c->seqnum);
+	if (rc == 0)
+		rc = rename(tmp, c->path) < 0 ? -errno : 0;
+	if (rc) {
+		log_dbg(ctx, "%s: failed to save: %s\n", c->path,
+			strerror(-rc));
+		unlink(tmp);
+	} else
+		log_dbg(ctx, "%s: saved %d entries\n", c->path, n);
+ out:
+	free(tmp);
+	free(all);
+	sysfs_cache_reset();
+	pthread_mutex_unlock(&sysfs_cache_lock);
+}
+
+static int __sysfs_read_attr_live(struct log_ctx *ctx, int dirfd,
+		const char *name, const char *path, char *buf)
+{
+	int fd = openat(dirfd, name, O_RDONLY|O_CLOEXEC);
 	int n;
 
 	if (fd < 0) {
@@ -40,11 +475,100 @@ int __sysfs_read_attr(struct log_ctx *ctx, const char *path, char *buf)
 	return 0;
 }
 
+/*
+ * Read @name relative to @dirfd, @path is the same attribute as an
+ * absolute path for the snapshot cache and error messages.
+ */
+static int read_attr(struct log_ctx *ctx, int dirfd, const char *name,
+		const char *path, char *buf)
+{
+	const char *val;
+	uint32_t len;
+	bool record;
+	int rc;
+
+	val = sysfs_cache_get(ctx, path, &len, &rc, &record);
+	if (val && len < SYSFS_ATTR_SIZE) {
+		memcpy(buf, val, len);
+		buf[len] = 0;
+		return rc;
+	}
+
+	rc = __sysfs_read_attr_live(ctx, dirfd, name, path, buf);
+	if (!record)
+		return rc;
+	/* @buf is not written when the attribute could not be opened */
+	if (rc < 0)
+		sysfs_cache_put(path, "", 0, rc);
+	else
+		sysfs_cache_put(path, buf, strlen(buf), rc);
+	return rc;
+}
+
+int __sysfs_read_attr(struct log_ctx *ctx, const char *path, char *buf)
+{
+	return read_attr(ctx, AT_FDCWD, path, path, buf);
+}
+
+/*
+ * Hold a device directory open so that a run of attribute reads below
+ * it only resolve the attribute name, not the whole path from /sys
+ * down. If the directory can not be opened the reads fall back to
+ * absolute paths, and fail the same way sysfs_read_attr() would.
+ */
+int __sysfs_dir_open(struct log_ctx *ctx, struct sysfs_dir *dir,
+		const char *path)
+{
+	dir->ctx = ctx;
+	dir->path = path;
+	dir->fd = open(path, O_PATH|O_DIRECTORY|O_CLOEXEC);
+	if (dir->fd < 0) {
+		log_dbg(ctx, "failed to open %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+	return 0;
+}
+
+int sysfs_dir_read_attr(struct sysfs_dir *dir, const char *attr, char *buf)
+{
+	char path[PATH_MAX];
+
+	if (snprintf(path, sizeof(path), "%s/%s", dir->path, attr)
+			>= (int) sizeof(path)) {
+		buf[0] = 0;
+		return -ENAMETOOLONG;
+	}
+	if (dir->fd < 0)
+		return read_attr(dir->ctx, AT_FDCWD, path, path, buf);
+	return read_attr(dir->ctx, dir->fd, attr, path, buf);
+}
+
+void sysfs_dir_close(struct sysfs_dir *dir)
+{
+	if (dir->fd >= 0)
+		close(dir->fd);
+	dir->fd = -1;
+}
+
 static int write_attr(struct log_ctx *ctx, const char *path,
 		const char *buf, int quiet)
 {
-	int fd = open(path, O_WRONLY|O_CLOEXEC);
-	int n, len = strlen(buf) + 1, rc;
+	int fd, n, len = strlen(buf) + 1, rc;
+
+	/*
+	 * The topology is about to change, and not every change raises a
+	 * uevent: drop the saved snapshot for later runs, and don't save
+	 * what was read.
+	 */
+	pthread_mutex_lock(&sysfs_cache_lock);
+	if (sysfs_cache.state == SYSFS_CACHE_INIT)
+		sysfs_cache_load(ctx);
+	if (sysfs_cache.state == SYSFS_CACHE_ON)
+		unlink(sysfs_cache.path);
+	sysfs_cache.dirty = true;
+	pthread_mutex_unlock(&sysfs_cache_lock);
+
+	fd = open(path, O_WRONLY|O_CLOEXEC);
 
 	if (fd < 0) {
 		rc = -errno;
@@ -75,51 +599,159 @@ int __sysfs_write_attr_quiet(struct log_ctx *ctx, const char *path,
 	return write_attr(ctx, path, buf, 1);
 }
 
+static void device_parse_one(struct log_ctx *ctx, const char *base_path,
+		const char *dev_name, const char *name, void *parent,
+		add_dev_fn add_dev, int *add_errors)
+{
+	char *dev_path;
+	char fmt[20];
+	void *dev;
+	int id;
+
+	sprintf(fmt, "%s%%d", dev_name);
+	if (sscanf(name, fmt, &id) != 1)
+		return;
+	if (asprintf(&dev_path, "%s/%s", base_path, name) < 0) {
+		log_err(ctx, "%s%d: path allocation failure\n",
+				dev_name, id);
+		return;
+	}
+
+	dev = add_dev(parent, id, dev_path);
+	free(dev_path);
+	if (!dev) {
+		(*add_errors)++;
+		log_err(ctx, "%s%d: add_dev() failed\n",
+				dev_name, id);
+	} else
+		log_dbg(ctx, "%s%d: processed\n", dev_name, id);
+}
+
 int __sysfs_device_parse(struct log_ctx *ctx, const char *base_path,
 		const char *dev_name, void *parent, add_dev_fn add_dev)
 {
-	int add_errors = 0;
+	char *key = NULL, *names = NULL;
+	size_t names_len = 0;
+	int add_errors = 0, rc;
+	const char *val;
 	struct dirent *de;
+	uint32_t len;
+	bool record;
 	DIR *dir;
+	FILE *f;
 
 	log_dbg(ctx, "base: '%s' dev: '%s'\n", base_path, dev_name);
+
+	/* directory listings are cached as NUL separated names */
+	if (asprintf(&key, "%s/", base_path) < 0)
+		key = NULL;
+	val = key ? sysfs_cache_get(ctx, key, &len, &rc, &record) : NULL;
+	if (val) {
+		const char *name, *end = val + len;
+
+		free(key);
+		if (rc) {
+			log_dbg(ctx, "no \"%s\" devices found\n", dev_name);
+			return rc;
+		}
+		for (name = val; name < end; name += strlen(name) + 1)
+			device_parse_one(ctx, base_path, dev_name, name, parent,
+					 add_dev, &add_errors);
+		return add_errors;
+	}
+
 	dir = opendir(base_path);
 	if (!dir) {
 		log_dbg(ctx, "no \"%s\" devices found\n", dev_name);
+		if (key && record)
+			sysfs_cache_put(key, "", 0, -ENODEV);
+		free(key);
 		return -ENODEV;
 	}
 
+	f = key && record ? open_memstream(&names, &names_len) : NULL;
 	while ((de = readdir(dir)) != NULL) {
-		char *dev_path;
-		char fmt[20];
-		void *dev;
-		int id;
-
-		sprintf(fmt, "%s%%d", dev_name);
 		if (de->d_ino == 0)
 			continue;
-		if (sscanf(de->d_name, fmt, &id) != 1)
-			continue;
-		if (asprintf(&dev_path, "%s/%s", base_path, de->d_name) < 0) {
-			log_err(ctx, "%s%d: path allocation failure\n",
-					dev_name, id);
-			continue;
-		}
-
-		dev = add_dev(parent, id, dev_path);
-		free(dev_path);
-		if (!dev) {
-			add_errors++;
-			log_err(ctx, "%s%d: add_dev() failed\n",
-					dev_name, id);
-		} else
-			log_dbg(ctx, "%s%d: processed\n", dev_name, id);
+		if (f)
+			fwrite(de->d_name, strlen(de->d_name) + 1, 1, f);
+		device_parse_one(ctx, base_path, dev_name, de->d_name, parent,
+				 add_dev, &add_errors);
 	}
 	closedir(dir);
 
+	if (f && fclose(f) == 0)
+		sysfs_cache_put(key, names, names_len, 0);
+	free(names);
+	free(key);
+
 	return add_errors;
 }
 
+struct sysfs_enum {
+	void **devs;
+	int count, next;
+	enum_dev_fn fn;
+};
+
+static void *sysfs_enum_worker(void *arg)
+{
+	struct sysfs_enum *e = arg;
+	int i;
+
+	while ((i = __atomic_fetch_add(&e->next, 1, __ATOMIC_RELAXED))
+			< e->count)
+		e->fn(e->devs[i]);
+	return NULL;
+}
+
+/*
+ * Call @fn on each device on the list at @head, whose list_node is at
+ * @off in the device, from up to @jobs threads, the caller included.
+ * Each call must only touch the state of its own device (for example
+ * populate that device's child list with sysfs_device_parse()), so
+ * every list is still built by one thread, in directory order.
+ */
+void __sysfs_enum_parallel(struct log_ctx *ctx, struct list_head *head,
+		size_t off, int jobs, enum_dev_fn fn)
+{
+	struct sysfs_enum e = {
+		.fn = fn,
+	};
+	pthread_t threads[SYSFS_ENUM_JOBS_MAX];
+	void *dev;
+	int i, n;
+
+	list_for_each_off(head, dev, off)
+		e.count++;
+	e.devs = calloc(e.count, sizeof(*e.devs));
+	if (!e.devs)
+		return;
+	i = 0;
+	list_for_each_off(head, dev, off)
+		e.devs[i++] = dev;
+
+	if (jobs > e.count)
+		jobs = e.count;
+	if (jobs > SYSFS_ENUM_JOBS_MAX)
+		jobs = SYSFS_ENUM_JOBS_MAX;
+
+	for (n = 0; n < jobs - 1; n++) {
+		int rc = pthread_create(&threads[n], NULL, sysfs_enum_worker,
+					&e);
+
+		if (rc) {
+			log_dbg(ctx, "thread create failed: %s\n",
+				strerror(rc));
+			break;
+		}
+	}
+	sysfs_enum_worker(&e);
+	for (i = 0; i < n; i++)
+		pthread_join(threads[i], NULL);
+	free(e.devs);
+}
+
 struct kmod_module *__util_modalias_to_module(struct kmod_ctx *kmod_ctx,
 					      const char *alias,
 					      struct log_ctx *log)
@@ -131,8 +763,11 @@ struct kmod_module *__util_modalias_to_module(struct kmod_ctx *kmod_ctx,
 	if (!kmod_ctx)
 		return NULL;
 
+	/* libkmod contexts are not thread safe */
+	pthread_mutex_lock(&kmod_lock);
 	rc = kmod_module_new_from_lookup(kmod_ctx, alias, &list);
 	if (rc < 0 || !list) {
+		pthread_mutex_unlock(&kmod_lock);
 		log_dbg(log,
 			"failed to find module for alias: %s %d list: %s\n",
 			alias, rc, list ? "populated" : "empty");
@@ -142,6 +777,7 @@ struct kmod_module *__util_modalias_to_module(struct kmod_ctx *kmod_ctx,
 	log_dbg(log, "alias: %s module: %s\n", alias,
 		kmod_module_get_name(mod));
 	kmod_module_unref_list(list);
+	pthread_mutex_unlock(&kmod_lock);
 
 	return mod;
 }
@@ -3,9 +3,11 @@
 #ifndef __UTIL_SYSFS_H__
 #define __UTIL_SYSFS_H__
 
+#include <stddef.h>
 #include <string.h>
 
 typedef void *(*add_dev_fn)(void *parent, int id, const char *dev_path);
+typedef void (*enum_dev_fn)(void *dev);
 
 #define SYSFS_ATTR_SIZE 1024
 
@@ -16,12 +18,34 @@ int __sysfs_write_attr_quiet(struct log_ctx *ctx, const char *path,
 		const char *buf);
 int __sysfs_device_parse(struct log_ctx *ctx, const char *base_path,
 		const char *dev_name, void *parent, add_dev_fn add_dev);
+void __sysfs_cache_flush(struct log_ctx *ctx);
+
+#define SYSFS_ENUM_JOBS_MAX 64
+struct list_head;
+void __sysfs_enum_parallel(struct log_ctx *ctx, struct list_head *head,
+		size_t off, int jobs, enum_dev_fn fn);
+
+/* a device directory held open for a series of attribute reads */
+struct sysfs_dir {
+	struct log_ctx *ctx;
+	const char *path;
+	int fd;
+};
+
+int __sysfs_dir_open(struct log_ctx *ctx, struct sysfs_dir *dir,
+		const char *path);
+int sysfs_dir_read_attr(struct sysfs_dir *dir, const char *attr, char *buf);
+void sysfs_dir_close(struct sysfs_dir *dir);
 
 #define sysfs_read_attr(c, p, b) __sysfs_read_attr(&(c)->ctx, (p), (b))
 #define sysfs_write_attr(c, p, b) __sysfs_write_attr(&(c)->ctx, (p), (b))
 #define sysfs_write_attr_quiet(c, p, b) __sysfs_write_attr_quiet(&(c)->ctx, (p), (b))
 #define sysfs_device_parse(c, b, d, p, fn) __sysfs_device_parse(&(c)->ctx, \
 		(b), (d), (p), (fn))
+#define sysfs_cache_flush(c) __sysfs_cache_flush(&(c)->ctx)
+#define sysfs_enum_parallel(c, h, type, member, j, fn) \
+	__sysfs_enum_parallel(&(c)->ctx, (h), offsetof(type, member), (j), (fn))
+#define sysfs_dir_open(c, d, p) __sysfs_dir_open(&(c)->ctx, (d), (p))
 
 static inline const char *devpath_to_devname(const char *devpath)
 {